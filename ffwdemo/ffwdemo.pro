@@ -9,17 +9,37 @@ CONFIG += c++11
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    ../libffwplayer/compositor.c \
+    ../libffwplayer/scaler.c \
+    ../libffwplayer/yuv2rgb.c \
+    ../libffwplayer/stream_cache.c \
+    ../libffwplayer/media_clock.c \
+    ../libffwplayer/kf_index.c \
+    ../libffwplayer/frame_cache.c \
+    ../libffwplayer/tempo.c \
+    ../libffwplayer/snapshot.c \
     ../libffwplayer/ffwplayer.c \
     ../libffwplayer/msg_thread.c \
     log.cpp \
     main.cpp \
-    mainwindow.cpp
+    mainwindow.cpp \
+    mosaicview.cpp
 
 HEADERS += \
+    ../libffwplayer/compositor.h \
+    ../libffwplayer/scaler.h \
+    ../libffwplayer/yuv2rgb.h \
+    ../libffwplayer/stream_cache.h \
+    ../libffwplayer/media_clock.h \
+    ../libffwplayer/kf_index.h \
+    ../libffwplayer/frame_cache.h \
+    ../libffwplayer/tempo.h \
+    ../libffwplayer/snapshot.h \
     ../libffwplayer/ffwplayer.h \
     ../libffwplayer/log.h \
     ../libffwplayer/msg_thread.h \
-    mainwindow.h
+    mainwindow.h \
+    mosaicview.h
 
 FORMS += \
     mainwindow.ui
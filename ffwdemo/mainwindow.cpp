@@ -10,8 +10,16 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 #include <QScreen>
+#include <QTimer>
+#include <QDir>
+#include <QStandardPaths>
+#include <QDateTime>
+#include <algorithm>
+#include <cmath>
+#include "stream_cache.h"
 
 #define DEMO_VERSION "0.0.1"
+#define MAIN_MSG_QUEUE_SIZE 32  /**< player notifications (READY, FAILED, ...) */
 MainWindow * mainApp;
 
 QString demo_videos_dir = "/home/mvaranda/Videos/";
@@ -27,18 +35,104 @@ QString demo_video_names[] =  {
 
 bool MainWindow::initPlayerResources()
 {
-  msg_thread_h main_msg_th;
   mainApp = this;
 
-  // create a message queue for this main thread
-  if ( ! (main_msg_th = reg_msg_thread(pthread_self(), 6)) ) {
+  // queue for the player notifications. It is drained by a listener thread so
+  // the GUI thread never blocks on wait_msg()
+  if ( ! (main_msg_th = reg_msg_thread(pthread_self(), MAIN_MSG_QUEUE_SIZE)) ) {
     LOG_E("Fail to create msg system for main App thread");
     return false;
   }
 
+  pthread_t tid = ffw_create_thread("player_msg_thread",
+                                    0,                // stack size
+                                    20,               // int priority,
+                                    playerMsgThread,  // void * ( *thread_entry)(void *),
+                                    this,
+                                    true);            // detached
+  if (tid == -1) {
+    LOG_E("Fail to create player message thread");
+    return false;
+  }
+  msg_thread_set_owner(main_msg_th, tid);
+
+  // cameras reopen faster with their stream parameters kept across runs
+  QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/streams";
+  if (QDir().mkpath(cacheDir)) {
+    stream_cache_set_dir(cacheDir.toLocal8Bit().constData());
+  }
+
   return true;
 }
 
+void * MainWindow::playerMsgThread(void * arg)
+{
+  MainWindow * w = static_cast<MainWindow *>(arg);
+  msg_t msg;
+
+  while (wait_msg(w->main_msg_th, &msg)) {
+    // handled in the GUI thread
+    QMetaObject::invokeMethod(w, [w, msg]() { w->handlePlayerMsg(msg); }, Qt::QueuedConnection);
+  }
+  return nullptr;
+}
+
+void MainWindow::handlePlayerMsg(const msg_t & msg)
+{
+  int i = static_cast<int>(reinterpret_cast<intptr_t>(msg.v_ptr_2));
+
+  if (i < 0 || i >= NUM_VIDEO_CELLS || videoCells[i].ffw_h != msg.v_ptr_1) {
+    if (msg.msg_id == MSG_ID__SNAPSHOT) {
+      snapshot_free(static_cast<snapshot_t *>(msg.v_ptr_3));
+    }
+    return; // player already gone
+  }
+
+  switch (msg.msg_id) {
+    case MSG_ID__READY:
+    {
+      const ffw_stream_info_t * info = static_cast<const ffw_stream_info_t *>(msg.v_ptr_3);
+      LOG("videoCell %d ready: %dx%d %.2f fps", i, info->width, info->height, info->fps);
+      videoCells[i].video_area->setToolTip(QString("%1x%2 %3 fps %4%5")
+                                           .arg(info->width)
+                                           .arg(info->height)
+                                           .arg(info->fps, 0, 'f', 2)
+                                           .arg(info->video_codec)
+                                           .arg(info->has_audio ? QString(" + ") + info->audio_codec : QString()));
+      break;
+    }
+
+    case MSG_ID__FIRST_FRAME:
+      cellStarted(i, msg.v_int);
+      break;
+
+    case MSG_ID__FAILED:
+      LOG_E("videoCell %d: could not open the stream (%d)", i, msg.v_int);
+      cellStarted(i, -1);
+      mosaicView->setCellActive(i, false);
+      ffw_destroy(videoCells[i].ffw_h);
+      videoCells[i].ffw_h = nullptr;
+      videoCells[i].video_area->setToolTip("Could not open the stream");
+      break;
+
+    case MSG_ID__SNAPSHOT:
+    {
+      snapshot_t * snapshot = static_cast<snapshot_t *>(msg.v_ptr_3);
+      if (msg.v_int) {
+        LOG_E("videoCell %d: snapshot failed (%d)", i, msg.v_int);
+      }
+      else {
+        LOG("videoCell %d: snapshot at %.3f s saved to %s", i, snapshot->pts, snapshot->path);
+      }
+      snapshot_free(snapshot);
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
 MainWindow::MainWindow(QWidget *parent)
   : QMainWindow(parent)
   , ui(new Ui::MainWindow)
@@ -92,6 +186,14 @@ MainWindow::MainWindow(QWidget *parent)
   }
 
 
+  // all the cells in the grid are drawn by a single compositor/widget
+  mosaicView = new MosaicView(ui->centralwidget);
+  mosaicView->raise();
+  for (int i=0; i < NUM_VIDEO_CELLS; i++) {
+    videoCells[i].video_area->installEventFilter(this);
+  }
+
+  // frames for players not attached to the mosaic (full screen cell)
   connect(this, &MainWindow::imageChanged, this, [&](QImage image, ffwplayer_t * ffw){
     uint64_t i = (uint64_t) ffw->client_data;
     int w = videoCells[i].video_area->width();
@@ -106,6 +208,42 @@ MainWindow::~MainWindow()
   delete ui;
 }
 
+bool MainWindow::eventFilter(QObject *obj, QEvent *event)
+{
+  if (event->type() == QEvent::Resize || event->type() == QEvent::Move) {
+    // labels are laid out in batches: relayout the mosaic once afterwards
+    if ( ! mosaicLayoutPending) {
+      mosaicLayoutPending = true;
+      QTimer::singleShot(0, this, &MainWindow::updateMosaicLayout);
+    }
+  }
+  return QMainWindow::eventFilter(obj, event);
+}
+
+void MainWindow::updateMosaicLayout()
+{
+  QVector<QRect> cells(NUM_VIDEO_CELLS);
+  QRect bounds;
+
+  mosaicLayoutPending = false;
+  for (int i=0; i < NUM_VIDEO_CELLS; i++) {
+    QLabel * label = videoCells[i].video_area;
+    if (label->isWindow()) {
+      continue; // full screen cell, not part of the grid
+    }
+    cells[i] = QRect(label->mapTo(ui->centralwidget, QPoint(0, 0)), label->size());
+    bounds |= cells[i];
+  }
+
+  for (int i=0; i < NUM_VIDEO_CELLS; i++) {
+    if ( ! cells[i].isNull()) {
+      cells[i].translate(-bounds.topLeft());
+    }
+  }
+  mosaicView->setGeometry(bounds);
+  mosaicView->setCells(cells);
+}
+
 void MainWindow::updatePicture(ffwplayer_t * ffw, VideoPicture * video_picture)
 {
   QImage *image = new QImage(QSize(video_picture->width, video_picture->height), QImage::Format_RGB32);
@@ -129,9 +267,13 @@ void update_picture_widget(ffwplayer_t * ffw, VideoPicture * video_picture)
 
 void MainWindow::on_pushButton_clicked()
 {
-  int i;
+  int i, n = 0;
   QString s;
-  char buf[MAX_URL_LEN];
+  char bufs[NUM_VIDEO_CELLS][MAX_URL_LEN];
+  char * urls[NUM_VIDEO_CELLS];
+  void * cells[NUM_VIDEO_CELLS];
+  int compositorCells[NUM_VIDEO_CELLS];
+  ffwplayer_t * players[NUM_VIDEO_CELLS];
 
   for (i=0; i<NUM_VIDEO_CELLS; i++) {
     if (videoCells[i].ffw_h != NULL) {
@@ -144,17 +286,88 @@ void MainWindow::on_pushButton_clicked()
       LOG("Skip videoCell %d as no URL given", i);
       continue;
     }
-    memset(buf, 0, sizeof(buf));
-    memcpy(buf, stdS.c_str(), stdS.length());
-    if ( ! (videoCells[i].ffw_h = ffw_create_player(buf, main_msg_th, (void *) i))) {
+    memset(bufs[n], 0, sizeof(bufs[n]));
+    memcpy(bufs[n], stdS.c_str(), std::min(stdS.length(), sizeof(bufs[n]) - 1));
+    urls[n] = bufs[n];
+    cells[n] = (void *) (intptr_t) i;
+    compositorCells[n] = i;
+    n++;
+  }
+  if (n == 0) {
+    return;
+  }
+
+  // all cells open together, returns right away: the outcome comes later as
+  // MSG_ID__READY/FAILED and then MSG_ID__FIRST_FRAME
+  ffw_options_t options;
+  ffw_default_options(&options);
+  options.stream_cache = true;
+  options.fast_start = true;    // operators care about a picture more than about early sync
+  options.keyframe_index = true; // recordings: seeks through a key frame index sidecar
+  options.frame_cache_mb = FRAME_CACHE_MB;
+  options.frame_cache_width = FRAME_CACHE_WIDTH;
+  options.focus = FFW_FOCUS_GRID;
+  options.compositor = mosaicView->compositor(); // drawn into their cells from the first frame
+  ffw_open_batch(urls, n, main_msg_th, cells, &options, compositorCells, MAX_PARALLEL_PROBES, players);
+  startingCells = 0;
+  batchWallMs = 0;
+  for (int k = 0; k < n; k++) {
+    i = static_cast<int>(reinterpret_cast<intptr_t>(cells[k]));
+    if ( ! (videoCells[i].ffw_h = players[k])) {
       LOG_E("No memo for ffwplayer_t object");
-    } else {
-      // mute
-      ffw_mute(videoCells[i].ffw_h, true);
+      continue;
+    }
+    mosaicView->setCellActive(i, true);
+    // mute
+    ffw_mute(videoCells[i].ffw_h, true);
+    videoCells[i].starting = true;
+    startingCells++;
+  }
+  updateVisibility();
+}
+
+/**
+ * Players nobody can see (covered by the full screen cell, or the window
+ * minimized) stop decoding what they do not show.
+ */
+void MainWindow::updateVisibility()
+{
+  for (int i = 0; i < NUM_VIDEO_CELLS; i++) {
+    if (videoCells[i].ffw_h) {
+      // the full screen cell is a window of its own, not minimized along
+      ffw_set_visible(videoCells[i].ffw_h, fullCell == i || (fullCell < 0 && ! minimized));
     }
   }
 }
 
+void MainWindow::changeEvent(QEvent *event)
+{
+  if (event->type() == QEvent::WindowStateChange && isMinimized() != minimized) {
+    minimized = isMinimized();
+    updateVisibility();
+  }
+  QMainWindow::changeEvent(event);
+}
+
+/**
+ * Accounts a cell of the last batch as up (first_frame_ms < 0 if it failed)
+ * and logs the wall start up time once all of them are.
+ */
+void MainWindow::cellStarted(int i, int first_frame_ms)
+{
+  if ( ! videoCells[i].starting) {
+    return;
+  }
+  videoCells[i].starting = false;
+  if (first_frame_ms >= 0) {
+    LOG("videoCell %d: first frame after %d ms", i, first_frame_ms);
+    batchWallMs = std::max(batchWallMs, first_frame_ms);
+  }
+  if (--startingCells == 0) {
+    LOG("all cells up after %d ms", batchWallMs);
+  }
+}
+
 void MainWindow::handleMute(int i)
 {
   if (videoCells[i].ffw_h == NULL) return;
@@ -202,7 +415,9 @@ void MainWindow::doPlay()
   int i = videoContextMenuItemIdx;
   LOG("doPlay %d", i);
 
-
+  if (videoCells[i].ffw_h) {
+    ffw_resume(videoCells[i].ffw_h);
+  }
 }
 
 void MainWindow::doPause()
@@ -210,7 +425,9 @@ void MainWindow::doPause()
   int i = videoContextMenuItemIdx;
   LOG("doPause %d", i);
 
-
+  if (videoCells[i].ffw_h) {
+    ffw_pause(videoCells[i].ffw_h);
+  }
 }
 
 void MainWindow::doStop()
@@ -218,7 +435,44 @@ void MainWindow::doStop()
   int i = videoContextMenuItemIdx;
   LOG("doStop %d", i);
 
+  if (videoCells[i].ffw_h) {
+    ffw_stop(videoCells[i].ffw_h);
+  }
+}
 
+void MainWindow::doStepForward()
+{
+  int i = videoContextMenuItemIdx;
+  LOG("doStepForward %d", i);
+
+  if (videoCells[i].ffw_h) {
+    ffw_step_frame(videoCells[i].ffw_h, 1);
+  }
+}
+
+void MainWindow::doStepBack()
+{
+  int i = videoContextMenuItemIdx;
+  LOG("doStepBack %d", i);
+
+  if (videoCells[i].ffw_h) {
+    ffw_step_frame(videoCells[i].ffw_h, -1);
+  }
+}
+
+void MainWindow::doSnapshot()
+{
+  int i = videoContextMenuItemIdx;
+  LOG("doSnapshot %d", i);
+
+  if ( ! videoCells[i].ffw_h) {
+    return;
+  }
+  QString path = QStandardPaths::writableLocation(QStandardPaths::PicturesLocation) +
+                 QString("/ffw_%1_%2.jpg").arg(i).arg(QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss"));
+  if ( ! ffw_snapshot_request(videoCells[i].ffw_h, NAN, SNAPSHOT_JPEG, path.toLocal8Bit().constData(), nullptr)) {
+    LOG_W("videoCell %d: no snapshot", i);
+  }
 }
 
 void MainWindow::doFull()
@@ -226,10 +480,21 @@ void MainWindow::doFull()
   int i = videoContextMenuItemIdx;
   LOG("doFull %d", i);
 
+  // the full screen cell gets its frames on its own label, at full quality
+  mosaicView->setCellActive(i, false);
+  if (videoCells[i].ffw_h) {
+    ffw_set_compositor(videoCells[i].ffw_h, NULL, -1);
+    ffw_set_focus(videoCells[i].ffw_h, FFW_FOCUS_FULL);
+  }
+
   videoCells[i].video_area->setWindowFlags(videoCells[i].video_area->windowFlags() | Qt::Window);
   videoCells[i].video_area->show();
   //ui->myImage->showMaximized();
   videoCells[i].video_area->showFullScreen();
+
+  // the other cells are covered
+  fullCell = i;
+  updateVisibility();
 }
 
 void MainWindow::doNormal  ()
@@ -239,6 +504,15 @@ void MainWindow::doNormal  ()
 
   videoCells[i].video_area->setWindowFlag(Qt::Window, false);
   videoCells[i].video_area->show();
+
+  if (videoCells[i].ffw_h) {
+    ffw_set_focus(videoCells[i].ffw_h, FFW_FOCUS_GRID);
+    ffw_set_compositor(videoCells[i].ffw_h, mosaicView->compositor(), i);
+    mosaicView->setCellActive(i, true);
+  }
+
+  fullCell = -1;
+  updateVisibility();
 }
 
 void MainWindow::doVideoContextMenu(int i, const QPoint &pos)
@@ -249,18 +523,27 @@ void MainWindow::doVideoContextMenu(int i, const QPoint &pos)
   QAction * actPlay = new QAction(QString("Play"), this);
   QAction * actPause = new QAction(QString("Pause"), this);
   QAction * actStop = new QAction(QString("Stop"), this);
+  QAction * actStepForward = new QAction(QString("Step Forward"), this);
+  QAction * actStepBack = new QAction(QString("Step Back"), this);
+  QAction * actSnapshot = new QAction(QString("Snapshot"), this);
   QAction * actFull = new QAction(QString("Full Screen"), this);
   QAction * actNormal = new QAction(QString("Normal Screen"), this);
 
   connect(actPlay, SIGNAL(triggered()), this, SLOT(doPlay()));
   connect(actPause, SIGNAL(triggered()), this, SLOT(doPause()));
   connect(actStop, SIGNAL(triggered()), this, SLOT(doStop()));
+  connect(actStepForward, SIGNAL(triggered()), this, SLOT(doStepForward()));
+  connect(actStepBack, SIGNAL(triggered()), this, SLOT(doStepBack()));
+  connect(actSnapshot, SIGNAL(triggered()), this, SLOT(doSnapshot()));
   connect(actFull, SIGNAL(triggered()), this, SLOT(doFull()));
   connect(actNormal, SIGNAL(triggered()), this, SLOT(doNormal()));
 
   menu->addAction(actPlay);
   menu->addAction(actPause);
   menu->addAction(actStop);
+  menu->addAction(actStepForward);
+  menu->addAction(actStepBack);
+  menu->addAction(actSnapshot);
   menu->addAction(actFull);
   menu->addAction(actNormal);
 
@@ -20,12 +20,16 @@
 #include "log.h"
 #include "msg_thread.h"
 #include "ffwplayer.h"
+#include "mosaicview.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
 QT_END_NAMESPACE
 
 #define NUM_VIDEO_CELLS 6
+#define MAX_PARALLEL_PROBES 4   /**< cells probing their stream at the same time */
+#define FRAME_CACHE_MB      32  /**< decoded frames kept per cell for scrubbing */
+#define FRAME_CACHE_WIDTH   640 /**< cached frames downscaled to the size of a grid cell */
 
 class MainWindow : public QMainWindow
 {
@@ -45,6 +49,7 @@ public:
         QPushButton * bt_file = nullptr;
         QCheckBox * chk_mute = nullptr;
         ffwplayer_t * ffw_h = nullptr;
+        bool starting = false;  /**< waiting for its first frame */
 
     };
     MainWindow(QWidget *parent = nullptr);
@@ -59,13 +64,27 @@ private:
     QPushButton * bt_file = nullptr;
 
     VideoCell videoCells[NUM_VIDEO_CELLS];
-    msg_thread_h main_msg_th;
+    msg_thread_h main_msg_th = nullptr;
     int videoContextMenuItemIdx;
+    MosaicView * mosaicView = nullptr;
+    bool mosaicLayoutPending = false;
+    int startingCells = 0;      /**< cells of the last batch without a first frame yet */
+    int batchWallMs = 0;
+    int fullCell = -1;          /**< cell shown full screen, covering the others, -1 if none */
+    bool minimized = false;
 
     bool initPlayerResources();
+    static void * playerMsgThread(void * arg);
+    void handlePlayerMsg(const msg_t & msg);
+    void cellStarted(int i, int first_frame_ms);
+    void updateMosaicLayout();
     void handleMute(int i);
     void doVideoContextMenu(int i, const QPoint &pos);
+    void updateVisibility();
 
+protected:
+    bool eventFilter(QObject *obj, QEvent *event) override;
+    void changeEvent(QEvent *event) override;
 
 signals:
     void imageChanged(QImage image, ffwplayer_t * ffw);
@@ -82,6 +101,9 @@ private slots:
     void doPlay();
     void doPause();
     void doStop();
+    void doStepForward();
+    void doStepBack();
+    void doSnapshot();
     void doFull();
     void doNormal();
 
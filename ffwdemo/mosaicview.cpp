@@ -0,0 +1,119 @@
+/******************************************
+ *
+ *             Multiplayer Demo
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+
+#include "mosaicview.h"
+#include "log.h"
+
+#include <QPainter>
+#include <QPaintEvent>
+#include <QRegion>
+#include <QScreen>
+
+#define DEFAULT_REFRESH_RATE 60.0
+
+MosaicView::MosaicView(QWidget *parent)
+  : QWidget(parent)
+{
+  // clicks go to the video labels underneath (context menus)
+  setAttribute(Qt::WA_TransparentForMouseEvents);
+  // every visible pixel is painted from the canvas
+  setAttribute(Qt::WA_OpaquePaintEvent);
+
+  comp = compositor_create(16, 16);
+  if ( ! comp) {
+    LOG_E("MosaicView: could not create compositor");
+  }
+
+  double rate = screen() ? screen()->refreshRate() : DEFAULT_REFRESH_RATE;
+  if (rate <= 0) {
+    rate = DEFAULT_REFRESH_RATE;
+  }
+  vsyncTimer.setTimerType(Qt::PreciseTimer);
+  vsyncTimer.setInterval(static_cast<int>(1000.0 / rate));
+  connect(&vsyncTimer, &QTimer::timeout, this, &MosaicView::onVsync);
+  vsyncTimer.start();
+}
+
+MosaicView::~MosaicView()
+{
+  vsyncTimer.stop();
+  compositor_destroy(comp);
+}
+
+void MosaicView::setCells(const QVector<QRect> & cells)
+{
+  cellRects = cells;
+  cellActive.resize(cells.size());
+  applyLayout();
+}
+
+void MosaicView::setCellActive(int cell, bool active)
+{
+  if (cell < 0 || cell >= cellActive.size() || cellActive[cell] == active) {
+    return;
+  }
+  cellActive[cell] = active;
+  applyLayout();
+}
+
+void MosaicView::applyLayout()
+{
+  QRegion mask;
+
+  if ( ! comp) return;
+
+  compositor_resize(comp, width(), height());
+  for (int i = 0; i < COMPOSITOR_MAX_CELLS; i++) {
+    if (i < cellRects.size() && cellActive[i]) {
+      const QRect & r = cellRects[i];
+      compositor_set_cell(comp, i, r.x(), r.y(), r.width(), r.height());
+      mask += r;
+    } else {
+      compositor_set_cell(comp, i, 0, 0, 0, 0);
+    }
+  }
+
+  // inactive cells keep showing the label (placeholder) underneath
+  setMask(mask);
+  update();
+}
+
+void MosaicView::onVsync()
+{
+  int cells[COMPOSITOR_MAX_CELLS];
+  compositor_rect_t rects[COMPOSITOR_MAX_CELLS];
+
+  if ( ! comp) return;
+
+  // only cells with a new frame are repainted, all in a single paint event
+  int n = compositor_collect(comp, cells, rects, COMPOSITOR_MAX_CELLS);
+  for (int i = 0; i < n; i++) {
+    update(rects[i].x, rects[i].y, rects[i].w, rects[i].h);
+  }
+}
+
+void MosaicView::paintEvent(QPaintEvent *event)
+{
+  QPainter painter(this);
+  int linesize, w, h;
+
+  for (int i = 0; i < cellRects.size(); i++) {
+    const QRect & r = cellRects[i];
+    if ( ! cellActive[i] || ! event->region().intersects(r)) {
+      continue;
+    }
+
+    compositor_lock_cell(comp, i);
+    const uchar * data = compositor_canvas(comp, &linesize, &w, &h);
+    // wraps the canvas, no copy
+    QImage image(data, w, h, linesize, QImage::Format_RGB32);
+    painter.drawImage(r.topLeft(), image, r);
+    compositor_unlock_cell(comp, i);
+  }
+}
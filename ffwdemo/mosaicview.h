@@ -0,0 +1,53 @@
+/******************************************
+ *
+ *             Multiplayer Demo
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+
+
+#ifndef MOSAICVIEW_H
+#define MOSAICVIEW_H
+
+#include <QWidget>
+#include <QTimer>
+#include <QVector>
+#include <QRect>
+
+#include "compositor.h"
+
+/**
+ * One widget painting the canvas of all the grid cells. It sits on top of the
+ * video labels and only covers (masks) the cells that have a player attached.
+ */
+class MosaicView : public QWidget
+{
+  Q_OBJECT
+
+public:
+  explicit MosaicView(QWidget *parent = nullptr);
+  ~MosaicView();
+
+  compositor_h compositor() const { return comp; }
+
+  void setCells(const QVector<QRect> & cells);
+  void setCellActive(int cell, bool active);
+
+protected:
+  void paintEvent(QPaintEvent *event) override;
+
+private slots:
+  void onVsync();
+
+private:
+  compositor_h comp = nullptr;
+  QTimer vsyncTimer;
+  QVector<QRect> cellRects;
+  QVector<bool> cellActive;
+
+  void applyLayout();
+};
+
+#endif // MOSAICVIEW_H
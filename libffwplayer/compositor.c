@@ -0,0 +1,467 @@
+/******************************************
+ *
+ * Mosaic compositor: many players, one canvas
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+
+#include "compositor.h"
+#include "msg_thread.h"
+#include "log.h"
+
+#define CANVAS_FORMAT       AV_PIX_FMT_RGB32
+#define CANVAS_BPP          4                 /**< bytes per pixel of the canvas */
+#define CANVAS_ALIGN        64
+#define CELL_X_ALIGN        4                 /**< keeps scaler destination pointers 16 bytes aligned */
+#define PRESENTER_IDLE_US   (1000 * 4)        /**< nothing dirty: check again in 4ms */
+
+typedef struct cell_st {
+  pthread_mutex_t     mutex;
+  compositor_rect_t   rect;     /**< cell area in the canvas */
+  compositor_rect_t   fit;      /**< area covered by the last frame (aspect ratio preserved) */
+  scaler_h            scaler;   /**< created on the first frame */
+  scaler_profile_t    profile;
+  bool                dirty;
+} cell_t;
+
+typedef struct compositor_st {
+  pthread_mutex_t mutex;        /**< serializes geometry changes */
+  uint8_t *       canvas;
+  int             linesize;
+  int             width;
+  int             height;
+  cell_t          cells[COMPOSITOR_MAX_CELLS];
+
+  pthread_t       presenter_tid;
+  char            title[64];
+  volatile bool   quit;
+} compositor_t;
+
+static void clear_rect(compositor_t * comp, compositor_rect_t * r)
+{
+  for (int y = r->y; y < r->y + r->h; y++) {
+    memset(comp->canvas + y * comp->linesize + r->x * CANVAS_BPP, 0, r->w * CANVAS_BPP);
+  }
+}
+
+/**
+ * Clips a cell rect to the canvas, a cell left too small is disabled (zeroed).
+ */
+static void clip_rect(compositor_t * comp, compositor_rect_t * r)
+{
+  if (r->x < 0) { r->w += r->x; r->x = 0; }
+  if (r->y < 0) { r->h += r->y; r->y = 0; }
+  if (r->x + r->w > comp->width)  r->w = comp->width - r->x;
+  if (r->y + r->h > comp->height) r->h = comp->height - r->y;
+  if (r->w < 2 || r->h < 2) {
+    memset(r, 0, sizeof(*r));
+  }
+}
+
+static bool alloc_canvas(compositor_t * comp, int width, int height)
+{
+  int linesize = FFALIGN(width * CANVAS_BPP, CANVAS_ALIGN);
+  uint8_t * canvas = av_mallocz((size_t) linesize * height);
+
+  if ( ! canvas) {
+    LOG_E("compositor: no memo for %dx%d canvas", width, height);
+    return false;
+  }
+  av_free(comp->canvas);
+  comp->canvas = canvas;
+  comp->linesize = linesize;
+  comp->width = width;
+  comp->height = height;
+  return true;
+}
+
+compositor_h compositor_create(int width, int height)
+{
+  compositor_t * comp = av_mallocz(sizeof(compositor_t));
+  if ( ! comp) {
+    LOG_E("compositor: no memo");
+    return NULL;
+  }
+
+  if ( ! alloc_canvas(comp, width, height)) {
+    av_free(comp);
+    return NULL;
+  }
+
+  pthread_mutex_init(&comp->mutex, NULL);
+  for (int i = 0; i < COMPOSITOR_MAX_CELLS; i++) {
+    pthread_mutex_init(&comp->cells[i].mutex, NULL);
+  }
+  comp->presenter_tid = -1;
+  return comp;
+}
+
+void compositor_destroy(compositor_h comp)
+{
+  if ( ! comp) return;
+
+  comp->quit = true;
+  if (comp->presenter_tid != -1) {
+    pthread_join(comp->presenter_tid, NULL);
+  }
+
+  for (int i = 0; i < COMPOSITOR_MAX_CELLS; i++) {
+    scaler_destroy(comp->cells[i].scaler);
+    pthread_mutex_destroy(&comp->cells[i].mutex);
+  }
+  pthread_mutex_destroy(&comp->mutex);
+  av_free(comp->canvas);
+  av_free(comp);
+}
+
+bool compositor_resize(compositor_h comp, int width, int height)
+{
+  bool ret;
+
+  if (width <= 0 || height <= 0) {
+    return false;
+  }
+
+  pthread_mutex_lock(&comp->mutex);
+  if (width == comp->width && height == comp->height) {
+    pthread_mutex_unlock(&comp->mutex);
+    return true;
+  }
+
+  // players only hold one cell lock at a time, taking them all in order is safe
+  for (int i = 0; i < COMPOSITOR_MAX_CELLS; i++) {
+    pthread_mutex_lock(&comp->cells[i].mutex);
+  }
+
+  ret = alloc_canvas(comp, width, height);
+  for (int i = 0; i < COMPOSITOR_MAX_CELLS; i++) {
+    cell_t * cell = &comp->cells[i];
+    // the layout is set after the resize: until then a player must not draw
+    // past a smaller canvas
+    clip_rect(comp, &cell->rect);
+    memset(&cell->fit, 0, sizeof(cell->fit));
+    cell->dirty = cell->rect.w > 0;
+  }
+
+  for (int i = COMPOSITOR_MAX_CELLS - 1; i >= 0; i--) {
+    pthread_mutex_unlock(&comp->cells[i].mutex);
+  }
+  pthread_mutex_unlock(&comp->mutex);
+  return ret;
+}
+
+bool compositor_set_cell(compositor_h comp, int cell_idx, int x, int y, int w, int h)
+{
+  cell_t * cell;
+
+  if (cell_idx < 0 || cell_idx >= COMPOSITOR_MAX_CELLS) {
+    LOG_E("compositor: invalid cell %d", cell_idx);
+    return false;
+  }
+  cell = &comp->cells[cell_idx];
+
+  pthread_mutex_lock(&comp->mutex);
+  pthread_mutex_lock(&cell->mutex);
+
+  cell->rect.x = x;
+  cell->rect.y = y;
+  cell->rect.w = w;
+  cell->rect.h = h;
+  clip_rect(comp, &cell->rect);
+  memset(&cell->fit, 0, sizeof(cell->fit));
+  if (cell->rect.w > 0) {
+    clear_rect(comp, &cell->rect);
+    cell->dirty = true;
+  }
+
+  pthread_mutex_unlock(&cell->mutex);
+  pthread_mutex_unlock(&comp->mutex);
+  return true;
+}
+
+static void fit_frame(const struct AVFrame * frame, compositor_rect_t * cell_r, compositor_rect_t * fit)
+{
+  double aspect_ratio = (double) frame->width / frame->height;
+  int w, h;
+
+  if (frame->sample_aspect_ratio.num > 0 && frame->sample_aspect_ratio.den > 0) {
+    aspect_ratio *= av_q2d(frame->sample_aspect_ratio);
+  }
+
+  h = cell_r->h;
+  w = ((int) (h * aspect_ratio + 0.5)) & ~1;
+  if (w > cell_r->w) {
+    w = cell_r->w & ~1;
+    h = ((int) (w / aspect_ratio + 0.5)) & ~1;
+  }
+
+  fit->w = w;
+  fit->h = h;
+  fit->x = FFALIGN(cell_r->x + (cell_r->w - w) / 2, CELL_X_ALIGN);
+  if (fit->x + w > cell_r->x + cell_r->w) {
+    // no room for alignment: never write outside of the cell
+    fit->x = cell_r->x + (cell_r->w - w) / 2;
+  }
+  fit->y = cell_r->y + (cell_r->h - h) / 2;
+}
+
+bool compositor_draw(compositor_h comp, int cell_idx, const struct AVFrame * frame)
+{
+  compositor_rect_t fit;
+  cell_t * cell;
+  uint8_t * dst[4] = { NULL };
+  int dst_linesize[4] = { 0 };
+
+  if (cell_idx < 0 || cell_idx >= COMPOSITOR_MAX_CELLS || ! frame || frame->width <= 0 || frame->height <= 0) {
+    return false;
+  }
+  cell = &comp->cells[cell_idx];
+
+  pthread_mutex_lock(&cell->mutex);
+  if (cell->rect.w == 0) {
+    // cell is not visible in the current layout
+    pthread_mutex_unlock(&cell->mutex);
+    return true;
+  }
+
+  fit_frame(frame, &cell->rect, &fit);
+  if (fit.w <= 0 || fit.h <= 0) {
+    pthread_mutex_unlock(&cell->mutex);
+    return false;
+  }
+
+  if (memcmp(&fit, &cell->fit, sizeof(fit))) {
+    // new geometry: clear the letterbox area once
+    clear_rect(comp, &cell->rect);
+    cell->fit = fit;
+  }
+
+  if ( ! cell->scaler && ! (cell->scaler = scaler_create(0))) {
+    LOG_E("compositor: no scaler for cell %d", cell_idx);
+    pthread_mutex_unlock(&cell->mutex);
+    return false;
+  }
+
+  // scale straight into the cell sub-rectangle of the canvas
+  dst[0] = comp->canvas + fit.y * comp->linesize + fit.x * CANVAS_BPP;
+  dst_linesize[0] = comp->linesize;
+  scaler_set_profile(cell->scaler, cell->profile);
+  scaler_set_colorspace(cell->scaler, frame->colorspace, frame->color_range);
+  if (scaler_convert(cell->scaler,
+                     (uint8_t const * const *) frame->data,
+                     frame->linesize,
+                     frame->width,
+                     frame->height,
+                     frame->format,
+                     dst,
+                     dst_linesize,
+                     fit.w,
+                     fit.h,
+                     CANVAS_FORMAT) < 0) {
+    LOG_E("compositor: could not scale into cell %d", cell_idx);
+    pthread_mutex_unlock(&cell->mutex);
+    return false;
+  }
+
+  cell->dirty = true;
+  pthread_mutex_unlock(&cell->mutex);
+  return true;
+}
+
+void compositor_set_cell_profile(compositor_h comp, int cell_idx, scaler_profile_t profile)
+{
+  if (cell_idx < 0 || cell_idx >= COMPOSITOR_MAX_CELLS) {
+    return;
+  }
+  // applied by the next compositor_draw()
+  comp->cells[cell_idx].profile = profile;
+}
+
+bool compositor_get_cell_stats(compositor_h comp, int cell_idx, scaler_stats_t * stats)
+{
+  bool ret = false;
+
+  if (cell_idx < 0 || cell_idx >= COMPOSITOR_MAX_CELLS) {
+    return false;
+  }
+  pthread_mutex_lock(&comp->cells[cell_idx].mutex);
+  if (comp->cells[cell_idx].scaler) {
+    scaler_get_stats(comp->cells[cell_idx].scaler, stats);
+    ret = true;
+  }
+  pthread_mutex_unlock(&comp->cells[cell_idx].mutex);
+  return ret;
+}
+
+int compositor_collect(compositor_h comp, int cells[], compositor_rect_t rects[], int max)
+{
+  int n = 0;
+
+  for (int i = 0; i < COMPOSITOR_MAX_CELLS && n < max; i++) {
+    cell_t * cell = &comp->cells[i];
+
+    pthread_mutex_lock(&cell->mutex);
+    if (cell->dirty) {
+      cell->dirty = false;
+      if (cells) {
+        cells[n] = i;
+      }
+      rects[n++] = cell->rect;
+    }
+    pthread_mutex_unlock(&cell->mutex);
+  }
+  return n;
+}
+
+int compositor_cell_at(compositor_h comp, int x, int y)
+{
+  int ret = -1;
+
+  pthread_mutex_lock(&comp->mutex);
+  for (int i = 0; i < COMPOSITOR_MAX_CELLS; i++) {
+    compositor_rect_t * r = &comp->cells[i].rect;
+    if (x >= r->x && x < r->x + r->w && y >= r->y && y < r->y + r->h) {
+      ret = i;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&comp->mutex);
+  return ret;
+}
+
+const uint8_t * compositor_canvas(compositor_h comp, int * linesize, int * width, int * height)
+{
+  if (linesize) *linesize = comp->linesize;
+  if (width) *width = comp->width;
+  if (height) *height = comp->height;
+  return comp->canvas;
+}
+
+void compositor_lock_cell(compositor_h comp, int cell)
+{
+  pthread_mutex_lock(&comp->cells[cell].mutex);
+}
+
+void compositor_unlock_cell(compositor_h comp, int cell)
+{
+  pthread_mutex_unlock(&comp->cells[cell].mutex);
+}
+
+#ifndef QT_PLATF
+#include <SDL2/SDL.h>
+
+static void * sdl_presenter_thread(void * arg)
+{
+  compositor_t * comp = (compositor_t *) arg;
+  SDL_Window * screen;
+  SDL_Renderer * renderer;
+  SDL_Texture * texture = NULL;
+  int tex_w = 0, tex_h = 0;
+  int cells[COMPOSITOR_MAX_CELLS];
+  compositor_rect_t rects[COMPOSITOR_MAX_CELLS];
+  SDL_Event ev;
+
+  // window, renderer and texture all live in this thread
+  screen = SDL_CreateWindow(comp->title,
+                            SDL_WINDOWPOS_UNDEFINED,
+                            SDL_WINDOWPOS_UNDEFINED,
+                            comp->width,
+                            comp->height,
+                            SDL_WINDOW_OPENGL | SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_RESIZABLE);
+  if ( ! screen) {
+    LOG_E("compositor: could not create window - %s", SDL_GetError());
+    return NULL;
+  }
+  renderer = SDL_CreateRenderer(screen, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+  if ( ! renderer) {
+    LOG_E("compositor: could not create renderer - %s", SDL_GetError());
+    SDL_DestroyWindow(screen);
+    return NULL;
+  }
+
+  while ( ! comp->quit) {
+    // MV: work around to get window resize updating its internal width and heigth
+    while (SDL_PollEvent(&ev)) { /* dummy */ }
+
+    pthread_mutex_lock(&comp->mutex);
+    if ( ! texture || tex_w != comp->width || tex_h != comp->height) {
+      if (texture) {
+        SDL_DestroyTexture(texture);
+      }
+      tex_w = comp->width;
+      tex_h = comp->height;
+      texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, tex_w, tex_h);
+    }
+    pthread_mutex_unlock(&comp->mutex);
+
+    int n = compositor_collect(comp, cells, rects, COMPOSITOR_MAX_CELLS);
+    if (n == 0) {
+      usleep(PRESENTER_IDLE_US);
+      continue;
+    }
+
+    // upload only the cells that changed
+    for (int i = 0; i < n; i++) {
+      compositor_lock_cell(comp, cells[i]);
+      // the rect as of now: a resize since compositor_collect() may have clipped it
+      compositor_rect_t * cr = &comp->cells[cells[i]].rect;
+      SDL_Rect r = { cr->x, cr->y, cr->w, cr->h };
+      if (texture && r.w > 0 && tex_w == comp->width && tex_h == comp->height) {
+        SDL_UpdateTexture(texture, &r, comp->canvas + r.y * comp->linesize + r.x * CANVAS_BPP, comp->linesize);
+      }
+      compositor_unlock_cell(comp, cells[i]);
+    }
+
+    // letterbox the canvas into the window
+    int screen_width, screen_height;
+    SDL_GetWindowSize(screen, &screen_width, &screen_height);
+    SDL_Rect rect_win = { 0, 0, screen_width, screen_height };
+    if ((int64_t) screen_width * tex_h > (int64_t) screen_height * tex_w) {
+      rect_win.w = screen_height * tex_w / tex_h;
+      rect_win.x = (screen_width - rect_win.w) / 2;
+    } else {
+      rect_win.h = screen_width * tex_h / tex_w;
+      rect_win.y = (screen_height - rect_win.h) / 2;
+    }
+
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, NULL, &rect_win);
+    // blocks until vsync: one present per refresh regardless of the number of cells
+    SDL_RenderPresent(renderer);
+  }
+
+  if (texture) {
+    SDL_DestroyTexture(texture);
+  }
+  SDL_DestroyRenderer(renderer);
+  SDL_DestroyWindow(screen);
+  return NULL;
+}
+
+bool compositor_start_sdl_presenter(compositor_h comp, const char * title)
+{
+  snprintf(comp->title, sizeof(comp->title), "%s", title);
+  comp->presenter_tid = ffw_create_thread(
+    "sdl_presenter",                                        // name
+    0,                                                      // stack size
+    20,                                                     // int priority,
+    sdl_presenter_thread,                                   // void * ( *thread_entry)(void *),
+    comp,
+    false);                                                 // joined by compositor_destroy()
+
+  if (comp->presenter_tid == -1) {
+    LOG_E("compositor: could not start presenter thread");
+    return false;
+  }
+  return true;
+}
+#endif // QT_PLATF
@@ -0,0 +1,108 @@
+/******************************************
+ *
+ * Mosaic compositor: many players, one canvas
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "scaler.h"
+
+/**
+ * @file
+ * @brief compositor
+ *
+ * Players attached to a compositor do not own a window/texture/label anymore.
+ * Their decoded frames are scaled straight into a sub-rectangle (cell) of a
+ * single RGB32 canvas and the host uploads/paints the canvas once per vsync,
+ * touching only the cells that got a new frame since the previous present.
+ *
+ */
+
+#define COMPOSITOR_MAX_CELLS 16
+
+struct AVFrame;
+
+typedef struct compositor_st * compositor_h;  /**< opaque definition for the compositor handle */
+
+typedef struct compositor_rect_st {
+  int x;
+  int y;
+  int w;
+  int h;
+} compositor_rect_t;
+
+#ifdef __cplusplus
+  extern "C" {
+#endif
+
+compositor_h compositor_create(int width, int height);
+void compositor_destroy(compositor_h comp);
+
+/**
+ * @brief reallocates the canvas. All cells are cleared and marked dirty.
+ */
+bool compositor_resize(compositor_h comp, int width, int height);
+
+/**
+ * @brief sets the canvas area of a cell. A zero width or height disables the cell.
+ */
+bool compositor_set_cell(compositor_h comp, int cell, int x, int y, int w, int h);
+
+/**
+ * @brief scales the frame into the cell (aspect ratio preserved) and marks it dirty.
+ *        Called from the player threads; cells are locked independently so
+ *        players never wait for each other.
+ */
+bool compositor_draw(compositor_h comp, int cell, const struct AVFrame * frame);
+
+/**
+ * @brief scaling profile of a cell, SCALER_PROFILE_AUTO by default.
+ */
+void compositor_set_cell_profile(compositor_h comp, int cell, scaler_profile_t profile);
+
+/**
+ * @brief conversion statistics of a cell.
+ *
+ * @return false if nothing was drawn into the cell yet
+ */
+bool compositor_get_cell_stats(compositor_h comp, int cell, scaler_stats_t * stats);
+
+/**
+ * @brief returns the dirty cells (and their areas) and clears their dirty flag.
+ *        Meant to be called once per vsync by the presenter.
+ *
+ * @return number of entries written to cells/rects
+ */
+int compositor_collect(compositor_h comp, int cells[], compositor_rect_t rects[], int max);
+
+/**
+ * @brief returns the cell under the canvas coordinate or -1.
+ */
+int compositor_cell_at(compositor_h comp, int x, int y);
+
+/**
+ * @brief canvas access for the presenter. The returned pointer is stable while
+ *        a cell lock is held (resizing takes all of them).
+ */
+const uint8_t * compositor_canvas(compositor_h comp, int * linesize, int * width, int * height);
+void compositor_lock_cell(compositor_h comp, int cell);
+void compositor_unlock_cell(compositor_h comp, int cell);
+
+#ifndef QT_PLATF
+/**
+ * @brief creates one SDL window/renderer/texture for the whole canvas and a thread
+ *        presenting the dirty cells once per vsync.
+ */
+bool compositor_start_sdl_presenter(compositor_h comp, const char * title);
+#endif
+
+#ifdef __cplusplus
+  }
+#endif
@@ -60,6 +60,12 @@
 
 #include "ffwplayer.h"
 #include "log.h"
+#include "scaler.h"
+#include "yuv2rgb.h"
+#include "stream_cache.h"
+#include "media_clock.h"
+#include "kf_index.h"
+#include "tempo.h"
 
 #ifdef QT_PLATF
 #define USE_RGB32
@@ -73,6 +79,15 @@
 #define AV_PIXEL_FORMAT SDL_PIXELFORMAT_YV12
 #endif
 
+#ifndef QT_PLATF
+/**
+ * SDL output mode: the scaler writes straight into the memory returned by
+ * SDL_LockTexture instead of a private frame that is copied into the texture
+ * later on.
+ */
+#define USE_LOCKED_TEXTURE
+#endif
+
 #define FFWPLAYER_AS_A_LIBRARY
 //#define TEST_FFWPLAYER_LIBRARY
 
@@ -115,6 +130,12 @@
  */
 #define AV_SYNC_THRESHOLD             0.01
 
+/**
+ * A frame that reached the screen later than this is not caught up with:
+ * the frame timer restarts from the actual present time.
+ */
+#define AV_SYNC_THRESHOLD_MAX         0.1
+
 /**
  * No AV sync correction threshold.
  */
@@ -143,9 +164,120 @@
 #define FF_QUIT_EVENT                 (SDL_USEREVENT + 1)
 
 /**
- * Video Frame queue size.
+ * Video Frame queue size: default and upper limit (ffw_options_t).
  */
 #define VIDEO_PICTURE_QUEUE_SIZE      1
+#define VIDEO_PICTURE_QUEUE_MAX       4
+
+/**
+ * Decoded frames waiting for the conversion stage: default and upper limit.
+ */
+#define DECODED_FRAME_QUEUE_SIZE      2
+#define DECODED_FRAME_QUEUE_MAX       8
+
+/**
+ * Streaming textures used round robin by the SDL output, so the conversion
+ * never writes into the texture being presented: one per queued picture plus
+ * the one on the screen.
+ */
+#define SDL_TEXTURE_RING_SIZE         (VIDEO_PICTURE_QUEUE_MAX + 1)
+
+/**
+ * Where a streaming texture of the ring is, see convert_to_texture().
+ */
+typedef enum {
+  TEX_IDLE = 0,     /**< unlocked, owned by the render thread */
+  TEX_LENT,         /**< locked by the render thread, free for the conversion to write into */
+  TEX_QUEUED,       /**< locked, holds a picture of the VideoPicture queue */
+} tex_state_t;
+
+/**
+ * Weight of the last sample in the stage timing moving averages.
+ */
+#define STAGE_AVG_WEIGHT              0.1
+
+/**
+ * Accurate seek: a frame ending this close after the target is still before it
+ * (pts rounding).
+ */
+#define ACCURATE_SEEK_MARGIN          0.001
+
+/**
+ * Fast seek: a cached frame this far before the target is as good as the key
+ * frame the demuxer would land on.
+ */
+#define FAST_SEEK_CACHE_DISTANCE      1.0
+
+/**
+ * Frame duration assumed when the stream does not tell its frame rate.
+ */
+#define DEFAULT_FRAME_DURATION        0.04
+
+/**
+ * Trick play: fastest speed, either way.
+ */
+#define TRICK_MAX_SPEED               16
+
+/**
+ * Trick play: backward speeds up to this one are decoded GOP by GOP and shown
+ * backward, faster ones key frame by key frame.
+ */
+#define TRICK_GOP_MAX_SPEED           2
+
+/**
+ * Trick play backward: decoded frames of a GOP kept to be shown, the latest
+ * ones of a longer GOP (references to the decoder buffers, full resolution).
+ */
+#define TRICK_GOP_MAX_FRAMES          128
+
+/**
+ * Trick play on key frames: time between two steps (µs), at most one key frame
+ * is decoded per step whatever the speed.
+ */
+#define TRICK_STEP_INTERVAL           (125 * 1000)
+
+/**
+ * Trick play: packets read at most looking for a key frame or the end of a GOP.
+ */
+#define TRICK_MAX_PACKETS             1000
+
+/**
+ * Messages queued to a player thread (commands from the application).
+ */
+#define FFW_MSG_QUEUE_SIZE            16
+
+/**
+ * Probing limits of the FFW_PROBE_LIVE_INSTANT profile: enough for the
+ * parameter sets and the first key frame of a camera stream.
+ */
+#define LIVE_PROBESIZE                (32 * 1024)
+#define LIVE_ANALYZEDURATION          (500 * 1000)  // us
+
+/**
+ * Fast start gives up waiting for a key frame after this many video packets:
+ * streams with intra refresh do not flag any.
+ */
+#define FAST_START_MAX_SKIPPED        300
+
+/**
+ * pause_wait(): what else than resuming ends the wait.
+ */
+#define PAUSE_WAKE_REQUESTS           0x01    // seek and speed requests (demuxer)
+#define PAUSE_WAKE_STEP               0x02    // pictures to show while paused (demuxer, timer)
+#define PAUSE_WAKE_VISIBILITY         0x04    // hidden or shown (demuxer)
+
+/**
+ * Hidden player: how far ahead of the clock the video is read (seconds), the
+ * decoder no longer paces it.
+ */
+#define HIDDEN_READ_AHEAD             1.0
+
+/**
+ * Default grid focus profile, see ffw_options_t.grid_profile.
+ */
+#define GRID_PROFILE_WIDTH            640
+#define GRID_PROFILE_HEIGHT           360
+#define GRID_PROFILE_FPS              15
 
 /**
  * Default audio video sync type.
@@ -165,6 +297,36 @@ typedef struct PacketQueue {
 
 } PacketQueue;
 
+/**
+ * Decoded frame waiting for the conversion stage.
+ */
+typedef struct DecodedFrame {
+  AVFrame * frame;
+  double pts;
+  int serial;     /**< seek serial it was decoded in */
+} DecodedFrame;
+
+/**
+ * Trick play: how the demuxer feeds the video decoder.
+ */
+typedef enum {
+  TRICK_NONE = 0,     /**< every frame in order: normal speed, 2x */
+  TRICK_KEYFRAMES,    /**< lone key frames, drained one by one */
+  TRICK_GOP,          /**< whole GOPs, decoded into the GOP buffer and shown backward */
+} trick_mode_t;
+
+/**
+ * Bounds how many players of a batch probe (open + find stream info) at the
+ * same time. Shared by the players of a batch, freed by the last one done
+ * probing.
+ */
+typedef struct probe_gate_st {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int slots;    /**< probes that can still start */
+  int refs;
+} probe_gate_t;
+
 /**
  * Struct used to hold the format context, the indices of the audio and video stream,
  * the corresponding AVStream objects, the audio and video codec information,
@@ -191,7 +353,8 @@ typedef struct VideoState {
   AVPacket audio_pkt;
   uint8_t * audio_pkt_data;
   int audio_pkt_size;
-  double audio_clock;
+  double audio_clock;                 // pts at the end of the audio buffer
+  media_clock_t audio_clk;            // what is being played
 
   /**
    * Video Stream.
@@ -199,44 +362,150 @@ typedef struct VideoState {
   int videoStream;
   AVStream * video_st;
   AVCodecContext * video_ctx;
-  SDL_Texture * texture;
+  SDL_Texture * textures[SDL_TEXTURE_RING_SIZE];
+  SDL_Texture * frame_texture;               // VideoPicture frames are uploaded into this one
+  tex_state_t tex_state[SDL_TEXTURE_RING_SIZE];
+  void * tex_pixels[SDL_TEXTURE_RING_SIZE];   // as returned by SDL_LockTexture
+  int tex_pitch[SDL_TEXTURE_RING_SIZE];
+  pthread_mutex_t tex_mutex;                  // tex_state
+  int tex_count;
+  int tex_windex;
   SDL_Renderer * renderer;
   PacketQueue videoq;
-  struct SwsContext * sws_ctx;
+  scaler_h scaler;                    /**< sliced colour conversion */
+  pthread_mutex_t scaler_mutex;       /**< scaler pointer: read by ffw_get_stats(), cleared on exit by the conversion thread */
   double frame_timer;
   double frame_last_pts;
   double frame_last_delay;
   double video_clock;
-  double video_current_pts;
-  int64_t video_current_pts_time;
+  media_clock_t video_clk;            // what is on the screen
   double audio_diff_cum;
   double audio_diff_avg_coef;
   double audio_diff_threshold;
   int audio_diff_avg_count;
 
   /**
-   * VideoPicture Queue.
+   * Decoded frame queue: video_thread (decode) -> video_convert_thread.
+   */
+  DecodedFrame frameq[DECODED_FRAME_QUEUE_MAX];
+  int frameq_depth;
+  int frameq_size;
+  int frameq_rindex;
+  int frameq_windex;
+  pthread_mutex_t frameq_mutex;
+  pthread_cond_t frameq_cond;
+  pthread_t convert_tid;
+
+  /**
+   * Per stage timing.
+   */
+  ffw_stage_stats_t decode_stats;
+  ffw_stage_stats_t convert_stats;
+
+  /**
+   * VideoPicture Queue: video_convert_thread -> display.
    */
-  VideoPicture pictq[VIDEO_PICTURE_QUEUE_SIZE];
+  VideoPicture pictq[VIDEO_PICTURE_QUEUE_MAX];
+  int pictq_depth;
   int pictq_size;
   int pictq_rindex;
   int pictq_windex;
   pthread_mutex_t pictq_mutex;
   pthread_cond_t pictq_cond;
+  int pictq_texture[VIDEO_PICTURE_QUEUE_MAX]; // index + 1 of the locked texture holding the picture, 0 if none
 
   /**
    * AV Sync.
    */
   int av_sync_type;
-  double external_clock;
-  int64_t external_clock_time;
+  media_clock_t ext_clk;              // monotonic time, started from the video
 
   /**
    * Seeking.
    */
   int seek_req;
-  int seek_flags;
   int64_t seek_pos;
+  int64_t seek_rel;                   // increment that led to seek_pos, AV_TIME_BASE units
+  int64_t seek_req_time;              // when the pending request was made
+  int64_t seek_shown_req_time;        // request of the executed seek waiting for its picture, 0 if none
+  int seek_serial;                    // bumped by every seek done, frames of older ones are stale
+  int video_serial;                   // seek serial of the frames the decoder produces
+  int frame_serial;                   // seek serial the frame timer was started in
+  double seek_accurate_pts;           // target of the last seek done in accurate mode, NAN in fast mode
+  double video_seek_pts;              // accurate seek target the decoder is heading to, NAN if none
+  double audio_seek_pts;              // same, for the audio decoder
+  double seek_shown_target;           // target of the executed seek waiting for its picture (seconds)
+  ffw_seek_stats_t seek_stats;
+  pthread_mutex_t seek_mutex;
+  kf_index_h kf_index;                // key frame index of a local recording, if any
+  frame_cache_h frame_cache;          // decoded key frames and seek targets, if any
+  pthread_mutex_t frame_cache_mutex;  // frame_cache, for the client threads: the video thread destroys it on exit
+  double seek_target_pts;             // target of the last seek done (seconds)
+  bool kf_index_applied;              // handed to the demuxer
+
+  /**
+   * Playback speed and trick play (fast forward and reverse), see
+   * ffw_set_speed() and ffw_set_trick_speed().
+   */
+  int speed_req;                      // speed change pending (seek_mutex)
+  double speed_req_value;
+  double speed;                       // 1 when playing normally, 0.5 to 2 every frame in order
+  trick_mode_t trick_mode;            // how the demuxer feeds the decoder
+  trick_mode_t video_trick_mode;      // same, for the packets the decoder got since the flush packet
+  double trick_pos;                   // position at trick_time (seconds)
+  int64_t trick_time;                 // when playing at speed from trick_pos started
+  int64_t trick_next_step;            // key frame mode: when the next key frame is due
+  double trick_kf;                    // key frame mode: last key frame queued (seconds), NAN if none
+  double trick_gop_end;               // GOP mode: where the next GOP to play backward ends (seconds)
+  ffw_trick_stats_t trick_stats;      // seek_mutex
+  AVPacket gop_pkt;                   // end of a GOP marker: pts its start, dts its end (AV_TIME_BASE units)
+  AVFrame * gop_frames[TRICK_GOP_MAX_FRAMES]; // GOP mode: decoded, in pts order, video thread only
+  double gop_pts[TRICK_GOP_MAX_FRAMES];
+  int gop_count;
+  tempo_h tempo;                      // audio time stretching, audio thread only
+
+  /**
+   * Pause, see ffw_pause(), ffw_resume() and ffw_stop().
+   */
+  pthread_mutex_t pause_mutex;
+  pthread_cond_t pause_cond;          // broadcast on resume, quit and requests for the demuxer
+  bool paused;                        // pause_mutex
+  int step_show;                      // pictures to show while paused, see ffw_step_frame() (pause_mutex)
+  int seek_step;                      // the pending seek is a step backward (seek_mutex)
+  bool step_seek;                     // the last seek done is a step backward, for the decoder
+  bool video_step_seek;               // same, for the packets the decoder got since the flush packet
+
+  /**
+   * Snapshots, see ffw_snapshot().
+   */
+  pthread_mutex_t snapshot_mutex;
+  AVFrame * shown_frame;              // decoded frame on the screen
+  double shown_pts;                   // its pts, NAN until a picture is shown
+
+  /**
+   * Visibility, see ffw_set_visible().
+   */
+  int visible_req;                    // visibility change pending (seek_mutex)
+  bool visible_req_value;
+  bool hide;                          // demuxer: hidden asked for
+  bool hidden;                        // demuxer: video kept in hidden_gopq, from a key frame on
+  PacketQueue hidden_gopq;            // video read while hidden since the last key frame, demuxer only
+  double hidden_read_pts;             // last video packet read while hidden (seconds)
+  bool video_hidden;                  // decoder: key frames only, not shown (since hide_pkt)
+  bool video_show_key;                // decoder: next frame shown at once (since show_pkt)
+  bool video_catch_up;                // decoder: video_seek_pts is the clock where showing again catches up
+  bool show_pending;                  // refresher: next picture shown at once, shown again
+  int64_t hide_time;                  // when hidden (seek_mutex)
+  int64_t show_req_time;              // shown again, picture not on the screen yet, 0 if none (seek_mutex)
+  ffw_visibility_stats_t visibility_stats; // seek_mutex
+  AVPacket hide_pkt;                  // decoder markers, in the video stream where it is hidden
+  AVPacket show_pkt;                  // and shown again
+
+  /**
+   * Focus profiles, see ffw_set_focus().
+   */
+  double focus_last_pts;              // conversion stage: last picture converted, NAN if none
+  ffw_focus_stats_t focus_stats;      // seek_mutex
 
   /**
    * Threads.
@@ -267,6 +536,26 @@ typedef struct VideoState {
 
   pthread_t video_timer_tid;
   pthread_t audio_thread_tid;
+
+  /**
+   * Presentation: the refresher hands pictures to the render thread so that
+   * a present blocked on vsync never delays the next refresh computation.
+   */
+  pthread_t render_tid;
+  pthread_mutex_t render_mutex;
+  pthread_cond_t render_cond;
+  bool render_pending;            // picture handed over, not on screen yet
+  double render_handoff_time;     // when the pending picture was handed over
+  double present_latency;         // average handoff to on-screen delay
+  double frame_last_present;      // when the last frame reached the screen
+  bool first_frame_shown;         // time to first frame reported
+  bool stream_from_cache;         // stream parameters not probed but cached
+  bool stream_cache_checked;      // first frame checked against them
+  bool wait_keyframe;             // fast start: video packets skipped until a key frame
+  bool fast_start_pending;        // fast start: first picture shown without A/V sync
+  bool audio_discarded;           // muted: audio stream not read
+  int  audio_sync_type;           // sync type to go back to on unmute
+
   unsigned int video_timer_delay;
   ffwplayer_t * parent_ffw;
 
@@ -331,21 +620,83 @@ static void printHelpMenu();
 
 static void * format_demux_thread(void * arg);
 
+static void notify_open(VideoState * videoState, bool ok, int error);
+
+static void probe_gate_enter(ffwplayer_t * ffw);
+
+static void probe_gate_leave(ffwplayer_t * ffw);
+
+static void probe_gate_unref(probe_gate_t * gate);
+
+static ffwplayer_t * create_player(char * url, msg_thread_h parent_msg_th, void * client_data,
+                                   const ffw_options_t * options, int compositor_cell,
+                                   probe_gate_t * gate);
+
 static int stream_component_open(
   VideoState * videoState,
   int stream_index
   );
 
+static int stream_component_open_or_probe(
+  VideoState * videoState,
+  int stream_index
+  );
+
+static bool use_stream_cache(VideoState * videoState);
+
+static bool use_fast_start(VideoState * videoState);
+
+static void kf_index_start(VideoState * videoState);
+
+static void kf_index_use(VideoState * videoState);
+
+static bool fast_start_skip(VideoState * videoState, AVPacket * packet);
+
+static void render_handoff(VideoState * videoState);
+
+static void pictq_advance(VideoState * videoState);
+
+static void pictq_drop(VideoState * videoState);
+
+static ffw_options_t get_options(VideoState * videoState);
+
+static int select_stream(VideoState * videoState, enum AVMediaType type, int wanted, int related);
+
+static void audio_discard_update(VideoState * videoState);
+
+static void stream_cache_check(VideoState * videoState, AVFrame * frame);
+
 static void alloc_picture(void * userdata);
 
 static int queue_picture(
   VideoState * videoState,
   AVFrame * pFrame,
-  double pts
+  double pts,
+  int serial
+  );
+
+static void lend_textures(VideoState * videoState);
+static bool convert_to_texture(
+  VideoState * videoState,
+  AVFrame * pFrame
   );
 
 static void * video_thread(void * arg);
 
+static void * video_convert_thread(void * arg);
+
+static int video_pipeline_init(VideoState * videoState);
+
+static int frame_queue_put(VideoState * videoState, AVFrame * frame, double pts);
+
+static int frame_queue_get(VideoState * videoState, AVFrame * frame, double * pts, int * serial);
+
+static void frame_queue_flush(VideoState * videoState);
+
+static bool frame_late(VideoState * videoState, double pts);
+
+static void stage_stats_update(ffw_stage_stats_t * stats, int64_t start);
+
 static int64_t guess_correct_pts(
   AVCodecContext * ctx,
   int64_t reordered_pts,
@@ -366,6 +717,16 @@ static int synchronize_audio(
 
 static void video_refresher(void * userdata);
 
+static void * video_render_thread(void * arg);
+
+static void notify_first_frame(VideoState * videoState);
+
+static void seek_shown(VideoState * videoState, int64_t now, double pts);
+
+static double video_frame_duration(VideoState * videoState);
+
+static int frame_cache_seek(VideoState * videoState, double frame_duration);
+
 static double get_audio_clock(VideoState * videoState);
 
 static double get_video_clock(VideoState * videoState);
@@ -374,6 +735,12 @@ static double get_external_clock(VideoState * videoState);
 
 static double get_master_clock(VideoState * videoState);
 
+static double get_master_clock_at(VideoState * videoState, int64_t now);
+
+static void sync_clocks_init(VideoState * videoState);
+
+static void set_audio_clock(VideoState * videoState);
+
 static void schedule_refresh(
   VideoState * videoState,
   Uint32 delay
@@ -386,6 +753,18 @@ static Uint32 sdl_refresh_timer_cb(
 
 static void video_display(VideoState * videoState);
 
+static compositor_h get_compositor(VideoState * videoState, int * cell);
+
+static scaler_profile_t get_scaler_profile(VideoState * videoState);
+
+static const ffw_focus_profile_t * get_focus_profile(VideoState * videoState);
+
+static void get_picture_size(VideoState * videoState, int * width, int * height);
+
+static bool focus_fps_capped(VideoState * videoState, double pts);
+
+static ffw_probe_profile_t get_probe_profile(VideoState * videoState);
+
 static void packet_queue_init(PacketQueue * q);
 
 static int packet_queue_put(
@@ -394,6 +773,7 @@ static int packet_queue_put(
   );
 
 static int packet_queue_get(
+  VideoState * videoState,
   PacketQueue * queue,
   AVPacket * packet,
   int blocking
@@ -401,6 +781,8 @@ static int packet_queue_get(
 
 static void packet_queue_flush(PacketQueue * queue);
 
+static void packet_queue_wake(PacketQueue * queue);
+
 void audio_callback(
   void * userdata,
   Uint8 * stream,
@@ -425,7 +807,53 @@ static void * alsa_audio_thread(void * arg);
 
 static AudioResamplingState * getAudioResampling(uint64_t channel_layout);
 
-static void stream_seek(VideoState * videoState, int64_t pos, int rel);
+static int audio_stretch(VideoState * videoState, uint8_t * audio_buf, int * data_size, int buf_size);
+
+static void stream_seek(VideoState * videoState, int64_t pos, int64_t rel);
+
+static double get_seek_base(VideoState * videoState);
+
+static void demux_flush(VideoState * videoState);
+
+static void speed_apply(VideoState * videoState);
+
+static void trick_origin(VideoState * videoState, double pos);
+
+static void trick_keyframe_step(VideoState * videoState, AVPacket * packet);
+
+static void trick_gop_step(VideoState * videoState, AVPacket * packet);
+
+static void trick_gop_keep(VideoState * videoState, AVFrame * frame, double pts);
+static int trick_gop_play(VideoState * videoState, double start, double end);
+static void trick_gop_clear(VideoState * videoState);
+
+static void trick_bounds(VideoState * videoState, double * start, double * end);
+
+static int trick_read_keyframe(VideoState * videoState, AVPacket * packet);
+
+static double packet_seconds(VideoState * videoState, AVPacket * packet);
+
+static void player_pause(VideoState * videoState, bool paused);
+
+static int64_t pause_wait(VideoState * videoState, int wake_on);
+
+static void step_frame(VideoState * videoState, int direction);
+
+static void stream_seek_request(VideoState * videoState, int64_t pos, int64_t rel, bool step);
+
+static void snapshot_done(snapshot_t * snapshot, void * arg);
+
+static void pause_wake(VideoState * videoState);
+
+static bool pause_buffering(VideoState * videoState);
+
+static void visibility_apply(VideoState * videoState);
+
+static bool hidden_packet(VideoState * videoState, AVPacket * packet);
+
+static void hidden_show(VideoState * videoState);
+
+static bool hidden_read_ahead(VideoState * videoState);
 
 /**
  * Entry point.
@@ -447,22 +875,24 @@ static void stream_seek(VideoState * videoState, int64_t pos, int rel);
 
 extern void update_picture_widget(ffwplayer_t * ffw, VideoPicture * video_picture);
 
-void * ffw_thread(void * arg)
+/**
+ * Allocates and initializes the VideoState of a player. Done by
+ * ffw_create_player_ex() itself, so the player API can be used as soon as it
+ * returns.
+ *
+ * @param   ffw the player.
+ *
+ * @return      the VideoState or NULL if out of memory.
+ */
+static VideoState * video_state_create(ffwplayer_t * ffw)
 {
-  bool ret_bool;
-  msg_t msg;
-
-  ffwplayer_t * ffw = (ffwplayer_t *) arg;
-
-  // the global VideoState reference will be set in format_demux_thread() to this pointer
-  VideoState * videoState = NULL;
-
   // allocate memory for the VideoState and zero it out
-  videoState = av_mallocz(sizeof(VideoState));
+  VideoState * videoState = av_mallocz(sizeof(VideoState));
+  if ( ! videoState) {
+    return NULL;
+  }
   videoState->parent_ffw = ffw;
 
-  ffw->private_data = videoState;
-
   videoState->video_timer_tid = -1;
   videoState->audio_thread_tid = -1;
   // set global VideoState reference
@@ -477,12 +907,64 @@ void * ffw_thread(void * arg)
   // initialize locks for the display buffer (pictq)
   pthread_mutex_init(&videoState->pictq_mutex, NULL);
   pthread_cond_init(&videoState->pictq_cond, NULL);
+  pthread_mutex_init(&videoState->seek_mutex, NULL);
+  videoState->seek_accurate_pts = NAN;
+  videoState->video_seek_pts = NAN;
+  videoState->audio_seek_pts = NAN;
+  videoState->speed = 1;
+  videoState->trick_stats.speed = 1;
+  videoState->trick_kf = NAN;
+  pthread_mutex_init(&videoState->pause_mutex, NULL);
+  pthread_cond_init(&videoState->pause_cond, NULL);
+  pthread_mutex_init(&videoState->snapshot_mutex, NULL);
+  pthread_mutex_init(&videoState->tex_mutex, NULL);
+  pthread_mutex_init(&videoState->scaler_mutex, NULL);
+  pthread_mutex_init(&videoState->frame_cache_mutex, NULL);
+  pthread_mutex_init(&videoState->render_mutex, NULL);
+  pthread_cond_init(&videoState->render_cond, NULL);
+  videoState->shown_pts = NAN;
+  packet_queue_init(&videoState->hidden_gopq);
+  // here rather than when the streams open: quit wakes them up any time
+  packet_queue_init(&videoState->videoq);
+  packet_queue_init(&videoState->audioq);
+  videoState->hidden_read_pts = NAN;
+  videoState->focus_last_pts = NAN;
+
+  // decode -> convert -> display stages
+  if (video_pipeline_init(videoState) < 0) {
+    av_free(videoState);
+    return NULL;
+  }
+  sync_clocks_init(videoState);
+
+  videoState->av_sync_type = DEFAULT_AV_SYNC_TYPE;
+
+  av_init_packet(&videoState->flush_pkt);
+  videoState->flush_pkt.data = (uint8_t *) "FLUSH";
+
+  av_init_packet(&videoState->gop_pkt);
+  videoState->gop_pkt.data = (uint8_t *) "GOP";
+
+  av_init_packet(&videoState->hide_pkt);
+  videoState->hide_pkt.data = (uint8_t *) "HIDE";
+
+  av_init_packet(&videoState->show_pkt);
+  videoState->show_pkt.data = (uint8_t *) "SHOW";
+
+  return videoState;
+}
+
+void * ffw_thread(void * arg)
+{
+  bool ret_bool;
+  msg_t msg;
+
+  ffwplayer_t * ffw = (ffwplayer_t *) arg;
+  VideoState * videoState = (VideoState *) ffw->private_data;
 
   // launch our threads by pushing an SDL_event of type FF_REFRESH_EVENT
   schedule_refresh(videoState, 100);
 
-  videoState->av_sync_type = DEFAULT_AV_SYNC_TYPE;
-
   // start the decoding thread to read data from the AVFormatContext
   // videoState->format_demux_tid = SDL_CreateThread(format_demux_thread, "Decoding Thread", videoState);
   videoState->format_demux_tid = ffw_create_thread(
@@ -496,16 +978,10 @@ void * ffw_thread(void * arg)
   // check the decode thread was correctly started
   if (videoState->format_demux_tid == -1) {
     LOG_E("Could not start decoding thread.\n");
-
-    // free allocated memory before exiting
-    av_free(videoState);
-
+    notify_open(videoState, false, AVERROR(EAGAIN));
     return NULL;
   }
 
-  av_init_packet(&videoState->flush_pkt);
-  videoState->flush_pkt.data = "FLUSH";
-
   while(1) {
     ret_bool = wait_msg(ffw->msg_th, &msg);
     if ( ret_bool == false) {
@@ -518,14 +994,72 @@ void * ffw_thread(void * arg)
       case MSG_ID__EOS:
         LOG("setting quit flag");
         videoState->quit = 1;
+        pthread_mutex_lock(&videoState->render_mutex);
+        pthread_cond_signal(&videoState->render_cond);
+        pthread_mutex_unlock(&videoState->render_mutex);
+        // wake up the decode and conversion stages
+        pthread_mutex_lock(&videoState->frameq_mutex);
+        pthread_cond_broadcast(&videoState->frameq_cond);
+        pthread_mutex_unlock(&videoState->frameq_mutex);
+        pthread_mutex_lock(&videoState->pictq_mutex);
+        pthread_cond_broadcast(&videoState->pictq_cond);
+        pthread_mutex_unlock(&videoState->pictq_mutex);
+        // the ones waiting for packets
+        packet_queue_wake(&videoState->videoq);
+        packet_queue_wake(&videoState->audioq);
+        // and the paused ones
+        pause_wake(videoState);
+        break;
+
+      case MSG_ID__PAUSE:
+        player_pause(videoState, true);
+        break;
+
+      case MSG_ID__RESUME:
+        player_pause(videoState, false);
+        break;
+
+      case MSG_ID__STEP:
+        step_frame(videoState, msg.v_int);
+        break;
+
+      case MSG_ID__STOP:
+        // the demuxer rewinds while paused; live sources just pause
+        player_pause(videoState, true);
+        if (ffw->open_state == FFW_OPEN_READY && ffw->info.duration > 0) {
+          stream_seek(videoState, 0, 0);
+        }
         break;
 
       case MSG_ID__SEEK_RELATIVE: {
         // LOG("*************** seeking... %d **************", msg.v_int);
-        int64_t pos = get_master_clock((VideoState *) ffw->private_data);
+        double clock = get_seek_base((VideoState *) ffw->private_data);
+        double pos = isnan(clock) ? 0 : clock; // nothing played yet: from the start
         pos += msg.v_int;
-        stream_seek((VideoState *) ffw->private_data, (int64_t)(pos * AV_TIME_BASE), msg.v_int);
+        if (pos < 0) {
+          pos = 0;
         }
+        stream_seek((VideoState *) ffw->private_data, (int64_t)(pos * AV_TIME_BASE), (int64_t) msg.v_int * AV_TIME_BASE);
+        }
+        break;
+
+      case MSG_ID__TRICK_PLAY:
+      case MSG_ID__SPEED:
+        // applied by the demuxer, the newest request wins
+        pthread_mutex_lock(&videoState->seek_mutex);
+        videoState->speed_req_value = msg.msg_id == MSG_ID__SPEED ? msg.v_int / 1000.0 : msg.v_int;
+        videoState->speed_req = 1;
+        pthread_mutex_unlock(&videoState->seek_mutex);
+        pause_wake(videoState);
+        break;
+
+      case MSG_ID__VISIBILITY:
+        // applied by the demuxer, the newest request wins
+        pthread_mutex_lock(&videoState->seek_mutex);
+        videoState->visible_req_value = msg.v_int != 0;
+        videoState->visible_req = 1;
+        pthread_mutex_unlock(&videoState->seek_mutex);
+        pause_wake(videoState);
         break;
 
       default:
@@ -536,7 +1070,86 @@ void * ffw_thread(void * arg)
 
 }
 
+void ffw_default_options(ffw_options_t * options)
+{
+  memset(options, 0, sizeof(ffw_options_t));
+  options->decoded_queue_depth = DECODED_FRAME_QUEUE_SIZE;
+  options->picture_queue_depth = VIDEO_PICTURE_QUEUE_SIZE;
+  options->video_stream = FFW_STREAM_AUTO;
+  options->audio_stream = FFW_STREAM_AUTO;
+  options->grid_profile.max_width = GRID_PROFILE_WIDTH;
+  options->grid_profile.max_height = GRID_PROFILE_HEIGHT;
+  options->grid_profile.max_fps = GRID_PROFILE_FPS;
+  options->grid_profile.skip_nonref = true;
+  options->grid_profile.scaler = SCALER_PROFILE_FAST;
+  options->full_profile.scaler = SCALER_PROFILE_QUALITY;
+  options->compositor_cell = -1;
+}
+
 ffwplayer_t * ffw_create_player(char * _url, msg_thread_h parent_msg_th, void * client_data)
+{
+  return ffw_create_player_ex(_url, parent_msg_th, client_data, NULL);
+}
+
+ffwplayer_t * ffw_create_player_ex(char * _url, msg_thread_h parent_msg_th, void * client_data,
+                                   const ffw_options_t * options)
+{
+  return create_player(_url, parent_msg_th, client_data, options,
+                       options ? options->compositor_cell : -1, NULL);
+}
+
+int ffw_open_batch(char * urls[], int count, msg_thread_h parent_msg_th, void * client_data[],
+                   const ffw_options_t * options, const int compositor_cells[],
+                   int max_parallel_probes, ffwplayer_t * players[])
+{
+  probe_gate_t * gate = NULL;
+  int created = 0;
+  int cell;
+
+  if (max_parallel_probes > 0 && max_parallel_probes < count) {
+    if ( ! (gate = calloc(1, sizeof(probe_gate_t)))) {
+      LOG_E("No memo for probe gate");
+      return 0;
+    }
+    pthread_mutex_init(&gate->mutex, NULL);
+    pthread_cond_init(&gate->cond, NULL);
+    gate->slots = max_parallel_probes;
+    gate->refs = 1; // released below, once all the players hold theirs
+  }
+
+  // all players start right away, only their probing is bounded
+  for (int i = 0; i < count; i++) {
+    if (gate) {
+      pthread_mutex_lock(&gate->mutex);
+      gate->refs++;
+      pthread_mutex_unlock(&gate->mutex);
+    }
+    cell = compositor_cells ? compositor_cells[i] : options ? options->compositor_cell : -1;
+    players[i] = create_player(urls[i], parent_msg_th, client_data ? client_data[i] : NULL,
+                               options, cell, gate);
+    if (players[i]) {
+      created++;
+    } else if (gate) {
+      probe_gate_unref(gate);
+    }
+  }
+
+  if (gate) {
+    probe_gate_unref(gate);
+  }
+  return created;
+}
+
+/**
+ * Creates a player and starts its threads.
+ *
+ * @param   compositor_cell  cell in options->compositor.
+ * @param   gate  probing gate shared by a batch of players, or NULL. A
+ *                reference is handed over to the player.
+ */
+static ffwplayer_t * create_player(char * _url, msg_thread_h parent_msg_th, void * client_data,
+                                   const ffw_options_t * options, int compositor_cell,
+                                   probe_gate_t * gate)
 {
   ffwplayer_t * ffw;
 
@@ -544,29 +1157,59 @@ ffwplayer_t * ffw_create_player(char * _url, msg_thread_h parent_msg_th, void *
     LOG_E("No memo for ffwplayer_t object");
     return NULL;
   }
+  ffw->created_time = av_gettime_relative();
+  ffw->probe_gate = gate;
+
+  if (options) {
+    ffw->options = *options;
+  } else {
+    ffw_default_options(&ffw->options);
+  }
+  ffw->focus = ffw->options.focus;
 
   //ffw->url = _url;
   //snprintf(ffw->url, MAX_URL_LEN, "%s", _url);
   strcpy(ffw->url, _url);
   ffw->parent_msg_th = parent_msg_th;
   ffw->client_data = client_data;
+  ffw->open_state = FFW_OPEN_PENDING;
+  pthread_mutex_init(&ffw->open_mutex, NULL);
+  pthread_cond_init(&ffw->open_cond, NULL);
+  pthread_mutex_init(&ffw->compositor_mutex, NULL);
+  // before the threads: the video stream picks its output when it opens
+  ffw->compositor = ffw->options.compositor;
+  ffw->compositor_cell = compositor_cell;
+
+  // the queue exists before the thread waiting on it: no start up delay
+  if ( ! (ffw->msg_th = reg_msg_thread(pthread_self(), FFW_MSG_QUEUE_SIZE))) {
+    LOG_E("fail to create ffw msg queue");
+    free(ffw);
+    return NULL;
+  }
 
-  ffw->msg_th = ffw_create_msg_thread(
-    "ffw_thread",
+  if ( ! (ffw->private_data = video_state_create(ffw))) {
+    LOG_E("No memo for VideoState");
+    dereg_msg_thread(ffw->msg_th);
+    free(ffw);
+    return NULL;
+  }
+
+  pthread_t tid = ffw_create_thread(
+    "ffw_thread",
     0,
     20,                             //   int priority,
     ffw_thread,                     // void * ( *thread_entry)(void *),
     ffw,                            // void * arg,
-    true,                           // bool detached,
-    6 );                            // int msg_queue_size);
+    true);                          // bool detached
 
-
-  usleep(10000); // give time to the thread to start up
-
-  if ( ! ffw->msg_th) {
+  if (tid == -1) {
    LOG_E("fail to create ffw thread");
+   av_free(ffw->private_data);
+   dereg_msg_thread(ffw->msg_th);
+   free(ffw);
    return NULL;
   }
+  msg_thread_set_owner(ffw->msg_th, tid);
 
   return ffw;
 }
@@ -584,6 +1227,194 @@ bool ffw_seek_relative(ffwplayer_t * ffw_t, int val)
   return true;
 }
 
+bool ffw_set_speed(ffwplayer_t * ffw_t, double speed)
+{
+  msg_t msg;
+
+  if ( ! (speed >= TEMPO_MIN_RATE && speed <= TEMPO_MAX_RATE)) {
+    LOG_E("ffw_set_speed: invalid speed %g", speed);
+    return false;
+  }
+
+  msg.msg_id = MSG_ID__SPEED;
+  msg.v_int = (int) lrint(speed * 1000);
+
+  if ( ! post_msg(NULL, ffw_t->msg_th, &msg)) {
+    LOG_E("ffw_set_speed: post error");
+    return false;
+  }
+  return true;
+}
+
+bool ffw_set_trick_speed(ffwplayer_t * ffw_t, int speed)
+{
+  msg_t msg;
+  int magnitude = abs(speed);
+
+  // 1, 2, 4, 8 or 16 either way
+  if (magnitude == 0 || magnitude > TRICK_MAX_SPEED || (magnitude & (magnitude - 1))) {
+    LOG_E("ffw_set_trick_speed: invalid speed %d", speed);
+    return false;
+  }
+
+  msg.msg_id = MSG_ID__TRICK_PLAY;
+  msg.v_int = speed;
+
+  if ( ! post_msg(NULL, ffw_t->msg_th, &msg)) {
+    LOG_E("ffw_set_trick_speed: post error");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Posts a message without argument to a player.
+ */
+static bool post_player_msg(ffwplayer_t * ffw_t, int msg_id, const char * caller)
+{
+  msg_t msg;
+  msg.msg_id = msg_id;
+  msg.v_int = 0;
+
+  if ( ! post_msg(NULL, ffw_t->msg_th, &msg)) {
+    LOG_E("%s: post error", caller);
+    return false;
+  }
+  return true;
+}
+
+bool ffw_pause(ffwplayer_t * ffw_t)
+{
+  return post_player_msg(ffw_t, MSG_ID__PAUSE, "ffw_pause");
+}
+
+bool ffw_resume(ffwplayer_t * ffw_t)
+{
+  return post_player_msg(ffw_t, MSG_ID__RESUME, "ffw_resume");
+}
+
+bool ffw_stop(ffwplayer_t * ffw_t)
+{
+  return post_player_msg(ffw_t, MSG_ID__STOP, "ffw_stop");
+}
+
+bool ffw_step_frame(ffwplayer_t * ffw_t, int direction)
+{
+  msg_t msg;
+  msg.msg_id = MSG_ID__STEP;
+  msg.v_int = direction < 0 ? -1 : 1;
+
+  if ( ! post_msg(NULL, ffw_t->msg_th, &msg)) {
+    LOG_E("ffw_step_frame: post error");
+    return false;
+  }
+  return true;
+}
+
+bool ffw_set_visible(ffwplayer_t * ffw_t, bool visible)
+{
+  msg_t msg;
+  msg.msg_id = MSG_ID__VISIBILITY;
+  msg.v_int = visible;
+
+  if ( ! post_msg(NULL, ffw_t->msg_th, &msg)) {
+    LOG_E("ffw_set_visible: post error");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * The frame on the screen, a new reference, NULL if nothing was shown yet.
+ *
+ * @param   videoState  the global VideoState reference.
+ * @param   pts         receives its pts (seconds).
+ */
+static AVFrame * shown_frame_ref(VideoState * videoState, double * pts)
+{
+  AVFrame * frame = NULL;
+
+  pthread_mutex_lock(&videoState->snapshot_mutex);
+  if (videoState->shown_frame && videoState->shown_frame->buf[0] &&
+      (frame = av_frame_alloc()) && av_frame_ref(frame, videoState->shown_frame) < 0) {
+    av_frame_free(&frame);
+  }
+  *pts = videoState->shown_pts;
+  pthread_mutex_unlock(&videoState->snapshot_mutex);
+  return frame;
+}
+
+/**
+ * True if the frame is smaller than the stream: a downscaled copy from the
+ * frame cache (seek or step back served from it).
+ */
+static bool frame_reduced(ffwplayer_t * ffw_t, const AVFrame * frame)
+{
+  return ffw_t->info.width > 0 &&
+         (frame->width < ffw_t->info.width || frame->height < ffw_t->info.height);
+}
+
+AVFrame * ffw_snapshot(ffwplayer_t * ffw_t, double * pts)
+{
+  VideoState * videoState = (VideoState *) ffw_t->private_data;
+  AVFrame * frame;
+  AVFrame * full;
+  double frame_pts, full_pts;
+
+  if ( ! videoState || ! (frame = shown_frame_ref(videoState, &frame_pts))) {
+    return NULL;
+  }
+  if (frame_reduced(ffw_t, frame) && (full = av_frame_alloc())) {
+    // decoded again from the recording, at the size of the stream
+    if (snapshot_decode(ffw_t->url, frame_pts, full, &full_pts) == 0) {
+      av_frame_free(&frame);
+      frame = full;
+      frame_pts = isnan(full_pts) ? frame_pts : full_pts;
+    } else {
+      LOG_W("%s: snapshot at %.3f s left downscaled", ffw_t->url, frame_pts);
+      av_frame_free(&full);
+    }
+  }
+  if (pts) {
+    *pts = frame_pts;
+  }
+  return frame;
+}
+
+bool ffw_snapshot_request(ffwplayer_t * ffw_t, double pts, snapshot_format_t format, const char * path,
+                          void * user_data)
+{
+  VideoState * videoState = (VideoState *) ffw_t->private_data;
+  AVFrame * frame = NULL;
+  double frame_pts = pts;
+  bool ok;
+
+  if (isnan(pts)) {
+    if ( ! videoState || ! (frame = shown_frame_ref(videoState, &frame_pts))) {
+      LOG_W("%s: no picture shown yet for a snapshot", ffw_t->url);
+      return false;
+    }
+    if (frame_reduced(ffw_t, frame)) {
+      // downscaled copy: the worker decodes it from the recording instead
+      av_frame_free(&frame);
+    }
+  } else if (videoState && (frame = av_frame_alloc())) {
+    // already decoded, unless it was cached downscaled
+    pthread_mutex_lock(&videoState->frame_cache_mutex);
+    if ( ! videoState->frame_cache ||
+        ! frame_cache_get(videoState->frame_cache, pts, 0, frame, &frame_pts) ||
+        frame_reduced(ffw_t, frame)) {
+      av_frame_free(&frame);
+      frame_pts = pts;
+    }
+    pthread_mutex_unlock(&videoState->frame_cache_mutex);
+  }
+
+  ok = snapshot_request(ffw_t->url, frame, frame_pts, format, path, user_data, snapshot_done, ffw_t);
+  av_frame_free(&frame);
+  return ok;
+}
+
 bool ffw_destroy(ffwplayer_t * ffw_h)
 {
   msg_t msg;
@@ -598,16 +1429,339 @@ void ffw_mute(ffwplayer_t * ffw_t, bool mute)
   videoState->mute = mute;
 }
 
+void ffw_set_compositor(ffwplayer_t * ffw_t, compositor_h comp, int cell)
+{
+  // picked up by the video threads on the next frame, the cell along with
+  // the compositor
+  pthread_mutex_lock(&ffw_t->compositor_mutex);
+  ffw_t->compositor_cell = cell;
+  ffw_t->compositor = comp;
+  pthread_mutex_unlock(&ffw_t->compositor_mutex);
+}
+
+ffw_open_state_t ffw_wait_ready(ffwplayer_t * ffw_t, int timeout_ms)
+{
+  struct timespec deadline;
+  ffw_open_state_t state;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  pthread_mutex_lock(&ffw_t->open_mutex);
+  while (ffw_t->open_state == FFW_OPEN_PENDING) {
+    if (pthread_cond_timedwait(&ffw_t->open_cond, &ffw_t->open_mutex, &deadline) == ETIMEDOUT) {
+      break;
+    }
+  }
+  state = ffw_t->open_state;
+  pthread_mutex_unlock(&ffw_t->open_mutex);
+  return state;
+}
+
+void ffw_set_scaler_profile(ffwplayer_t * ffw_t, scaler_profile_t profile)
+{
+  // picked up by the scalers before their next picture
+  ffw_t->scaler_profile = profile;
+}
+
+void ffw_set_focus(ffwplayer_t * ffw_t, ffw_focus_t focus)
+{
+  VideoState * videoState = (VideoState *) ffw_t->private_data;
+
+  if (focus == ffw_t->focus) {
+    return;
+  }
+  // picked up by the decoder, the conversion stage and the scalers on their next frame
+  ffw_t->focus = focus;
+  pthread_mutex_lock(&videoState->seek_mutex);
+  videoState->focus_stats.switches++;
+  pthread_mutex_unlock(&videoState->seek_mutex);
+}
+
+void ffw_set_seek_mode(ffwplayer_t * ffw_t, ffw_seek_mode_t mode)
+{
+  // read by the demuxer when it does the next seek
+  ffw_t->options.seek_mode = mode;
+}
+
+bool ffw_get_stats(ffwplayer_t * ffw_t, ffw_stats_t * stats)
+{
+  VideoState * videoState = (VideoState *) ffw_t->private_data;
+  scaler_stats_t sc_stats;
+  compositor_h comp;
+  int cell;
+
+  memset(stats, 0, sizeof(ffw_stats_t));
+  if ( ! videoState) {
+    return false;
+  }
+
+  // own conversion (texture/widget) plus scaling into the compositor cell
+  pthread_mutex_lock(&videoState->scaler_mutex);
+  if (videoState->scaler) {
+    scaler_get_stats(videoState->scaler, &sc_stats);
+    stats->scaled_frames += sc_stats.frames;
+    stats->scale_total_ms += sc_stats.total_ms;
+    stats->scale_avg_ms = sc_stats.avg_ms;
+    stats->scaler = sc_stats;
+  }
+  pthread_mutex_unlock(&videoState->scaler_mutex);
+  comp = get_compositor(videoState, &cell);
+  if (comp && compositor_get_cell_stats(comp, cell, &sc_stats)) {
+    stats->scaled_frames += sc_stats.frames;
+    stats->scale_total_ms += sc_stats.total_ms;
+    stats->scale_avg_ms = sc_stats.avg_ms;
+    stats->scaler = sc_stats;
+  }
+
+  stats->decode = videoState->decode_stats;
+  stats->convert = videoState->convert_stats;
+  pthread_mutex_lock(&videoState->render_mutex);
+  stats->present_latency_ms = videoState->present_latency * 1000.0;
+  pthread_mutex_unlock(&videoState->render_mutex);
+  pthread_mutex_lock(&videoState->frame_cache_mutex);
+  if (videoState->frame_cache) {
+    frame_cache_get_stats(videoState->frame_cache, &stats->frame_cache);
+  }
+  pthread_mutex_unlock(&videoState->frame_cache_mutex);
+  stats->startup = ffw_t->startup;
+  pthread_mutex_lock(&videoState->seek_mutex);
+  stats->seek = videoState->seek_stats;
+  stats->trick = videoState->trick_stats;
+  stats->visibility = videoState->visibility_stats;
+  if (stats->visibility.hidden) {
+    stats->visibility.hidden_ms += (media_clock_now() - videoState->hide_time) / 1000.0;
+  }
+  stats->focus = videoState->focus_stats;
+  stats->focus.focus = ffw_t->focus;
+  pthread_mutex_unlock(&videoState->seek_mutex);
+  return true;
+}
+
 #ifdef TEST_FFWPLAYER_LIBRARY
+
+#define MAX_TEST_PLAYERS  COMPOSITOR_MAX_CELLS
+#define TEST_OPEN_TIMEOUT_MS  (10 * 1000)
+#define TEST_MAX_PARALLEL_PROBES  4
+#define TTFF_ROUNDS       3
+#define TTFF_SETTLE_MS    500   // lets the previous player tear down its connection
+#define SEEK_SHOWN_TIMEOUT_MS (5 * 1000)
+#define SEEK_SETTLE_MS    300   // plays a little between seeks
+#define KF_INDEX_TIMEOUT_MS (120 * 1000)
+#define TEST_FRAME_CACHE_MB     256
+#define TEST_FRAME_CACHE_WIDTH  640
+
+/**
+ * Time to first frame of each URL with each probing profile, with and without
+ * the stream cache, averaged over a few opens. Players are opened one at a
+ * time, on their own window. The cache is primed by an extra open that is not
+ * accounted.
+ */
+static void ttff_benchmark(char * urls[], int count)
+{
+  static const struct {
+    ffw_probe_profile_t profile;
+    bool                cache;
+    bool                fast_start;
+    const char *        name;
+  } variants[] = {
+    { FFW_PROBE_ROBUST,       false, false, "robust" },
+    { FFW_PROBE_ROBUST,       true,  false, "robust+cache" },
+    { FFW_PROBE_LIVE_INSTANT, false, false, "live-instant" },
+    { FFW_PROBE_LIVE_INSTANT, true,  false, "live+cache" },
+    { FFW_PROBE_LIVE_INSTANT, true,  true,  "live+cache+fs" },
+  };
+  ffw_options_t options;
+
+  ffw_default_options(&options);
+  printf("%-40s %-13s %9s %9s %14s\n", "url", "profile", "probe ms", "ready ms", "1st frame ms");
+  for (int i = 0; i < count; i++) {
+    for (int v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+      double probe_ms = 0, ready_ms = 0, first_frame_ms = 0;
+      int ok = 0;
+
+      options.probe_profile = variants[v].profile;
+      options.stream_cache = variants[v].cache;
+      options.fast_start = variants[v].fast_start;
+      stream_cache_clear();
+      for (int r = variants[v].cache ? -1 : 0; r < TTFF_ROUNDS; r++) {
+        ffwplayer_t * ffw = ffw_create_player_ex(urls[i], NULL, NULL, &options);
+        if ( ! ffw) {
+          break;
+        }
+        if (ffw_wait_ready(ffw, TEST_OPEN_TIMEOUT_MS) == FFW_OPEN_READY) {
+          int64_t deadline = av_gettime_relative() + TEST_OPEN_TIMEOUT_MS * 1000LL;
+          while (ffw->startup.first_frame_ms == 0 && av_gettime_relative() < deadline) {
+            usleep(1000);
+          }
+          if (ffw->startup.first_frame_ms > 0 && r >= 0) {
+            probe_ms += ffw->startup.probe_ms;
+            ready_ms += ffw->startup.ready_ms;
+            first_frame_ms += ffw->startup.first_frame_ms;
+            ok++;
+          }
+        }
+        ffw_destroy(ffw);
+        usleep(TTFF_SETTLE_MS * 1000);
+      }
+
+      if (ok) {
+        printf("%-40.40s %-13s %9.0f %9.0f %14.0f  (%d/%d)\n", urls[i], variants[v].name,
+               probe_ms / ok, ready_ms / ok, first_frame_ms / ok, ok, TTFF_ROUNDS);
+      } else {
+        printf("%-40.40s %-13s %9s\n", urls[i], variants[v].name, "failed");
+      }
+      fflush(stdout);
+    }
+  }
+}
+
+/**
+ * Seek to display latency and accuracy of each URL in fast and accurate mode:
+ * the same series of relative seeks, each one waited for until its first
+ * picture is on the screen. Meant for long GOP content, where the two modes
+ * differ the most. The index and cache options given apply: with the key
+ * frame index the seeks start once it is in use, with the frame cache the
+ * steps coming back to places already visited can be served from memory.
+ */
+static void seek_benchmark(char * urls[], int count, const ffw_options_t * base)
+{
+  // seconds, odd enough for the targets to rarely fall on key frames
+  static const int steps[] = { 7, 13, -5, 29, -11, 3, 17, -23, 9, -3, 31, -19 };
+  static const struct {
+    ffw_seek_mode_t mode;
+    const char *    name;
+  } modes[] = {
+    { FFW_SEEK_FAST,      "fast" },
+    { FFW_SEEK_ACCURATE,  "accurate" },
+  };
+  int num_steps = sizeof(steps) / sizeof(steps[0]);
+  ffw_options_t options;
+  ffw_stats_t stats;
+
+  options = *base;
+  printf("%-40s %-9s %9s %9s %13s %9s\n", "url", "mode", "avg ms", "max ms", "avg |err| ms", "skipped");
+  for (int i = 0; i < count; i++) {
+    for (int m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+      double total_ms = 0, max_ms = 0, total_error_ms = 0;
+      uint64_t skipped = 0, cache_hits = 0;
+      int ok = 0;
+
+      options.seek_mode = modes[m].mode;
+      ffwplayer_t * ffw = ffw_create_player_ex(urls[i], NULL, NULL, &options);
+      if ( ! ffw) {
+        break;
+      }
+      if (ffw_wait_ready(ffw, TEST_OPEN_TIMEOUT_MS) == FFW_OPEN_READY) {
+        int64_t deadline = av_gettime_relative() + TEST_OPEN_TIMEOUT_MS * 1000LL;
+        while (ffw->startup.first_frame_ms == 0 && av_gettime_relative() < deadline) {
+          usleep(1000);
+        }
+        usleep(SEEK_SETTLE_MS * 1000);
+
+        // the index is handed to the demuxer on the first seek once built
+        deadline = av_gettime_relative() + KF_INDEX_TIMEOUT_MS * 1000LL;
+        while (options.keyframe_index && ffw_get_stats(ffw, &stats) && stats.seek.indexed_keyframes == 0 &&
+               av_gettime_relative() < deadline) {
+          ffw_seek_relative(ffw, 0);
+          usleep(SEEK_SETTLE_MS * 1000);
+        }
+
+        for (int s = 0; s < num_steps && ffw_get_stats(ffw, &stats); s++) {
+          uint64_t shown = stats.seek.shown;
+
+          ffw_seek_relative(ffw, steps[s]);
+          deadline = av_gettime_relative() + SEEK_SHOWN_TIMEOUT_MS * 1000LL;
+          while (ffw_get_stats(ffw, &stats) && stats.seek.shown == shown && av_gettime_relative() < deadline) {
+            usleep(1000);
+          }
+          if (stats.seek.shown != shown) {
+            total_ms += stats.seek.last_ms;
+            max_ms = FFMAX(max_ms, stats.seek.last_ms);
+            total_error_ms += fabs(stats.seek.last_error_ms);
+            skipped = stats.seek.skipped_frames;
+            cache_hits = stats.frame_cache.hits;
+            ok++;
+          }
+          usleep(SEEK_SETTLE_MS * 1000);
+        }
+      }
+      ffw_destroy(ffw);
+      usleep(TTFF_SETTLE_MS * 1000);
+
+      if (ok) {
+        printf("%-40.40s %-9s %9.1f %9.1f %13.1f %9llu  (%d/%d, %llu from the frame cache)\n", urls[i],
+               modes[m].name, total_ms / ok, max_ms, total_error_ms / ok, (unsigned long long) skipped,
+               ok, num_steps, (unsigned long long) cache_hits);
+      } else {
+        printf("%-40.40s %-9s %9s\n", urls[i], modes[m].name, "failed");
+      }
+      fflush(stdout);
+    }
+  }
+}
+
+/**
+ * usage: ffwplayer [-l] [-c] [-f] [-A] [-e] [-a] [-x] [-m] [-P] url...  play (-l: live-instant probing,
+ *                                                             -c: stream cache, -f: fast start, -A: no audio,
+ *                                                             -e: external clock, -a: accurate seek,
+ *                                                             -x: key frame index, -m: decoded frame cache,
+ *                                                             -P: live sources read while paused)
+ *        ffwplayer -t url...                                  time to first frame benchmark
+ *        ffwplayer [-x] [-m] -k url...                        seek benchmark, fast vs accurate
+ */
 int main(int argc, char * argv[])
 {
-  ffwplayer_t * ffw_h;
+  ffwplayer_t * players[MAX_TEST_PLAYERS];
+  void * client_data[MAX_TEST_PLAYERS];
+  int num_players = 0;
+  compositor_h comp = NULL;
   msg_thread_h main_msg_th;
   msg_t msg;
+  ffw_options_t options;
+  bool benchmark = false;
+  bool seek_bench = false;
+  char ** urls = &argv[1];
+  int num_urls = argc - 1;
 
   log_init();
 
-  if (argc < 2) {
+  ffw_default_options(&options);
+  for ( ; num_urls > 0 && urls[0][0] == '-'; urls++, num_urls--) {
+    if (strcmp(urls[0], "-l") == 0) {
+      options.probe_profile = FFW_PROBE_LIVE_INSTANT;
+    } else if (strcmp(urls[0], "-c") == 0) {
+      options.stream_cache = true;
+    } else if (strcmp(urls[0], "-f") == 0) {
+      options.fast_start = true;
+    } else if (strcmp(urls[0], "-A") == 0) {
+      options.audio_stream = FFW_STREAM_NONE;
+    } else if (strcmp(urls[0], "-e") == 0) {
+      options.sync_master = FFW_SYNC_EXTERNAL;
+    } else if (strcmp(urls[0], "-a") == 0) {
+      options.seek_mode = FFW_SEEK_ACCURATE;
+    } else if (strcmp(urls[0], "-x") == 0) {
+      options.keyframe_index = true;
+    } else if (strcmp(urls[0], "-m") == 0) {
+      options.frame_cache_mb = TEST_FRAME_CACHE_MB;
+      options.frame_cache_width = TEST_FRAME_CACHE_WIDTH;
+    } else if (strcmp(urls[0], "-P") == 0) {
+      options.live_pause_buffer = true;
+    } else if (strcmp(urls[0], "-N") == 0) {
+      options.hidden_mode = FFW_HIDDEN_NO_DECODE;
+    } else if (strcmp(urls[0], "-t") == 0) {
+      benchmark = true;
+    } else if (strcmp(urls[0], "-k") == 0) {
+      seek_bench = true;
+    }
+  }
+
+  if (num_urls < 1) {
     LOG_E("missing url argument.");
     return -1;
   }
@@ -622,17 +1776,68 @@ int main(int argc, char * argv[])
     return -1;
   }
 
-  // create a message queue for this main thread
-  if ( ! (main_msg_th = reg_msg_thread(pthread_self(), 6)) ) {
+  // create a message queue for this main thread (room for the open result and first frame of each player,
+  // and a round of snapshots)
+  if ( ! (main_msg_th = reg_msg_thread(pthread_self(), MAX_TEST_PLAYERS * 4)) ) {
     LOG_E("Fail to create msg system for main App thread");
     return -1;
   }
 
-  if ( ! (ffw_h = ffw_create_player(argv[1], main_msg_th, 0))) {
+  if (benchmark) {
+    ttff_benchmark(urls, num_urls);
+    return 0;
+  }
+
+  if (seek_bench) {
+    seek_benchmark(urls, num_urls, &options);
+    return 0;
+  }
+
+  num_players = num_urls;
+  if (num_players > MAX_TEST_PLAYERS) {
+    num_players = MAX_TEST_PLAYERS;
+  }
+
+  if (num_players > 1) {
+    // more than one URL: all players share a single mosaic window
+    int cols = (int) ceil(sqrt(num_players));
+    int rows = (num_players + cols - 1) / cols;
+    int cell_w = DEFAULT_WIDTH / cols;
+    int cell_h = DEFAULT_HEIGTH / rows;
+
+    if ( ! (comp = compositor_create(cell_w * cols, cell_h * rows))) {
+      return -1;
+    }
+    for (int i = 0; i < num_players; i++) {
+      compositor_set_cell(comp, i, (i % cols) * cell_w, (i / cols) * cell_h, cell_w, cell_h);
+    }
+    compositor_start_sdl_presenter(comp, "FFmpeg SDL Mosaic");
+  }
+
+  for (int i = 0; i < num_players; i++) {
+    client_data[i] = (void *) (intptr_t) i;
+  }
+  // cell i for player i
+  options.compositor = comp;
+  if (ffw_open_batch(urls, num_players, main_msg_th, client_data, &options, NULL,
+                     TEST_MAX_PARALLEL_PROBES, players) != num_players) {
     LOG_E("No memo for ffwplayer_t object");
     return -1;
   }
 
+  // all of them are opening in parallel by now
+  for (int i = 0; i < num_players; i++) {
+    ffw_open_state_t state = ffw_wait_ready(players[i], TEST_OPEN_TIMEOUT_MS);
+    if (state == FFW_OPEN_READY) {
+      printf("%s: %dx%d %.2f fps %s%s%s (streams %d/%d of %d)\n", urls[i],
+             players[i]->info.width, players[i]->info.height, players[i]->info.fps, players[i]->info.video_codec,
+             players[i]->info.has_audio ? " + " : "", players[i]->info.audio_codec,
+             players[i]->info.video_stream, players[i]->info.audio_stream, players[i]->info.nb_streams);
+    } else {
+      printf("%s: %s\n", urls[i], state == FFW_OPEN_FAILED ? "failed to open" : "still opening");
+    }
+  }
+
   char c, line[32];
   int line_idx = 0;
   bool user_quit = false;
@@ -660,7 +1865,9 @@ int main(int argc, char * argv[])
         // msg.msg_id = MSG_ID__EOS;
         // post_msg(main_msg_th, ffw_h->msg_th, &msg);
         user_quit = true;
-        ffw_destroy(ffw_h);
+        for (int i = 0; i < num_players; i++) {
+          ffw_destroy(players[i]);
+        }
         break;
 
       case 's':
@@ -673,48 +1880,322 @@ int main(int argc, char * argv[])
         // int64_t pos = get_master_clock((VideoState *) ffw_h->private_data);
         // pos += v;
         // stream_seek((VideoState *) ffw_h->private_data, (int64_t)(pos * AV_TIME_BASE), v);
-        ffw_seek_relative(ffw_h, v);
+        for (int i = 0; i < num_players; i++) {
+          ffw_seek_relative(players[i], v);
+        }
         printf(PROMPT);
         fflush(stdout);
         break;
       }
-      default:
-        printf("invalid option\n\n" PROMPT);
-        break;
-    }
-    line_idx = 0;
-    memset(line, 0, sizeof(line));
-  } 
 
-  return 0;
+      case 'z':
+      {
+        // z <step> <count>: scrubbing, seeks posted back to back end up coalesced
+        char * pEnd;
+        int step = strtol(&line[2], &pEnd, 10);
+        int count = strtol(pEnd, NULL, 10);
 
-}
+        printf("Scrub %d x %d...\n", count, step);
+        for (int n = 0; n < count; n++) {
+          for (int i = 0; i < num_players; i++) {
+            ffw_seek_relative(players[i], step);
+          }
+        }
+        printf(PROMPT);
+        fflush(stdout);
+        break;
+      }
 
+      case 'r':
+      {
+        // r <speed>: trick play, 1 back to normal
+        int speed = strtol(&line[2], NULL, 10);
 
-#endif // TEST_FFWPLAYER_LIBRARY
+        printf("Speed %dx...\n", speed);
+        for (int i = 0; i < num_players; i++) {
+          ffw_set_trick_speed(players[i], speed);
+        }
+        printf(PROMPT);
+        fflush(stdout);
+        break;
+      }
 
-#else
-int main(int argc, char * argv[])
-{
-  // if the given number of command line arguments is wrong
-  if ( argc < 2 ) {
-    // print help menu and exit
-    printHelpMenu();
-    return -1;
-  }
+      case 'v':
+      {
+        // v <speed>: variable speed, 0.5 to 2
+        double speed = strtod(&line[2], NULL);
 
-  /**
-   * Initialize SDL.
-   * New API: this implementation does not use deprecated SDL functionalities.
-   */
-  int ret = SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER);
-  if (ret != 0) {
-    LOG("Could not initialize SDL - %s\n.", SDL_GetError());
-    return -1;
-  }
+        printf("Speed %gx...\n", speed);
+        for (int i = 0; i < num_players; i++) {
+          ffw_set_speed(players[i], speed);
+        }
+        printf(PROMPT);
+        fflush(stdout);
+        break;
+      }
 
-  // the global VideoState reference will be set in format_demux_thread() to this pointer
-  VideoState * videoState = NULL;
+      case 'u':
+      case 'g':
+      case 't':
+        // pause, go (resume), stop
+        printf("%s...\n", line[0] == 'u' ? "Pause" : line[0] == 'g' ? "Resume" : "Stop");
+        for (int i = 0; i < num_players; i++) {
+          if (line[0] == 'u') {
+            ffw_pause(players[i]);
+          } else if (line[0] == 'g') {
+            ffw_resume(players[i]);
+          } else {
+            ffw_stop(players[i]);
+          }
+        }
+        printf(PROMPT);
+        fflush(stdout);
+        break;
+
+      case 'w':
+      {
+        // w <seconds>: CPU taken by the whole process meanwhile (~0 with all the players paused)
+        int seconds = strtol(&line[2], NULL, 10);
+        struct timespec cpu_start, cpu_end;
+
+        seconds = seconds > 0 ? seconds : 5;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+        sleep(seconds);
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+        double cpu_ms = (cpu_end.tv_sec - cpu_start.tv_sec) * 1000.0 + (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1000000.0;
+        printf("%d players: %.1f ms of CPU in %d s (%.2f%% of a core)\n",
+               num_players, cpu_ms, seconds, cpu_ms / (seconds * 10.0));
+        printf(PROMPT);
+        fflush(stdout);
+        break;
+      }
+
+      case 'h':
+      case 'o':
+      {
+        // h [cell]: hides all the players but cell (as covered by it full screen), o: shows them again
+        char * pEnd;
+        int cell = strtol(&line[1], &pEnd, 10);
+
+        if (pEnd == &line[1]) {
+          cell = -1;
+        }
+        printf("%s...\n", line[0] == 'h' ? "Hide" : "Show");
+        for (int i = 0; i < num_players; i++) {
+          ffw_set_visible(players[i], line[0] == 'o' || i == cell);
+        }
+        printf(PROMPT);
+        fflush(stdout);
+        break;
+      }
+
+      case 'f':
+      {
+        // f [cell]: cell in full screen quality, the others in grid quality (none given: all of them)
+        char * pEnd;
+        int cell = strtol(&line[1], &pEnd, 10);
+
+        if (pEnd == &line[1]) {
+          cell = -1;
+        }
+        printf("Focus %d...\n", cell);
+        for (int i = 0; i < num_players; i++) {
+          ffw_set_focus(players[i], i == cell ? FFW_FOCUS_FULL : FFW_FOCUS_GRID);
+        }
+        printf(PROMPT);
+        fflush(stdout);
+        break;
+      }
+
+      case 'e':
+      {
+        // e <1|-1>: frame step
+        int direction = strtol(&line[2], NULL, 10);
+
+        printf("Step %s...\n", direction < 0 ? "backward" : "forward");
+        for (int i = 0; i < num_players; i++) {
+          ffw_step_frame(players[i], direction);
+        }
+        printf(PROMPT);
+        fflush(stdout);
+        break;
+      }
+
+      case 'j':
+      {
+        // j [seconds]: JPEG snapshot of each player, on the screen or at a time of the recording
+        char * pEnd;
+        double pts = strtod(&line[1], &pEnd);
+        char path[64];
+        int requested = 0;
+
+        if (pEnd == &line[1]) {
+          pts = NAN;
+        }
+        for (int i = 0; i < num_players; i++) {
+          snprintf(path, sizeof(path), "/tmp/ffw_snapshot_%d.jpg", i);
+          requested += ffw_snapshot_request(players[i], pts, SNAPSHOT_JPEG, path, NULL);
+        }
+        // the players post them here
+        while (requested > 0 && wait_msg(main_msg_th, &msg)) {
+          if (msg.msg_id != MSG_ID__SNAPSHOT) {
+            continue;
+          }
+          snapshot_t * snapshot = (snapshot_t *) msg.v_ptr_3;
+          if (snapshot->error == 0) {
+            printf("player %d: %s, %dx%d at %.3f s, %d KB, decode %.1f ms, encode %.1f ms, total %.1f ms\n",
+                   (int) (intptr_t) msg.v_ptr_2, snapshot->path, snapshot->frame->width, snapshot->frame->height,
+                   snapshot->pts, snapshot->size / 1024, snapshot->decode_ms, snapshot->encode_ms,
+                   snapshot->total_ms);
+          } else {
+            printf("player %d: snapshot failed (%d)\n", (int) (intptr_t) msg.v_ptr_2, snapshot->error);
+          }
+          snapshot_free(snapshot);
+          requested--;
+        }
+        printf(PROMPT);
+        fflush(stdout);
+        break;
+      }
+
+      case 'b':
+        scaler_benchmark();
+        yuv2rgb_benchmark();
+        tempo_benchmark();
+        snapshot_benchmark();
+        printf(PROMPT);
+        fflush(stdout);
+        break;
+
+      case 'c':
+        yuv2rgb_test();
+        printf(PROMPT);
+        fflush(stdout);
+        break;
+
+      case 'p':
+      {
+        // p <0..3>: auto, fast, balanced, quality
+        int v = strtol(&line[2], NULL, 10);
+        for (int i = 0; i < num_players; i++) {
+          ffw_set_scaler_profile(players[i], (scaler_profile_t) v);
+        }
+        printf(PROMPT);
+        fflush(stdout);
+        break;
+      }
+
+      case 'i':
+        for (int i = 0; i < num_players; i++) {
+          ffw_stats_t stats;
+          if ( ! ffw_get_stats(players[i], &stats)) {
+            continue;
+          }
+          printf("player %d: scaled %llu frames, %.1f ms total, %.2f ms avg, "
+                 "profile %d flags 0x%x slices %d%s, cpu load %.2f\n",
+                 i, (unsigned long long) stats.scaled_frames, stats.scale_total_ms, stats.scale_avg_ms,
+                 stats.scaler.profile, stats.scaler.flags, stats.scaler.slices,
+                 stats.scaler.fast_path ? " (simd)" : "", stats.scaler.cpu_load);
+          printf("          decode %.2f ms/frame (blocked %.0f ms), convert %.2f ms/frame (blocked %.0f ms), "
+                 "present latency %.2f ms\n",
+                 stats.decode.avg_ms, stats.decode.wait_ms, stats.convert.avg_ms, stats.convert.wait_ms,
+                 stats.present_latency_ms);
+          printf("          startup: queued %.0f ms, probe %.0f ms%s, ready %.0f ms, first frame %.0f ms\n",
+                 stats.startup.queued_ms, stats.startup.probe_ms, stats.startup.stream_cached ? " (cached)" : "",
+                 stats.startup.ready_ms, stats.startup.first_frame_ms);
+          printf("          seek: %llu requests, %llu coalesced, %llu done, %llu failed, "
+                 "shown in %.0f ms (avg %.0f ms) %+.0f ms from the target, %llu frames skipped, "
+                 "%d key frames indexed\n",
+                 (unsigned long long) stats.seek.requests, (unsigned long long) stats.seek.coalesced,
+                 (unsigned long long) stats.seek.executed, (unsigned long long) stats.seek.failed,
+                 stats.seek.last_ms, stats.seek.avg_ms, stats.seek.last_error_ms,
+                 (unsigned long long) stats.seek.skipped_frames, stats.seek.indexed_keyframes);
+          if (stats.frame_cache.budget) {
+            uint64_t lookups = stats.frame_cache.hits + stats.frame_cache.misses;
+            printf("          frame cache: %d frames, %.1f of %.0f MB, %llu hits / %llu lookups (%.0f%%), "
+                   "%llu evicted\n",
+                   stats.frame_cache.frames, stats.frame_cache.bytes / 1048576.0,
+                   stats.frame_cache.budget / 1048576.0,
+                   (unsigned long long) stats.frame_cache.hits, (unsigned long long) lookups,
+                   lookups ? 100.0 * stats.frame_cache.hits / lookups : 0.0,
+                   (unsigned long long) stats.frame_cache.evictions);
+          }
+          if (i == 0) {
+            snapshot_stats_t snapshots;
+            snapshot_get_stats(&snapshots);
+            if (snapshots.requests) {
+              printf("          snapshots: %llu requests, %llu rejected, %llu failed, %d pending, "
+                     "%llu decoded (avg %.1f ms), encode avg %.1f ms, total avg %.1f ms\n",
+                     (unsigned long long) snapshots.requests, (unsigned long long) snapshots.rejected,
+                     (unsigned long long) snapshots.failed, snapshots.pending,
+                     (unsigned long long) snapshots.decoded, snapshots.avg_decode_ms,
+                     snapshots.avg_encode_ms, snapshots.avg_total_ms);
+            }
+          }
+          if (stats.trick.speed != 1 || stats.trick.keyframes || stats.trick.gops) {
+            printf("          speed %gx: %llu key frames, %llu GOPs backward (%llu frames over the buffer), "
+                   "%llu late steps, %llu frames dropped, decode %.2f ms/frame, audio stretch load %.4f\n",
+                   stats.trick.speed, (unsigned long long) stats.trick.keyframes,
+                   (unsigned long long) stats.trick.gops, (unsigned long long) stats.trick.gop_dropped_frames,
+                   (unsigned long long) stats.trick.late_steps,
+                   (unsigned long long) stats.trick.dropped_frames, stats.decode.avg_ms,
+                   stats.trick.tempo_load);
+          }
+          if (stats.focus.focus != FFW_FOCUS_NONE) {
+            printf("          focus %s: %llu switches, %llu frames above the profile fps, pictures %dx%d\n",
+                   stats.focus.focus == FFW_FOCUS_FULL ? "full" : "grid", (unsigned long long) stats.focus.switches,
+                   (unsigned long long) stats.focus.capped_frames, stats.focus.picture_width,
+                   stats.focus.picture_height);
+          }
+          if (stats.visibility.hides) {
+            printf("          %s: hidden %llu times for %.0f ms, %llu key frames decoded, %llu packets dropped, "
+                   "%llu frames to catch up, shown again in %.0f ms\n",
+                   stats.visibility.hidden ? "hidden" : "visible", (unsigned long long) stats.visibility.hides,
+                   stats.visibility.hidden_ms, (unsigned long long) stats.visibility.keyframes,
+                   (unsigned long long) stats.visibility.dropped_packets,
+                   (unsigned long long) stats.visibility.catch_up_frames, stats.visibility.last_show_ms);
+          }
+        }
+        printf(PROMPT);
+        fflush(stdout);
+        break;
+      default:
+        printf("invalid option\n\n" PROMPT);
+        break;
+    }
+    line_idx = 0;
+    memset(line, 0, sizeof(line));
+  } 
+
+  return 0;
+
+}
+
+
+#endif // TEST_FFWPLAYER_LIBRARY
+
+#else
+int main(int argc, char * argv[])
+{
+  // if the given number of command line arguments is wrong
+  if ( argc < 2 ) {
+    // print help menu and exit
+    printHelpMenu();
+    return -1;
+  }
+
+  /**
+   * Initialize SDL.
+   * New API: this implementation does not use deprecated SDL functionalities.
+   */
+  int ret = SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER);
+  if (ret != 0) {
+    LOG("Could not initialize SDL - %s\n.", SDL_GetError());
+    return -1;
+  }
+
+  // the global VideoState reference will be set in format_demux_thread() to this pointer
+  VideoState * videoState = NULL;
 
   // allocate memory for the VideoState and zero it out
   videoState = av_mallocz(sizeof(VideoState));
@@ -736,6 +2217,35 @@ int main(int argc, char * argv[])
   // initialize locks for the display buffer (pictq)
   pthread_mutex_init(&videoState->pictq_mutex, NULL);
   pthread_cond_init(&videoState->pictq_cond, NULL);
+  pthread_mutex_init(&videoState->seek_mutex, NULL);
+  videoState->seek_accurate_pts = NAN;
+  videoState->video_seek_pts = NAN;
+  videoState->audio_seek_pts = NAN;
+  videoState->speed = 1;
+  videoState->trick_stats.speed = 1;
+  videoState->trick_kf = NAN;
+  pthread_mutex_init(&videoState->pause_mutex, NULL);
+  pthread_cond_init(&videoState->pause_cond, NULL);
+  pthread_mutex_init(&videoState->snapshot_mutex, NULL);
+  pthread_mutex_init(&videoState->tex_mutex, NULL);
+  pthread_mutex_init(&videoState->scaler_mutex, NULL);
+  pthread_mutex_init(&videoState->frame_cache_mutex, NULL);
+  pthread_mutex_init(&videoState->render_mutex, NULL);
+  pthread_cond_init(&videoState->render_cond, NULL);
+  videoState->shown_pts = NAN;
+  packet_queue_init(&videoState->hidden_gopq);
+  // here rather than when the streams open: quit wakes them up any time
+  packet_queue_init(&videoState->videoq);
+  packet_queue_init(&videoState->audioq);
+  videoState->hidden_read_pts = NAN;
+  videoState->focus_last_pts = NAN;
+
+  // decode -> convert -> display stages
+  if (video_pipeline_init(videoState) < 0) {
+    av_free(videoState);
+    return -1;
+  }
+  sync_clocks_init(videoState);
 
   // launch our threads by pushing an SDL_event of type FF_REFRESH_EVENT
   schedule_refresh(videoState, 100);
@@ -763,7 +2273,16 @@ int main(int argc, char * argv[])
   }
 
   av_init_packet(&videoState->flush_pkt);
-  videoState->flush_pkt.data = "FLUSH";
+  videoState->flush_pkt.data = (uint8_t *) "FLUSH";
+
+  av_init_packet(&videoState->gop_pkt);
+  videoState->gop_pkt.data = (uint8_t *) "GOP";
+
+  av_init_packet(&videoState->hide_pkt);
+  videoState->hide_pkt.data = (uint8_t *) "HIDE";
+
+  av_init_packet(&videoState->show_pkt);
+  videoState->show_pkt.data = (uint8_t *) "SHOW";
 
 #if 1
   char c, line[32];
@@ -791,9 +2310,9 @@ int main(int argc, char * argv[])
       case 's':
       {
         printf("Seek...\n");
-        int64_t pos = get_master_clock(global_video_state);
-        pos += 60.0;
-        stream_seek(global_video_state, (int64_t)(pos * AV_TIME_BASE), 60.0);
+        double pos = get_seek_base(global_video_state);
+        pos = isnan(pos) ? 60.0 : pos + 60.0;
+        stream_seek(global_video_state, (int64_t)(pos * AV_TIME_BASE), (int64_t)(60.0 * AV_TIME_BASE));
         break;
       }
       default:
@@ -840,13 +2359,27 @@ int main(int argc, char * argv[])
             incr = 60.0;
             goto do_seek;
           }
+          case SDLK_SPACE:
+          {
+            player_pause(videoState, ! videoState->paused);
+            break;
+          }
+          case SDLK_PERIOD:
+          case SDLK_COMMA:
+          {
+            step_frame(videoState, event.key.keysym.sym == SDLK_PERIOD ? 1 : -1);
+            break;
+          }
 
  do_seek:
             {
               if (global_video_state) {
-                pos = get_master_clock(global_video_state);
-                pos += incr;
-                stream_seek(global_video_state, (int64_t)(pos * AV_TIME_BASE), incr);
+                pos = get_seek_base(global_video_state);
+                pos = isnan(pos) ? incr : pos + incr;
+                if (pos < 0) {
+                  pos = 0;
+                }
+                stream_seek(global_video_state, (int64_t)(pos * AV_TIME_BASE), (int64_t)(incr * AV_TIME_BASE));
               }
               break;
             };
@@ -873,6 +2406,8 @@ int main(int argc, char * argv[])
         pthread_cond_signal(&videoState->audioq.cond);
         pthread_cond_signal(&videoState->videoq.cond);
 
+        pause_wake(videoState);
+
         SDL_Quit();
       }
       break;
@@ -936,6 +2471,7 @@ static void * format_demux_thread(void * arg)
 
   AVInputFormat* input_format = NULL;
   AVDictionary *opt = NULL;
+  bool read_paused = false;   // av_read_pause() done
 
 
   pFormatCtx = avformat_alloc_context();
@@ -951,10 +2487,22 @@ static void * format_demux_thread(void * arg)
   }
   
 
-  int ret = avformat_open_input(&pFormatCtx, videoState->filename, input_format, NULL);//&opt);
+  if (get_probe_profile(videoState) == FFW_PROBE_LIVE_INSTANT) {
+    // probe just what is needed to start decoding and do not buffer at all
+    av_dict_set_int(&opt, "probesize", LIVE_PROBESIZE, 0);
+    av_dict_set_int(&opt, "analyzeduration", LIVE_ANALYZEDURATION, 0);
+    av_dict_set(&opt, "fflags", "nobuffer", 0);
+  }
+
+  probe_gate_enter(videoState->parent_ffw);
+
+  int ret = avformat_open_input(&pFormatCtx, videoState->filename, input_format, &opt);
+  av_dict_free(&opt);
 
   if (ret < 0) {
     LOG("Could not open file %s.\n", videoState->filename);
+    probe_gate_leave(videoState->parent_ffw);
+    notify_open(videoState, false, ret);
     return (void *)-1;
   }
 
@@ -968,34 +2516,35 @@ static void * format_demux_thread(void * arg)
   // set the AVFormatContext for the global VideoState reference
   videoState->pFormatCtx = pFormatCtx;
 
-  // read packets of the media file to get stream information
-  ret = avformat_find_stream_info(pFormatCtx, NULL);
+  // a source opened before does not need to be probed again
+  videoState->stream_from_cache = use_stream_cache(videoState) &&
+                                  stream_cache_apply(pFormatCtx, videoState->filename);
+  if (videoState->stream_from_cache) {
+    LOG_I("%s: stream parameters from the cache", videoState->filename);
+    videoState->parent_ffw->startup.stream_cached = true;
+  } else {
+    // read packets of the media file to get stream information
+    ret = avformat_find_stream_info(pFormatCtx, NULL);
+  }
+  probe_gate_leave(videoState->parent_ffw);
   if (ret < 0) {
     LOG("Could not find stream information: %s.\n", videoState->filename);
+    notify_open(videoState, false, ret);
     return (void *)-1;
   }
+  if (use_stream_cache(videoState) && ! videoState->stream_from_cache) {
+    stream_cache_store(pFormatCtx, videoState->filename);
+  }
 
   // dump information about file onto standard error
   if (_DEBUG_) {
     av_dump_format(pFormatCtx, 0, videoState->filename, 0);
   }
 
-  // video and audio stream indexes
-  int videoStream = -1;
-  int audioStream = -1;
-
-  // loop through the streams that have been found
-  for (int i = 0; i < pFormatCtx->nb_streams; i++) {
-    // look for the video stream
-    if (pFormatCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && videoStream < 0) {
-      videoStream = i;
-    }
-
-    // look for the audio stream
-    if (pFormatCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO && audioStream < 0) {
-      audioStream = i;
-    }
-  }
+  // video and audio stream indexes: the ones asked for or the best ones
+  ffw_options_t options = get_options(videoState);
+  int videoStream = select_stream(videoState, AVMEDIA_TYPE_VIDEO, options.video_stream, -1);
+  int audioStream = select_stream(videoState, AVMEDIA_TYPE_AUDIO, options.audio_stream, videoStream);
 
   // return with error in case no video stream was found
   if (videoStream == -1) {
@@ -1003,7 +2552,7 @@ static void * format_demux_thread(void * arg)
     goto fail;
   } else {
     // open video stream component codec
-    ret = stream_component_open(videoState, videoStream);
+    ret = stream_component_open_or_probe(videoState, videoStream);
 
     // check video codec was opened correctly
     if (ret < 0) {
@@ -1012,27 +2561,44 @@ static void * format_demux_thread(void * arg)
     }
   }
 
-  // return with error in case no audio stream was found
+  // audio is optional: most cameras have none
   if (audioStream == -1) {
-    LOG("Could not find audio stream.\n");
-    goto fail;
+    LOG_I("%s: no audio stream, playing video only", videoState->filename);
   } else {
     // open audio stream component codec
-    ret = stream_component_open(videoState, audioStream);
+    ret = stream_component_open_or_probe(videoState, audioStream);
 
-    // check audio codec was opened correctly
+    // without a working audio codec the video still plays
     if (ret < 0) {
-      LOG("Could not open audio codec.\n");
-      goto fail;
+      LOG_W("%s: could not open audio codec, playing video only", videoState->filename);
     }
   }
 
-  // check both the audio and video codecs were correctly retrieved
-  if (videoState->videoStream < 0 || videoState->audioStream < 0) {
+  // check the video codec was correctly retrieved
+  if (videoState->videoStream < 0) {
     LOG("Could not open codecs: %s.\n", videoState->filename);
     goto fail;
   }
 
+  if (options.sync_master == FFW_SYNC_VIDEO) {
+    videoState->av_sync_type = AV_SYNC_VIDEO_MASTER;
+  } else if (options.sync_master == FFW_SYNC_EXTERNAL) {
+    videoState->av_sync_type = AV_SYNC_EXTERNAL_MASTER;
+  }
+
+  // no audio thread and no audio queue: the video paces itself
+  if (videoState->audioStream < 0 && videoState->av_sync_type == AV_SYNC_AUDIO_MASTER) {
+    videoState->av_sync_type = AV_SYNC_VIDEO_MASTER;
+  }
+  videoState->audio_sync_type = videoState->av_sync_type;
+
+  // demuxers that support it do not even read the streams not played
+  for (int i = 0; i < pFormatCtx->nb_streams; i++) {
+    if (i != videoState->videoStream && i != videoState->audioStream) {
+      pFormatCtx->streams[i]->discard = AVDISCARD_ALL;
+    }
+  }
+
   // alloc the AVPacket used to read the media file
   AVPacket * packet = av_packet_alloc();
   if (packet == NULL) {
@@ -1040,6 +2606,14 @@ static void * format_demux_thread(void * arg)
     goto fail;
   }
 
+  videoState->wait_keyframe = use_fast_start(videoState);
+  videoState->fast_start_pending = use_fast_start(videoState);
+
+  kf_index_start(videoState);
+
+  // streams and codecs are open: let the application know
+  notify_open(videoState, true, 0);
+
   // main decode loop: read in a packet and put it on the right queue
   for (;;) {
     // check global quit flag
@@ -1049,43 +2623,114 @@ static void * format_demux_thread(void * arg)
 
     // seek stuff goes here
     if (videoState->seek_req) {
-      int video_stream_index = -1;
-      int audio_stream_index = -1;
-      int64_t seek_target_video = videoState->seek_pos;
-      int64_t seek_target_audio = videoState->seek_pos;
+      // take the newest request: one made from now on waits for the next loop
+      pthread_mutex_lock(&videoState->seek_mutex);
+      int64_t seek_target = videoState->seek_pos;
+      int64_t seek_rel = videoState->seek_rel;
+      int64_t seek_req_time = videoState->seek_req_time;
+      bool seek_step = videoState->seek_step;
+      videoState->seek_req = 0;
+      pthread_mutex_unlock(&videoState->seek_mutex);
 
-      if (videoState->videoStream >= 0) {
-        video_stream_index = videoState->videoStream;
+      if (videoState->kf_index && ! videoState->kf_index_applied && kf_index_ready(videoState->kf_index)) {
+        kf_index_use(videoState);
       }
 
-      if (videoState->audioStream >= 0) {
-        audio_stream_index = videoState->audioStream;
-      }
+      // one seek for all the streams; a step forward never lands before where
+      // it started from nor a step backward after it
+      bool accurate = get_options(videoState).seek_mode == FFW_SEEK_ACCURATE || seek_step;
+      int64_t seek_min = seek_rel > 0 ? seek_target - seek_rel + 2 : INT64_MIN;
+      int64_t seek_max = seek_rel < 0 ? seek_target - seek_rel - 2 : INT64_MAX;
 
-      if (video_stream_index >= 0 && audio_stream_index >= 0) {
-        seek_target_video = av_rescale_q(seek_target_video, AV_TIME_BASE_Q, pFormatCtx->streams[video_stream_index]->time_base);
-        seek_target_audio = av_rescale_q(seek_target_audio, AV_TIME_BASE_Q, pFormatCtx->streams[audio_stream_index]->time_base);
+      if (accurate) {
+        // the key frame at or before the target, decoded forward from there
+        seek_min = INT64_MIN;
+        seek_max = seek_target;
       }
 
-      ret = av_seek_frame(videoState->pFormatCtx, video_stream_index, seek_target_video, videoState->seek_flags);
-      ret &= av_seek_frame(videoState->pFormatCtx, audio_stream_index, seek_target_audio, videoState->seek_flags);
-
+      ret = avformat_seek_file(pFormatCtx, -1, seek_min, seek_target, seek_max, 0);
       if (ret < 0) {
-        // LOG_E("%s: error while seeking\n", videoState->pFormatCtx->filename);
         LOG_E("%s: error while seeking\n", videoState->pFormatCtx->url);
+        pthread_mutex_lock(&videoState->seek_mutex);
+        videoState->seek_stats.failed++;
+        pthread_mutex_unlock(&videoState->seek_mutex);
       } else {
-        if (videoState->videoStream >= 0) {
-          packet_queue_flush(&videoState->videoq);
-          packet_queue_put(&videoState->videoq, &videoState->flush_pkt);
+        // picked up by the decoders along with the flush packet
+        videoState->seek_target_pts = seek_target / (double) AV_TIME_BASE;
+        videoState->seek_accurate_pts = accurate ? videoState->seek_target_pts : NAN;
+        videoState->step_seek = seek_step;
+
+        demux_flush(videoState);
+
+        if (seek_step && videoState->paused) {
+          // its picture is shown even though paused
+          pthread_mutex_lock(&videoState->pause_mutex);
+          videoState->step_show++;
+          pthread_cond_broadcast(&videoState->pause_cond);
+          pthread_mutex_unlock(&videoState->pause_mutex);
         }
 
-        if (videoState->audioStream >= 0) {
-          packet_queue_flush(&videoState->audioq);
-          packet_queue_put(&videoState->audioq, &videoState->flush_pkt);
+        // trick play goes on from there
+        if (videoState->trick_mode != TRICK_NONE) {
+          trick_origin(videoState, videoState->seek_target_pts);
         }
+
+        pthread_mutex_lock(&videoState->seek_mutex);
+        videoState->seek_stats.executed++;
+        videoState->seek_shown_req_time = seek_req_time;
+        videoState->seek_shown_target = seek_target / (double) AV_TIME_BASE;
+        pthread_mutex_unlock(&videoState->seek_mutex);
       }
+    }
 
-      videoState->seek_req = 0;
+    if (videoState->speed_req) {
+      speed_apply(videoState);
+    }
+
+    if (videoState->visible_req) {
+      visibility_apply(videoState);
+    }
+
+    // paused: nothing read until resumed (or a seek, speed or visibility
+    // request comes), but for a frame step
+    if (videoState->paused && ! videoState->step_show && ! pause_buffering(videoState)) {
+      if ( ! read_paused) {
+        // network sources stop sending, no-op for files
+        av_read_pause(pFormatCtx);
+        read_paused = true;
+      }
+      int64_t paused_us = pause_wait(videoState, PAUSE_WAKE_REQUESTS | PAUSE_WAKE_STEP | PAUSE_WAKE_VISIBILITY);
+      // trick play goes on from where it was
+      videoState->trick_time += paused_us;
+      if (videoState->trick_next_step) {
+        videoState->trick_next_step += paused_us;
+      }
+      continue;
+    }
+    if (read_paused) {
+      av_read_play(pFormatCtx);
+      read_paused = false;
+    }
+
+    // muting (or trick play) stops the audio at the demuxer, unmuting resumes it in sync
+    if (videoState->audio_st && (videoState->mute || videoState->trick_mode != TRICK_NONE) != videoState->audio_discarded) {
+      audio_discard_update(videoState);
+    }
+
+    // fast forward and reverse on key frames or GOPs: the demuxer picks what to read
+    if (videoState->trick_mode == TRICK_KEYFRAMES) {
+      trick_keyframe_step(videoState, packet);
+      continue;
+    } else if (videoState->trick_mode == TRICK_GOP) {
+      trick_gop_step(videoState, packet);
+      continue;
+    }
+
+    // hidden: the video is no longer consumed as it plays, the clock paces the reading
+    if (videoState->hidden && hidden_read_ahead(videoState)) {
+      usleep(1000 *  10);
+
+      continue;
     }
 
     // check audio and video packets queues size
@@ -1116,8 +2761,15 @@ static void * format_demux_thread(void * arg)
 
     // put the packet in the appropriate queue
     if (packet->stream_index == videoState->videoStream) {
+      if (fast_start_skip(videoState, packet)) {
+        av_packet_unref(packet);
+        continue;
+      }
+      if (hidden_packet(videoState, packet)) {
+        continue;
+      }
       packet_queue_put(&videoState->videoq, packet);
-    } else if (packet->stream_index == videoState->audioStream) {
+    } else if (packet->stream_index == videoState->audioStream && ! videoState->audio_discarded) {
       packet_queue_put(&videoState->audioq, packet);
     } else {
       // otherwise free the memory
@@ -1130,12 +2782,22 @@ static void * format_demux_thread(void * arg)
     usleep(1000 *  100);
   }
 
+  // video kept while hidden
+  packet_queue_flush(&videoState->hidden_gopq);
+
+  // stops the index build, if still running
+  kf_index_close(videoState->kf_index);
+  videoState->kf_index = NULL;
+
   // close the opened input AVFormatContext
   avformat_close_input(&pFormatCtx);
 
   // in case of failure, push the FF_QUIT_EVENT and return
  fail:
   {
+    // no-op if the open already succeeded
+    notify_open(videoState, false, ret < 0 ? ret : AVERROR_STREAM_NOT_FOUND);
+
     // create an SDL_Event of type FF_QUIT_EVENT
     SDL_Event event;
     event.type = FF_QUIT_EVENT;
@@ -1150,64 +2812,425 @@ static void * format_demux_thread(void * arg)
 }
 
 /**
- * Retrieves the AVCodec and initializes the AVCodecContext for the given AVStream
- * index. In case of AVMEDIA_TYPE_AUDIO codec type, it sets the desired audio specs,
- * opens the audio device and starts playing.
+ * Waits for a probing slot of the player batch, if any.
  *
- * @param   videoState      the global VideoState reference used to save info
- *                          related to the media being played.
- * @param   stream_index    the stream index obtained from the AVFormatContext.
+ * @param   ffw the player (NULL in the stand alone build).
+ */
+static void probe_gate_enter(ffwplayer_t * ffw)
+{
+  probe_gate_t * gate;
+
+  if ( ! ffw) {
+    return;
+  }
+  if ((gate = ffw->probe_gate)) {
+    pthread_mutex_lock(&gate->mutex);
+    while (gate->slots == 0) {
+      pthread_cond_wait(&gate->cond, &gate->mutex);
+    }
+    gate->slots--;
+    pthread_mutex_unlock(&gate->mutex);
+  }
+  ffw->probe_start_time = av_gettime_relative();
+  ffw->startup.queued_ms = (ffw->probe_start_time - ffw->created_time) / 1000.0;
+}
+
+/**
+ * Gives the probing slot back and drops the player reference to the gate.
  *
- * @return                  < 0 in case of error, 0 otherwise.
+ * @param   ffw the player (NULL in the stand alone build).
  */
-static int stream_component_open(VideoState * videoState, int stream_index)
+static void probe_gate_leave(ffwplayer_t * ffw)
 {
-  //static bool audio_already_open = false;
-  // retrieve file I/O context
-  AVFormatContext * pFormatCtx = videoState->pFormatCtx;
+  probe_gate_t * gate;
 
-  // check the given stream index is valid
-  if (stream_index < 0 || stream_index >= pFormatCtx->nb_streams) {
-    LOG("Invalid stream index.");
-    return -1;
+  if ( ! ffw) {
+    return;
   }
+  ffw->startup.probe_ms = (av_gettime_relative() - ffw->probe_start_time) / 1000.0;
+  if ((gate = ffw->probe_gate)) {
+    ffw->probe_gate = NULL;
+    pthread_mutex_lock(&gate->mutex);
+    gate->slots++;
+    pthread_cond_signal(&gate->cond);
+    pthread_mutex_unlock(&gate->mutex);
+    probe_gate_unref(gate);
+  }
+}
 
-  // retrieve codec for the given stream index
-  AVCodec * codec = NULL;
-  codec = avcodec_find_decoder(pFormatCtx->streams[stream_index]->codecpar->codec_id);
-  if (codec == NULL) {
-    LOG("Unsupported codec.\n");
-    return -1;
+static void probe_gate_unref(probe_gate_t * gate)
+{
+  bool last;
+
+  pthread_mutex_lock(&gate->mutex);
+  last = --gate->refs == 0;
+  pthread_mutex_unlock(&gate->mutex);
+
+  if (last) {
+    pthread_cond_destroy(&gate->cond);
+    pthread_mutex_destroy(&gate->mutex);
+    free(gate);
   }
+}
 
-  // retrieve codec context
-  AVCodecContext * codecCtx = NULL;
-  codecCtx = avcodec_alloc_context3(codec);
-  int ret = avcodec_parameters_to_context(codecCtx, pFormatCtx->streams[stream_index]->codecpar);
-  if (ret != 0) {
-    LOG("Could not copy codec context.\n");
-    return -1;
+/**
+ * Ends the open handshake: fills the stream info, wakes up ffw_wait_ready()
+ * and posts MSG_ID__READY or MSG_ID__FAILED to the parent message thread.
+ * Only the first call has an effect.
+ *
+ * @param   videoState  the global VideoState reference.
+ * @param   ok          true if the streams and codecs were opened.
+ * @param   error       AVERROR code when failed.
+ */
+static void notify_open(VideoState * videoState, bool ok, int error)
+{
+  ffwplayer_t * ffw = videoState->parent_ffw;
+  msg_t msg;
+
+  if ( ! ffw) {
+    return;
   }
 
-  // in case of Audio codec, set up and open the audio device
-  if (codecCtx->codec_type == AVMEDIA_TYPE_AUDIO) {
-#ifdef USE_SDL_AUDIO
-    // desired and obtained audio specs references
-    SDL_AudioSpec wanted_specs;
-    SDL_AudioSpec specs;
+  pthread_mutex_lock(&ffw->open_mutex);
+  if (ffw->open_state != FFW_OPEN_PENDING) {
+    pthread_mutex_unlock(&ffw->open_mutex);
+    return;
+  }
 
-    // Set audio settings from codec info
-    wanted_specs.freq = codecCtx->sample_rate;
-    wanted_specs.format = AUDIO_S16SYS;
-    wanted_specs.channels = codecCtx->channels;
-    wanted_specs.silence = 0;
-    wanted_specs.samples = SDL_AUDIO_BUFFER_SIZE;
-    wanted_specs.callback = audio_callback;
-    wanted_specs.userdata = videoState;
+  if (ok) {
+    ffw_stream_info_t * info = &ffw->info;
+    AVFormatContext * pFormatCtx = videoState->pFormatCtx;
 
-    /* Deprecated, please refer to tutorial04-resampled.c for the new API */
-    // open audio device
-    //if (audio_already_open == false) {
+    memset(info, 0, sizeof(ffw_stream_info_t));
+    if (pFormatCtx->duration != AV_NOPTS_VALUE) {
+      info->duration = (double) pFormatCtx->duration / AV_TIME_BASE;
+    }
+    if (videoState->video_st) {
+      info->width = videoState->video_ctx->width;
+      info->height = videoState->video_ctx->height;
+      info->fps = av_q2d(av_guess_frame_rate(pFormatCtx, videoState->video_st, NULL));
+      av_strlcpy(info->video_codec, avcodec_get_name(videoState->video_ctx->codec_id), sizeof(info->video_codec));
+    }
+    if (videoState->audio_st) {
+      info->has_audio = true;
+      info->sample_rate = videoState->audio_ctx->sample_rate;
+      info->channels = videoState->audio_ctx->channels;
+      av_strlcpy(info->audio_codec, avcodec_get_name(videoState->audio_ctx->codec_id), sizeof(info->audio_codec));
+    }
+    info->nb_streams = pFormatCtx->nb_streams;
+    info->video_stream = videoState->videoStream;
+    info->audio_stream = videoState->audioStream;
+    ffw->open_state = FFW_OPEN_READY;
+    ffw->startup.ready_ms = (av_gettime_relative() - ffw->created_time) / 1000.0;
+  } else {
+    ffw->open_error = error;
+    ffw->open_state = FFW_OPEN_FAILED;
+  }
+  pthread_cond_broadcast(&ffw->open_cond);
+  pthread_mutex_unlock(&ffw->open_mutex);
+
+  if (ok) {
+    LOG_I("%s: ready, %dx%d %.2f fps", ffw->url, ffw->info.width, ffw->info.height, ffw->info.fps);
+  } else {
+    LOG_E("%s: open failed (%d)", ffw->url, error);
+  }
+
+  if (ffw->parent_msg_th) {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_id = ok ? MSG_ID__READY : MSG_ID__FAILED;
+    msg.v_int = ok ? 0 : error;
+    msg.v_ptr_1 = ffw;
+    msg.v_ptr_2 = ffw->client_data;
+    msg.v_ptr_3 = ok ? &ffw->info : NULL;
+    if ( ! post_msg(NULL, ffw->parent_msg_th, &msg)) {
+      LOG_E("%s: could not post the open result", ffw->url);
+    }
+  }
+}
+
+/**
+ * stream_component_open() for streams whose parameters may come from the
+ * stream cache: if they do not work, they are dropped from the cache, the
+ * input is probed for real and the stream opened again.
+ *
+ * @param   videoState      the global VideoState reference.
+ * @param   stream_index    the stream index obtained from the AVFormatContext.
+ *
+ * @return                  < 0 in case of error, 0 otherwise.
+ */
+static int stream_component_open_or_probe(VideoState * videoState, int stream_index)
+{
+  int ret = stream_component_open(videoState, stream_index);
+
+  if (ret < 0 && videoState->stream_from_cache) {
+    LOG_W("%s: cached stream parameters rejected, probing", videoState->filename);
+    stream_cache_invalidate(videoState->filename);
+    videoState->stream_from_cache = false;
+    videoState->parent_ffw->startup.stream_cached = false;
+    if ((ret = avformat_find_stream_info(videoState->pFormatCtx, NULL)) >= 0) {
+      stream_cache_store(videoState->pFormatCtx, videoState->filename);
+      ret = stream_component_open(videoState, stream_index);
+    }
+  }
+  return ret;
+}
+
+/**
+ * True if the player keeps its stream parameters in the stream cache (never
+ * in the stand alone build).
+ *
+ * @param   videoState  the global VideoState reference.
+ */
+static bool use_stream_cache(VideoState * videoState)
+{
+  return videoState->parent_ffw && videoState->parent_ffw->options.stream_cache;
+}
+
+/**
+ * Options of the player (the defaults in the stand alone build).
+ *
+ * @param   videoState  the global VideoState reference.
+ */
+static ffw_options_t get_options(VideoState * videoState)
+{
+  ffw_options_t options;
+
+  if (videoState->parent_ffw) {
+    return videoState->parent_ffw->options;
+  }
+  ffw_default_options(&options);
+  return options;
+}
+
+/**
+ * Picks the stream to play for a media type: the one asked for in the options
+ * if it is of that type, otherwise the best one.
+ *
+ * @param   videoState  the global VideoState reference.
+ * @param   type        media type of the stream.
+ * @param   wanted      stream index, FFW_STREAM_AUTO or FFW_STREAM_NONE.
+ * @param   related     stream the one picked should go with, or -1.
+ *
+ * @return              the stream index, -1 if none.
+ */
+static int select_stream(VideoState * videoState, enum AVMediaType type, int wanted, int related)
+{
+  AVFormatContext * pFormatCtx = videoState->pFormatCtx;
+  int ret;
+
+  if (wanted == FFW_STREAM_NONE) {
+    return -1;
+  }
+  if (wanted >= 0) {
+    if (wanted < pFormatCtx->nb_streams && pFormatCtx->streams[wanted]->codecpar->codec_type == type) {
+      return wanted;
+    }
+    LOG_W("%s: stream %d is not a %s stream, picking one", videoState->filename, wanted,
+          av_get_media_type_string(type));
+  }
+  ret = av_find_best_stream(pFormatCtx, type, -1, related, NULL, 0);
+  return ret >= 0 ? ret : -1;
+}
+
+/**
+ * Follows the mute state of the player: while muted the audio stream is
+ * discarded by the demuxer, nothing is decoded and the video follows its own
+ * clock. On unmute the audio decoder is flushed, the audio clock restarts from
+ * the next packets and the audio is the master again. Demuxer thread only.
+ *
+ * @param   videoState  the global VideoState reference.
+ */
+static void audio_discard_update(VideoState * videoState)
+{
+  videoState->audio_discarded = videoState->mute || videoState->trick_mode != TRICK_NONE;
+  packet_queue_flush(&videoState->audioq);
+  if (videoState->audio_discarded) {
+    videoState->audio_st->discard = AVDISCARD_ALL;
+    videoState->av_sync_type = AV_SYNC_VIDEO_MASTER;
+  } else {
+    videoState->audio_st->discard = AVDISCARD_DEFAULT;
+    packet_queue_put(&videoState->audioq, &videoState->flush_pkt);
+    media_clock_invalidate(&videoState->audio_clk); // set again once audio plays
+    videoState->av_sync_type = videoState->audio_sync_type;
+  }
+}
+
+/**
+ * True if the player starts in fast start mode (never in the stand alone
+ * build).
+ *
+ * @param   videoState  the global VideoState reference.
+ */
+static bool use_fast_start(VideoState * videoState)
+{
+  return videoState->parent_ffw && videoState->parent_ffw->options.fast_start;
+}
+
+/**
+ * True if the container came with an index of the video stream (MP4 sample
+ * tables, MKV cues, AVI idx1). The demuxers flagged AVFMT_GENERIC_INDEX (raw
+ * H.264/HEVC, ...) have none: their index entries are only the packets read
+ * so far, while probing.
+ *
+ * @param   videoState  the global VideoState reference.
+ */
+static bool has_container_index(VideoState * videoState)
+{
+  if (videoState->pFormatCtx->iformat->flags & AVFMT_GENERIC_INDEX) {
+    return false;
+  }
+  return avformat_index_get_entries_count(videoState->video_st) > 0;
+}
+
+/**
+ * Loads or starts building the key frame index of a local recording, unless
+ * not asked for (never in the stand alone build) or the demuxer already has
+ * an index of its own, see has_container_index().
+ *
+ * @param   videoState  the global VideoState reference.
+ */
+static void kf_index_start(VideoState * videoState)
+{
+  if ( ! videoState->parent_ffw || ! videoState->parent_ffw->options.keyframe_index ||
+       ! videoState->video_st || has_container_index(videoState)) {
+    return;
+  }
+  videoState->kf_index = kf_index_open(videoState->filename, videoState->videoStream);
+}
+
+/**
+ * Hands the key frame index over to the demuxer: from then on its seeks go
+ * straight to the byte offset of the key frame. Demuxer thread only.
+ *
+ * @param   videoState  the global VideoState reference.
+ */
+static void kf_index_use(VideoState * videoState)
+{
+  int added = kf_index_apply(videoState->kf_index, videoState->pFormatCtx);
+
+  videoState->kf_index_applied = true;
+  if (added < 0) {
+    LOG_W("%s: key frame index does not match the stream", videoState->filename);
+    return;
+  }
+  LOG_I("%s: seeking through %d indexed key frames", videoState->filename, added);
+  pthread_mutex_lock(&videoState->seek_mutex);
+  videoState->seek_stats.indexed_keyframes = added;
+  pthread_mutex_unlock(&videoState->seek_mutex);
+}
+
+/**
+ * Fast start: video packets ahead of the first key frame cannot be decoded
+ * into anything worth showing, they are not even queued.
+ *
+ * @param   videoState  the global VideoState reference.
+ * @param   packet      a video packet read from the input.
+ *
+ * @return              true if the packet is to be dropped.
+ */
+static bool fast_start_skip(VideoState * videoState, AVPacket * packet)
+{
+  ffwplayer_t * ffw = videoState->parent_ffw;
+
+  if ( ! videoState->wait_keyframe) {
+    return false;
+  }
+  if ( ! (packet->flags & AV_PKT_FLAG_KEY) && ffw->startup.skipped_packets < FAST_START_MAX_SKIPPED) {
+    ffw->startup.skipped_packets++;
+    return true;
+  }
+  if (ffw->startup.skipped_packets) {
+    LOG_I("%s: skipped %d video packets before the first key frame", ffw->url, ffw->startup.skipped_packets);
+  }
+  videoState->wait_keyframe = false;
+  return false;
+}
+
+/**
+ * Checks the first decoded picture against the cached stream parameters, if
+ * they were used. On a mismatch (or if nothing could be decoded, frame NULL)
+ * they are dropped so the next open probes the stream. The decoder copes with
+ * the difference for the current one.
+ *
+ * @param   videoState  the global VideoState reference.
+ * @param   frame       first decoded frame, NULL on a decoding error.
+ */
+static void stream_cache_check(VideoState * videoState, AVFrame * frame)
+{
+  AVCodecParameters * par;
+
+  if ( ! videoState->stream_from_cache || videoState->stream_cache_checked) {
+    return;
+  }
+  videoState->stream_cache_checked = true;
+
+  par = videoState->video_st->codecpar;
+  if ( ! frame || frame->width != par->width || frame->height != par->height ||
+       frame->format != par->format) {
+    LOG_W("%s: stream differs from its cached parameters, dropping them", videoState->filename);
+    stream_cache_invalidate(videoState->filename);
+  }
+}
+
+/**
+ * Retrieves the AVCodec and initializes the AVCodecContext for the given AVStream
+ * index. In case of AVMEDIA_TYPE_AUDIO codec type, it sets the desired audio specs,
+ * opens the audio device and starts playing.
+ *
+ * @param   videoState      the global VideoState reference used to save info
+ *                          related to the media being played.
+ * @param   stream_index    the stream index obtained from the AVFormatContext.
+ *
+ * @return                  < 0 in case of error, 0 otherwise.
+ */
+static int stream_component_open(VideoState * videoState, int stream_index)
+{
+  //static bool audio_already_open = false;
+  // retrieve file I/O context
+  AVFormatContext * pFormatCtx = videoState->pFormatCtx;
+
+  // check the given stream index is valid
+  if (stream_index < 0 || stream_index >= pFormatCtx->nb_streams) {
+    LOG("Invalid stream index.");
+    return -1;
+  }
+
+  // retrieve codec for the given stream index
+  AVCodec * codec = NULL;
+  codec = avcodec_find_decoder(pFormatCtx->streams[stream_index]->codecpar->codec_id);
+  if (codec == NULL) {
+    LOG("Unsupported codec.\n");
+    return -1;
+  }
+
+  // retrieve codec context
+  AVCodecContext * codecCtx = NULL;
+  codecCtx = avcodec_alloc_context3(codec);
+  int ret = avcodec_parameters_to_context(codecCtx, pFormatCtx->streams[stream_index]->codecpar);
+  if (ret != 0) {
+    LOG("Could not copy codec context.\n");
+    return -1;
+  }
+
+  // in case of Audio codec, set up and open the audio device
+  if (codecCtx->codec_type == AVMEDIA_TYPE_AUDIO) {
+#ifdef USE_SDL_AUDIO
+    // desired and obtained audio specs references
+    SDL_AudioSpec wanted_specs;
+    SDL_AudioSpec specs;
+
+    // Set audio settings from codec info
+    wanted_specs.freq = codecCtx->sample_rate;
+    wanted_specs.format = AUDIO_S16SYS;
+    wanted_specs.channels = codecCtx->channels;
+    wanted_specs.silence = 0;
+    wanted_specs.samples = SDL_AUDIO_BUFFER_SIZE;
+    wanted_specs.callback = audio_callback;
+    wanted_specs.userdata = videoState;
+
+    /* Deprecated, please refer to tutorial04-resampled.c for the new API */
+    // open audio device
+    //if (audio_already_open == false) {
       audio_already_open = true;
       ret = SDL_OpenAudio(&wanted_specs, &specs);
       //ret = SDL_OpenAudioDevice(NULL, 0, &wanted_specs, &specs, SDL_AUDIO_ALLOW_ANY_CHANGE);
@@ -1232,6 +3255,14 @@ static int stream_component_open(VideoState * videoState, int stream_index)
   }
 
 
+  if (get_probe_profile(videoState) == FFW_PROBE_LIVE_INSTANT &&
+      codecCtx->codec_type == AVMEDIA_TYPE_VIDEO) {
+    // output each frame as soon as it is decoded: no reordering delay and no
+    // frame threading latency
+    codecCtx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    codecCtx->thread_type = FF_THREAD_SLICE;
+  }
+
   // initialize the AVCodecContext to use the given AVCodec
   if (avcodec_open2(codecCtx, codec, NULL) < 0) {
     LOG("Unsupported codec.\n");
@@ -1254,8 +3285,11 @@ static int stream_component_open(VideoState * videoState, int stream_index)
       // zero out the block of memory pointed by videoState->audio_pkt
       memset(&videoState->audio_pkt, 0, sizeof(videoState->audio_pkt));
 
-      // init audio packet queue
-      packet_queue_init(&videoState->audioq);
+      // variable speed: the decoded audio is stretched to it
+      videoState->tempo = tempo_create(codecCtx->sample_rate, codecCtx->channels);
+      if ( ! videoState->tempo) {
+        LOG_W("%s: no audio time stretching, the audio plays at 1x only", videoState->filename);
+      }
 
       // start playing audio on the first audio device
 #ifdef USE_SDL_AUDIO
@@ -1282,12 +3316,16 @@ static int stream_component_open(VideoState * videoState, int stream_index)
 
       // Don't forget to initialize the frame timer and the initial
       // previous frame delay: 1ms = 1e-6s
-      videoState->frame_timer = (double)av_gettime() / 1000000.0;
+      videoState->frame_timer = media_clock_now() / 1000000.0;
       videoState->frame_last_delay = 40e-3;
-      videoState->video_current_pts_time = av_gettime();
 
-      // init video packet queue
-      packet_queue_init(&videoState->videoq);
+      // colour conversion, sliced across cores for large pictures. Created
+      // before the conversion thread, which is its only user.
+      videoState->scaler = scaler_create(0);
+      if ( ! videoState->scaler) {
+        LOG_E("Could not create scaler");
+        return -1;
+      }
 
       // start video thread
       // videoState->video_tid = SDL_CreateThread(video_thread, "Video Thread", videoState);
@@ -1298,18 +3336,18 @@ static int stream_component_open(VideoState * videoState, int stream_index)
                                                  videoState,
                                                  true);         // detached
 
-      // set up the VideoState SWSContext to convert the image data to YUV420
-      videoState->sws_ctx = sws_getContext(videoState->video_ctx->width,
-                                           videoState->video_ctx->height,
-                                           videoState->video_ctx->pix_fmt,
-                                           videoState->video_ctx->width,
-                                           videoState->video_ctx->height,
-                                           AV_VIDEO_FORMAT,
-                                           SWS_BILINEAR,
-                                           NULL,
-                                           NULL,
-                                           NULL
-                                           );
+      // start the conversion stage, fed by the video thread
+      videoState->convert_tid = ffw_create_thread("video_convert_thread",
+                                                  0,                    // stack size
+                                                  20,                   // int priority,
+                                                  video_convert_thread, // void * ( *thread_entry)(void *),
+                                                  videoState,
+                                                  true);                // detached
+      if (videoState->convert_tid == -1) {
+        LOG_E("Could not start the conversion thread");
+        return -1;
+      }
+
       //
 #ifdef USE_SDL_AUDIO
       SDL_GL_SetSwapInterval(1);
@@ -1320,6 +3358,11 @@ static int stream_component_open(VideoState * videoState, int stream_index)
       pthread_mutex_init(&videoState->screen_mutex, NULL);
 
 #ifndef QT_PLATF
+      if (get_compositor(videoState, NULL)) {
+        // the compositor owns the one and only window
+        break;
+      }
+
       // create a window with the specified position, dimensions, and flags.
       videoState->screen = SDL_CreateWindow(
         "FFmpeg SDL Video Player",
@@ -1341,14 +3384,25 @@ static int stream_component_open(VideoState * videoState, int stream_index)
       // create a 2D rendering context for the SDL_Window
       videoState->renderer = SDL_CreateRenderer(videoState->screen, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC | SDL_RENDERER_TARGETTEXTURE);
 
-      // create a texture for a rendering context
-      videoState->texture = SDL_CreateTexture(
+      // create the streaming textures for the rendering context: the ring
+      // converted into, and the one the VideoPicture frames are uploaded into
+      videoState->frame_texture = SDL_CreateTexture(
         videoState->renderer,
         AV_PIXEL_FORMAT,
         SDL_TEXTUREACCESS_STREAMING,
         videoState->video_ctx->width,
         videoState->video_ctx->height
         );
+      videoState->tex_count = videoState->pictq_depth + 1;
+      for (int i = 0; i < videoState->tex_count; i++) {
+        videoState->textures[i] = SDL_CreateTexture(
+          videoState->renderer,
+          AV_PIXEL_FORMAT,
+          SDL_TEXTUREACCESS_STREAMING,
+          videoState->video_ctx->width,
+          videoState->video_ctx->height
+          );
+      }
 #endif
     }
     break;
@@ -1387,6 +3441,10 @@ static void alloc_picture(void * userdata)
     av_free(videoPicture->frame);
   }
 
+  // as decoded, or smaller as the focus profile wants it
+  int width, height;
+  get_picture_size(videoState, &width, &height);
+
   // lock global screen mutex
   pthread_mutex_lock(&videoState->screen_mutex);
 
@@ -1394,8 +3452,8 @@ static void alloc_picture(void * userdata)
   int numBytes;
   numBytes = av_image_get_buffer_size(
     AV_VIDEO_FORMAT,
-    videoState->video_ctx->width,
-    videoState->video_ctx->height,
+    width,
+    height,
     32
     );
 
@@ -1416,17 +3474,19 @@ static void alloc_picture(void * userdata)
     videoPicture->frame->linesize,
     buffer,
     AV_VIDEO_FORMAT,
-    videoState->video_ctx->width,
-    videoState->video_ctx->height,
+    width,
+    height,
     32
     );
 
+  videoPicture->frame->format = AV_VIDEO_FORMAT;
+
   // unlock global screen mutex
   pthread_mutex_unlock(&videoState->screen_mutex);
 
   // update VideoPicture struct fields
-  videoPicture->width = videoState->video_ctx->width;
-  videoPicture->height = videoState->video_ctx->height;
+  videoPicture->width = width;
+  videoPicture->height = height;
   videoPicture->allocated = 1;
 }
 
@@ -1438,16 +3498,21 @@ static void alloc_picture(void * userdata)
  *
  * @param   videoState  the global VideoState reference.
  * @param   pFrame      AVFrame to be inserted in the VideoState->pictq (as an AVPicture).
+ * @param   pts         presentation time of the frame.
+ * @param   serial      seek serial the frame was decoded in.
  *
  * @return              < 0 in case the global quit flag is set, 0 otherwise.
  */
-static int queue_picture(VideoState * videoState, AVFrame * pFrame, double pts)
+static int queue_picture(VideoState * videoState, AVFrame * pFrame, double pts, int serial)
 {
+  int64_t wait_start = av_gettime_relative();
+  int64_t start;
+
   // lock VideoState->pictq mutex
   pthread_mutex_lock(&videoState->pictq_mutex);
 
   // wait until we have space for a new pic in VideoState->pictq
-  while (videoState->pictq_size >= VIDEO_PICTURE_QUEUE_SIZE && !videoState->quit) {
+  while (videoState->pictq_size >= videoState->pictq_depth && !videoState->quit) {
     pthread_cond_wait(&videoState->pictq_cond, &videoState->pictq_mutex);
   }
 
@@ -1459,28 +3524,65 @@ static int queue_picture(VideoState * videoState, AVFrame * pFrame, double pts)
     return -1;
   }
 
+  start = av_gettime_relative();
+  videoState->convert_stats.wait_ms += (start - wait_start) / 1000.0;
+
   // retrieve video picture using the queue write index
   VideoPicture * videoPicture;
   videoPicture = &videoState->pictq[videoState->pictq_windex];
+  videoPicture->serial = serial;
 
-  // if the VideoPicture SDL_Overlay is not allocated or has a different width/height
-  if (!videoPicture->frame ||
-      videoPicture->width != videoState->video_ctx->width ||
-      videoPicture->height != videoState->video_ctx->height) {
-    // set SDL_Overlay not allocated
-    videoPicture->allocated = 0;
-
-    // allocate a new SDL_Overlay for the VideoPicture struct
-    alloc_picture(videoState);
+  // kept for the snapshots once on the screen: a reference, no copy
+  if ( ! videoPicture->source && ! (videoPicture->source = av_frame_alloc())) {
+    LOG("Could not allocate frame.\n");
+    return -1;
+  }
+  av_frame_unref(videoPicture->source);
+  if (av_frame_ref(videoPicture->source, pFrame) < 0) {
+    LOG("Could not reference frame.\n");
+    return -1;
+  }
 
-    // check global quit flag
-    if (videoState->quit) {
+  if (get_compositor(videoState, NULL)) {
+    // the compositor scales the decoded frame straight into its canvas at
+    // display time: just keep a reference, no conversion here.
+    if ( ! videoPicture->decoded && ! (videoPicture->decoded = av_frame_alloc())) {
+      LOG("Could not allocate frame.\n");
       return -1;
     }
-  }
+    av_frame_unref(videoPicture->decoded);
+    if (av_frame_ref(videoPicture->decoded, pFrame) < 0) {
+      LOG("Could not reference frame.\n");
+      return -1;
+    }
+    videoPicture->pts = pts;
+  } else if (convert_to_texture(videoState, pFrame)) {
+    // converted in place: no private frame involved
+    videoPicture->pts = pts;
+  } else {
+    int width, height;
+    get_picture_size(videoState, &width, &height);
+
+    // if the VideoPicture SDL_Overlay is not allocated or has a different width/height
+    // (stream size change, or focus profile switched)
+    if (!videoPicture->frame || videoPicture->width != width || videoPicture->height != height) {
+      // set SDL_Overlay not allocated
+      videoPicture->allocated = 0;
+
+      // allocate a new SDL_Overlay for the VideoPicture struct
+      alloc_picture(videoState);
+
+      // check global quit flag
+      if (videoState->quit) {
+        return -1;
+      }
+    }
+
+    // check the new SDL_Overlay was correctly allocated
+    if (!videoPicture->frame) {
+      return 0;
+    }
 
-  // check the new SDL_Overlay was correctly allocated
-  if (videoPicture->frame) {
     // set pts value for the last decode frame in the VideoPicture queu (pctq)
     videoPicture->pts = pts;
 
@@ -1495,66 +3597,186 @@ static int queue_picture(VideoState * videoState, AVFrame * pFrame, double pts)
     videoPicture->frame->height = pFrame->height;
 
     // scale the image in pFrame->data and put the resulting scaled image in pict->data
-    sws_scale(
-      videoState->sws_ctx,
-      (uint8_t const * const *)pFrame->data,
-      pFrame->linesize,
-      0,
-      videoState->video_ctx->height,
-      videoPicture->frame->data,
-      videoPicture->frame->linesize
-      );
+    scaler_set_colorspace(videoState->scaler, pFrame->colorspace, pFrame->color_range);
+    scaler_set_profile(videoState->scaler, get_scaler_profile(videoState));
+    scaler_convert(videoState->scaler,
+                   (uint8_t const * const *)pFrame->data,
+                   pFrame->linesize,
+                   pFrame->width,
+                   pFrame->height,
+                   pFrame->format,
+                   videoPicture->frame->data,
+                   videoPicture->frame->linesize,
+                   videoPicture->width,
+                   videoPicture->height,
+                   AV_VIDEO_FORMAT);
+
+    pthread_mutex_lock(&videoState->seek_mutex);
+    videoState->focus_stats.picture_width = videoPicture->width;
+    videoState->focus_stats.picture_height = videoPicture->height;
+    pthread_mutex_unlock(&videoState->seek_mutex);
+  }
 
-    // update VideoPicture queue write index
-    ++videoState->pictq_windex;
+  // update VideoPicture queue write index
+  ++videoState->pictq_windex;
 
-    // if the write index has reached the VideoPicture queue size
-    if (videoState->pictq_windex == VIDEO_PICTURE_QUEUE_SIZE) {
-      // set it to 0
-      videoState->pictq_windex = 0;
-    }
+  // if the write index has reached the VideoPicture queue size
+  if (videoState->pictq_windex == videoState->pictq_depth) {
+    // set it to 0
+    videoState->pictq_windex = 0;
+  }
 
-    // lock VideoPicture queue
-    pthread_mutex_lock(&videoState->pictq_mutex);
+  // lock VideoPicture queue
+  pthread_mutex_lock(&videoState->pictq_mutex);
 
-    // increase VideoPicture queue size
-    videoState->pictq_size++;
+  // increase VideoPicture queue size
+  videoState->pictq_size++;
 
-    // unlock VideoPicture queue
-    pthread_mutex_unlock(&videoState->pictq_mutex);
-  }
+  // unlock VideoPicture queue
+  pthread_mutex_unlock(&videoState->pictq_mutex);
+
+  stage_stats_update(&videoState->convert_stats, start);
 
   return 0;
 }
 
 /**
- * This function is used as callback for the SDL_Thread.
+ * SDL output mode: converts the decoded frame straight into the next streaming
+ * texture of the ring.
  *
- * This thread reads in packets from the video queue, packet_queue_get(), decodes
- * the video packets into a frame, and then calls the queue_picture() function to
- * put the processed frame into the picture queue.
+ * SDL calls are made by the render thread only: it locks the idle textures of
+ * the ring after each present and lends them (TEX_LENT) to the conversion,
+ * which only writes into the memory returned by SDL_LockTexture. The texture
+ * stays locked until video_display() unlocks it (uploads) right before
+ * copying it to the screen, see lend_textures().
  *
- * @param   arg the data pointer passed by the thread callback function.
+ * @param   videoState  the global VideoState reference.
+ * @param   pFrame      the decoded frame.
  *
- * @return
+ * @return              true if the picture was converted into a texture, false
+ *                      if the caller has to use the VideoPicture frame instead.
  */
-static void * video_thread(void * arg)
+static bool convert_to_texture(VideoState * videoState, AVFrame * pFrame)
 {
-  // retrieve global VideoState reference
-  VideoState * videoState = (VideoState *)arg;
+#ifdef USE_LOCKED_TEXTURE
+  int idx = videoState->tex_windex;
+  uint8_t * dst[4] = { NULL };
+  int dst_linesize[4] = { 0 };
+  int height = videoState->video_ctx->height;
+  int pitch;
+  bool lent;
+
+  int picture_width, picture_height;
+  get_picture_size(videoState, &picture_width, &picture_height);
+
+  videoState->pictq_texture[videoState->pictq_windex] = 0;
+
+  // window not created yet (or owned by a compositor), or pictures smaller
+  // than the textures wanted by the focus profile
+  if ( ! videoState->textures[idx] || ! videoState->scaler || picture_width != videoState->video_ctx->width ||
+       picture_height != height) {
+    return false;
+  }
 
-  // allocate an AVPacket to be used to retrieve data from the videoq.
-  AVPacket * packet = av_packet_alloc();
+  pthread_mutex_lock(&videoState->tex_mutex);
+  lent = videoState->tex_state[idx] == TEX_LENT;
+  pthread_mutex_unlock(&videoState->tex_mutex);
+  if ( ! lent) {
+    // not given back by the render thread yet (first frames)
+    return false;
+  }
 
-  if (packet == NULL) {
-    LOG("Could not allocate AVPacket.\n");
-    return (void *)-1;
+  pitch = videoState->tex_pitch[idx];
+  dst[0] = videoState->tex_pixels[idx];
+  dst_linesize[0] = pitch;
+#ifndef USE_RGB32
+  // SDL_PIXELFORMAT_YV12: Y plane followed by the V and then the U plane
+  dst_linesize[1] = dst_linesize[2] = pitch / 2;
+  dst[2] = dst[0] + pitch * height;
+  dst[1] = dst[2] + (pitch / 2) * ((height + 1) / 2);
+#endif
+
+  scaler_set_colorspace(videoState->scaler, pFrame->colorspace, pFrame->color_range);
+  scaler_set_profile(videoState->scaler, get_scaler_profile(videoState));
+  if (scaler_convert(videoState->scaler,
+                     (uint8_t const * const *)pFrame->data,
+                     pFrame->linesize,
+                     pFrame->width,
+                     pFrame->height,
+                     pFrame->format,
+                     dst,
+                     dst_linesize,
+                     videoState->video_ctx->width,
+                     height,
+                     AV_VIDEO_FORMAT) < 0) {
+    // still lent: written into again by the next frame
+    return false;
   }
 
-  // set this when we are done decoding an entire frame
-  int frameFinished = 0;
+  pthread_mutex_lock(&videoState->tex_mutex);
+  videoState->tex_state[idx] = TEX_QUEUED;
+  pthread_mutex_unlock(&videoState->tex_mutex);
 
-  // allocate a new AVFrame, used to decode video packets
+  videoState->pictq_texture[videoState->pictq_windex] = idx + 1;
+  videoState->tex_windex = (idx + 1) % videoState->tex_count;
+  return true;
+#else
+  return false;
+#endif // USE_LOCKED_TEXTURE
+}
+
+/**
+ * SDL output mode: locks the idle textures of the ring and lends them to the
+ * conversion, see convert_to_texture(). Render thread, when no picture is
+ * being presented.
+ *
+ * @param   videoState  the global VideoState reference.
+ */
+static void lend_textures(VideoState * videoState)
+{
+#ifdef USE_LOCKED_TEXTURE
+  pthread_mutex_lock(&videoState->tex_mutex);
+  for (int i = 0; i < videoState->tex_count; i++) {
+    if (videoState->textures[i] && videoState->tex_state[i] == TEX_IDLE) {
+      if (SDL_LockTexture(videoState->textures[i], NULL, &videoState->tex_pixels[i], &videoState->tex_pitch[i]) < 0) {
+        LOG_E("SDL_LockTexture: %s", SDL_GetError());
+        continue;
+      }
+      videoState->tex_state[i] = TEX_LENT;
+    }
+  }
+  pthread_mutex_unlock(&videoState->tex_mutex);
+#endif // USE_LOCKED_TEXTURE
+}
+
+/**
+ * This function is used as callback for the SDL_Thread.
+ *
+ * This thread reads in packets from the video queue, packet_queue_get(), decodes
+ * the video packets into a frame, and then hands the frame over to the
+ * conversion stage (video_convert_thread()) through frame_queue_put().
+ *
+ * @param   arg the data pointer passed by the thread callback function.
+ *
+ * @return
+ */
+static void * video_thread(void * arg)
+{
+  // retrieve global VideoState reference
+  VideoState * videoState = (VideoState *)arg;
+
+  // allocate an AVPacket to be used to retrieve data from the videoq.
+  AVPacket * packet = av_packet_alloc();
+
+  if (packet == NULL) {
+    LOG("Could not allocate AVPacket.\n");
+    return (void *)-1;
+  }
+
+  // set this when we are done decoding an entire frame
+  int frameFinished = 0;
+
+  // allocate a new AVFrame, used to decode video packets
   videoState->v_pFrame = av_frame_alloc();
   if (!videoState->v_pFrame) {
     LOG("Could not allocate AVFrame.\n");
@@ -1564,9 +3786,22 @@ static void * video_thread(void * arg)
   // each decoded frame carries its PTS in the VideoPicture queue
   double pts;
 
+  // accurate seek: frames decoded silently on the way to the target
+  double frame_duration = video_frame_duration(videoState);
+  uint64_t skipped = 0;
+  bool seek_frame;
+
+  // hidden: last key frame decoded, shown at once again
+  AVFrame * hidden_frame = av_frame_alloc();
+  double hidden_pts = NAN;
+  if ( ! hidden_frame) {
+    LOG("Could not allocate AVFrame.\n");
+    return (void *)-1;
+  }
+
   for (;;) {
     // get a packet from the video PacketQueue
-    int ret = packet_queue_get(&videoState->videoq, packet, 1);
+    int ret = packet_queue_get(videoState, &videoState->videoq, packet, 1);
     if (ret < 0) {
       // means we quit getting packets
       break;
@@ -1574,13 +3809,95 @@ static void * video_thread(void * arg)
 
     if (packet->data == videoState->flush_pkt.data) {
       avcodec_flush_buffers(videoState->video_ctx);
+      // decoded before the seek: not worth converting
+      frame_queue_flush(videoState);
+      videoState->video_serial = videoState->seek_serial;
+      videoState->video_trick_mode = videoState->trick_mode;
+      videoState->video_step_seek = videoState->step_seek;
+      trick_gop_clear(videoState);
+      // accurate seek: whatever target the previous seek was still decoding
+      // up to is dropped, and with it the discarding of the frames no other
+      // refers to (or a fast seek would never decode them again)
+      videoState->video_ctx->skip_frame = AVDISCARD_DEFAULT;
+      skipped = 0;
+      // visible from here, unless a hide packet follows
+      videoState->video_hidden = false;
+      videoState->video_show_key = false;
+      videoState->video_catch_up = false;
+      av_frame_unref(hidden_frame);
+      if (videoState->video_trick_mode != TRICK_NONE) {
+        // trick play: no seek target, the demuxer queues what is to be shown
+        videoState->video_seek_pts = NAN;
+        continue;
+      }
+      videoState->video_seek_pts = videoState->seek_accurate_pts;
+      if (videoState->frame_cache && frame_cache_seek(videoState, frame_duration) < 0) {
+        break;
+      }
+      continue;
+    }
+
+    if (packet->data == videoState->hide_pkt.data) {
+      // hidden: only key frames come (or nothing at all), none is shown
+      videoState->video_hidden = true;
+      continue;
+    }
+
+    if (packet->data == videoState->show_pkt.data) {
+      // shown again: the video read since the last key frame follows, decoded
+      // silently up to the clock once its key frame is on the screen
+      double clock = get_master_clock(videoState);
+
+      avcodec_flush_buffers(videoState->video_ctx);
+      videoState->video_hidden = false;
+      videoState->video_show_key = true;
+      if (hidden_frame->buf[0]) {
+        // decoded already, while hidden
+        videoState->video_show_key = false;
+        videoState->show_pending = true;
+        clock = isnan(clock) ? hidden_pts + frame_duration : FFMAX(clock, hidden_pts + frame_duration);
+        if (frame_queue_put(videoState, hidden_frame, synchronize_video(videoState, hidden_frame, hidden_pts)) < 0) {
+          break;
+        }
+      }
+      if ( ! isnan(clock) && (isnan(videoState->video_seek_pts) || clock > videoState->video_seek_pts)) {
+        videoState->video_seek_pts = clock;
+        videoState->video_catch_up = true;
+      }
       continue;
     }
 
+    // trick play: after a lone key frame or at the end of a GOP, the decoder
+    // gives out all the frames it holds; so does a hidden one after a key frame
+    bool gop_end = packet->data == videoState->gop_pkt.data;
+    bool hidden = videoState->video_hidden && videoState->video_trick_mode == TRICK_NONE;
+    bool drain = gop_end || hidden || videoState->video_trick_mode == TRICK_KEYFRAMES;
+
+    if ( ! isnan(videoState->video_seek_pts) && ! (videoState->video_step_seek && videoState->frame_cache)) {
+      // accurate seek: the frames no other refers to are not even decoded
+      // before the target (unless stepping backward: they are cached for the
+      // next steps)
+      double packet_time = packet->pts == AV_NOPTS_VALUE ? NAN : packet->pts * av_q2d(videoState->video_st->time_base);
+      videoState->video_ctx->skip_frame =
+        packet_time + frame_duration <= videoState->video_seek_pts + ACCURATE_SEEK_MARGIN ?
+        AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    } else if (isnan(videoState->video_seek_pts) && videoState->video_trick_mode == TRICK_NONE) {
+      // the focus profile may not want the frames no other refers to either,
+      // from the next packet on
+      const ffw_focus_profile_t * profile = get_focus_profile(videoState);
+      videoState->video_ctx->skip_frame = profile && profile->skip_nonref ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    }
+
+    int64_t start = av_gettime_relative();
+
     // give the decoder raw compressed data in an AVPacket
-    ret = avcodec_send_packet(videoState->video_ctx, packet);
+    ret = gop_end ? 0 : avcodec_send_packet(videoState->video_ctx, packet);
+    if (ret >= 0 && drain) {
+      ret = avcodec_send_packet(videoState->video_ctx, NULL);
+    }
     if (ret < 0) {
       LOG("Error sending packet for decoding.\n");
+      stream_cache_check(videoState, NULL);
       return (void *)-1;
     }
 
@@ -1593,9 +3910,11 @@ static void * video_thread(void * arg)
         break;
       } else if (ret < 0) {
         LOG("Error while decoding.\n");
+        stream_cache_check(videoState, NULL);
         return (void *)-1;
       } else {
         frameFinished = 1;
+        stream_cache_check(videoState, videoState->v_pFrame);
       }
 
       // attempt to guess proper monotonic timestamps for decoded video frames
@@ -1609,16 +3928,98 @@ static void * video_thread(void * arg)
 
       pts *= av_q2d(videoState->video_st->time_base);
 
+      if (hidden) {
+        // kept to be shown at once again, for the snapshots and for the seeks back
+        if (videoState->frame_cache) {
+          frame_cache_put(videoState->frame_cache, videoState->v_pFrame, pts, frame_duration);
+        }
+        pthread_mutex_lock(&videoState->snapshot_mutex);
+        if (videoState->shown_frame || (videoState->shown_frame = av_frame_alloc())) {
+          av_frame_unref(videoState->shown_frame);
+          if (av_frame_ref(videoState->shown_frame, videoState->v_pFrame) == 0) {
+            videoState->shown_pts = pts;
+          }
+        }
+        pthread_mutex_unlock(&videoState->snapshot_mutex);
+        av_frame_unref(hidden_frame);
+        av_frame_move_ref(hidden_frame, videoState->v_pFrame);
+        hidden_pts = pts;
+        pthread_mutex_lock(&videoState->seek_mutex);
+        videoState->visibility_stats.keyframes++;
+        pthread_mutex_unlock(&videoState->seek_mutex);
+        continue;
+      }
+
+      seek_frame = false;
+      if (videoState->video_show_key) {
+        // shown again: the key frame goes to the screen whatever the clock
+        videoState->video_show_key = false;
+        videoState->show_pending = true;
+      } else if ( ! isnan(videoState->video_seek_pts)) {
+        if (pts + frame_duration <= videoState->video_seek_pts + ACCURATE_SEEK_MARGIN) {
+          // before the target: neither converted nor shown
+          if (videoState->video_step_seek && videoState->frame_cache) {
+            frame_cache_put(videoState->frame_cache, videoState->v_pFrame, pts, frame_duration);
+          }
+          skipped++;
+          av_frame_unref(videoState->v_pFrame);
+          continue;
+        }
+        // reached: this is the frame the seek presents
+        seek_frame = true;
+        videoState->video_seek_pts = NAN;
+        videoState->video_ctx->skip_frame = AVDISCARD_DEFAULT;
+        pthread_mutex_lock(&videoState->seek_mutex);
+        if (videoState->video_catch_up) {
+          videoState->visibility_stats.catch_up_frames += skipped;
+        } else {
+          videoState->seek_stats.skipped_frames += skipped;
+        }
+        pthread_mutex_unlock(&videoState->seek_mutex);
+        videoState->video_catch_up = false;
+        skipped = 0;
+      }
+
+      // a seek was done while decoding: the flush packet is on its way
+      if (videoState->video_serial != videoState->seek_serial) {
+        av_frame_unref(videoState->v_pFrame);
+        continue;
+      }
+
+      if (videoState->video_trick_mode == TRICK_GOP) {
+        // shown backward once the whole GOP is decoded
+        trick_gop_keep(videoState, videoState->v_pFrame, pts);
+        continue;
+      }
+
       // did we get an entire video frame?
       if (frameFinished) {
+        // what seeks come back to: the key frames and the seek targets
+        if (videoState->frame_cache && (videoState->v_pFrame->key_frame || seek_frame)) {
+          frame_cache_put(videoState->frame_cache, videoState->v_pFrame, pts, frame_duration);
+        }
+
         pts = synchronize_video(videoState, videoState->v_pFrame, pts);
 
-        if (queue_picture(videoState, videoState->v_pFrame, pts) < 0) {
+        stage_stats_update(&videoState->decode_stats, start);
+
+        // hand it over to the conversion stage, blocks while its queue is full
+        if (frame_queue_put(videoState, videoState->v_pFrame, pts) < 0) {
           break;
         }
+        start = av_gettime_relative();
       }
     }
 
+    if (drain) {
+      // out of draining mode, ready for the next packet
+      avcodec_flush_buffers(videoState->video_ctx);
+    }
+    if (gop_end && trick_gop_play(videoState, packet->pts / (double) AV_TIME_BASE,
+                                  packet->dts / (double) AV_TIME_BASE) < 0) {
+      break;
+    }
+
     // wipe the packet
     av_packet_unref(packet);
   }
@@ -1626,10 +4027,83 @@ static void * video_thread(void * arg)
   // wipe the frame
   av_frame_free(&videoState->v_pFrame);
   av_free(videoState->v_pFrame);
+  av_frame_free(&hidden_frame);
+  trick_gop_clear(videoState);
+  for (int i = 0; i < TRICK_GOP_MAX_FRAMES; i++) {
+    av_frame_free(&videoState->gop_frames[i]);
+  }
+
+  // filled and searched by this thread only, no more seeks to serve from it;
+  // a snapshot or a stats request may still be looking into it
+  pthread_mutex_lock(&videoState->frame_cache_mutex);
+  frame_cache_destroy(videoState->frame_cache);
+  videoState->frame_cache = NULL;
+  pthread_mutex_unlock(&videoState->frame_cache_mutex);
 
   return 0;
 }
 
+/**
+ * Conversion stage: takes the decoded frames queued by video_thread(), converts
+ * them (queue_picture()) and puts them into the VideoPicture queue. Runs on its
+ * own core so the decoder never waits for the colour conversion.
+ *
+ * @param   arg the global VideoState reference.
+ */
+static void * video_convert_thread(void * arg)
+{
+  VideoState * videoState = (VideoState *) arg;
+  AVFrame * frame = av_frame_alloc();
+  double pts;
+  int serial;
+
+  if ( ! frame) {
+    LOG("Could not allocate AVFrame.\n");
+    return NULL;
+  }
+
+  while (frame_queue_get(videoState, frame, &pts, &serial) == 0) {
+    if (serial != videoState->seek_serial) {
+      // from before a seek: not worth converting
+      av_frame_unref(frame);
+      continue;
+    }
+    if (videoState->speed > 1 && frame_late(videoState, pts)) {
+      // faster than normal and behind the master clock already: dropped
+      // before the conversion, the refresher shows the next one instead
+      av_frame_unref(frame);
+      pthread_mutex_lock(&videoState->seek_mutex);
+      videoState->trick_stats.dropped_frames++;
+      pthread_mutex_unlock(&videoState->seek_mutex);
+      continue;
+    }
+    if (focus_fps_capped(videoState, pts)) {
+      // too soon after the previous one for the focus profile
+      av_frame_unref(frame);
+      pthread_mutex_lock(&videoState->seek_mutex);
+      videoState->focus_stats.capped_frames++;
+      pthread_mutex_unlock(&videoState->seek_mutex);
+      continue;
+    }
+    int ret = queue_picture(videoState, frame, pts, serial);
+    av_frame_unref(frame);
+    if (ret < 0) {
+      break;
+    }
+  }
+
+  av_frame_free(&frame);
+
+  // the conversions were done by this thread: only ffw_get_stats() may still
+  // be reading the stats of the scaler
+  pthread_mutex_lock(&videoState->scaler_mutex);
+  scaler_destroy(videoState->scaler);
+  videoState->scaler = NULL;
+  pthread_mutex_unlock(&videoState->scaler_mutex);
+
+  return NULL;
+}
+
 /**
  * Attempts to guess proper monotonic timestamps for decoded video frames which
  * might have incorrect times.
@@ -1816,9 +4290,9 @@ static int synchronize_audio(VideoState * videoState, short * samples, int sampl
 
 /**
  * Pulls from the VideoPicture queue when we have something, sets our timer for
- * when the next video frame should be shown, calls the video_display() method to
- * actually show the video on the screen, then decrements the counter on the queue,
- * and decreases its size.
+ * when the next video frame should be shown and hands the picture over to
+ * video_render_thread(), which actually shows it on the screen, then decrements
+ * the counter on the queue and decreases its size.
  *
  * @param   userdata    SDL_UserEvent->data1;   User defined data pointer.
  */
@@ -1838,6 +4312,9 @@ static void video_refresher(void * userdata)
   double sync_threshold;
   double real_delay;
   double audio_video_delay;
+  double last_present;
+  double present_latency;
+  int64_t now = media_clock_now(); // one time reference for the whole refresh
 
   // check the video stream was correctly opened
   if (videoState->video_st) {
@@ -1845,11 +4322,56 @@ static void video_refresher(void * userdata)
     if (videoState->pictq_size == 0) {
       //LOG_E("\n!!!videoState->pictq_size == 0!!!\n");
 
+      schedule_refresh(videoState, 1);
+    } else if (videoState->render_pending) {
+      // the render thread is still presenting the previous picture
       schedule_refresh(videoState, 1);
     } else {
       // get VideoPicture reference using the queue read index
       videoPicture = &videoState->pictq[videoState->pictq_rindex];
 
+      if (videoPicture->serial != videoState->seek_serial) {
+        // converted just before a seek went through
+        pictq_drop(videoState);
+        schedule_refresh(videoState, 1);
+        return;
+      }
+
+      if (videoState->paused && ! videoState->step_show) {
+        // converted while stepping, shown on the next step or on resume
+        schedule_refresh(videoState, 1);
+        return;
+      }
+
+      if (videoState->fast_start_pending || videoPicture->serial != videoState->frame_serial ||
+          videoState->trick_mode == TRICK_KEYFRAMES || videoState->step_show || videoState->show_pending) {
+        // fast start, first picture after a seek, key frame trick play (the
+        // demuxer paces the key frames), frame step or shown again: it goes
+        // to the screen right away, the frame timer and the A/V sync start
+        // from it
+        if (videoState->show_pending) {
+          videoState->show_pending = false;
+          pthread_mutex_lock(&videoState->seek_mutex);
+          if (videoState->show_req_time) {
+            videoState->visibility_stats.last_show_ms = (now - videoState->show_req_time) / 1000.0;
+            videoState->show_req_time = 0;
+          }
+          pthread_mutex_unlock(&videoState->seek_mutex);
+        }
+        if (videoState->step_show) {
+          pthread_mutex_lock(&videoState->pause_mutex);
+          videoState->step_show--;
+          pthread_mutex_unlock(&videoState->pause_mutex);
+        }
+        videoState->fast_start_pending = false;
+        videoState->frame_serial = videoPicture->serial;
+        videoState->frame_last_pts = videoPicture->pts;
+        videoState->frame_timer = media_clock_now() / 1000000.0;
+        schedule_refresh(videoState, (Uint32)(videoState->frame_last_delay * 1000 + 0.5));
+        render_handoff(videoState);
+        return;
+      }
+
       if (_DEBUG_) {
         LOG("Current Frame PTS:\t\t%f\n", videoPicture->pts);
         LOG("Last Frame PTS:\t\t\t%f\n",  videoState->frame_last_pts);
@@ -1858,6 +4380,11 @@ static void video_refresher(void * userdata)
       // get last frame pts
       pts_delay = videoPicture->pts - videoState->frame_last_pts;
 
+      if (videoState->speed != 1) {
+        // as far apart as in the stream (backward too), at the playback speed
+        pts_delay = fabs(pts_delay) / fabs(videoState->speed);
+      }
+
       if (_DEBUG_) {
         LOG("PTS Delay:\t\t\t\t%f\n", pts_delay);
       }
@@ -1876,10 +4403,21 @@ static void video_refresher(void * userdata)
       videoState->frame_last_delay = pts_delay;
       videoState->frame_last_pts = videoPicture->pts;
 
-      // in case the external clock is not used
-      if (videoState->av_sync_type != AV_SYNC_VIDEO_MASTER) {
-        // update delay to stay in sync with the master clock: audio or video
-        audio_ref_clock = get_master_clock(videoState);
+      // the external clock starts from the video and is put back on it when
+      // the stream drifted too far from the local time (live sources)
+      if (videoState->av_sync_type == AV_SYNC_EXTERNAL_MASTER) {
+        double ext = media_clock_get_at(&videoState->ext_clk, now);
+        if (isnan(ext) || fabs(ext - videoPicture->pts) > AV_NOSYNC_THRESHOLD) {
+          media_clock_set_at(&videoState->ext_clk, videoPicture->pts, now);
+        }
+      }
+
+      // in case the external clock is not used (and not in trick play: the
+      // audio is muted, nothing to stay in sync with)
+      if (videoState->av_sync_type != AV_SYNC_VIDEO_MASTER && videoState->trick_mode == TRICK_NONE) {
+        // update delay to stay in sync with the master clock: audio or
+        // external (NAN until the audio plays: no correction)
+        audio_ref_clock = get_master_clock_at(videoState, now);
 
         if (_DEBUG_) {
           LOG("Ref Clock:\t\t\t\t%f\n", audio_ref_clock);
@@ -1913,10 +4451,23 @@ static void video_refresher(void * userdata)
         LOG("Corrected PTS delay:\t%f\n", pts_delay);
       }
 
+      // both written by the render thread
+      pthread_mutex_lock(&videoState->render_mutex);
+      last_present = videoState->frame_last_present;
+      present_latency = videoState->present_latency;
+      pthread_mutex_unlock(&videoState->render_mutex);
+
+      // the previous frame reached the screen much later than this one was
+      // due: restart pacing from there instead of rushing to catch up
+      if (last_present > videoState->frame_timer + AV_SYNC_THRESHOLD_MAX) {
+        videoState->frame_timer = last_present;
+      }
+
       videoState->frame_timer += pts_delay;
 
-      // compute the real delay
-      real_delay = videoState->frame_timer - (av_gettime() / 1000000.0);
+      // compute the real delay, handing the next picture over early enough to
+      // reach the screen in time
+      real_delay = videoState->frame_timer - (now / 1000000.0) - present_latency;
 
       if (_DEBUG_) {
         LOG("Real Delay:\t\t\t\t%f\n", real_delay);
@@ -1936,25 +4487,7 @@ static void video_refresher(void * userdata)
         LOG("Next Scheduled Refresh:\t%f\n\n", (real_delay * 1000 + 0.5));
       }
 
-      // show the frame on the SDL_Surface (the screen)
-      video_display(videoState);
-
-      // update read index for the next frame
-      if (++videoState->pictq_rindex == VIDEO_PICTURE_QUEUE_SIZE) {
-        videoState->pictq_rindex = 0;
-      }
-
-      // lock VideoPicture queue mutex
-      pthread_mutex_lock(&videoState->pictq_mutex);
-
-      // decrease VideoPicture queue size
-      videoState->pictq_size--;
-
-      // notify other threads waiting for the VideoPicture queue
-      pthread_cond_signal(&videoState->pictq_cond);
-
-      // unlock VideoPicture queue mutex
-      pthread_mutex_unlock(&videoState->pictq_mutex);
+      render_handoff(videoState);
     }
   } else {
     schedule_refresh(videoState, 100);
@@ -1962,59 +4495,100 @@ static void video_refresher(void * userdata)
 }
 
 /**
- * Calculates and returns the current audio clock reference value.
+ * Hands the picture at the read index of the VideoPicture queue over to the
+ * render thread to show it on the screen.
  *
  * @param   videoState  the global VideoState reference.
+ */
+static void render_handoff(VideoState * videoState)
+{
+  pthread_mutex_lock(&videoState->render_mutex);
+  videoState->render_handoff_time = media_clock_now() / 1000000.0;
+  videoState->render_pending = true;
+  pthread_cond_signal(&videoState->render_cond);
+  pthread_mutex_unlock(&videoState->render_mutex);
+}
+
+/**
+ * Initializes the audio, video and external clocks: none of them is set.
  *
- * @return              the current audio clock reference value.
+ * @param   videoState  the global VideoState reference.
  */
-static double get_audio_clock(VideoState * videoState)
+static void sync_clocks_init(VideoState * videoState)
+{
+  media_clock_init(&videoState->audio_clk);
+  media_clock_init(&videoState->video_clk);
+  media_clock_init(&videoState->ext_clk);
+}
+
+/**
+ * Sets the audio clock from the audio just handed to the device: the pts at
+ * the end of the audio buffer minus what is still left in it.
+ *
+ * @param   videoState  the global VideoState reference.
+ */
+static void set_audio_clock(VideoState * videoState)
 {
   double pts = videoState->audio_clock;
 
   int hw_buf_size = videoState->audio_buf_size - videoState->audio_buf_index;
 
-  int bytes_per_sec = 0;
-
   int n = 2 * videoState->audio_ctx->channels;
-
-  if (videoState->audio_st) {
-    bytes_per_sec = videoState->audio_ctx->sample_rate * n;
+  int bytes_per_sec = n * videoState->audio_ctx->sample_rate;
+
+  if (videoState->tempo && tempo_get_rate(videoState->tempo) != 1.0) {
+    // stretched: the time stretcher knows where what is still buffered was
+    // copied from
+    pts -= tempo_delay(videoState->tempo, hw_buf_size / n);
+  } else if (bytes_per_sec) {
+    // what is still buffered plays at the playback speed
+    pts -= (double)hw_buf_size / bytes_per_sec * videoState->speed;
   }
 
-  if (bytes_per_sec) {
-    pts -= (double)hw_buf_size / bytes_per_sec;
+  media_clock_set(&videoState->audio_clk, pts);
+}
+
+/**
+ * Calculates and returns the current audio clock reference value.
+ *
+ * @param   videoState  the global VideoState reference.
+ *
+ * @return              the current audio clock reference value, NAN until
+ *                      the audio plays.
+ */
+static double get_audio_clock(VideoState * videoState)
+{
+  // no audio playing: the video is the only clock there is
+  if ( ! videoState->audio_st || ! videoState->audio_ctx) {
+    return get_video_clock(videoState);
   }
 
-  return pts;
+  return media_clock_get(&videoState->audio_clk);
 }
 
 /**
- * Calculates and returns the current video clock reference value.
+ * Calculates and returns the current video clock reference value: the pts of
+ * the picture on the screen, running from the time it got there.
  *
  * @param   videoState  the global VideoState reference.
  *
- * @return              the current video clock reference value.
+ * @return              the current video clock reference value, NAN until
+ *                      the first picture is shown.
  */
 static double get_video_clock(VideoState * videoState)
 {
-  double delta = (av_gettime() - videoState->video_current_pts_time) / 1000000.0;
-
-  return videoState->video_current_pts + delta;
+  return media_clock_get(&videoState->video_clk);
 }
 
 /**
- * Calculates and returns the current external clock reference value: the computer
- * clock.
+ * Calculates and returns the current external clock reference value: the
+ * monotonic time, in the stream time base (started from the video).
  *
  * @return  the current external clock reference value.
  */
 static double get_external_clock(VideoState * videoState)
 {
-  videoState->external_clock_time = av_gettime();
-  videoState->external_clock = videoState->external_clock_time / 1000000.0;
-
-  return videoState->external_clock;
+  return media_clock_get(&videoState->ext_clk);
 }
 
 /**
@@ -2026,90 +4600,360 @@ static double get_external_clock(VideoState * videoState)
  * @return              the reference clock according to the chosen AV sync type.
  */
 static double get_master_clock(VideoState * videoState)
+{
+  return get_master_clock_at(videoState, media_clock_now());
+}
+
+/**
+ * get_master_clock() at a given time (media_clock_now()), so a caller reading
+ * the time itself reads the clock at the same point.
+ *
+ * @param   videoState  the global VideoState reference.
+ * @param   now         media_clock_now() value.
+ *
+ * @return              the reference clock according to the chosen AV sync type.
+ */
+static double get_master_clock_at(VideoState * videoState, int64_t now)
 {
   if (videoState->av_sync_type == AV_SYNC_VIDEO_MASTER) {
-    return get_video_clock(videoState);
+    return media_clock_get_at(&videoState->video_clk, now);
   } else if (videoState->av_sync_type == AV_SYNC_AUDIO_MASTER) {
-    return get_audio_clock(videoState);
+    if ( ! videoState->audio_st || ! videoState->audio_ctx) {
+      return media_clock_get_at(&videoState->video_clk, now);
+    }
+    return media_clock_get_at(&videoState->audio_clk, now);
   } else if (videoState->av_sync_type == AV_SYNC_EXTERNAL_MASTER) {
-    return get_external_clock(videoState);
+    return media_clock_get_at(&videoState->ext_clk, now);
   } else {
     LOG_E("Error: Undefined A/V sync type.");
     return -1;
   }
 }
 
-void * video_timer_thread(void * arg)
+/**
+ * Presents the pictures handed over by video_refresher(). This is the only
+ * thread blocking on SDL_RenderPresent (vsync) and polling SDL events; the
+ * time a frame actually reached the screen is fed back to the refresher and
+ * to the video clock.
+ *
+ * @param   arg the global VideoState reference.
+ */
+static void * video_render_thread(void * arg)
 {
   VideoState * videoState = (VideoState *) arg;
+  VideoPicture * videoPicture;
+  double present_time;
 
-  while(1) {
-    if (global_video_state->quit) {
+  for (;;) {
+    // the textures unlocked by the last present go back to the conversion
+    lend_textures(videoState);
+
+    pthread_mutex_lock(&videoState->render_mutex);
+    while ( ! videoState->render_pending && ! videoState->quit) {
+      pthread_cond_wait(&videoState->render_cond, &videoState->render_mutex);
+    }
+    pthread_mutex_unlock(&videoState->render_mutex);
+
+    if (videoState->quit) {
       break;
     }
-    if (videoState->video_timer_delay == 0) {
-      usleep(1000);
-      //continue;
+
+    videoPicture = &videoState->pictq[videoState->pictq_rindex];
+
+    // show the frame on the SDL_Surface (the screen), may block until vsync
+    video_display(videoState);
+
+    if ( ! videoState->first_frame_shown) {
+      videoState->first_frame_shown = true;
+      notify_first_frame(videoState);
     }
-    
-    usleep(videoState->video_timer_delay * 1000);
-    video_refresher(videoState); 
+
+    present_time = media_clock_now() / 1000000.0;
+    pthread_mutex_lock(&videoState->render_mutex);
+    videoState->present_latency = 0.9 * videoState->present_latency +
+                                  0.1 * (present_time - videoState->render_handoff_time);
+    videoState->frame_last_present = present_time;
+    pthread_mutex_unlock(&videoState->render_mutex);
+
+    // the video clock follows what is on the screen
+    media_clock_set_at(&videoState->video_clk, videoPicture->pts, (int64_t) (present_time * 1000000.0));
+
+    // and so do the snapshots
+    pthread_mutex_lock(&videoState->snapshot_mutex);
+    if (videoState->shown_frame || (videoState->shown_frame = av_frame_alloc())) {
+      av_frame_unref(videoState->shown_frame);
+      av_frame_move_ref(videoState->shown_frame, videoPicture->source);
+      videoState->shown_pts = videoPicture->pts;
+    }
+    pthread_mutex_unlock(&videoState->snapshot_mutex);
+
+    if (videoPicture->serial == videoState->seek_serial) {
+      seek_shown(videoState, (int64_t) (present_time * 1000000.0), videoPicture->pts);
+    }
+
+    pictq_advance(videoState);
+
+    pthread_mutex_lock(&videoState->render_mutex);
+    videoState->render_pending = false;
+    pthread_mutex_unlock(&videoState->render_mutex);
   }
+
+  return NULL;
 }
 
 /**
- * Schedules video updates - every time we call this function, it will set the
- * timer, which will trigger an event, which will have our main() function in turn
- * call a function that pulls a frame from our picture queue and displays it.
+ * Releases the picture at the read index of the VideoPicture queue, shown or
+ * not, and wakes up the conversion stage waiting for room.
  *
  * @param   videoState  the global VideoState reference.
- * @param   delay       the delay, expressed in milliseconds, before displaying
- *                      the next video frame on the screen.
  */
-static void schedule_refresh(VideoState * videoState, Uint32 delay)
+static void pictq_advance(VideoState * videoState)
 {
-#if 1
-  videoState->video_timer_delay = delay;
-  if (videoState->video_timer_tid == -1) {
-    videoState->video_timer_tid = ffw_create_thread(
-      "format_demux_thread",                                  // name
-      0,                                                      // stack size
-      20,                                                     // int priority,
-      video_timer_thread,                                     // void * ( *thread_entry)(void *),
-      videoState,
-      true);                                                  // detached
+  // update read index for the next frame
+  if (++videoState->pictq_rindex == videoState->pictq_depth) {
+    videoState->pictq_rindex = 0;
   }
 
-#else
-  // schedule an SDL timer
-  int ret = SDL_AddTimer(delay, sdl_refresh_timer_cb, videoState);
+  // lock VideoPicture queue mutex
+  pthread_mutex_lock(&videoState->pictq_mutex);
 
-  // check the timer was correctly scheduled
-  if (ret == 0) {
-    LOG("Could not schedule refresh callback: %s.\n.", SDL_GetError());
-  }
-#endif
+  // decrease VideoPicture queue size
+  videoState->pictq_size--;
+
+  // notify other threads waiting for the VideoPicture queue
+  pthread_cond_signal(&videoState->pictq_cond);
+
+  // unlock VideoPicture queue mutex
+  pthread_mutex_unlock(&videoState->pictq_mutex);
 }
 
 /**
- * This is the callback function for the SDL Timer.
- *
- * Pushes an SDL_Event of type FF_REFRESH_EVENT to the events queue.
- *
- * @param   interval    the timer delay in milliseconds.
- * @param   param       user defined data passed to the callback function when
- *                      scheduling the timer. In our case the global VideoState
- *                      reference.
+ * Drops the picture at the read index without showing it (stale after a
+ * seek). Only called while no picture is handed to the render thread.
  *
- * @return              if the returned value from the callback is 0, the timer
- *                      is canceled.
+ * @param   videoState  the global VideoState reference.
  */
-static Uint32 sdl_refresh_timer_cb(Uint32 interval, void * param)
+static void pictq_drop(VideoState * videoState)
 {
-  // create an SDL_Event of type FF_REFRESH_EVENT
-  SDL_Event event;
-
-  event.type = FF_REFRESH_EVENT;
+  VideoPicture * videoPicture = &videoState->pictq[videoState->pictq_rindex];
+  int tex = videoState->pictq_texture[videoState->pictq_rindex];
+
+  if (tex) {
+    // converted in place: still locked, lent to the conversion again
+    pthread_mutex_lock(&videoState->tex_mutex);
+    videoState->tex_state[tex - 1] = TEX_LENT;
+    pthread_mutex_unlock(&videoState->tex_mutex);
+    videoState->pictq_texture[videoState->pictq_rindex] = 0;
+  }
+  if (videoPicture->decoded) {
+    av_frame_unref(videoPicture->decoded);
+  }
+  if (videoPicture->source) {
+    av_frame_unref(videoPicture->source);
+  }
+
+  pictq_advance(videoState);
+}
+
+/**
+ * Serves a seek from the frame cache: the cached frame showing at the target
+ * goes to the screen right away, the decoder then skips silently up to the
+ * frame after it. Video thread, on the flush packet of the seek.
+ *
+ * @param   videoState      the global VideoState reference.
+ * @param   frame_duration  nominal duration of a frame.
+ *
+ * @return                  1 if served, 0 if not, < 0 in case the global quit flag is set.
+ */
+static int frame_cache_seek(VideoState * videoState, double frame_duration)
+{
+  AVFrame * frame = av_frame_alloc();
+  double pts;
+  int ret = 0;
+  double distance = isnan(videoState->seek_accurate_pts) ? FAST_SEEK_CACHE_DISTANCE : 0;
+
+  if ( ! frame) {
+    return 0;
+  }
+  if (frame_cache_get(videoState->frame_cache, videoState->seek_target_pts, distance, frame, &pts)) {
+    videoState->video_seek_pts = pts + frame_duration;
+    pts = synchronize_video(videoState, frame, pts);
+    ret = frame_queue_put(videoState, frame, pts) < 0 ? -1 : 1;
+  }
+  av_frame_free(&frame);
+  return ret;
+}
+
+/**
+ * Nominal duration of a video frame, from the frame rate of the stream.
+ *
+ * @param   videoState  the global VideoState reference.
+ *
+ * @return              seconds.
+ */
+static double video_frame_duration(VideoState * videoState)
+{
+  AVRational rate = av_guess_frame_rate(videoState->pFormatCtx, videoState->video_st, NULL);
+
+  return rate.num && rate.den ? av_q2d(av_inv_q(rate)) : DEFAULT_FRAME_DURATION;
+}
+
+/**
+ * True if a video frame is due since more than AV_SYNC_THRESHOLD_MAX by the
+ * master clock (not a discontinuity though, see AV_NOSYNC_THRESHOLD).
+ *
+ * @param   videoState  the global VideoState reference.
+ * @param   pts         presentation time of the frame.
+ */
+static bool frame_late(VideoState * videoState, double pts)
+{
+  double late = get_master_clock(videoState) - pts;
+
+  return late > AV_SYNC_THRESHOLD_MAX && late < AV_NOSYNC_THRESHOLD;
+}
+
+/**
+ * Accounts the seek-to-display latency once the first picture of the latest
+ * seek is on the screen.
+ *
+ * @param   videoState  the global VideoState reference.
+ * @param   now         when the picture was presented, media_clock_now() units.
+ * @param   pts         presentation time of the picture.
+ */
+static void seek_shown(VideoState * videoState, int64_t now, double pts)
+{
+  ffw_seek_stats_t * stats = &videoState->seek_stats;
+
+  pthread_mutex_lock(&videoState->seek_mutex);
+  if (videoState->seek_shown_req_time) {
+    stats->last_ms = (now - videoState->seek_shown_req_time) / 1000.0;
+    stats->avg_ms = stats->avg_ms > 0 ? stats->avg_ms * (1.0 - STAGE_AVG_WEIGHT) + stats->last_ms * STAGE_AVG_WEIGHT :
+                                        stats->last_ms;
+    stats->last_error_ms = (pts - videoState->seek_shown_target) * 1000.0;
+    stats->shown++;
+    videoState->seek_shown_req_time = 0;
+    LOG_I("%s: seek shown in %.1f ms, %+.0f ms from the target", videoState->filename, stats->last_ms,
+          stats->last_error_ms);
+  }
+  pthread_mutex_unlock(&videoState->seek_mutex);
+}
+
+/**
+ * Reports the time to first frame (creation to first picture on the screen)
+ * with a MSG_ID__FIRST_FRAME to the parent message thread.
+ *
+ * @param   videoState  the global VideoState reference.
+ */
+static void notify_first_frame(VideoState * videoState)
+{
+  ffwplayer_t * ffw = videoState->parent_ffw;
+  msg_t msg;
+
+  if ( ! ffw) {
+    return;
+  }
+
+  ffw->startup.first_frame_ms = (av_gettime_relative() - ffw->created_time) / 1000.0;
+  LOG_I("%s: first frame after %.0f ms (queued %.0f, probe %.0f, ready %.0f)", ffw->url,
+        ffw->startup.first_frame_ms, ffw->startup.queued_ms, ffw->startup.probe_ms, ffw->startup.ready_ms);
+
+  if (ffw->parent_msg_th) {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_id = MSG_ID__FIRST_FRAME;
+    msg.v_int = (int) ffw->startup.first_frame_ms;
+    msg.v_ptr_1 = ffw;
+    msg.v_ptr_2 = ffw->client_data;
+    if ( ! post_msg(NULL, ffw->parent_msg_th, &msg)) {
+      LOG_E("%s: could not post the first frame", ffw->url);
+    }
+  }
+}
+
+void * video_timer_thread(void * arg)
+{
+  VideoState * videoState = (VideoState *) arg;
+
+  while(1) {
+    if (videoState->quit) {
+      break;
+    }
+    int64_t paused_us = pause_wait(videoState, PAUSE_WAKE_STEP);
+    if (paused_us) {
+      // the frames were not late by the time spent paused
+      videoState->frame_timer += paused_us / 1000000.0;
+      continue;
+    }
+    if (videoState->video_timer_delay == 0) {
+      usleep(1000);
+      //continue;
+    }
+    
+    usleep(videoState->video_timer_delay * 1000);
+    video_refresher(videoState); 
+  }
+}
+
+/**
+ * Schedules video updates - every time we call this function, it will set the
+ * timer, which will trigger an event, which will have our main() function in turn
+ * call a function that pulls a frame from our picture queue and displays it.
+ *
+ * @param   videoState  the global VideoState reference.
+ * @param   delay       the delay, expressed in milliseconds, before displaying
+ *                      the next video frame on the screen.
+ */
+static void schedule_refresh(VideoState * videoState, Uint32 delay)
+{
+#if 1
+  videoState->video_timer_delay = delay;
+  if (videoState->video_timer_tid == -1) {
+    videoState->render_tid = ffw_create_thread(
+      "video_render_thread",                                  // name
+      0,                                                      // stack size
+      20,                                                     // int priority,
+      video_render_thread,                                    // void * ( *thread_entry)(void *),
+      videoState,
+      true);                                                  // detached
+
+    videoState->video_timer_tid = ffw_create_thread(
+      "video_timer_thread",                                  // name
+      0,                                                      // stack size
+      20,                                                     // int priority,
+      video_timer_thread,                                     // void * ( *thread_entry)(void *),
+      videoState,
+      true);                                                  // detached
+  }
+
+#else
+  // schedule an SDL timer
+  int ret = SDL_AddTimer(delay, sdl_refresh_timer_cb, videoState);
+
+  // check the timer was correctly scheduled
+  if (ret == 0) {
+    LOG("Could not schedule refresh callback: %s.\n.", SDL_GetError());
+  }
+#endif
+}
+
+/**
+ * This is the callback function for the SDL Timer.
+ *
+ * Pushes an SDL_Event of type FF_REFRESH_EVENT to the events queue.
+ *
+ * @param   interval    the timer delay in milliseconds.
+ * @param   param       user defined data passed to the callback function when
+ *                      scheduling the timer. In our case the global VideoState
+ *                      reference.
+ *
+ * @return              if the returned value from the callback is 0, the timer
+ *                      is canceled.
+ */
+static Uint32 sdl_refresh_timer_cb(Uint32 interval, void * param)
+{
+  // create an SDL_Event of type FF_REFRESH_EVENT
+  SDL_Event event;
+
+  event.type = FF_REFRESH_EVENT;
   event.user.data1 = param;
 
   // push the event to the events queue
@@ -2139,7 +4983,31 @@ static void video_display(VideoState * videoState)
   // get next VideoPicture to be displayed from the VideoPicture queue
   videoPicture = &videoState->pictq[videoState->pictq_rindex];
 
-  if (videoPicture->frame) {
+  int cell;
+  compositor_h comp = get_compositor(videoState, &cell);
+  if (comp) {
+    compositor_set_cell_profile(comp, cell, get_scaler_profile(videoState));
+  }
+
+  if (videoPicture->decoded && videoPicture->decoded->data[0]) {
+    // queued for the compositor: scale it straight into the canvas cell.
+    // If the compositor was detached in the meantime this one frame is dropped.
+    if (comp) {
+      compositor_draw(comp, cell, videoPicture->decoded);
+    }
+    av_frame_unref(videoPicture->decoded);
+    return;
+  }
+
+  if (comp) {
+    // compositor attached after this frame was converted
+    if (videoPicture->frame) {
+      compositor_draw(comp, cell, videoPicture->frame);
+    }
+    return;
+  }
+
+  if (videoPicture->frame || videoState->pictq_texture[videoState->pictq_rindex]) {
     if (videoState->video_ctx->sample_aspect_ratio.num == 0) {
       aspect_ratio = 0;
     } else {
@@ -2158,6 +5026,11 @@ static void video_display(VideoState * videoState)
 #ifdef QT_PLATF
     update_picture_widget(videoState->parent_ffw, videoPicture);
 #else
+    if ( ! videoState->renderer) {
+      // no window of its own: the player was opened for a compositor
+      return;
+    }
+
     // MV: work around to get window resize updating its internal width and heigth
     SDL_Event ev;
     while(SDL_PollEvent(&ev)) { /* summy */ }
@@ -2188,7 +5061,7 @@ static void video_display(VideoState * videoState)
     if ((videoState->maxFramesToDecode == 0) || 
       (videoState->currentFrameIndex < videoState->maxFramesToDecode)) {
 //    if (videoState->currentFrameIndex < videoState->maxFramesToDecode) {
-      if (_DEBUG_) {
+      if (_DEBUG_ && videoPicture->frame) {
         // dump information about the frame being rendered
         printf(
           "Frame %c (%d) pts %" PRId64 " dts %" PRId64 " key_frame %d [coded_picture_number %d, display_picture_number %d, %dx%d]\n",
@@ -2207,8 +5080,9 @@ static void video_display(VideoState * videoState)
       SDL_Rect rect_picture;
       rect_picture.x = 0;
       rect_picture.y = 0;
-      rect_picture.w = videoState->video_ctx->width;
-      rect_picture.h = videoState->video_ctx->height;
+      rect_picture.w = videoPicture->frame ? videoPicture->width : videoState->video_ctx->width;
+      rect_picture.h = videoPicture->frame ? videoPicture->height : videoState->video_ctx->height;
+      SDL_Rect * rect_source = NULL;
 
 
       SDL_Rect rect_win;
@@ -2227,30 +5101,47 @@ static void video_display(VideoState * videoState)
       // lock screen mutex
       pthread_mutex_lock(&videoState->screen_mutex);
 
-      // update the texture with the new pixel data
+      SDL_Texture * texture;
+      int tex = videoState->pictq_texture[videoState->pictq_rindex];
+      if (tex) {
+        // converted in place by the conversion thread: unlocking uploads it
+        texture = videoState->textures[tex - 1];
+        SDL_UnlockTexture(texture);
+        pthread_mutex_lock(&videoState->tex_mutex);
+        videoState->tex_state[tex - 1] = TEX_IDLE;
+        pthread_mutex_unlock(&videoState->tex_mutex);
+        videoState->pictq_texture[videoState->pictq_rindex] = 0;
+      } else {
+        texture = videoState->frame_texture;
+        // smaller than the texture when the focus profile says so
+        rect_source = &rect_picture;
+
+        // update the texture with the new pixel data
 #ifdef USE_RGB32
-      SDL_UpdateTexture(
-        videoState->texture,
-        &rect_picture, // &rect,
-        videoPicture->frame->data[0],
-        *videoPicture->frame->linesize);
+        SDL_UpdateTexture(
+          texture,
+          &rect_picture, // &rect,
+          videoPicture->frame->data[0],
+          *videoPicture->frame->linesize);
 #else
-      SDL_UpdateYUVTexture(
-        videoState->texture,
-        &rect_picture, // &rect,
-        videoPicture->frame->data[0],
-        videoPicture->frame->linesize[0],
-        videoPicture->frame->data[1],
-        videoPicture->frame->linesize[1],
-        videoPicture->frame->data[2],
-        videoPicture->frame->linesize[2]
-        );
+        SDL_UpdateYUVTexture(
+          texture,
+          &rect_picture, // &rect,
+          videoPicture->frame->data[0],
+          videoPicture->frame->linesize[0],
+          videoPicture->frame->data[1],
+          videoPicture->frame->linesize[1],
+          videoPicture->frame->data[2],
+          videoPicture->frame->linesize[2]
+          );
 #endif
+      }
+
       // clear the current rendering target with the drawing color
       SDL_RenderClear(videoState->renderer);
 
       // copy a portion of the texture to the current rendering target
-      SDL_RenderCopy(videoState->renderer, videoState->texture, NULL, &rect_win);
+      SDL_RenderCopy(videoState->renderer, texture, rect_source, &rect_win);
 
       // update the screen with any rendering performed since the previous call
       SDL_RenderPresent(videoState->renderer);
@@ -2271,117 +5162,375 @@ static void video_display(VideoState * videoState)
 }
 
 /**
- * Initialize the given PacketQueue.
+ * Returns the compositor the player draws into, if any, and its cell in it:
+ * both as set together by ffw_set_compositor().
  *
- * @param q the PacketQueue to be initialized.
+ * @param   videoState  the global VideoState reference.
+ * @param   cell        receives the cell, may be NULL.
+ *
+ * @return              the compositor handle or NULL when the player owns its output.
  */
-static void packet_queue_init(PacketQueue * q)
+static compositor_h get_compositor(VideoState * videoState, int * cell)
 {
-  // alloc memory for the audio queue
-  memset(
-    q,
-    0,
-    sizeof(PacketQueue)
-    );
+  ffwplayer_t * ffw = videoState->parent_ffw;
+  compositor_h comp;
 
-  // Returns the initialized and unlocked mutex or NULL on failure
-  // q->mutex = SDL_CreateMutex();
-  // if (!q->mutex)
-  if (pthread_mutex_init(&q->mutex, NULL) != 0) {
-    // could not create mutex
-    LOG("SDL_CreateMutex Error: %s.\n", SDL_GetError());
-    return;
+  if ( ! ffw) {
+    return NULL;
   }
-
-  // Returns a new condition variable or NULL on failure
-  // q->cond = SDL_CreateCond();
-  // if (!q->cond)
-  if (pthread_cond_init(&q->cond, NULL) != 0) {
-    // could not create condition variable
-    LOG("SDL_CreateCond Error: %s.\n", SDL_GetError());
-    return;
+  pthread_mutex_lock(&ffw->compositor_mutex);
+  comp = ffw->compositor;
+  if (cell) {
+    *cell = ffw->compositor_cell;
   }
+  pthread_mutex_unlock(&ffw->compositor_mutex);
+  return comp;
+}
+
+static scaler_profile_t get_scaler_profile(VideoState * videoState)
+{
+  scaler_profile_t pinned = videoState->parent_ffw ? videoState->parent_ffw->scaler_profile : SCALER_PROFILE_AUTO;
+  const ffw_focus_profile_t * profile = get_focus_profile(videoState);
+
+  return pinned == SCALER_PROFILE_AUTO && profile ? profile->scaler : pinned;
 }
 
 /**
- * Put the given AVPacket in the given PacketQueue.
+ * Quality profile of where the player is shown, see ffw_set_focus().
  *
- * @param  queue    the queue to be used for the insert
- * @param  packet   the AVPacket to be inserted in the queue
+ * @param   videoState  the global VideoState reference.
  *
- * @return          0 if the AVPacket is correctly inserted in the given PacketQueue.
+ * @return              NULL if none (FFW_FOCUS_NONE, stand alone build).
  */
-static int packet_queue_put(PacketQueue * queue, AVPacket * packet)
+static const ffw_focus_profile_t * get_focus_profile(VideoState * videoState)
 {
-  // alloc the new AVPacketList to be inserted in the audio PacketQueue
-  AVPacketList * avPacketList;
-
-  avPacketList = av_malloc(sizeof(AVPacketList));
+  ffwplayer_t * ffw = videoState->parent_ffw;
 
-  // check the AVPacketList was allocated
-  if (!avPacketList) {
-    return -1;
+  if ( ! ffw || ffw->focus == FFW_FOCUS_NONE) {
+    return NULL;
   }
+  return ffw->focus == FFW_FOCUS_FULL ? &ffw->options.full_profile : &ffw->options.grid_profile;
+}
 
-  // add reference to the given AVPacket
-  avPacketList->pkt = *packet;
-
-  // the new AVPacketList will be inserted at the end of the queue
-  avPacketList->next = NULL;
-
-  // lock mutex
-  pthread_mutex_lock(&queue->mutex);
+/**
+ * Size the pictures of the player's own output are converted to: as decoded,
+ * or fitted into the limits of the focus profile, aspect ratio kept (whole
+ * 32 bytes RGB32 lines).
+ *
+ * @param   videoState  the global VideoState reference.
+ * @param   width       receives the picture width.
+ * @param   height      receives the picture height.
+ */
+static void get_picture_size(VideoState * videoState, int * width, int * height)
+{
+  const ffw_focus_profile_t * profile = get_focus_profile(videoState);
+  int w = videoState->video_ctx->width;
+  int h = videoState->video_ctx->height;
 
-  // check the queue is empty
-  if (!queue->last_pkt) {
-    // if it is, insert as first
-    queue->first_pkt = avPacketList;
-  } else {
-    // if not, insert as last
-    queue->last_pkt->next = avPacketList;
+  if (profile && profile->max_width > 0 && w > profile->max_width) {
+    h = (int) ((int64_t) h * profile->max_width / w);
+    w = profile->max_width;
   }
-
-  // point the last AVPacketList in the queue to the newly created AVPacketList
-  queue->last_pkt = avPacketList;
-
-  // increase by 1 the number of AVPackets in the queue
-  queue->nb_packets++;
-
-  // increase queue size by adding the size of the newly inserted AVPacket
-  queue->size += avPacketList->pkt.size;
-
-  // notify packet_queue_get which is waiting that a new packet is available
-  pthread_cond_signal(&queue->cond);
-
-  // unlock mutex
-  pthread_mutex_unlock(&queue->mutex);
-
-  return 0;
+  if (profile && profile->max_height > 0 && h > profile->max_height) {
+    w = (int) ((int64_t) w * profile->max_height / h);
+    h = profile->max_height;
+  }
+  if (w != videoState->video_ctx->width) {
+    w = FFMAX(w & ~7, 8);
+    h = FFMAX(h & ~1, 2);
+  }
+  *width = w;
+  *height = h;
 }
 
 /**
- * Get the first AVPacket from the given PacketQueue.
- *
- * @param   queue       the PacketQueue to extract from.
- * @param   packet      the first AVPacket extracted from the queue.
- * @param   blocking    0 to avoid waiting for an AVPacket to be inserted in the given
- *                      queue, != 0 otherwise.
+ * Conversion stage: true if the picture comes too soon after the previous one
+ * converted for the max_fps of the focus profile (at the playback speed).
+ * Never in trick play, which paces the pictures itself.
  *
- * @return              < 0 if returning because the quit flag is set, 0 if the queue
- *                      is empty, 1 if it is not empty and a packet was extracted.
+ * @param   videoState  the global VideoState reference.
+ * @param   pts         presentation time of the decoded frame.
  */
-static int packet_queue_get(PacketQueue * queue, AVPacket * packet, int blocking)
+static bool focus_fps_capped(VideoState * videoState, double pts)
 {
-  int ret;
-
-  AVPacketList * avPacketList;
+  const ffw_focus_profile_t * profile = get_focus_profile(videoState);
+  double interval;
+
+  if (profile && profile->max_fps > 0 && videoState->trick_mode == TRICK_NONE &&
+      ! isnan(videoState->focus_last_pts) && pts > videoState->focus_last_pts) {
+    // a little slack: 15 fps out of 30 keeps every other frame
+    interval = (pts - videoState->focus_last_pts) / fabs(videoState->speed);
+    if (interval < 0.9 / profile->max_fps) {
+      return true;
+    }
+  }
+  videoState->focus_last_pts = pts;
+  return false;
+}
+
+/**
+ * Probing profile of the player (robust in the stand alone build).
+ *
+ * @param   videoState  the global VideoState reference.
+ */
+static ffw_probe_profile_t get_probe_profile(VideoState * videoState)
+{
+  return videoState->parent_ffw ? videoState->parent_ffw->options.probe_profile : FFW_PROBE_ROBUST;
+}
+
+/**
+ * Sets the queue depths from the player options and allocates the decoded
+ * frame queue.
+ *
+ * @param   videoState  the global VideoState reference.
+ *
+ * @return              < 0 if out of memory.
+ */
+static int video_pipeline_init(VideoState * videoState)
+{
+  ffw_options_t options;
+
+  if (videoState->parent_ffw) {
+    options = videoState->parent_ffw->options;
+  } else {
+    ffw_default_options(&options);
+  }
+  videoState->frameq_depth = av_clip(options.decoded_queue_depth, 1, DECODED_FRAME_QUEUE_MAX);
+  videoState->pictq_depth = av_clip(options.picture_queue_depth, 1, VIDEO_PICTURE_QUEUE_MAX);
+
+  for (int i = 0; i < videoState->frameq_depth; i++) {
+    if ( ! (videoState->frameq[i].frame = av_frame_alloc())) {
+      LOG_E("Could not allocate the decoded frame queue");
+      return -1;
+    }
+  }
+  pthread_mutex_init(&videoState->frameq_mutex, NULL);
+  pthread_cond_init(&videoState->frameq_cond, NULL);
+
+  if (options.frame_cache_mb > 0) {
+    videoState->frame_cache = frame_cache_create((size_t) options.frame_cache_mb * 1024 * 1024,
+                                                 options.frame_cache_width);
+  }
+  return 0;
+}
+
+/**
+ * Moves a decoded frame into the conversion queue, waiting for room.
+ *
+ * @param   videoState  the global VideoState reference.
+ * @param   frame       decoded frame, its reference is taken (left blank).
+ * @param   pts         presentation time of the frame.
+ *
+ * @return              < 0 in case the global quit flag is set, 0 otherwise.
+ */
+static int frame_queue_put(VideoState * videoState, AVFrame * frame, double pts)
+{
+  int64_t start = av_gettime_relative();
+  DecodedFrame * slot;
+
+  pthread_mutex_lock(&videoState->frameq_mutex);
+  while (videoState->frameq_size >= videoState->frameq_depth && ! videoState->quit) {
+    pthread_cond_wait(&videoState->frameq_cond, &videoState->frameq_mutex);
+  }
+  if (videoState->quit) {
+    pthread_mutex_unlock(&videoState->frameq_mutex);
+    av_frame_unref(frame);
+    return -1;
+  }
+
+  slot = &videoState->frameq[videoState->frameq_windex];
+  av_frame_move_ref(slot->frame, frame);
+  slot->pts = pts;
+  slot->serial = videoState->video_serial;
+  videoState->frameq_windex = (videoState->frameq_windex + 1) % videoState->frameq_depth;
+  videoState->frameq_size++;
+  videoState->decode_stats.wait_ms += (av_gettime_relative() - start) / 1000.0;
+
+  pthread_cond_signal(&videoState->frameq_cond);
+  pthread_mutex_unlock(&videoState->frameq_mutex);
+  return 0;
+}
+
+/**
+ * Takes the oldest decoded frame out of the conversion queue, waiting for one.
+ *
+ * @param   videoState  the global VideoState reference.
+ * @param   frame       blank frame receiving the reference.
+ * @param   pts         presentation time of the frame.
+ * @param   serial      seek serial the frame was decoded in.
+ *
+ * @return              < 0 in case the global quit flag is set, 0 otherwise.
+ */
+static int frame_queue_get(VideoState * videoState, AVFrame * frame, double * pts, int * serial)
+{
+  DecodedFrame * slot;
+
+  pthread_mutex_lock(&videoState->frameq_mutex);
+  while (videoState->frameq_size == 0 && ! videoState->quit) {
+    pthread_cond_wait(&videoState->frameq_cond, &videoState->frameq_mutex);
+  }
+  if (videoState->quit) {
+    pthread_mutex_unlock(&videoState->frameq_mutex);
+    return -1;
+  }
+
+  slot = &videoState->frameq[videoState->frameq_rindex];
+  av_frame_move_ref(frame, slot->frame);
+  *pts = slot->pts;
+  *serial = slot->serial;
+  videoState->frameq_rindex = (videoState->frameq_rindex + 1) % videoState->frameq_depth;
+  videoState->frameq_size--;
+
+  pthread_cond_signal(&videoState->frameq_cond);
+  pthread_mutex_unlock(&videoState->frameq_mutex);
+  return 0;
+}
+
+/**
+ * Drops the decoded frames not converted yet (seek).
+ *
+ * @param   videoState  the global VideoState reference.
+ */
+static void frame_queue_flush(VideoState * videoState)
+{
+  pthread_mutex_lock(&videoState->frameq_mutex);
+  while (videoState->frameq_size > 0) {
+    av_frame_unref(videoState->frameq[videoState->frameq_rindex].frame);
+    videoState->frameq_rindex = (videoState->frameq_rindex + 1) % videoState->frameq_depth;
+    videoState->frameq_size--;
+  }
+  pthread_cond_signal(&videoState->frameq_cond);
+  pthread_mutex_unlock(&videoState->frameq_mutex);
+}
+
+/**
+ * Accounts one frame worth of work of a pipeline stage.
+ *
+ * @param   stats   the stage statistics.
+ * @param   start   av_gettime_relative() when the work on the frame started.
+ */
+static void stage_stats_update(ffw_stage_stats_t * stats, int64_t start)
+{
+  double ms = (av_gettime_relative() - start) / 1000.0;
+
+  stats->avg_ms = stats->frames ? stats->avg_ms * (1.0 - STAGE_AVG_WEIGHT) + ms * STAGE_AVG_WEIGHT : ms;
+  stats->total_ms += ms;
+  stats->frames++;
+}
+
+/**
+ * Initialize the given PacketQueue.
+ *
+ * @param q the PacketQueue to be initialized.
+ */
+static void packet_queue_init(PacketQueue * q)
+{
+  // alloc memory for the audio queue
+  memset(
+    q,
+    0,
+    sizeof(PacketQueue)
+    );
+
+  // Returns the initialized and unlocked mutex or NULL on failure
+  // q->mutex = SDL_CreateMutex();
+  // if (!q->mutex)
+  if (pthread_mutex_init(&q->mutex, NULL) != 0) {
+    // could not create mutex
+    LOG("SDL_CreateMutex Error: %s.\n", SDL_GetError());
+    return;
+  }
+
+  // Returns a new condition variable or NULL on failure
+  // q->cond = SDL_CreateCond();
+  // if (!q->cond)
+  if (pthread_cond_init(&q->cond, NULL) != 0) {
+    // could not create condition variable
+    LOG("SDL_CreateCond Error: %s.\n", SDL_GetError());
+    return;
+  }
+}
+
+/**
+ * Put the given AVPacket in the given PacketQueue.
+ *
+ * @param  queue    the queue to be used for the insert
+ * @param  packet   the AVPacket to be inserted in the queue
+ *
+ * @return          0 if the AVPacket is correctly inserted in the given PacketQueue.
+ */
+static int packet_queue_put(PacketQueue * queue, AVPacket * packet)
+{
+  // alloc the new AVPacketList to be inserted in the audio PacketQueue
+  AVPacketList * avPacketList;
+
+  avPacketList = av_malloc(sizeof(AVPacketList));
+
+  // check the AVPacketList was allocated
+  if (!avPacketList) {
+    return -1;
+  }
+
+  // add reference to the given AVPacket
+  avPacketList->pkt = *packet;
+
+  // the new AVPacketList will be inserted at the end of the queue
+  avPacketList->next = NULL;
+
+  // lock mutex
+  pthread_mutex_lock(&queue->mutex);
+
+  // check the queue is empty
+  if (!queue->last_pkt) {
+    // if it is, insert as first
+    queue->first_pkt = avPacketList;
+  } else {
+    // if not, insert as last
+    queue->last_pkt->next = avPacketList;
+  }
+
+  // point the last AVPacketList in the queue to the newly created AVPacketList
+  queue->last_pkt = avPacketList;
+
+  // increase by 1 the number of AVPackets in the queue
+  queue->nb_packets++;
+
+  // increase queue size by adding the size of the newly inserted AVPacket
+  queue->size += avPacketList->pkt.size;
+
+  // notify packet_queue_get which is waiting that a new packet is available
+  pthread_cond_signal(&queue->cond);
+
+  // unlock mutex
+  pthread_mutex_unlock(&queue->mutex);
+
+  return 0;
+}
+
+/**
+ * Get the first AVPacket from the given PacketQueue.
+ *
+ * @param   videoState  the VideoState owning the queue, for its quit flag.
+ * @param   queue       the PacketQueue to extract from.
+ * @param   packet      the first AVPacket extracted from the queue.
+ * @param   blocking    0 to avoid waiting for an AVPacket to be inserted in the given
+ *                      queue, != 0 otherwise.
+ *
+ * @return              < 0 if returning because the quit flag is set, 0 if the queue
+ *                      is empty, 1 if it is not empty and a packet was extracted.
+ */
+static int packet_queue_get(VideoState * videoState, PacketQueue * queue, AVPacket * packet, int blocking)
+{
+  int ret;
+
+  AVPacketList * avPacketList;
 
   // lock mutex
   pthread_mutex_lock(&queue->mutex);
 
   for (;;) {
     // check quit flag
-    if (global_video_state->quit) {
+    if (videoState->quit) {
       ret = -1;
       break;
     }
@@ -2429,6 +5578,19 @@ static int packet_queue_get(PacketQueue * queue, AVPacket * packet, int blocking
   return ret;
 }
 
+/**
+ * Wakes up the threads blocked in packet_queue_get() on the given queue, so
+ * they see the quit flag.
+ *
+ * @param   queue       the PacketQueue to wake up.
+ */
+static void packet_queue_wake(PacketQueue * queue)
+{
+  pthread_mutex_lock(&queue->mutex);
+  pthread_cond_broadcast(&queue->cond);
+  pthread_mutex_unlock(&queue->mutex);
+}
+
 /**
  *
  * @param queue
@@ -2526,6 +5688,21 @@ static void * alsa_audio_thread(void * arg)
 
   while (videoState->quit == 0) {
 
+    if (videoState->paused) {
+      // what the device holds plays on resume, unless it cannot pause
+      bool hw_paused = snd_pcm_hw_params_can_pause(params) && snd_pcm_pause(handle, 1) == 0;
+      if ( ! hw_paused) {
+        snd_pcm_drop(handle);
+      }
+      pause_wait(videoState, 0);
+      if (hw_paused) {
+        snd_pcm_pause(handle, 0);
+      } else {
+        snd_pcm_prepare(handle);
+      }
+      continue;
+    }
+
     audio_callback(arg, buffer, size);
 
     if (videoState->mute) {
@@ -2550,6 +5727,10 @@ static void * alsa_audio_thread(void * arg)
   snd_pcm_close(handle);
   free(buffer);
 
+  // this thread was the only user of the time stretcher
+  tempo_destroy(videoState->tempo);
+  videoState->tempo = NULL;
+
   LOG("exit audio thread");
 }
 
@@ -2572,8 +5753,8 @@ void audio_callback(void * userdata, Uint8 * stream, int len)
 
   // while the length of the audio data buffer is > 0
   while (len > 0) {
-    // check global quit flag
-    if (global_video_state->quit) {
+    // check quit flag
+    if (videoState->quit) {
       return;
     }
 
@@ -2622,6 +5803,8 @@ void audio_callback(void * userdata, Uint8 * stream, int len)
     // update global VideoState audio buffer index
     videoState->audio_buf_index += len1;
   }
+
+  set_audio_clock(videoState);
 }
 
 /**
@@ -2739,6 +5922,15 @@ static int audio_decode_frame(VideoState * videoState, uint8_t * audio_buf, int
       n = 2 * videoState->audio_ctx->channels;
       videoState->audio_clock += (double)data_size / (double)(n * videoState->audio_ctx->sample_rate);
 
+      if (videoState->tempo && audio_stretch(videoState, audio_buf, &data_size, buf_size) < 0) {
+        av_frame_free(&videoState->avFrame);
+        return -1;
+      }
+      if (data_size <= 0) {
+        // stretching: not enough for a sequence yet
+        continue;
+      }
+
       if (avPacket->data) {
         // wipe the packet
         av_packet_unref(avPacket);
@@ -2755,19 +5947,30 @@ static int audio_decode_frame(VideoState * videoState, uint8_t * audio_buf, int
     }
 
     // get more audio AVPacket
-    int ret = packet_queue_get(&videoState->audioq, avPacket, 1);
+    int ret = packet_queue_get(videoState, &videoState->audioq, avPacket, 1);
 
-    // if packet_queue_get returns < 0, the global quit flag was set
+    // if packet_queue_get returns < 0, the quit flag was set
     if (ret < 0) {
       return -1;
     }
 
     if (avPacket->data == videoState->flush_pkt.data) {
       avcodec_flush_buffers(videoState->audio_ctx);
-
+      videoState->audio_seek_pts = videoState->seek_accurate_pts;
+      if (videoState->tempo) {
+        tempo_reset(videoState->tempo);
+      }
       continue;
     }
 
+    if ( ! isnan(videoState->audio_seek_pts) && avPacket->pts != AV_NOPTS_VALUE) {
+      // accurate seek: the audio starts along with the target picture
+      if ((avPacket->pts + avPacket->duration) * av_q2d(videoState->audio_st->time_base) <= videoState->audio_seek_pts) {
+        continue;
+      }
+      videoState->audio_seek_pts = NAN;
+    }
+
     videoState->audio_pkt_data = avPacket->data;
     videoState->audio_pkt_size = avPacket->size;
 
@@ -2781,6 +5984,42 @@ static int audio_decode_frame(VideoState * videoState, uint8_t * audio_buf, int
   return 0;
 }
 
+/**
+ * Variable speed: stretches the resampled audio to the playback speed, in
+ * place. The stretcher keeps what does not fit and what is not enough for a
+ * sequence yet.
+ *
+ * @param   videoState  the global VideoState reference.
+ * @param   audio_buf   resampled audio, stretched audio on return.
+ * @param   data_size   its size, in and out (0 if nothing is ready).
+ * @param   buf_size    size of audio_buf.
+ *
+ * @return              0, < 0 if out of memory.
+ */
+static int audio_stretch(VideoState * videoState, uint8_t * audio_buf, int * data_size, int buf_size)
+{
+  tempo_stats_t stats;
+  int n = 2 * videoState->audio_ctx->channels;
+
+  // muted in trick play anyway
+  tempo_set_rate(videoState->tempo, videoState->trick_mode == TRICK_NONE ? videoState->speed : 1.0);
+  if (tempo_get_rate(videoState->tempo) == 1.0) {
+    return 0;
+  }
+
+  if ( ! tempo_put(videoState->tempo, (int16_t *) audio_buf, *data_size / n)) {
+    LOG_E("audio time stretching: no memo");
+    return -1;
+  }
+  *data_size = tempo_get(videoState->tempo, (int16_t *) audio_buf, buf_size / n) * n;
+
+  tempo_get_stats(videoState->tempo, &stats);
+  pthread_mutex_lock(&videoState->seek_mutex);
+  videoState->trick_stats.tempo_load = stats.load;
+  pthread_mutex_unlock(&videoState->seek_mutex);
+  return 0;
+}
+
 /**
  * Resamples the audio data retrieved using FFmpeg before playing it.
  *
@@ -3039,18 +6278,747 @@ static AudioResamplingState * getAudioResampling(uint64_t channel_layout)
 }
 
 /**
+ * Requests a seek from the demuxer. The latest request wins: one made while
+ * another is still pending replaces it, so scrubbing always ends where the
+ * user stopped.
  *
  * @param videoState
- * @param pos
- * @param rel
+ * @param pos   target, AV_TIME_BASE units
+ * @param rel   increment from the current position that gave pos (0 for an
+ *              absolute seek), AV_TIME_BASE units
  */
-static void stream_seek(VideoState * videoState, int64_t pos, int rel)
+static void stream_seek(VideoState * videoState, int64_t pos, int64_t rel)
 {
-  pthread_mutex_lock(&videoState->screen_mutex);
-  if (!videoState->seek_req) {
-    videoState->seek_pos = pos;
-    videoState->seek_flags = rel < 0 ? AVSEEK_FLAG_BACKWARD : 0;
-    videoState->seek_req = 1;
+  stream_seek_request(videoState, pos, rel, false);
+}
+
+/**
+ * stream_seek(), telling whether the seek is a step backward.
+ *
+ * @param videoState
+ * @param pos   target, AV_TIME_BASE units
+ * @param rel   increment that led to it
+ * @param step  frame step: decoded accurately whatever the seek mode, shown
+ *              while paused
+ */
+static void stream_seek_request(VideoState * videoState, int64_t pos, int64_t rel, bool step)
+{
+  // not the screen mutex: a present waiting for vsync must not delay a seek
+  pthread_mutex_lock(&videoState->seek_mutex);
+  videoState->seek_stats.requests++;
+  if (videoState->seek_req) {
+    videoState->seek_stats.coalesced++;
   }
-  pthread_mutex_unlock(&videoState->screen_mutex);
+  videoState->seek_pos = pos;
+  videoState->seek_rel = rel;
+  videoState->seek_req_time = media_clock_now();
+  videoState->seek_step = step;
+  videoState->seek_req = 1;
+  pthread_mutex_unlock(&videoState->seek_mutex);
+
+  // done right away even if paused
+  pause_wake(videoState);
+}
+
+/**
+ * Position relative seeks start from: the target of the last seek until its
+ * first picture is on the screen, so that repeated steps add up, or else the
+ * master clock.
+ *
+ * @param videoState
+ *
+ * @return  seconds, NAN if nothing was played yet
+ */
+static double get_seek_base(VideoState * videoState)
+{
+  double base = NAN;
+
+  pthread_mutex_lock(&videoState->seek_mutex);
+  if (videoState->seek_req || videoState->seek_shown_req_time) {
+    base = videoState->seek_pos / (double) AV_TIME_BASE;
+  }
+  pthread_mutex_unlock(&videoState->seek_mutex);
+
+  return isnan(base) ? get_master_clock(videoState) : base;
+}
+
+/**
+ * Drops what is queued for the decoders and queues the flush packet: what
+ * they decode from now on until they get it is stale. Demuxer thread only.
+ *
+ * @param videoState
+ */
+static void demux_flush(VideoState * videoState)
+{
+  // anything decoded from now on before the flush packet is stale
+  videoState->seek_serial++;
+
+  if (videoState->videoStream >= 0) {
+    packet_queue_flush(&videoState->videoq);
+    packet_queue_put(&videoState->videoq, &videoState->flush_pkt);
+    // kept while hidden: from before the seek, the next key frame starts over
+    packet_queue_flush(&videoState->hidden_gopq);
+    if (videoState->hidden) {
+      // the flush packet puts the decoder back to visible
+      packet_queue_put(&videoState->videoq, &videoState->hide_pkt);
+    }
+  }
+
+  if (videoState->audioStream >= 0) {
+    packet_queue_flush(&videoState->audioq);
+    packet_queue_put(&videoState->audioq, &videoState->flush_pkt);
+  }
+
+  media_clock_invalidate(&videoState->audio_clk);
+  media_clock_invalidate(&videoState->ext_clk);
+}
+
+/**
+ * Applies the newest speed request (variable speed or trick play), from the
+ * picture on the screen. Demuxer thread only.
+ *
+ * @param videoState
+ */
+static void speed_apply(VideoState * videoState)
+{
+  trick_mode_t previous = videoState->trick_mode;
+  trick_mode_t mode;
+  double pos;
+  double speed;
+
+  pthread_mutex_lock(&videoState->seek_mutex);
+  speed = videoState->speed_req_value;
+  videoState->speed_req = 0;
+  pthread_mutex_unlock(&videoState->seek_mutex);
+
+  if (speed == videoState->speed) {
+    return;
+  }
+
+  if (speed >= TEMPO_MIN_RATE && speed <= TEMPO_MAX_RATE) {
+    mode = TRICK_NONE;
+  } else if (speed < 0 && -speed <= TRICK_GOP_MAX_SPEED) {
+    mode = TRICK_GOP;
+  } else {
+    mode = TRICK_KEYFRAMES;
+  }
+
+  pos = get_video_clock(videoState);
+  if (isnan(pos)) {
+    pos = 0; // nothing shown yet: from the start
+  }
+
+  videoState->speed = speed;
+  videoState->trick_mode = mode;
+  trick_origin(videoState, pos);
+
+  // the clocks run at the new speed, backward too; the audio decoder stretches
+  // the audio to it
+  media_clock_set_speed(&videoState->video_clk, speed);
+  media_clock_set_speed(&videoState->audio_clk, speed);
+  media_clock_set_speed(&videoState->ext_clk, speed);
+
+  pthread_mutex_lock(&videoState->seek_mutex);
+  videoState->trick_stats.speed = speed;
+  pthread_mutex_unlock(&videoState->seek_mutex);
+  LOG_I("%s: playing at %gx from %.3f s", videoState->filename, speed, pos);
+
+  if (mode != TRICK_NONE) {
+    // key frames or GOPs from now on: nothing queued is of any use
+    demux_flush(videoState);
+  } else if (previous != TRICK_NONE) {
+    // every frame in order again, from the picture on the screen
+    stream_seek(videoState, (int64_t) (pos * AV_TIME_BASE), 0);
+  }
+}
+
+/**
+ * Trick play goes on from a given position (speed change, seek).
+ *
+ * @param videoState
+ * @param pos   seconds
+ */
+static void trick_origin(VideoState * videoState, double pos)
+{
+  videoState->trick_pos = pos;
+  videoState->trick_time = media_clock_now();
+  videoState->trick_next_step = 0;
+  videoState->trick_kf = NAN;
+  videoState->trick_gop_end = pos;
+}
+
+/**
+ * Fast forward and reverse on key frames: every TRICK_STEP_INTERVAL, the key
+ * frame at or before where the speed got to is queued alone, unless already
+ * shown. The key frame index tells which one it is without reading anything;
+ * a step is skipped while the decoder still has the previous one, so the CPU
+ * taken does not depend on the speed. Demuxer thread only.
+ *
+ * @param videoState
+ * @param packet    blank packet to read into
+ */
+static void trick_keyframe_step(VideoState * videoState, AVPacket * packet)
+{
+  AVStream * st = videoState->video_st;
+  int64_t now = media_clock_now();
+  double start, end, pos, kf = NAN;
+  int64_t target;
+  int i;
+
+  if (now < videoState->trick_next_step) {
+    // short naps: seeks, speed changes and quit are seen right away
+    usleep(FFMIN(videoState->trick_next_step - now, 1000 * 10));
+    return;
+  }
+  videoState->trick_next_step = now + TRICK_STEP_INTERVAL;
+
+  if (videoState->videoq.nb_packets > 0) {
+    pthread_mutex_lock(&videoState->seek_mutex);
+    videoState->trick_stats.late_steps++;
+    pthread_mutex_unlock(&videoState->seek_mutex);
+    return;
+  }
+
+  trick_bounds(videoState, &start, &end);
+  pos = videoState->trick_pos + (now - videoState->trick_time) / 1000000.0 * videoState->speed;
+  pos = FFMIN(FFMAX(pos, start), end);
+  target = (int64_t) (pos * AV_TIME_BASE);
+
+  i = av_index_search_timestamp(st, av_rescale_q(target, AV_TIME_BASE_Q, st->time_base), AVSEEK_FLAG_BACKWARD);
+  if (i >= 0) {
+    kf = avformat_index_get_entry(st, i)->timestamp * av_q2d(st->time_base);
+    if (fabs(kf - videoState->trick_kf) < ACCURATE_SEEK_MARGIN) {
+      return; // still on the screen
+    }
+  }
+
+  if (avformat_seek_file(videoState->pFormatCtx, -1, INT64_MIN, target, target, 0) < 0 ||
+      trick_read_keyframe(videoState, packet) < 0) {
+    return;
+  }
+
+  // not indexed: known once read
+  if (isnan(kf)) {
+    kf = packet_seconds(videoState, packet);
+    if (fabs(kf - videoState->trick_kf) < ACCURATE_SEEK_MARGIN) {
+      av_packet_unref(packet);
+      return;
+    }
+  }
+
+  videoState->trick_kf = kf;
+  packet_queue_put(&videoState->videoq, packet);
+
+  pthread_mutex_lock(&videoState->seek_mutex);
+  videoState->trick_stats.keyframes++;
+  pthread_mutex_unlock(&videoState->seek_mutex);
+}
+
+/**
+ * Slow reverse: queues the GOP before the one last played, from its key frame
+ * up to the next one, followed by the end of GOP marker. The decoder decodes
+ * it into the GOP buffer and shows it backward (trick_gop_play()); the next
+ * GOP is read once it took this one. Demuxer thread only.
+ *
+ * @param videoState
+ * @param packet    blank packet to read into
+ */
+static void trick_gop_step(VideoState * videoState, AVPacket * packet)
+{
+  AVFormatContext * pFormatCtx = videoState->pFormatCtx;
+  double gop_end = videoState->trick_gop_end;
+  double gop_start = NAN;
+  double start, end;
+  int count = 0;
+  int ret;
+
+  trick_bounds(videoState, &start, &end);
+  if (videoState->videoq.nb_packets > 0 || gop_end <= start + ACCURATE_SEEK_MARGIN) {
+    // the decoder is not done with the previous GOP, or this is the beginning
+    usleep(1000 * 10);
+    return;
+  }
+
+  // the key frame before the end; the index may be on decoding timestamps and
+  // give the key frame the end is on: a second further back then
+  for (int attempt = 0; attempt < 2; attempt++) {
+    int64_t target = (int64_t) ((gop_end - ACCURATE_SEEK_MARGIN - attempt) * AV_TIME_BASE);
+    if (avformat_seek_file(pFormatCtx, -1, INT64_MIN, target, target, 0) < 0 ||
+        trick_read_keyframe(videoState, packet) < 0) {
+      break;
+    }
+    gop_start = packet_seconds(videoState, packet);
+    if (gop_start < gop_end - ACCURATE_SEEK_MARGIN) {
+      break;
+    }
+    av_packet_unref(packet);
+    gop_start = NAN;
+  }
+  if (isnan(gop_start)) {
+    LOG_W("%s: no key frame before %.3f s, reverse play stops", videoState->filename, gop_end);
+    videoState->trick_gop_end = start;
+    return;
+  }
+
+  do {
+    if (packet->stream_index == videoState->videoStream) {
+      packet_queue_put(&videoState->videoq, packet);
+      count++;
+    } else {
+      av_packet_unref(packet);
+    }
+    ret = av_read_frame(pFormatCtx, packet);
+  } while (ret >= 0 && count < TRICK_MAX_PACKETS &&
+           ! (packet->stream_index == videoState->videoStream && (packet->flags & AV_PKT_FLAG_KEY)));
+  if (ret >= 0) {
+    // key frame of the GOP played last
+    av_packet_unref(packet);
+  }
+
+  // copied by the queue
+  videoState->gop_pkt.pts = (int64_t) (gop_start * AV_TIME_BASE);
+  videoState->gop_pkt.dts = (int64_t) (gop_end * AV_TIME_BASE);
+  packet_queue_put(&videoState->videoq, &videoState->gop_pkt);
+  videoState->trick_gop_end = gop_start;
+
+  pthread_mutex_lock(&videoState->seek_mutex);
+  videoState->trick_stats.gops++;
+  pthread_mutex_unlock(&videoState->seek_mutex);
+}
+
+/**
+ * Slow reverse: keeps a frame of the GOP being decoded, in pts order. Past
+ * TRICK_GOP_MAX_FRAMES the oldest one is dropped. Video thread only.
+ *
+ * @param videoState
+ * @param frame     decoded frame, its reference is taken (left blank)
+ * @param pts       seconds
+ */
+static void trick_gop_keep(VideoState * videoState, AVFrame * frame, double pts)
+{
+  int i;
+
+  if (videoState->gop_count == TRICK_GOP_MAX_FRAMES) {
+    AVFrame * oldest = videoState->gop_frames[0];
+
+    pthread_mutex_lock(&videoState->seek_mutex);
+    videoState->trick_stats.gop_dropped_frames++;
+    pthread_mutex_unlock(&videoState->seek_mutex);
+    if (pts < videoState->gop_pts[0]) {
+      av_frame_unref(frame);
+      return;
+    }
+    av_frame_unref(oldest);
+    videoState->gop_count--;
+    memmove(&videoState->gop_frames[0], &videoState->gop_frames[1], videoState->gop_count * sizeof(AVFrame *));
+    memmove(&videoState->gop_pts[0], &videoState->gop_pts[1], videoState->gop_count * sizeof(double));
+    videoState->gop_frames[videoState->gop_count] = oldest;
+  }
+
+  i = videoState->gop_count;
+  if ( ! videoState->gop_frames[i] && ! (videoState->gop_frames[i] = av_frame_alloc())) {
+    av_frame_unref(frame);
+    return;
+  }
+  // the decoder gives them out in order, unless the timestamps are odd
+  AVFrame * slot = videoState->gop_frames[i];
+  for (; i > 0 && videoState->gop_pts[i - 1] > pts; i--) {
+    videoState->gop_frames[i] = videoState->gop_frames[i - 1];
+    videoState->gop_pts[i] = videoState->gop_pts[i - 1];
+  }
+  videoState->gop_frames[i] = slot;
+  videoState->gop_pts[i] = pts;
+  av_frame_move_ref(slot, frame);
+  videoState->gop_count++;
+}
+
+/**
+ * Slow reverse: the GOP just decoded goes to the conversion stage backward,
+ * from the frame before its end down to its key frame, at the resolution it
+ * was decoded at. Video thread, on the end of GOP marker.
+ *
+ * @param videoState
+ * @param start             pts of the key frame of the GOP (seconds)
+ * @param end               the frames from there on are not shown (seconds)
+ *
+ * @return  0, < 0 in case the global quit flag is set
+ */
+static int trick_gop_play(VideoState * videoState, double start, double end)
+{
+  int ret = 0;
+
+  // until a seek or a speed change
+  for (int i = videoState->gop_count - 1;
+       i >= 0 && videoState->video_serial == videoState->seek_serial; i--) {
+    AVFrame * frame = videoState->gop_frames[i];
+    double pts = videoState->gop_pts[i];
+
+    if (pts >= end - ACCURATE_SEEK_MARGIN || pts < start - ACCURATE_SEEK_MARGIN) {
+      continue;
+    }
+    pts = synchronize_video(videoState, frame, pts);
+    if (frame_queue_put(videoState, frame, pts) < 0) {
+      ret = -1;
+      break;
+    }
+  }
+
+  trick_gop_clear(videoState);
+  return ret;
+}
+
+/**
+ * Drops the frames of the GOP buffer (played, or a seek). Video thread only.
+ *
+ * @param videoState
+ */
+static void trick_gop_clear(VideoState * videoState)
+{
+  for (int i = 0; i < videoState->gop_count; i++) {
+    av_frame_unref(videoState->gop_frames[i]);
+  }
+  videoState->gop_count = 0;
+}
+
+/**
+ * Bounds of the input.
+ *
+ * @param videoState
+ * @param start     seconds
+ * @param end       seconds, INFINITY if not known (live)
+ */
+static void trick_bounds(VideoState * videoState, double * start, double * end)
+{
+  AVFormatContext * pFormatCtx = videoState->pFormatCtx;
+
+  *start = pFormatCtx->start_time != AV_NOPTS_VALUE ? pFormatCtx->start_time / (double) AV_TIME_BASE : 0;
+  *end = pFormatCtx->duration != AV_NOPTS_VALUE ? *start + pFormatCtx->duration / (double) AV_TIME_BASE : INFINITY;
+}
+
+/**
+ * Reads up to the first video key frame, the other packets are dropped.
+ *
+ * @param videoState
+ * @param packet    blank packet receiving the key frame
+ *
+ * @return  0, < 0 if none within TRICK_MAX_PACKETS or on error (EOF)
+ */
+static int trick_read_keyframe(VideoState * videoState, AVPacket * packet)
+{
+  for (int i = 0; i < TRICK_MAX_PACKETS; i++) {
+    int ret = av_read_frame(videoState->pFormatCtx, packet);
+    if (ret < 0) {
+      return ret;
+    }
+    if (packet->stream_index == videoState->videoStream && (packet->flags & AV_PKT_FLAG_KEY)) {
+      return 0;
+    }
+    av_packet_unref(packet);
+  }
+  return AVERROR(EAGAIN);
+}
+
+/**
+ * Presentation time of a video packet, its decoding time if not known.
+ *
+ * @param videoState
+ * @param packet
+ *
+ * @return  seconds, NAN if neither is known
+ */
+static double packet_seconds(VideoState * videoState, AVPacket * packet)
+{
+  int64_t ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+
+  return ts == AV_NOPTS_VALUE ? NAN : ts * av_q2d(videoState->video_st->time_base);
+}
+
+/**
+ * Pauses or resumes: the clocks freeze (or run again from where they were),
+ * the demuxer, the timer and the audio thread sleep in pause_wait() until
+ * resumed; the decoding stages block on their queues.
+ *
+ * @param videoState
+ * @param paused
+ */
+static void player_pause(VideoState * videoState, bool paused)
+{
+  pthread_mutex_lock(&videoState->pause_mutex);
+  if (videoState->paused == paused) {
+    pthread_mutex_unlock(&videoState->pause_mutex);
+    return;
+  }
+  media_clock_set_paused(&videoState->audio_clk, paused);
+  media_clock_set_paused(&videoState->video_clk, paused);
+  media_clock_set_paused(&videoState->ext_clk, paused);
+  videoState->paused = paused;
+  pthread_cond_broadcast(&videoState->pause_cond);
+  pthread_mutex_unlock(&videoState->pause_mutex);
+
+#ifdef USE_SDL_AUDIO
+  if (videoState->audio_st) {
+    SDL_PauseAudio(paused);
+  }
+#endif
+  LOG("%s: %s", videoState->filename, paused ? "paused" : "resumed");
+}
+
+/**
+ * Blocks while paused.
+ *
+ * @param videoState
+ * @param wake_on   PAUSE_WAKE_xxx: what else ends the wait
+ *
+ * @return  time spent waiting, microseconds, 0 if it did not wait
+ */
+static int64_t pause_wait(VideoState * videoState, int wake_on)
+{
+  int64_t start = 0;
+
+  if ( ! videoState->paused) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&videoState->pause_mutex);
+  while (videoState->paused && ! videoState->quit &&
+         ! ((wake_on & PAUSE_WAKE_REQUESTS) && (videoState->seek_req || videoState->speed_req)) &&
+         ! ((wake_on & PAUSE_WAKE_STEP) && videoState->step_show) &&
+         ! ((wake_on & PAUSE_WAKE_VISIBILITY) && videoState->visible_req)) {
+    if ( ! start) {
+      start = media_clock_now();
+    }
+    pthread_cond_wait(&videoState->pause_cond, &videoState->pause_mutex);
+  }
+  pthread_mutex_unlock(&videoState->pause_mutex);
+  return start ? media_clock_now() - start : 0;
+}
+
+/**
+ * Wakes the threads waiting in pause_wait() up to check what changed: the
+ * quit flag, a request for the demuxer (seek, speed, visibility).
+ *
+ * @param videoState
+ */
+static void pause_wake(VideoState * videoState)
+{
+  pthread_mutex_lock(&videoState->pause_mutex);
+  pthread_cond_broadcast(&videoState->pause_cond);
+  pthread_mutex_unlock(&videoState->pause_mutex);
+}
+
+/**
+ * Whether the demuxer goes on reading while paused: live sources, if asked
+ * to, until the packet queues are full.
+ *
+ * @param videoState
+ *
+ * @return
+ */
+static bool pause_buffering(VideoState * videoState)
+{
+  return get_options(videoState).live_pause_buffer &&
+         videoState->pFormatCtx->duration == AV_NOPTS_VALUE &&
+         videoState->audioq.size <= MAX_AUDIOQ_SIZE && videoState->videoq.size <= MAX_VIDEOQ_SIZE;
+}
+
+/**
+ * Pauses and shows the next or the previous frame. Forward, the next picture
+ * of the queue goes to the screen (the demuxer reads just what it takes).
+ * Backward, an accurate seek to the middle of the frame before the one on the
+ * screen, or before the target of the step still pending.
+ *
+ * @param videoState
+ * @param direction   > 0 forward, < 0 backward
+ */
+static void step_frame(VideoState * videoState, int direction)
+{
+  double frame_duration, target = NAN;
+
+  player_pause(videoState, true);
+
+  if (direction > 0) {
+    pthread_mutex_lock(&videoState->pause_mutex);
+    videoState->step_show++;
+    pthread_cond_broadcast(&videoState->pause_cond);
+    pthread_mutex_unlock(&videoState->pause_mutex);
+    return;
+  }
+
+  if ( ! videoState->video_st) {
+    return;
+  }
+  frame_duration = video_frame_duration(videoState);
+
+  pthread_mutex_lock(&videoState->seek_mutex);
+  if (videoState->seek_req || videoState->seek_shown_req_time) {
+    // its target is the middle of the frame it shows
+    target = videoState->seek_pos / (double) AV_TIME_BASE - frame_duration;
+  }
+  pthread_mutex_unlock(&videoState->seek_mutex);
+
+  if (isnan(target)) {
+    pthread_mutex_lock(&videoState->snapshot_mutex);
+    target = videoState->shown_pts - frame_duration / 2;
+    pthread_mutex_unlock(&videoState->snapshot_mutex);
+  }
+  if (isnan(target)) {
+    return; // nothing shown yet
+  }
+
+  stream_seek_request(videoState, (int64_t) (FFMAX(target, 0) * AV_TIME_BASE),
+                      (int64_t) (-frame_duration * AV_TIME_BASE), true);
+}
+
+/**
+ * Hands a snapshot done by the worker over to the parent of its player.
+ *
+ * @param snapshot
+ * @param arg       the player
+ */
+static void snapshot_done(snapshot_t * snapshot, void * arg)
+{
+  ffwplayer_t * ffw = (ffwplayer_t *) arg;
+  msg_t msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_id = MSG_ID__SNAPSHOT;
+  msg.v_int = snapshot->error;
+  msg.v_ptr_1 = ffw;
+  msg.v_ptr_2 = ffw->client_data;
+  msg.v_ptr_3 = snapshot;
+  if ( ! ffw->parent_msg_th || ! post_msg(NULL, ffw->parent_msg_th, &msg)) {
+    LOG_W("%s: snapshot not delivered", ffw->url);
+    snapshot_free(snapshot);
+  }
+}
+
+/**
+ * Applies the newest visibility request. Hidden, the video is kept from the
+ * next key frame on (hidden_packet()); shown again, what was kept goes to the
+ * decoder, or the next key frame does if none was. Demuxer thread only.
+ *
+ * @param videoState
+ */
+static void visibility_apply(VideoState * videoState)
+{
+  bool hide;
+  int64_t now = media_clock_now();
+
+  pthread_mutex_lock(&videoState->seek_mutex);
+  hide = ! videoState->visible_req_value;
+  videoState->visible_req = 0;
+  if (hide != videoState->visibility_stats.hidden) {
+    videoState->visibility_stats.hidden = hide;
+    if (hide) {
+      videoState->visibility_stats.hides++;
+      videoState->hide_time = now;
+      videoState->show_req_time = 0;
+    } else {
+      videoState->visibility_stats.hidden_ms += (now - videoState->hide_time) / 1000.0;
+      // nothing to wait for if the decoder was not hidden yet
+      videoState->show_req_time = videoState->hidden ? now : 0;
+    }
+  }
+  pthread_mutex_unlock(&videoState->seek_mutex);
+
+  if (hide == videoState->hide) {
+    return;
+  }
+  videoState->hide = hide;
+  LOG_I("%s: %s", videoState->filename, hide ? "hidden" : "shown again");
+
+  if ( ! hide && videoState->hidden && videoState->hidden_gopq.nb_packets > 0) {
+    hidden_show(videoState);
+  }
+}
+
+/**
+ * Hidden: the video packets read are kept in hidden_gopq, dropped with their
+ * GOP when the next key frame comes, and only the key frames go to the
+ * decoder (FFW_HIDDEN_KEYFRAMES). Starts at the first key frame once hidden:
+ * until then the decoder goes on with the GOP it is in. Demuxer thread only.
+ *
+ * @param videoState
+ * @param packet      a video packet read from the input
+ *
+ * @return  true if it was taken (kept or dropped), false if it is for the
+ *          decoder as usual
+ */
+static bool hidden_packet(VideoState * videoState, AVPacket * packet)
+{
+  bool key = packet->flags & AV_PKT_FLAG_KEY;
+  int dropped = 0;
+
+  if ( ! videoState->hidden) {
+    if ( ! videoState->hide || ! key) {
+      return false;
+    }
+    videoState->hidden = true;
+    packet_queue_put(&videoState->videoq, &videoState->hide_pkt);
+  }
+  videoState->hidden_read_pts = packet_seconds(videoState, packet);
+
+  if (key || videoState->hidden_gopq.size + packet->size > MAX_VIDEOQ_SIZE) {
+    // a new GOP, or one too long to be kept: the next key frame starts over
+    dropped = videoState->hidden_gopq.nb_packets;
+    packet_queue_flush(&videoState->hidden_gopq);
+  }
+  if ( ! key && videoState->hidden_gopq.nb_packets == 0) {
+    // nothing to decode it from
+    dropped++;
+    av_packet_unref(packet);
+  } else {
+    AVPacket keyframe;
+    if (key && get_options(videoState).hidden_mode == FFW_HIDDEN_KEYFRAMES &&
+        av_packet_ref(&keyframe, packet) == 0) {
+      packet_queue_put(&videoState->videoq, &keyframe);
+    }
+    packet_queue_put(&videoState->hidden_gopq, packet);
+  }
+
+  if (dropped) {
+    pthread_mutex_lock(&videoState->seek_mutex);
+    videoState->visibility_stats.dropped_packets += dropped;
+    pthread_mutex_unlock(&videoState->seek_mutex);
+  }
+
+  // shown again while waiting for a key frame
+  if ( ! videoState->hide && videoState->hidden_gopq.nb_packets > 0) {
+    hidden_show(videoState);
+  }
+  return true;
+}
+
+/**
+ * Shown again: the decoder gets the marker and then the video kept while
+ * hidden, from its key frame on. Demuxer thread only.
+ *
+ * @param videoState
+ */
+static void hidden_show(VideoState * videoState)
+{
+  AVPacket packet;
+
+  videoState->hidden = false;
+  videoState->hidden_read_pts = NAN;
+  packet_queue_put(&videoState->videoq, &videoState->show_pkt);
+  while (packet_queue_get(videoState, &videoState->hidden_gopq, &packet, 0) > 0) {
+    packet_queue_put(&videoState->videoq, &packet);
+  }
+}
+
+/**
+ * Hidden: true if the video read is far enough ahead of the clock. Nothing
+ * else would pace the reading of a recording without audio.
+ *
+ * @param videoState
+ *
+ * @return
+ */
+static bool hidden_read_ahead(VideoState * videoState)
+{
+  double clock = get_master_clock(videoState);
+
+  return ! isnan(clock) && ! isnan(videoState->hidden_read_pts) &&
+         videoState->hidden_read_pts - clock > HIDDEN_READ_AHEAD;
 }
@@ -41,9 +41,13 @@
 #pragma once
 
 #include <stdbool.h>
+#include <pthread.h>
 #include <libavformat/avformat.h>
 
 #include "msg_thread.h"
+#include "compositor.h"
+#include "frame_cache.h"
+#include "snapshot.h"
 
 /**
  * @file
@@ -62,17 +66,258 @@ enum {
   MSG_ID__SEEK_RELATIVE,
   MSG_ID__POS_REPORT,
   MSG_ID__POS_SET,
-  MSG_ID__TIMER
+  MSG_ID__TIMER,
+  MSG_ID__READY,    /**< to parent: v_ptr_1 player, v_ptr_2 client_data, v_ptr_3 ffw_stream_info_t */
+  MSG_ID__FAILED,   /**< to parent: v_ptr_1 player, v_ptr_2 client_data, v_int AVERROR code */
+  MSG_ID__FIRST_FRAME, /**< to parent: v_ptr_1 player, v_ptr_2 client_data, v_int time to first frame (ms) */
+  MSG_ID__TRICK_PLAY, /**< v_int speed, see ffw_set_trick_speed() */
+  MSG_ID__SPEED,    /**< v_int speed in thousandths, see ffw_set_speed() */
+  MSG_ID__STEP,     /**< v_int direction, see ffw_step_frame() */
+  MSG_ID__SNAPSHOT, /**< to parent: v_ptr_1 player, v_ptr_2 client_data, v_ptr_3 snapshot_t (snapshot_free() it),
+                         v_int AVERROR code, see ffw_snapshot_request() */
+  MSG_ID__VISIBILITY, /**< v_int visible, see ffw_set_visible() */
 };
 
+typedef enum {
+  FFW_OPEN_PENDING = 0,
+  FFW_OPEN_READY,
+  FFW_OPEN_FAILED,
+} ffw_open_state_t;
+
+/**
+ * What was found when opening the stream (MSG_ID__READY).
+ */
+typedef struct ffw_stream_info_st {
+  int     width;
+  int     height;
+  double  fps;
+  double  duration;         /**< seconds, 0 for live streams */
+  char    video_codec[32];
+  bool    has_audio;
+  int     sample_rate;
+  int     channels;
+  char    audio_codec[32];
+  int     nb_streams;       /**< in the source, played or not */
+  int     video_stream;     /**< index of the stream played */
+  int     audio_stream;     /**< index of the stream played, -1 if none */
+} ffw_stream_info_t;
+
+#define FFW_STREAM_AUTO   -1  /**< ffw_options_t stream: the best one of its type */
+#define FFW_STREAM_NONE   -2  /**< ffw_options_t stream: none (audio only) */
+
+/**
+ * How the stream is probed when opened.
+ */
+typedef enum {
+  FFW_PROBE_ROBUST = 0,     /**< FFmpeg defaults: reliable on any source */
+  FFW_PROBE_LIVE_INSTANT,   /**< known live sources: minimal probing, no buffering, low delay decoding */
+} ffw_probe_profile_t;
+
+/**
+ * Clock the video is synchronized to.
+ */
+typedef enum {
+  FFW_SYNC_AUTO = 0,        /**< the audio, the video itself if there is no audio */
+  FFW_SYNC_VIDEO,           /**< paced by its own pts */
+  FFW_SYNC_EXTERNAL,        /**< the local monotonic time */
+} ffw_sync_master_t;
+
+/**
+ * Where a seek lands.
+ */
+typedef enum {
+  FFW_SEEK_FAST = 0,        /**< on a key frame near the target */
+  FFW_SEEK_ACCURATE,        /**< exactly on the target: decoded from the key frame before it, nothing
+                                 shown until reached */
+} ffw_seek_mode_t;
+
+/**
+ * What a hidden player decodes, see ffw_set_visible(). Either way the video
+ * read since the last key frame is kept, to be decoded when shown again.
+ */
+typedef enum {
+  FFW_HIDDEN_KEYFRAMES = 0, /**< key frames only, not converted: a recent picture at hand (shown at once
+                                 again, snapshots, frame cache) */
+  FFW_HIDDEN_NO_DECODE,     /**< nothing: the video only read */
+} ffw_hidden_mode_t;
+
+/**
+ * Where the player is shown, see ffw_set_focus(): each place has a quality
+ * profile.
+ */
+typedef enum {
+  FFW_FOCUS_NONE = 0,       /**< no profile: every frame decoded, converted as decoded */
+  FFW_FOCUS_GRID,           /**< one cell among many: ffw_options_t.grid_profile */
+  FFW_FOCUS_FULL,           /**< alone, full screen: ffw_options_t.full_profile */
+} ffw_focus_t;
+
+/**
+ * Quality of the decoding and conversion, see ffw_set_focus().
+ */
+typedef struct ffw_focus_profile_st {
+  int     max_width;        /**< own output (not a compositor cell): pictures converted no larger,
+                                 aspect ratio kept, 0 = as decoded */
+  int     max_height;
+  double  max_fps;          /**< pictures converted and shown per second at most, 0 = all of them */
+  bool    skip_nonref;      /**< the frames no other one refers to (B frames) are not even decoded */
+  scaler_profile_t scaler;  /**< unless pinned by ffw_set_scaler_profile() */
+} ffw_focus_profile_t;
+
+/**
+ * Player creation options, see ffw_create_player_ex().
+ */
+typedef struct ffw_options_st {
+  int decoded_queue_depth;  /**< decoded frames waiting for conversion, 1..8 */
+  int picture_queue_depth;  /**< converted pictures waiting for display, 1..4 */
+  ffw_probe_profile_t probe_profile;
+  bool stream_cache;        /**< reuse the stream parameters of a previous open, see stream_cache.h */
+  bool fast_start;          /**< skip the video before the first key frame and show the first
+                                 picture as soon as it is decoded, before A/V sync settles */
+  int video_stream;         /**< stream index, or FFW_STREAM_AUTO */
+  int audio_stream;         /**< stream index, FFW_STREAM_AUTO or FFW_STREAM_NONE */
+  ffw_sync_master_t sync_master;
+  ffw_seek_mode_t seek_mode;
+  bool keyframe_index;      /**< local recordings: seek through a key frame index kept in a sidecar
+                                 file, see kf_index.h */
+  int frame_cache_mb;       /**< decoded frames kept for seeks back to places already visited, MB,
+                                 0 = none, see frame_cache.h */
+  int frame_cache_width;    /**< frames cached downscaled to this width, 0 = as decoded */
+  bool live_pause_buffer;   /**< live sources keep being read while paused, up to the packet queue
+                                 limits, instead of being paused at the source */
+  ffw_hidden_mode_t hidden_mode;
+  ffw_focus_t focus;        /**< at start, see ffw_set_focus() */
+  ffw_focus_profile_t grid_profile; /**< small, cheap: defaults to 640x360, 15 fps, no B frames, fast scaler */
+  ffw_focus_profile_t full_profile; /**< defaults to as decoded, every frame, quality scaler */
+  compositor_h compositor;  /**< draw into this compositor from the first frame, NULL (default) for
+                                 an own window, see ffw_set_compositor() */
+  int compositor_cell;      /**< cell in it, ffw_open_batch() can give one per player */
+} ffw_options_t;
+
+/**
+ * Start up timing, all in ms. Each one is 0 until reached.
+ */
+typedef struct ffw_startup_stats_st {
+  double  queued_ms;      /**< creation to probing start (waiting for a batch slot) */
+  double  probe_ms;       /**< open + find stream info */
+  double  ready_ms;       /**< creation to MSG_ID__READY */
+  double  first_frame_ms; /**< creation to the first picture displayed */
+  bool    stream_cached;  /**< stream parameters from the cache: no deep probing */
+  int     skipped_packets;/**< video packets before the first key frame (fast start) */
+} ffw_startup_stats_t;
+
+struct probe_gate_st;
+
 typedef struct ffwplayer_st {
   char          url[MAX_URL_LEN + 1];
   msg_thread_h  msg_th;
   msg_thread_h  parent_msg_th;
   void *        private_data;
   void *        client_data;
+  compositor_h  compositor;     /**< when set frames are drawn into this compositor cell */
+  int           compositor_cell;
+  pthread_mutex_t compositor_mutex; /**< compositor and compositor_cell, see ffw_set_compositor() */
+  volatile scaler_profile_t scaler_profile;
+  volatile ffw_focus_t focus;
+  ffw_options_t options;
+
+  // open handshake
+  pthread_mutex_t           open_mutex;
+  pthread_cond_t            open_cond;
+  volatile ffw_open_state_t open_state;
+  int                       open_error;   /**< AVERROR code when failed */
+  ffw_stream_info_t         info;         /**< valid once ready */
+
+  // start up
+  struct probe_gate_st *    probe_gate;   /**< batch probing limit, see ffw_open_batch() */
+  int64_t                   created_time;
+  int64_t                   probe_start_time;
+  ffw_startup_stats_t       startup;
 } ffwplayer_t;
 
+/**
+ * Timing of one stage of the video pipeline (decode -> convert -> display).
+ */
+typedef struct ffw_stage_stats_st {
+  uint64_t  frames;     /**< frames processed */
+  double    avg_ms;     /**< moving average of the work per frame */
+  double    total_ms;   /**< work, queue waits excluded */
+  double    wait_ms;    /**< time blocked on the next stage (its queue full) */
+} ffw_stage_stats_t;
+
+/**
+ * Seeking, see ffw_get_stats(). Requests made while one is pending replace it:
+ * only the newest target is executed.
+ */
+typedef struct ffw_seek_stats_st {
+  uint64_t  requests;   /**< seek requests received */
+  uint64_t  coalesced;  /**< requests replaced by a newer one before being executed */
+  uint64_t  executed;   /**< seeks done by the demuxer */
+  uint64_t  failed;     /**< seeks the demuxer could not do */
+  uint64_t  shown;      /**< seeks whose first picture reached the screen */
+  uint64_t  skipped_frames; /**< decoded but not shown on the way to accurate seek targets */
+  double    last_ms;    /**< request to the first picture of the new position on the screen */
+  double    avg_ms;     /**< moving average of last_ms */
+  double    last_error_ms;  /**< first picture shown minus the target of the last seek */
+  int       indexed_keyframes; /**< key frames the seeks go through, 0 until the index is ready */
+} ffw_seek_stats_t;
+
+/**
+ * Playback speed and trick play, see ffw_set_speed(), ffw_set_trick_speed()
+ * and ffw_get_stats().
+ */
+typedef struct ffw_trick_stats_st {
+  double    speed;      /**< current speed, 1 when playing normally */
+  uint64_t  keyframes;  /**< lone key frames decoded (fast forward, fast reverse) */
+  uint64_t  gops;       /**< GOPs decoded to be played backward (slow reverse) */
+  uint64_t  gop_dropped_frames; /**< slow reverse: frames of GOPs too long for the GOP buffer, not shown */
+  uint64_t  late_steps; /**< key frame steps not taken: the decoder was still busy */
+  uint64_t  dropped_frames; /**< faster than 1x: decoded frames already late, not converted */
+  double    tempo_load; /**< audio time stretching time over the audio duration */
+} ffw_trick_stats_t;
+
+/**
+ * Hidden players, see ffw_set_visible() and ffw_get_stats().
+ */
+typedef struct ffw_visibility_stats_st {
+  bool      hidden;     /**< currently */
+  uint64_t  hides;      /**< times hidden */
+  double    hidden_ms;  /**< total time hidden */
+  uint64_t  keyframes;  /**< key frames decoded while hidden (FFW_HIDDEN_KEYFRAMES) */
+  uint64_t  dropped_packets; /**< video packets read while hidden and dropped with their GOP, undecoded */
+  uint64_t  catch_up_frames; /**< decoded but not shown when shown again, on the way to the clock */
+  double    last_show_ms;   /**< request to the picture handed to the screen */
+} ffw_visibility_stats_t;
+
+/**
+ * Focus profiles, see ffw_set_focus() and ffw_get_stats().
+ */
+typedef struct ffw_focus_stats_st {
+  ffw_focus_t focus;      /**< currently */
+  uint64_t  switches;     /**< focus changes */
+  uint64_t  capped_frames;/**< decoded but not converted: above the max_fps of the profile */
+  int       picture_width;  /**< own output: size of the last picture converted */
+  int       picture_height;
+} ffw_focus_stats_t;
+
+/**
+ * Player statistics, see ffw_get_stats().
+ */
+typedef struct ffw_stats_st {
+  uint64_t        scaled_frames;  /**< pictures converted/scaled */
+  double          scale_total_ms; /**< time spent converting/scaling */
+  double          scale_avg_ms;   /**< moving average per picture */
+  scaler_stats_t  scaler;         /**< scaler doing the output scaling (profile, flags, load) */
+  ffw_stage_stats_t decode;       /**< decoding */
+  ffw_stage_stats_t convert;      /**< conversion into display-ready pictures */
+  double          present_latency_ms; /**< handoff to on-screen delay (SDL output) */
+  ffw_startup_stats_t startup;    /**< time to first frame */
+  ffw_seek_stats_t seek;          /**< seek latency */
+  frame_cache_stats_t frame_cache;/**< decoded frame cache hit rate and memory use */
+  ffw_trick_stats_t trick;        /**< fast forward and reverse */
+  ffw_visibility_stats_t visibility; /**< hidden */
+  ffw_focus_stats_t focus;        /**< grid or full screen quality */
+} ffw_stats_t;
+
 /**
  * Queue structure used to store processed video frames.
  */
@@ -82,6 +327,9 @@ typedef struct VideoPicture {
   int height;
   int allocated;
   double pts;
+  int serial;         /**< seek serial the picture was decoded in */
+  AVFrame * decoded;  /**< reference to the decoded frame, converted by the compositor at display time */
+  AVFrame * source;   /**< reference to the decoded frame, the snapshot of the picture once shown */
 } VideoPicture;
 
 #ifdef __cplusplus
@@ -94,11 +342,196 @@ typedef struct VideoPicture {
  */
 void ffwplayer_init(void);
 
+/**
+ * @brief creates a player and starts opening the url. Returns right away: the
+ *        outcome is posted to parent_msg_th (if not NULL) as MSG_ID__READY or
+ *        MSG_ID__FAILED, or can be waited for with ffw_wait_ready().
+ */
 ffwplayer_t * ffw_create_player(char * url, msg_thread_h parent_msg_th, void * client_data);
+
+/**
+ * @brief same as ffw_create_player() with explicit options (NULL for the defaults).
+ */
+ffwplayer_t * ffw_create_player_ex(char * url, msg_thread_h parent_msg_th, void * client_data,
+                                   const ffw_options_t * options);
+
+/**
+ * @brief creates count players at once. They all open in parallel, but no more
+ *        than max_parallel_probes of them are probing (open + find stream
+ *        info) at the same time, so a wall of cameras comes up in about the
+ *        time of the slowest ones instead of the sum of all of them.
+ *
+ * @param client_data         per player client data, may be NULL
+ * @param compositor_cells    per player cell in options->compositor, NULL for
+ *                            options->compositor_cell
+ * @param max_parallel_probes 0 for no limit
+ * @param players             receives the players, NULL for the ones that
+ *                            could not be created
+ *
+ * @return number of players created
+ */
+int ffw_open_batch(char * urls[], int count, msg_thread_h parent_msg_th, void * client_data[],
+                   const ffw_options_t * options, const int compositor_cells[],
+                   int max_parallel_probes, ffwplayer_t * players[]);
+
+/**
+ * @brief fills the options with their default values. Always start from them,
+ *        the streams are not selected by a 0 index.
+ */
+void ffw_default_options(ffw_options_t * options);
+
+/**
+ * @brief blocks until the player is ready, failed or the timeout expired.
+ *
+ * @return FFW_OPEN_PENDING on timeout
+ */
+ffw_open_state_t ffw_wait_ready(ffwplayer_t * ffw_t, int timeout_ms);
 bool ffw_seek_relative(ffwplayer_t * ffw_t, int val);
 bool ffw_destroy(ffwplayer_t * ffw_t);
+
+/**
+ * @brief pauses: the clocks freeze, the picture on the screen stays, the
+ *        audio device is paused and nothing is read (network sources are
+ *        paused at the source, see ffw_options_t.live_pause_buffer). All the
+ *        player threads sleep until resumed. Seeks made while paused are
+ *        done right away and shown on resume.
+ */
+bool ffw_pause(ffwplayer_t * ffw_t);
+
+/**
+ * @brief resumes after ffw_pause() or ffw_stop().
+ */
+bool ffw_resume(ffwplayer_t * ffw_t);
+
+/**
+ * @brief pauses and rewinds to the start (recordings): ffw_resume() plays
+ *        from there. The player stays open.
+ */
+bool ffw_stop(ffwplayer_t * ffw_t);
+/**
+ * @brief mutes/unmutes the audio. While muted the audio stream is not even
+ *        read (the video follows its own clock); unmuting resumes it in sync.
+ */
 void ffw_mute(ffwplayer_t * ffw_t, bool mute);
 
+/**
+ * @brief draws the player frames into a compositor cell instead of its own
+ *        window (SDL) or widget (Qt). NULL detaches it. To start in a
+ *        compositor set it in ffw_options_t: the output is picked when the
+ *        video stream opens, before this call can be made.
+ */
+void ffw_set_compositor(ffwplayer_t * ffw_t, compositor_h comp, int cell);
+
+/**
+ * @brief pins the scaling profile (SCALER_PROFILE_AUTO by default: picked from
+ *        the scale ratio and the CPU load). Takes effect on the next frame.
+ */
+void ffw_set_scaler_profile(ffwplayer_t * ffw_t, scaler_profile_t profile);
+
+/**
+ * @brief changes the seek mode (ffw_options_t.seek_mode). Takes effect on the
+ *        next seek.
+ */
+void ffw_set_seek_mode(ffwplayer_t * ffw_t, ffw_seek_mode_t mode);
+
+/**
+ * @brief plays slower or faster, 0.5 to 2 times the normal speed. The clocks
+ *        run at that speed; the audio is time stretched (its pitch kept), the
+ *        video repeats or drops frames to follow it. Ends trick play.
+ *
+ * @return false if out of range or the request could not be posted
+ */
+bool ffw_set_speed(ffwplayer_t * ffw_t, double speed);
+
+/**
+ * @brief fast forward and reverse: 1 plays normally, 2, 4, 8 or 16 forward,
+ *        -1, -2, -4, -8 or -16 backward. The audio is muted while not at 1 or
+ *        2 (time stretched, see ffw_set_speed()).
+ *
+ *        2x decodes every frame. Above that, forward or backward, only key
+ *        frames are decoded, found through the index of the recording, a few
+ *        per second whatever the speed. -1 and -2 decode each GOP, keep its
+ *        frames as decoded and show them backward. Back to 1, playback
+ *        resumes from the picture on the screen.
+ *
+ * @return false if the speed is not one of these or the request could not be
+ *         posted
+ */
+bool ffw_set_trick_speed(ffwplayer_t * ffw_t, int speed);
+
+/**
+ * @brief pauses and shows the next (+1) or the previous (-1) frame. Forward,
+ *        the frames come as when playing; backward, the previous frame is
+ *        decoded from the key frame before it (accurate seek), unless the
+ *        frame cache has it: the frames decoded on the way are cached, so
+ *        stepping back through a GOP decodes it once.
+ *
+ * @return false if the request could not be posted
+ */
+bool ffw_step_frame(ffwplayer_t * ffw_t, int direction);
+
+/**
+ * @brief the frame on the screen, as decoded (size and pixel format of the
+ *        stream). Returns right away, unless the picture on the screen is a
+ *        downscaled copy from the frame cache (seek or step back served from
+ *        it): the frame is then decoded from the recording, a GOP at most.
+ *
+ * @param pts   receives its pts (seconds), may be NULL
+ *
+ * @return a new reference, to be freed with av_frame_free(), NULL if nothing
+ *         was shown yet
+ */
+struct AVFrame * ffw_snapshot(ffwplayer_t * ffw_t, double * pts);
+
+/**
+ * @brief takes a snapshot in the background: the frame on the screen (pts
+ *        NAN) or the one showing at pts in a recording, taken from the frame
+ *        cache or else decoded on its own without disturbing the playback.
+ *        Encoded and written to path if asked. The result is posted to the
+ *        parent as MSG_ID__SNAPSHOT. See snapshot.h.
+ *
+ * @param pts       seconds, NAN for the frame on the screen
+ * @param format    SNAPSHOT_RAW for the decoded frame only
+ * @param path      file to write the picture to, NULL for none
+ * @param user_data snapshot_t user_data
+ *
+ * @return false if nothing was shown yet (pts NAN) or the request could not
+ *         be queued
+ */
+bool ffw_snapshot_request(ffwplayer_t * ffw_t, double pts, snapshot_format_t format, const char * path,
+                          void * user_data);
+
+/**
+ * @brief switches the quality profile to where the player is shown: a cell of
+ *        the grid (FFW_FOCUS_GRID) or the whole screen (FFW_FOCUS_FULL), see
+ *        ffw_options_t.grid_profile and full_profile. Returns right away; the
+ *        next frame decoded is decoded, converted and shown with the new
+ *        profile, by the same decoder.
+ */
+void ffw_set_focus(ffwplayer_t * ffw_t, ffw_focus_t focus);
+
+/**
+ * @brief tells whether the player can be seen (its cell hidden, covered or the
+ *        window minimized): hidden, it stops converting and presenting, and
+ *        decodes the key frames only or nothing, see
+ *        ffw_options_t.hidden_mode. The audio goes on. The demuxer keeps the
+ *        video from the last key frame on, read no faster than the clock.
+ *
+ *        Shown again, the key frame goes to the screen at once and the rest
+ *        of its GOP is decoded silently up to the clock, from where playback
+ *        goes on. Trick play is not affected. Applied on resume if paused.
+ *
+ * @return false if the request could not be posted
+ */
+bool ffw_set_visible(ffwplayer_t * ffw_t, bool visible);
+
+/**
+ * @brief snapshot of the player statistics.
+ *
+ * @return false if the player is not running yet
+ */
+bool ffw_get_stats(ffwplayer_t * ffw_t, ffw_stats_t * stats);
+
 #ifdef __cplusplus
   }
 #endif
@@ -0,0 +1,240 @@
+/******************************************
+ *
+ * Decoded frame cache
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+#include <libavutil/common.h>
+#include <libavutil/frame.h>
+#include <libavutil/mem.h>
+
+#include "frame_cache.h"
+#include "scaler.h"
+#include "log.h"
+
+#define FRAME_CACHE_MAX_FRAMES    1024
+#define FRAME_CACHE_PTS_EPSILON   0.0001    /**< same frame (pts rounding) */
+
+typedef struct cached_frame_st {
+  AVFrame *             frame;          /**< NULL if the slot is free */
+  double                pts;
+  double                duration;
+  size_t                bytes;
+  uint64_t              last_use;
+} cached_frame_t;
+
+struct frame_cache_st {
+  pthread_mutex_t       mutex;
+  cached_frame_t        frames[FRAME_CACHE_MAX_FRAMES];
+  int                   max_width;
+  scaler_h              scaler;         /**< downscaling, created on first use */
+  uint64_t              use_counter;
+  frame_cache_stats_t   stats;
+};
+
+static size_t frame_bytes(const AVFrame * frame)
+{
+  size_t bytes = 0;
+
+  for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++) {
+    bytes += frame->buf[i]->size;
+  }
+  return bytes;
+}
+
+static void free_slot(frame_cache_h fc, cached_frame_t * slot)
+{
+  fc->stats.bytes -= slot->bytes;
+  fc->stats.frames--;
+  av_frame_free(&slot->frame);
+  memset(slot, 0, sizeof(cached_frame_t));
+}
+
+/**
+ * Frees the least recently used frame.
+ *
+ * @return false if there was none
+ */
+static bool evict(frame_cache_h fc)
+{
+  cached_frame_t * lru = NULL;
+
+  for (int i = 0; i < FRAME_CACHE_MAX_FRAMES; i++) {
+    if (fc->frames[i].frame && ( ! lru || fc->frames[i].last_use < lru->last_use)) {
+      lru = &fc->frames[i];
+    }
+  }
+  if ( ! lru) {
+    return false;
+  }
+  free_slot(fc, lru);
+  fc->stats.evictions++;
+  return true;
+}
+
+static cached_frame_t * find_free_slot(frame_cache_h fc)
+{
+  for (int i = 0; i < FRAME_CACHE_MAX_FRAMES; i++) {
+    if ( ! fc->frames[i].frame) {
+      return &fc->frames[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Copy of a frame scaled down to the cache width, same pixel format.
+ */
+static AVFrame * downscale(frame_cache_h fc, const AVFrame * src)
+{
+  AVFrame * dst = av_frame_alloc();
+
+  if ( ! dst) {
+    return NULL;
+  }
+  dst->format = src->format;
+  dst->width = fc->max_width & ~1;
+  dst->height = (int) ((int64_t) src->height * fc->max_width / src->width) & ~1;
+  if (dst->height <= 0 || av_frame_get_buffer(dst, 0) < 0 ||
+      ( ! fc->scaler && ! (fc->scaler = scaler_create(1)))) {
+    av_frame_free(&dst);
+    return NULL;
+  }
+
+  scaler_set_colorspace(fc->scaler, src->colorspace, src->color_range);
+  if (scaler_convert(fc->scaler,
+                     (const uint8_t * const *) src->data, src->linesize,
+                     src->width, src->height, src->format,
+                     dst->data, dst->linesize,
+                     dst->width, dst->height, dst->format) < 0) {
+    av_frame_free(&dst);
+    return NULL;
+  }
+  av_frame_copy_props(dst, src);
+  return dst;
+}
+
+frame_cache_h frame_cache_create(size_t budget, int max_width)
+{
+  frame_cache_h fc = av_mallocz(sizeof(struct frame_cache_st));
+
+  if ( ! fc) {
+    return NULL;
+  }
+  pthread_mutex_init(&fc->mutex, NULL);
+  fc->max_width = max_width;
+  fc->stats.budget = budget;
+  return fc;
+}
+
+void frame_cache_destroy(frame_cache_h fc)
+{
+  if ( ! fc) {
+    return;
+  }
+  frame_cache_clear(fc);
+  scaler_destroy(fc->scaler);
+  pthread_mutex_destroy(&fc->mutex);
+  av_free(fc);
+}
+
+bool frame_cache_put(frame_cache_h fc, const AVFrame * frame, double pts, double duration)
+{
+  cached_frame_t * slot;
+  AVFrame * copy;
+  size_t bytes;
+
+  pthread_mutex_lock(&fc->mutex);
+
+  // already there: decoded again while playing the same part once more
+  for (int i = 0; i < FRAME_CACHE_MAX_FRAMES; i++) {
+    if (fc->frames[i].frame && fabs(fc->frames[i].pts - pts) < FRAME_CACHE_PTS_EPSILON) {
+      fc->frames[i].last_use = ++fc->use_counter;
+      pthread_mutex_unlock(&fc->mutex);
+      return true;
+    }
+  }
+
+  if (fc->max_width > 0 && frame->width > fc->max_width) {
+    copy = downscale(fc, frame);
+  } else if ((copy = av_frame_alloc()) && av_frame_ref(copy, frame) < 0) {
+    av_frame_free(&copy);
+  }
+  if ( ! copy) {
+    pthread_mutex_unlock(&fc->mutex);
+    return false;
+  }
+
+  bytes = frame_bytes(copy);
+  if (bytes > fc->stats.budget) {
+    av_frame_free(&copy);
+    pthread_mutex_unlock(&fc->mutex);
+    return false;
+  }
+  while (fc->stats.bytes + bytes > fc->stats.budget || ! (slot = find_free_slot(fc))) {
+    evict(fc);
+  }
+
+  slot->frame = copy;
+  slot->pts = pts;
+  slot->duration = duration;
+  slot->bytes = bytes;
+  slot->last_use = ++fc->use_counter;
+  fc->stats.bytes += bytes;
+  fc->stats.frames++;
+
+  pthread_mutex_unlock(&fc->mutex);
+  return true;
+}
+
+bool frame_cache_get(frame_cache_h fc, double pts, double distance, AVFrame * frame, double * frame_pts)
+{
+  cached_frame_t * best = NULL;
+  bool found = false;
+
+  pthread_mutex_lock(&fc->mutex);
+
+  for (int i = 0; i < FRAME_CACHE_MAX_FRAMES; i++) {
+    cached_frame_t * c = &fc->frames[i];
+    if (c->frame && c->pts <= pts + FRAME_CACHE_PTS_EPSILON && pts < c->pts + FFMAX(c->duration, distance) &&
+        ( ! best || c->pts > best->pts)) {
+      best = c;
+    }
+  }
+
+  if (best && av_frame_ref(frame, best->frame) == 0) {
+    best->last_use = ++fc->use_counter;
+    *frame_pts = best->pts;
+    found = true;
+    fc->stats.hits++;
+  } else {
+    fc->stats.misses++;
+  }
+
+  pthread_mutex_unlock(&fc->mutex);
+  return found;
+}
+
+void frame_cache_clear(frame_cache_h fc)
+{
+  pthread_mutex_lock(&fc->mutex);
+  for (int i = 0; i < FRAME_CACHE_MAX_FRAMES; i++) {
+    if (fc->frames[i].frame) {
+      free_slot(fc, &fc->frames[i]);
+    }
+  }
+  pthread_mutex_unlock(&fc->mutex);
+}
+
+void frame_cache_get_stats(frame_cache_h fc, frame_cache_stats_t * stats)
+{
+  pthread_mutex_lock(&fc->mutex);
+  *stats = fc->stats;
+  pthread_mutex_unlock(&fc->mutex);
+}
@@ -0,0 +1,93 @@
+/******************************************
+ *
+ * Decoded frame cache
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * @file
+ * @brief frame_cache
+ *
+ * Decoded video frames of a player kept by pts within a memory budget, the
+ * least recently used ones going first. Players store the key frames they
+ * decode and the frames seeks land on, so that scrubbing back to a place
+ * already visited, or stepping backward, shows a picture without seeking and
+ * decoding the GOP again.
+ *
+ * Frames can be kept downscaled: more of them fit in the budget, at the price
+ * of a softer picture until the decoder catches up.
+ *
+ * Thread safe.
+ *
+ */
+
+struct AVFrame;
+
+typedef struct frame_cache_st * frame_cache_h;  /**< opaque definition for the frame cache handle */
+
+typedef struct frame_cache_stats_st {
+  uint64_t  hits;       /**< lookups served */
+  uint64_t  misses;     /**< lookups not served */
+  uint64_t  evictions;  /**< frames dropped to stay within the budget */
+  int       frames;     /**< frames kept */
+  size_t    bytes;      /**< memory taken by the frames kept */
+  size_t    budget;     /**< memory allowed */
+} frame_cache_stats_t;
+
+#ifdef __cplusplus
+  extern "C" {
+#endif
+
+/**
+ * @brief creates a cache.
+ *
+ * @param budget      bytes the frames may take
+ * @param max_width   wider frames are downscaled to this width, 0 keeps them as
+ *                    decoded
+ */
+frame_cache_h frame_cache_create(size_t budget, int max_width);
+void frame_cache_destroy(frame_cache_h fc);
+
+/**
+ * @brief stores a frame, replacing the one at the same pts if any. The frame
+ *        is referenced (or copied when downscaled), the caller keeps its own.
+ *
+ * @param pts       presentation time, seconds
+ * @param duration  time it stays on the screen, seconds
+ *
+ * @return false if not stored (larger than the budget, no memory)
+ */
+bool frame_cache_put(frame_cache_h fc, const struct AVFrame * frame, double pts, double duration);
+
+/**
+ * @brief the frame on the screen at a given time: the one whose pts is the
+ *        closest at or before it and still showing then, or else not further
+ *        before it than a given distance.
+ *
+ * @param pts       seconds
+ * @param distance  seconds, 0 for the frame showing at pts only
+ * @param frame     blank frame receiving a reference
+ * @param frame_pts pts of the frame found
+ *
+ * @return true if found
+ */
+bool frame_cache_get(frame_cache_h fc, double pts, double distance, struct AVFrame * frame, double * frame_pts);
+
+/**
+ * @brief drops all the frames.
+ */
+void frame_cache_clear(frame_cache_h fc);
+
+void frame_cache_get_stats(frame_cache_h fc, frame_cache_stats_t * stats);
+
+#ifdef __cplusplus
+  }
+#endif
@@ -0,0 +1,385 @@
+/******************************************
+ *
+ * Key frame index
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <libavformat/avformat.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+#include "kf_index.h"
+#include "msg_thread.h"
+#include "log.h"
+
+#define KFI_PATH_LEN          1024
+#define KFI_FILE_MAGIC        0x494b5746      /**< "FWKI" */
+#define KFI_FILE_VERSION      1
+#define KFI_MAX_ENTRIES       (16 * 1024 * 1024)
+#define KFI_THREAD_PRIORITY   1               /**< below the players: it only reads ahead of a seek */
+
+typedef struct kf_entry_st {
+  int64_t               timestamp;      /**< dts (pts if none), stream time base */
+  int64_t               pos;            /**< byte offset of the packet */
+  int32_t               size;
+  int32_t               reserved;
+} kf_entry_t;
+
+typedef struct kfi_file_header_st {
+  uint32_t              magic;
+  uint32_t              version;
+  uint32_t              entry_size;     /**< sizeof(kf_entry_t): layout check */
+  int32_t               stream_index;
+  int32_t               nb_streams;
+  int32_t               codec_id;
+  int32_t               time_base_num;
+  int32_t               time_base_den;
+  int64_t               size;
+  int64_t               mtime;
+  int64_t               count;
+} kfi_file_header_t;
+
+struct kf_index_st {
+  char                  path[KFI_PATH_LEN];     /**< the recording */
+  char                  sidecar[KFI_PATH_LEN + 32];
+  int                   stream_index;
+  int                   nb_streams;
+  enum AVCodecID        codec_id;
+  AVRational            time_base;
+  int64_t               size;
+  int64_t               mtime;
+
+  kf_entry_t *          entries;
+  int                   count;
+  int                   allocated;
+
+  pthread_t             thread;
+  bool                  building;
+  atomic_bool           abort;
+  atomic_bool           ready;
+};
+
+static pthread_mutex_t  dir_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char             sidecar_dir[KFI_PATH_LEN];
+
+/**
+ * Size and modification time of a local file.
+ *
+ * @return false if it is not a regular file
+ */
+static bool file_stamp(const char * path, int64_t * size, int64_t * mtime)
+{
+  struct stat st;
+
+  if (stat(path, &st) != 0 || ! S_ISREG(st.st_mode)) {
+    return false;
+  }
+  *size = st.st_size;
+  *mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  return true;
+}
+
+static void sidecar_path(kf_index_h kf)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;  // FNV-1a
+
+  pthread_mutex_lock(&dir_mutex);
+  if (sidecar_dir[0]) {
+    for (const char * c = kf->path; *c; c++) {
+      hash = (hash ^ (uint8_t) *c) * 0x100000001b3ULL;
+    }
+    snprintf(kf->sidecar, sizeof(kf->sidecar), "%s/%016" PRIx64 ".ffki", sidecar_dir, hash);
+  } else {
+    snprintf(kf->sidecar, sizeof(kf->sidecar), "%s.ffki", kf->path);
+  }
+  pthread_mutex_unlock(&dir_mutex);
+}
+
+static bool add_entry(kf_index_h kf, int64_t timestamp, int64_t pos, int size)
+{
+  if (kf->count == kf->allocated) {
+    int allocated = kf->allocated ? kf->allocated * 2 : 1024;
+    kf_entry_t * entries;
+
+    if (allocated > KFI_MAX_ENTRIES ||
+        ! (entries = av_realloc_array(kf->entries, allocated, sizeof(kf_entry_t)))) {
+      return false;
+    }
+    kf->entries = entries;
+    kf->allocated = allocated;
+  }
+
+  kf->entries[kf->count].timestamp = timestamp;
+  kf->entries[kf->count].pos = pos;
+  kf->entries[kf->count].size = size;
+  kf->entries[kf->count].reserved = 0;
+  kf->count++;
+  return true;
+}
+
+static void save_sidecar(kf_index_h kf)
+{
+  char tmp[KFI_PATH_LEN + 40];
+  kfi_file_header_t hdr;
+  bool ok;
+  FILE * f;
+  int fd;
+
+  // a temp file of its own: players opening the same recording may be
+  // saving the sidecar at the same time, the last rename wins
+  snprintf(tmp, sizeof(tmp), "%s.XXXXXX", kf->sidecar);
+  if ((fd = mkstemp(tmp)) < 0) {
+    LOG_W("key frame index: could not write %s", tmp);
+    return;
+  }
+  fchmod(fd, 0644);
+  if ( ! (f = fdopen(fd, "wb"))) {
+    LOG_W("key frame index: could not write %s", tmp);
+    close(fd);
+    remove(tmp);
+    return;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = KFI_FILE_MAGIC;
+  hdr.version = KFI_FILE_VERSION;
+  hdr.entry_size = sizeof(kf_entry_t);
+  hdr.stream_index = kf->stream_index;
+  hdr.nb_streams = kf->nb_streams;
+  hdr.codec_id = kf->codec_id;
+  hdr.time_base_num = kf->time_base.num;
+  hdr.time_base_den = kf->time_base.den;
+  hdr.size = kf->size;
+  hdr.mtime = kf->mtime;
+  hdr.count = kf->count;
+  ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+       fwrite(kf->entries, sizeof(kf_entry_t), kf->count, f) == kf->count;
+
+  if (fclose(f) != 0 || ! ok || rename(tmp, kf->sidecar) != 0) {
+    LOG_W("key frame index: could not write %s", kf->sidecar);
+    remove(tmp);
+  }
+}
+
+/**
+ * Loads the sidecar of the recording, if there is one made for it as it is
+ * now.
+ */
+static bool load_sidecar(kf_index_h kf)
+{
+  kfi_file_header_t hdr;
+  FILE * f;
+
+  if ( ! (f = fopen(kf->sidecar, "rb"))) {
+    return false;
+  }
+
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+      hdr.magic != KFI_FILE_MAGIC || hdr.version != KFI_FILE_VERSION ||
+      hdr.entry_size != sizeof(kf_entry_t) ||
+      hdr.stream_index != kf->stream_index ||
+      hdr.size != kf->size || hdr.mtime != kf->mtime ||
+      hdr.count <= 0 || hdr.count > KFI_MAX_ENTRIES ||
+      hdr.time_base_num <= 0 || hdr.time_base_den <= 0) {
+    fclose(f);
+    return false;
+  }
+
+  if ( ! (kf->entries = av_malloc_array(hdr.count, sizeof(kf_entry_t))) ||
+       fread(kf->entries, sizeof(kf_entry_t), hdr.count, f) != hdr.count) {
+    fclose(f);
+    av_freep(&kf->entries);
+    return false;
+  }
+  fclose(f);
+
+  kf->count = kf->allocated = hdr.count;
+  kf->nb_streams = hdr.nb_streams;
+  kf->codec_id = hdr.codec_id;
+  kf->time_base = (AVRational) { hdr.time_base_num, hdr.time_base_den };
+  return true;
+}
+
+static int build_interrupt(void * opaque)
+{
+  kf_index_h kf = (kf_index_h) opaque;
+
+  return atomic_load(&kf->abort);
+}
+
+/**
+ * Reads the whole recording with a demuxer of its own, taking note of the key
+ * frames of the stream.
+ */
+static void * build_thread(void * arg)
+{
+  kf_index_h kf = (kf_index_h) arg;
+  AVFormatContext * fmt = avformat_alloc_context();
+  AVPacket * packet = av_packet_alloc();
+  int64_t start = av_gettime_relative();
+  int ret = AVERROR(ENOMEM);
+
+  if ( ! fmt || ! packet) {
+    goto done;
+  }
+
+  // closing the player stops the build, even in the middle of a read
+  fmt->interrupt_callback.callback = build_interrupt;
+  fmt->interrupt_callback.opaque = kf;
+  if ((ret = avformat_open_input(&fmt, kf->path, NULL, NULL)) < 0) {
+    goto done; // fmt freed
+  }
+  if ((ret = avformat_find_stream_info(fmt, NULL)) < 0) {
+    goto done;
+  }
+  if (kf->stream_index >= fmt->nb_streams ||
+      fmt->streams[kf->stream_index]->codecpar->codec_type != AVMEDIA_TYPE_VIDEO) {
+    ret = AVERROR(EINVAL);
+    goto done;
+  }
+
+  kf->nb_streams = fmt->nb_streams;
+  kf->codec_id = fmt->streams[kf->stream_index]->codecpar->codec_id;
+  kf->time_base = fmt->streams[kf->stream_index]->time_base;
+  for (int i = 0; i < fmt->nb_streams; i++) {
+    fmt->streams[i]->discard = i == kf->stream_index ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+  }
+
+  while ((ret = av_read_frame(fmt, packet)) >= 0) {
+    if (packet->stream_index == kf->stream_index && (packet->flags & AV_PKT_FLAG_KEY) && packet->pos >= 0) {
+      int64_t timestamp = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+      if (timestamp != AV_NOPTS_VALUE && ! add_entry(kf, timestamp, packet->pos, packet->size)) {
+        ret = AVERROR(ENOMEM);
+        av_packet_unref(packet);
+        break;
+      }
+    }
+    av_packet_unref(packet);
+  }
+
+done:
+  if (fmt) {
+    avformat_close_input(&fmt);
+  }
+  av_packet_free(&packet);
+
+  if (ret == AVERROR_EOF && kf->count > 0) {
+    LOG_I("%s: %d key frames indexed in %.1f s", kf->path, kf->count,
+          (av_gettime_relative() - start) / 1000000.0);
+    save_sidecar(kf);
+    atomic_store(&kf->ready, true);
+  } else if ( ! atomic_load(&kf->abort)) {
+    LOG_W("%s: could not index the key frames (%d)", kf->path, ret);
+  }
+  return NULL;
+}
+
+void kf_index_set_dir(const char * dir)
+{
+  pthread_mutex_lock(&dir_mutex);
+  snprintf(sidecar_dir, sizeof(sidecar_dir), "%s", dir ? dir : "");
+  pthread_mutex_unlock(&dir_mutex);
+}
+
+kf_index_h kf_index_open(const char * url, int stream_index)
+{
+  kf_index_h kf;
+
+  if (strncmp(url, "file:", 5) == 0) {
+    url += 5;
+  } else if (strstr(url, "://")) {
+    return NULL; // network sources are not indexed
+  }
+
+  if ( ! (kf = av_mallocz(sizeof(struct kf_index_st)))) {
+    return NULL;
+  }
+  snprintf(kf->path, sizeof(kf->path), "%s", url);
+  kf->stream_index = stream_index;
+  atomic_init(&kf->abort, false);
+  atomic_init(&kf->ready, false);
+  if ( ! file_stamp(kf->path, &kf->size, &kf->mtime)) {
+    av_free(kf);
+    return NULL;
+  }
+  sidecar_path(kf);
+
+  if (load_sidecar(kf)) {
+    LOG_I("%s: %d key frames from %s", kf->path, kf->count, kf->sidecar);
+    atomic_store(&kf->ready, true);
+    return kf;
+  }
+
+  kf->thread = ffw_create_thread("kf_index_thread", 0, KFI_THREAD_PRIORITY, build_thread, kf, false);
+  if (kf->thread == -1) {
+    LOG_E("Could not start the key frame index thread.");
+    av_free(kf);
+    return NULL;
+  }
+  kf->building = true;
+  return kf;
+}
+
+bool kf_index_ready(kf_index_h kf)
+{
+  return atomic_load(&kf->ready);
+}
+
+int kf_index_apply(kf_index_h kf, struct AVFormatContext * fmt)
+{
+  AVStream * st;
+  size_t needed;
+  int added = 0;
+
+  if ( ! atomic_load(&kf->ready)) {
+    return 0;
+  }
+  if (fmt->nb_streams != kf->nb_streams || kf->stream_index >= fmt->nb_streams) {
+    return -1;
+  }
+  st = fmt->streams[kf->stream_index];
+  if (st->codecpar->codec_id != kf->codec_id) {
+    return -1;
+  }
+
+  // the demuxer drops index entries past max_index_size
+  needed = (kf->count + avformat_index_get_entries_count(st) + 1) * sizeof(AVIndexEntry);
+  if (fmt->max_index_size < needed) {
+    fmt->max_index_size = needed;
+  }
+
+  for (int i = 0; i < kf->count; i++) {
+    kf_entry_t * e = &kf->entries[i];
+    if (av_add_index_entry(st, e->pos, av_rescale_q(e->timestamp, kf->time_base, st->time_base),
+                           e->size, 0, AVINDEX_KEYFRAME) < 0) {
+      break;
+    }
+    added++;
+  }
+  return added;
+}
+
+void kf_index_close(kf_index_h kf)
+{
+  if ( ! kf) {
+    return;
+  }
+  if (kf->building) {
+    atomic_store(&kf->abort, true);
+    pthread_join(kf->thread, NULL);
+  }
+  av_freep(&kf->entries);
+  av_free(kf);
+}
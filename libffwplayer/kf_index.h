@@ -0,0 +1,77 @@
+/******************************************
+ *
+ * Key frame index
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * @file
+ * @brief kf_index
+ *
+ * Index of the key frames of the video stream of a local recording: timestamp
+ * to byte offset. Raw streams (.h264, .ts) have none and the demuxers scan the
+ * file for every seek; long MP4/MKV recordings may not have a complete one.
+ *
+ * The first open of a recording builds the index in the background, reading
+ * the file with its own demuxer, and saves it as a sidecar file. Later opens
+ * load the sidecar right away, as long as the recording did not change (size
+ * and modification time).
+ *
+ * Once ready, the index is handed to the demuxer of the player
+ * (kf_index_apply()): its seeks go straight to the key frame byte offset,
+ * however long the recording.
+ *
+ */
+
+struct AVFormatContext;
+
+typedef struct kf_index_st * kf_index_h;
+
+#ifdef __cplusplus
+  extern "C" {
+#endif
+
+/**
+ * @brief sets the directory the sidecar files are kept in (it must exist).
+ *        NULL, the default, keeps them next to the recordings.
+ */
+void kf_index_set_dir(const char * dir);
+
+/**
+ * @brief index of a video stream of a local file: loaded from its sidecar or
+ *        built in the background.
+ *
+ * @param url           the recording, anything but a local file gives NULL
+ * @param stream_index  the video stream
+ *
+ * @return the index, NULL if not applicable
+ */
+kf_index_h kf_index_open(const char * url, int stream_index);
+
+/**
+ * @brief true once the index is complete.
+ */
+bool kf_index_ready(kf_index_h kf);
+
+/**
+ * @brief adds the key frames to the index of the stream of a demuxer opened
+ *        on the same recording. Only once ready.
+ *
+ * @return number of key frames added, < 0 if the index does not match the input
+ */
+int kf_index_apply(kf_index_h kf, struct AVFormatContext * fmt);
+
+/**
+ * @brief stops building, if still at it, and frees the index.
+ */
+void kf_index_close(kf_index_h kf);
+
+#ifdef __cplusplus
+  }
+#endif
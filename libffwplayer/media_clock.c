@@ -0,0 +1,156 @@
+/******************************************
+ *
+ * Media clock
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+
+#include <math.h>
+#include <time.h>
+
+#include "media_clock.h"
+
+typedef struct clock_state_st {
+  double  pts;
+  int64_t base_time;
+  double  speed;
+  bool    paused;
+} clock_state_t;
+
+/**
+ * Consistent snapshot of the clock: retried while a writer is in the middle
+ * of an update.
+ */
+static void read_state(media_clock_t * clock, clock_state_t * state)
+{
+  unsigned seq;
+
+  for (;;) {
+    seq = atomic_load_explicit(&clock->seq, memory_order_acquire);
+    if (seq & 1) {
+      continue;
+    }
+    state->pts = atomic_load_explicit(&clock->pts, memory_order_relaxed);
+    state->base_time = atomic_load_explicit(&clock->base_time, memory_order_relaxed);
+    state->speed = atomic_load_explicit(&clock->speed, memory_order_relaxed);
+    state->paused = atomic_load_explicit(&clock->paused, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&clock->seq, memory_order_relaxed) == seq) {
+      return;
+    }
+  }
+}
+
+static double state_value(clock_state_t * state, int64_t now)
+{
+  if (state->paused || isnan(state->pts)) {
+    return state->pts;
+  }
+  return state->pts + (now - state->base_time) / 1000000.0 * state->speed;
+}
+
+/**
+ * Publishes a new state. Called with the writers mutex held.
+ */
+static void write_state(media_clock_t * clock, clock_state_t * state)
+{
+  unsigned seq = atomic_load_explicit(&clock->seq, memory_order_relaxed);
+
+  atomic_store_explicit(&clock->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&clock->pts, state->pts, memory_order_relaxed);
+  atomic_store_explicit(&clock->base_time, state->base_time, memory_order_relaxed);
+  atomic_store_explicit(&clock->speed, state->speed, memory_order_relaxed);
+  atomic_store_explicit(&clock->paused, state->paused, memory_order_relaxed);
+  atomic_store_explicit(&clock->seq, seq + 2, memory_order_release);
+}
+
+void media_clock_init(media_clock_t * clock)
+{
+  clock_state_t state = { NAN, 0, 1.0, false };
+
+  pthread_mutex_init(&clock->mutex, NULL);
+  atomic_init(&clock->seq, 0);
+  write_state(clock, &state);
+}
+
+void media_clock_destroy(media_clock_t * clock)
+{
+  pthread_mutex_destroy(&clock->mutex);
+}
+
+int64_t media_clock_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+double media_clock_get_at(media_clock_t * clock, int64_t now)
+{
+  clock_state_t state;
+
+  read_state(clock, &state);
+  return state_value(&state, now);
+}
+
+double media_clock_get(media_clock_t * clock)
+{
+  return media_clock_get_at(clock, media_clock_now());
+}
+
+void media_clock_set_at(media_clock_t * clock, double pts, int64_t time)
+{
+  clock_state_t state;
+
+  pthread_mutex_lock(&clock->mutex);
+  read_state(clock, &state);
+  state.pts = pts;
+  state.base_time = time;
+  write_state(clock, &state);
+  pthread_mutex_unlock(&clock->mutex);
+}
+
+void media_clock_set(media_clock_t * clock, double pts)
+{
+  media_clock_set_at(clock, pts, media_clock_now());
+}
+
+void media_clock_invalidate(media_clock_t * clock)
+{
+  media_clock_set_at(clock, NAN, media_clock_now());
+}
+
+void media_clock_set_paused(media_clock_t * clock, bool paused)
+{
+  clock_state_t state;
+  int64_t now = media_clock_now();
+
+  pthread_mutex_lock(&clock->mutex);
+  read_state(clock, &state);
+  if (state.paused != paused) {
+    // rebase: frozen at, or running again from, the current value
+    state.pts = state_value(&state, now);
+    state.base_time = now;
+    state.paused = paused;
+    write_state(clock, &state);
+  }
+  pthread_mutex_unlock(&clock->mutex);
+}
+
+void media_clock_set_speed(media_clock_t * clock, double speed)
+{
+  clock_state_t state;
+  int64_t now = media_clock_now();
+
+  pthread_mutex_lock(&clock->mutex);
+  read_state(clock, &state);
+  state.pts = state_value(&state, now);
+  state.base_time = now;
+  state.speed = speed;
+  write_state(clock, &state);
+  pthread_mutex_unlock(&clock->mutex);
+}
@@ -0,0 +1,84 @@
+/******************************************
+ *
+ * Media clock
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/**
+ * @file
+ * @brief media_clock
+ *
+ * A presentation clock: a pts taken at a point of the monotonic time, running
+ * from there at a given speed unless paused. Players have one per sync source
+ * (audio, video, external).
+ *
+ * Reads are lock free (seqlock) and never block the writer; writes are
+ * serialized by a mutex and are expected to be far less frequent.
+ *
+ */
+
+typedef struct media_clock_st {
+  pthread_mutex_t   mutex;          /**< serializes writers */
+  atomic_uint       seq;            /**< odd while being written */
+  _Atomic double    pts;            /**< seconds at base_time, NAN if not set */
+  _Atomic int64_t   base_time;      /**< monotonic time (us) the pts was taken at */
+  _Atomic double    speed;
+  atomic_bool       paused;
+} media_clock_t;
+
+#ifdef __cplusplus
+  extern "C" {
+#endif
+
+/**
+ * @brief initializes a clock: not set, speed 1, running.
+ */
+void media_clock_init(media_clock_t * clock);
+void media_clock_destroy(media_clock_t * clock);
+
+/**
+ * @brief monotonic time in us, the time base of all the clocks.
+ */
+int64_t media_clock_now(void);
+
+/**
+ * @brief current value of the clock in seconds, NAN if it was never set.
+ *
+ * @param now   media_clock_now(), so several clocks can be read at one point
+ */
+double media_clock_get_at(media_clock_t * clock, int64_t now);
+double media_clock_get(media_clock_t * clock);
+
+/**
+ * @brief sets the clock to pts at the time given (media_clock_now() units).
+ */
+void media_clock_set_at(media_clock_t * clock, double pts, int64_t time);
+void media_clock_set(media_clock_t * clock, double pts);
+
+/**
+ * @brief back to not set (NAN), e.g. after a flush.
+ */
+void media_clock_invalidate(media_clock_t * clock);
+
+/**
+ * @brief freezes/resumes the clock at its current value.
+ */
+void media_clock_set_paused(media_clock_t * clock, bool paused);
+
+/**
+ * @brief changes the speed the clock runs at from its current value.
+ */
+void media_clock_set_speed(media_clock_t * clock, double speed);
+
+#ifdef __cplusplus
+  }
+#endif
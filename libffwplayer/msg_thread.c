@@ -51,6 +51,7 @@ typedef struct msg_thread_st * msg_thread_h;  /**< opaque definition for the eve
 
 #define STACKSIZE__DEFAULT   PTHREAD_STACK_MIN                      /**< 16K set by <limits.h>  (Linux default is 8M) */
 #define DEFAULT_SCHED_POLICY SCHED_RR
+#define THREAD_NAME_LEN      16                                     /**< Linux limit, terminating null included */
 
 typedef struct queue_st {
   int max_num_msgs;
@@ -64,7 +65,7 @@ typedef struct msg_thread_st {
 #ifdef CK_HANDLE
   uint32_t        magic;
 #endif
-  const char *    name;
+  char            name[THREAD_NAME_LEN];
   pthread_t       tid;
   pthread_mutex_t q_mutex;
   pthread_cond_t  cond;
@@ -72,7 +73,7 @@ typedef struct msg_thread_st {
 } msg_thread_t;
 
 extern int pthread_setname_np(pthread_t thread, const char * name);
-extern int pthread_getname_np(pthread_t thread, const char **name);
+extern int pthread_getname_np(pthread_t thread, char * name, size_t len);
 
 static bool queue_put( queue_t * q, msg_t * msg)
 {
@@ -134,7 +135,7 @@ msg_thread_h reg_msg_thread(pthread_t id, int max_num_msgs)
 
   msg_ht->tid = id;
   msg_ht->queue.max_num_msgs = max_num_msgs;
-  pthread_getname_np(id, &msg_ht->name);
+  pthread_getname_np(id, msg_ht->name, sizeof(msg_ht->name));
 
   return msg_ht;
 }
@@ -152,6 +153,17 @@ bool dereg_msg_thread(msg_thread_h evt_h)
   return NULL;
 }
 
+void msg_thread_set_owner(msg_thread_h handle, pthread_t id)
+{
+  msg_thread_t * msg_ht = (msg_thread_t *) handle;
+  RETURN_IF_BAD_HANDLE(msg_ht,);
+
+  LOCK(msg_ht);
+  msg_ht->tid = id;
+  pthread_getname_np(id, msg_ht->name, sizeof(msg_ht->name));
+  UNLOCK(msg_ht);
+}
+
 bool post_msg(  msg_thread_h src_handle,
                 msg_thread_h dst_handle,
                 msg_t * msg)
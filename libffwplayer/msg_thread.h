@@ -33,6 +33,12 @@ typedef struct msg_st {
 msg_thread_h reg_msg_thread(pthread_t id, int msg_queue_size);
 bool dereg_msg_thread(msg_thread_h evt_h);
 
+/**
+ * @brief sets the thread owning a queue registered before that thread was
+ *        created (so the thread never sees its handle unset).
+ */
+void msg_thread_set_owner(msg_thread_h handle, pthread_t id);
+
 bool post_msg(  msg_thread_h src_handle,
                 msg_thread_h dst_handle,
                 msg_t * msg);
@@ -0,0 +1,562 @@
+/******************************************
+ *
+ * Sliced colour conversion/scaling
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
+#include <libswscale/swscale.h>
+
+#include "scaler.h"
+#include "yuv2rgb.h"
+#include "msg_thread.h"
+#include "log.h"
+
+#define SCALER_MAX_SLICES   8
+#define SLICE_MIN_PIXELS    (1280 * 720 / 2)  /**< smaller slices are not worth a thread hop */
+#define SLICE_ALIGN         16                /**< slice rows, covers any chroma subsampling */
+#define SCALER_FLAGS        SWS_BILINEAR      /**< no scaling, or no better reason */
+
+// AUTO profile
+#define RATIO_SMALL         0.25              /**< destination/source area: a grid cell */
+#define RATIO_LARGE         0.75              /**< close to or above the source size */
+#define LOAD_PERIOD_US      (1000 * 1000)     /**< CPU load sampling period */
+#define LOAD_HIGH           0.85              /**< above it AUTO gives up one quality step */
+#define LOAD_LOW            0.60              /**< ... and gets it back below this one */
+#define AVG_WEIGHT          0.1               /**< moving average of the conversion time */
+
+typedef struct slice_st {
+  struct SwsContext * sws_ctx;
+  int y;
+  int h;
+} slice_t;
+
+typedef struct worker_st {
+  struct scaler_st *  sc;
+  int                 slice;    /**< slice this worker converts */
+  unsigned            job_seen;
+  pthread_t           tid;
+} worker_t;
+
+typedef struct scaler_st {
+  int max_slices;
+
+  // geometry the slices were built for
+  int src_w;
+  int src_h;
+  enum AVPixelFormat src_fmt;
+  int dst_w;
+  int dst_h;
+  enum AVPixelFormat dst_fmt;
+  const AVPixFmtDescriptor * src_desc;
+  const AVPixFmtDescriptor * dst_desc;
+  enum AVColorSpace colorspace;
+  enum AVColorRange color_range;
+
+  // YUV420P -> RGB32 without scaling goes to the SIMD converter
+  bool fast;
+  yuv2rgb_matrix_t matrix;
+  bool full_range;
+
+  volatile scaler_profile_t profile;  /**< requested, applied on the next conversion */
+  scaler_profile_t effective;         /**< what AUTO resolved to */
+  int flags;
+
+  int nb_slices;
+  slice_t slices[SCALER_MAX_SLICES];
+
+  scaler_stats_t stats;               /**< protected by mutex */
+
+  // current job
+  const uint8_t * const * src;
+  const int * src_linesize;
+  uint8_t * const * dst;
+  const int * dst_linesize;
+
+  // worker pool: slice 0 runs on the caller, slice N on worker N
+  int nb_workers;
+  worker_t workers[SCALER_MAX_SLICES];
+  pthread_mutex_t mutex;
+  pthread_cond_t work_cond;
+  pthread_cond_t done_cond;
+  unsigned job_id;
+  int pending;
+  bool quit;
+} scaler_t;
+
+static int num_cores(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int) n : 1;
+}
+
+int scaler_slice_count(int width, int height, int max_slices)
+{
+  int n = ((int64_t) width * height + SLICE_MIN_PIXELS - 1) / SLICE_MIN_PIXELS;
+
+  if (max_slices <= 0) {
+    max_slices = num_cores();
+  }
+  if (max_slices > SCALER_MAX_SLICES) {
+    max_slices = SCALER_MAX_SLICES;
+  }
+  if (n > max_slices) {
+    n = max_slices;
+  }
+  return n < 1 ? 1 : n;
+}
+
+static void offset_planes(const uint8_t * const in[], const int linesize[],
+                          const AVPixFmtDescriptor * desc, int y, uint8_t * out[4])
+{
+  for (int p = 0; p < 4; p++) {
+    int shift = (p == 1 || p == 2) ? desc->log2_chroma_h : 0;
+    out[p] = in[p] ? (uint8_t *) in[p] + (y >> shift) * linesize[p] : NULL;
+  }
+}
+
+static void run_slice(scaler_t * sc, int i)
+{
+  slice_t * slice = &sc->slices[i];
+  uint8_t * src[4];
+  uint8_t * dst[4];
+
+  offset_planes(sc->src, sc->src_linesize, sc->src_desc, slice->y, src);
+  offset_planes((const uint8_t * const *) sc->dst, sc->dst_linesize, sc->dst_desc, slice->y, dst);
+
+  if (sc->fast) {
+    yuv2rgb_convert((const uint8_t * const *) src, sc->src_linesize, dst[0], sc->dst_linesize[0],
+                    sc->dst_w, slice->h, sc->matrix, sc->full_range, YUV2RGB_IMPL_AUTO);
+    return;
+  }
+
+  sws_scale(slice->sws_ctx,
+            (uint8_t const * const *) src,
+            sc->src_linesize,
+            0,
+            sc->nb_slices == 1 ? sc->src_h : slice->h,
+            dst,
+            sc->dst_linesize);
+}
+
+static void * worker_thread(void * arg)
+{
+  worker_t * w = (worker_t *) arg;
+  scaler_t * sc = w->sc;
+
+  pthread_mutex_lock(&sc->mutex);
+  for (;;) {
+    while (sc->job_id == w->job_seen && ! sc->quit) {
+      pthread_cond_wait(&sc->work_cond, &sc->mutex);
+    }
+    if (sc->quit) {
+      break;
+    }
+    w->job_seen = sc->job_id;
+    if (w->slice >= sc->nb_slices) {
+      continue;
+    }
+
+    pthread_mutex_unlock(&sc->mutex);
+    run_slice(sc, w->slice);
+    pthread_mutex_lock(&sc->mutex);
+
+    if (--sc->pending == 0) {
+      pthread_cond_signal(&sc->done_cond);
+    }
+  }
+  pthread_mutex_unlock(&sc->mutex);
+  return NULL;
+}
+
+static void free_slices(scaler_t * sc)
+{
+  for (int i = 0; i < SCALER_MAX_SLICES; i++) {
+    sws_freeContext(sc->slices[i].sws_ctx);
+    sc->slices[i].sws_ctx = NULL;
+  }
+  sc->nb_slices = 0;
+}
+
+static bool start_workers(scaler_t * sc, int count)
+{
+  while (sc->nb_workers < count) {
+    worker_t * w = &sc->workers[sc->nb_workers + 1];
+    w->sc = sc;
+    w->slice = sc->nb_workers + 1;
+    w->job_seen = sc->job_id;
+    w->tid = ffw_create_thread("scaler_thread",
+                               0,               // stack size
+                               20,              // int priority,
+                               worker_thread,   // void * ( *thread_entry)(void *),
+                               w,
+                               false);          // joined by scaler_destroy()
+    if (w->tid == -1) {
+      LOG_E("scaler: could not start worker %d", w->slice);
+      return false;
+    }
+    sc->nb_workers++;
+  }
+  return true;
+}
+
+/**
+ * Process CPU time over wall time, normalized to the online cores. Shared by
+ * all scalers and sampled at most once per LOAD_PERIOD_US.
+ */
+static double process_load(bool * busy)
+{
+  static pthread_mutex_t load_mutex = PTHREAD_MUTEX_INITIALIZER;
+  static int64_t last_wall;
+  static int64_t last_cpu;
+  static double load;
+  static bool high;
+  struct timespec ts;
+  int64_t wall = av_gettime_relative();
+
+  pthread_mutex_lock(&load_mutex);
+  if (wall - last_wall >= LOAD_PERIOD_US &&
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == 0) {
+    int64_t cpu = (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    if (last_wall) {
+      load = (double) (cpu - last_cpu) / (wall - last_wall) / num_cores();
+      // hysteresis, so AUTO does not flip the contexts every period
+      if (load > LOAD_HIGH) {
+        high = true;
+      } else if (load < LOAD_LOW) {
+        high = false;
+      }
+    }
+    last_wall = wall;
+    last_cpu = cpu;
+  }
+  *busy = high;
+  pthread_mutex_unlock(&load_mutex);
+  return load;
+}
+
+static scaler_profile_t auto_profile(int src_w, int src_h, int dst_w, int dst_h, bool busy)
+{
+  double ratio = ((double) dst_w * dst_h) / ((double) src_w * src_h);
+  scaler_profile_t profile;
+
+  if (ratio <= RATIO_SMALL) {
+    profile = SCALER_PROFILE_FAST;
+  } else if (ratio >= RATIO_LARGE) {
+    profile = SCALER_PROFILE_QUALITY;
+  } else {
+    profile = SCALER_PROFILE_BALANCED;
+  }
+
+  if (busy && profile != SCALER_PROFILE_FAST) {
+    profile--;
+  }
+  return profile;
+}
+
+static int profile_flags(scaler_profile_t profile, int src_w, int src_h, int dst_w, int dst_h)
+{
+  switch (profile) {
+    case SCALER_PROFILE_FAST:
+      // nearest is fine when most of the source pixels are dropped anyway
+      return (dst_w * 2 <= src_w && dst_h * 2 <= src_h) ? SWS_POINT : SWS_FAST_BILINEAR;
+    case SCALER_PROFILE_QUALITY:
+      return (dst_w > src_w || dst_h > src_h) ? SWS_LANCZOS : SWS_BICUBIC;
+    default:
+      return SWS_BILINEAR;
+  }
+}
+
+static int configure(scaler_t * sc, int src_w, int src_h, enum AVPixelFormat src_fmt,
+                     int dst_w, int dst_h, enum AVPixelFormat dst_fmt)
+{
+  scaler_profile_t effective = SCALER_PROFILE_BALANCED;
+  int flags = SCALER_FLAGS;
+  int nb_slices = 1;
+  int rows;
+  bool busy;
+
+  sc->stats.cpu_load = process_load(&busy);
+  if (src_w != dst_w || src_h != dst_h) {
+    effective = sc->profile;
+    if (effective == SCALER_PROFILE_AUTO) {
+      effective = auto_profile(src_w, src_h, dst_w, dst_h, busy);
+    }
+    flags = profile_flags(effective, src_w, src_h, dst_w, dst_h);
+  }
+
+  if (sc->nb_slices && sc->flags == flags &&
+      sc->src_w == src_w && sc->src_h == src_h && sc->src_fmt == src_fmt &&
+      sc->dst_w == dst_w && sc->dst_h == dst_h && sc->dst_fmt == dst_fmt) {
+    return 0;
+  }
+
+  free_slices(sc);
+  sc->src_desc = av_pix_fmt_desc_get(src_fmt);
+  sc->dst_desc = av_pix_fmt_desc_get(dst_fmt);
+  if ( ! sc->src_desc || ! sc->dst_desc) {
+    LOG_E("scaler: unsupported pixel format");
+    return -1;
+  }
+
+  // slices need a 1:1 vertical mapping (no filter taps across slice borders)
+  if (src_h == dst_h && ! (sc->src_desc->flags & AV_PIX_FMT_FLAG_PAL)) {
+    nb_slices = scaler_slice_count(dst_w, dst_h, sc->max_slices);
+  }
+  if (nb_slices > 1 && ! start_workers(sc, nb_slices - 1)) {
+    // use whatever the pool could take
+    nb_slices = sc->nb_workers + 1;
+  }
+
+  sc->fast = yuv2rgb_supported(src_w, src_h, src_fmt, dst_w, dst_h, dst_fmt);
+  sc->matrix = yuv2rgb_matrix(sc->colorspace);
+  sc->full_range = yuv2rgb_full_range(sc->color_range, src_fmt);
+
+  rows = FFALIGN((dst_h + nb_slices - 1) / nb_slices, SLICE_ALIGN);
+  for (int i = 0; i < nb_slices; i++) {
+    slice_t * slice = &sc->slices[i];
+    slice->y = i * rows;
+    slice->h = FFMIN(rows, dst_h - slice->y);
+    if (slice->h <= 0) {
+      nb_slices = i;
+      break;
+    }
+    if (sc->fast) {
+      continue;
+    }
+
+    slice->sws_ctx = sws_getContext(src_w,
+                                    nb_slices == 1 ? src_h : slice->h,
+                                    src_fmt,
+                                    dst_w,
+                                    nb_slices == 1 ? dst_h : slice->h,
+                                    dst_fmt,
+                                    flags,
+                                    NULL,
+                                    NULL,
+                                    NULL);
+    if ( ! slice->sws_ctx) {
+      LOG_E("scaler: could not create sws context");
+      sc->nb_slices = i;
+      free_slices(sc);
+      return -1;
+    }
+    if (sc->dst_desc->flags & AV_PIX_FMT_FLAG_RGB) {
+      // same interpretation of the source as the SIMD converter
+      sws_setColorspaceDetails(slice->sws_ctx,
+                               sws_getCoefficients(sc->matrix == YUV2RGB_BT709 ? SWS_CS_ITU709 : SWS_CS_DEFAULT),
+                               sc->full_range,
+                               sws_getCoefficients(SWS_CS_DEFAULT),
+                               1,
+                               0, 1 << 16, 1 << 16);
+    }
+  }
+  sc->nb_slices = nb_slices;
+  sc->flags = flags;
+  sc->effective = effective;
+
+  sc->src_w = src_w;
+  sc->src_h = src_h;
+  sc->src_fmt = src_fmt;
+  sc->dst_w = dst_w;
+  sc->dst_h = dst_h;
+  sc->dst_fmt = dst_fmt;
+  return 0;
+}
+
+scaler_h scaler_create(int max_slices)
+{
+  scaler_t * sc = calloc(1, sizeof(scaler_t));
+  if ( ! sc) {
+    LOG_E("scaler: no memo");
+    return NULL;
+  }
+
+  sc->max_slices = max_slices;
+  pthread_mutex_init(&sc->mutex, NULL);
+  pthread_cond_init(&sc->work_cond, NULL);
+  pthread_cond_init(&sc->done_cond, NULL);
+  return sc;
+}
+
+void scaler_destroy(scaler_h sc)
+{
+  if ( ! sc) return;
+
+  pthread_mutex_lock(&sc->mutex);
+  sc->quit = true;
+  pthread_cond_broadcast(&sc->work_cond);
+  pthread_mutex_unlock(&sc->mutex);
+
+  for (int i = 1; i <= sc->nb_workers; i++) {
+    pthread_join(sc->workers[i].tid, NULL);
+  }
+
+  free_slices(sc);
+  pthread_cond_destroy(&sc->done_cond);
+  pthread_cond_destroy(&sc->work_cond);
+  pthread_mutex_destroy(&sc->mutex);
+  free(sc);
+}
+
+int scaler_convert(scaler_h sc,
+                   const uint8_t * const src[], const int src_linesize[],
+                   int src_w, int src_h, enum AVPixelFormat src_fmt,
+                   uint8_t * const dst[], const int dst_linesize[],
+                   int dst_w, int dst_h, enum AVPixelFormat dst_fmt)
+{
+  int64_t t0 = av_gettime_relative();
+  double ms;
+
+  // the only place contexts change: always between two pictures
+  if (configure(sc, src_w, src_h, src_fmt, dst_w, dst_h, dst_fmt) < 0) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&sc->mutex);
+  sc->src = src;
+  sc->src_linesize = src_linesize;
+  sc->dst = dst;
+  sc->dst_linesize = dst_linesize;
+  if (sc->nb_slices > 1) {
+    sc->pending = sc->nb_slices - 1;
+    sc->job_id++;
+    pthread_cond_broadcast(&sc->work_cond);
+  }
+  pthread_mutex_unlock(&sc->mutex);
+
+  run_slice(sc, 0);
+
+  if (sc->nb_slices > 1) {
+    pthread_mutex_lock(&sc->mutex);
+    while (sc->pending > 0) {
+      pthread_cond_wait(&sc->done_cond, &sc->mutex);
+    }
+    pthread_mutex_unlock(&sc->mutex);
+  }
+
+  ms = (av_gettime_relative() - t0) / 1000.0;
+  pthread_mutex_lock(&sc->mutex);
+  sc->stats.avg_ms = sc->stats.frames ? sc->stats.avg_ms * (1.0 - AVG_WEIGHT) + ms * AVG_WEIGHT : ms;
+  sc->stats.frames++;
+  sc->stats.total_ms += ms;
+  sc->stats.profile = sc->effective;
+  sc->stats.flags = sc->flags;
+  sc->stats.slices = sc->nb_slices;
+  sc->stats.fast_path = sc->fast;
+  pthread_mutex_unlock(&sc->mutex);
+  return 0;
+}
+
+void scaler_set_profile(scaler_h sc, scaler_profile_t profile)
+{
+  sc->profile = profile;
+}
+
+void scaler_get_stats(scaler_h sc, scaler_stats_t * stats)
+{
+  pthread_mutex_lock(&sc->mutex);
+  *stats = sc->stats;
+  pthread_mutex_unlock(&sc->mutex);
+}
+
+void scaler_set_colorspace(scaler_h sc, enum AVColorSpace colorspace, enum AVColorRange range)
+{
+  if (sc->colorspace != colorspace || sc->color_range != range) {
+    sc->colorspace = colorspace;
+    sc->color_range = range;
+    // rebuilt on the next conversion
+    free_slices(sc);
+  }
+}
+
+bool scaler_fast_path(scaler_h sc)
+{
+  return sc->nb_slices && sc->fast;
+}
+
+int scaler_slices(scaler_h sc)
+{
+  return sc->nb_slices;
+}
+
+#ifdef TEST_FFWPLAYER_LIBRARY
+
+#define BENCH_FRAMES 100
+
+static double bench_run(scaler_h sc, uint8_t * src[4], int src_linesize[4],
+                        uint8_t * dst[4], int dst_linesize[4], int w, int h)
+{
+  int64_t t0;
+
+  // first call builds the contexts and the pool
+  scaler_convert(sc, (const uint8_t * const *) src, src_linesize, w, h, AV_PIX_FMT_YUV420P,
+                 dst, dst_linesize, w, h, AV_PIX_FMT_RGB32);
+
+  t0 = av_gettime_relative();
+  for (int i = 0; i < BENCH_FRAMES; i++) {
+    scaler_convert(sc, (const uint8_t * const *) src, src_linesize, w, h, AV_PIX_FMT_YUV420P,
+                   dst, dst_linesize, w, h, AV_PIX_FMT_RGB32);
+  }
+  return (av_gettime_relative() - t0) / 1000.0 / BENCH_FRAMES;
+}
+
+void scaler_benchmark(void)
+{
+  static const struct {
+    const char * name;
+    int w;
+    int h;
+  } sizes[] = {
+    { "720p",  1280,  720 },
+    { "1080p", 1920, 1080 },
+    { "4K",    3840, 2160 },
+  };
+
+  printf("YUV420P -> RGB32, %d frames, %d cores\n", BENCH_FRAMES, num_cores());
+  for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    uint8_t * src[4], * dst[4];
+    int src_linesize[4], dst_linesize[4];
+    int w = sizes[i].w, h = sizes[i].h;
+
+    if (av_image_alloc(src, src_linesize, w, h, AV_PIX_FMT_YUV420P, 32) < 0 ||
+        av_image_alloc(dst, dst_linesize, w, h, AV_PIX_FMT_RGB32, 32) < 0) {
+      printf("no memo for %s\n", sizes[i].name);
+      return;
+    }
+    // some non-flat content
+    for (int y = 0; y < h; y++) {
+      for (int x = 0; x < w; x++) {
+        src[0][y * src_linesize[0] + x] = (uint8_t) (x + y);
+      }
+    }
+    for (int y = 0; y < h / 2; y++) {
+      memset(src[1] + y * src_linesize[1], y & 0xff, w / 2);
+      memset(src[2] + y * src_linesize[2], (255 - y) & 0xff, w / 2);
+    }
+
+    scaler_h single = scaler_create(1);
+    scaler_h sliced = scaler_create(0);
+    double t_single = bench_run(single, src, src_linesize, dst, dst_linesize, w, h);
+    double t_sliced = bench_run(sliced, src, src_linesize, dst, dst_linesize, w, h);
+
+    printf("%-6s single: %7.2f ms/frame   sliced (%d): %7.2f ms/frame   speedup %.2fx\n",
+           sizes[i].name, t_single, scaler_slices(sliced), t_sliced, t_single / t_sliced);
+
+    scaler_destroy(single);
+    scaler_destroy(sliced);
+    av_freep(&src[0]);
+    av_freep(&dst[0]);
+  }
+}
+#endif // TEST_FFWPLAYER_LIBRARY
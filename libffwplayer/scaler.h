@@ -0,0 +1,117 @@
+/******************************************
+ *
+ * Sliced colour conversion/scaling
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libavutil/pixfmt.h>
+
+/**
+ * @file
+ * @brief scaler
+ *
+ * Wraps swscale. When the conversion does not scale vertically the picture is
+ * split into horizontal slices, each one with its own SwsContext, converted in
+ * parallel by a small worker pool (the calling thread takes the first slice).
+ * The number of slices depends on the resolution and on the cores available.
+ *
+ * Unscaled YUV420P -> RGB32 skips swscale and uses the SIMD converter
+ * (yuv2rgb.h), sliced the same way.
+ *
+ */
+
+typedef struct scaler_st * scaler_h;  /**< opaque definition for the scaler handle */
+
+/**
+ * Speed/quality trade off of the scaling filter. Conversions without scaling
+ * are not affected.
+ */
+typedef enum {
+  SCALER_PROFILE_AUTO = 0,  /**< from the scale ratio and the CPU load */
+  SCALER_PROFILE_FAST,      /**< point / fast bilinear: small grid cells */
+  SCALER_PROFILE_BALANCED,  /**< bilinear */
+  SCALER_PROFILE_QUALITY,   /**< bicubic down, lanczos up: focused/fullscreen */
+} scaler_profile_t;
+
+typedef struct scaler_stats_st {
+  uint64_t          frames;     /**< conversions done */
+  double            total_ms;   /**< time spent converting */
+  double            avg_ms;     /**< moving average per conversion */
+  double            cpu_load;   /**< process CPU load, 1.0 = all cores busy */
+  scaler_profile_t  profile;    /**< profile in use (AUTO resolved) */
+  int               flags;      /**< swscale flags in use */
+  int               slices;
+  bool              fast_path;  /**< SIMD converter instead of swscale */
+} scaler_stats_t;
+
+#ifdef __cplusplus
+  extern "C" {
+#endif
+
+/**
+ * @brief creates a scaler.
+ *
+ * @param max_slices  upper limit of slices (threads) per picture. 0 selects it
+ *                    from the available cores, 1 is single threaded.
+ */
+scaler_h scaler_create(int max_slices);
+void scaler_destroy(scaler_h sc);
+
+/**
+ * @brief converts (and scales) a picture. Contexts and slices are rebuilt on
+ *        the fly whenever the geometry or the formats change.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int scaler_convert(scaler_h sc,
+                   const uint8_t * const src[], const int src_linesize[],
+                   int src_w, int src_h, enum AVPixelFormat src_fmt,
+                   uint8_t * const dst[], const int dst_linesize[],
+                   int dst_w, int dst_h, enum AVPixelFormat dst_fmt);
+
+/**
+ * @brief colour properties of the source (matrix and range). Unspecified
+ *        values are taken the way swscale does: BT.601, limited range unless
+ *        the format is a J one.
+ */
+void scaler_set_colorspace(scaler_h sc, enum AVColorSpace colorspace, enum AVColorRange range);
+
+/**
+ * @brief selects the scaling profile. Safe to call from any thread, the
+ *        contexts are rebuilt by the converting thread before its next picture.
+ */
+void scaler_set_profile(scaler_h sc, scaler_profile_t profile);
+
+void scaler_get_stats(scaler_h sc, scaler_stats_t * stats);
+
+/**
+ * @brief true if the last conversion went through the SIMD converter.
+ */
+bool scaler_fast_path(scaler_h sc);
+
+/**
+ * @brief number of slices used by the last conversion.
+ */
+int scaler_slices(scaler_h sc);
+
+/**
+ * @brief number of slices worth using for a picture of the given size.
+ */
+int scaler_slice_count(int width, int height, int max_slices);
+
+#ifdef TEST_FFWPLAYER_LIBRARY
+/**
+ * @brief prints single threaded vs sliced throughput at 720p, 1080p and 4K.
+ */
+void scaler_benchmark(void);
+#endif
+
+#ifdef __cplusplus
+  }
+#endif
@@ -0,0 +1,485 @@
+/******************************************
+ *
+ * Snapshots
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+#include "snapshot.h"
+#include "scaler.h"
+#include "msg_thread.h"
+#include "log.h"
+
+#define SNAPSHOT_MAX_PENDING      64
+#define SNAPSHOT_THREAD_PRIORITY  1       /**< below the players */
+#define SNAPSHOT_JPEG_QSCALE      3       /**< 2 (best) to 31 */
+#define SNAPSHOT_PTS_EPSILON      0.0005  /**< same frame (pts rounding), seconds */
+#define SNAPSHOT_MAX_PACKETS      10000   /**< gives up decoding to a time past this */
+
+typedef struct job_st {
+  snapshot_t *          snapshot;
+  char *                url;            /**< NULL: the frame is at hand */
+  snapshot_done_t       done;
+  void *                arg;
+  int64_t               request_time;
+  struct job_st *       next;
+} job_t;
+
+static pthread_mutex_t  queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   queue_cond = PTHREAD_COND_INITIALIZER;
+static job_t *          queue_first;
+static job_t *          queue_last;
+static bool             worker_started;
+static snapshot_stats_t stats;          // queue_mutex
+
+static double ms_since(int64_t start)
+{
+  return (av_gettime_relative() - start) / 1000.0;
+}
+
+static void average(double * avg, uint64_t count, double ms)
+{
+  *avg += (ms - *avg) / count;
+}
+
+/**
+ * The frame showing at pts in a recording: decoded from the key frame at or
+ * before it, the frames before it are dropped as they come out.
+ *
+ * @param frame     blank frame receiving it
+ * @param frame_pts its pts, NAN if it has none
+ *
+ * @return 0, AVERROR code on error
+ */
+static int decode_at(const char * url, double pts, AVFrame * frame, double * frame_pts)
+{
+  AVFormatContext * fmt = NULL;
+  AVCodecContext * ctx = NULL;
+  AVCodec * codec;
+  AVStream * st;
+  AVPacket * packet = av_packet_alloc();
+  AVFrame * decoded = av_frame_alloc();
+  int ret, stream_index;
+  bool found = false;
+  bool draining = false;
+
+  if ( ! packet || ! decoded) {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+  if ((ret = avformat_open_input(&fmt, url, NULL, NULL)) < 0 ||
+      (ret = avformat_find_stream_info(fmt, NULL)) < 0 ||
+      (ret = av_find_best_stream(fmt, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0)) < 0) {
+    goto end;
+  }
+  stream_index = ret;
+  st = fmt->streams[stream_index];
+  for (int i = 0; i < fmt->nb_streams; i++) {
+    fmt->streams[i]->discard = i == stream_index ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+  }
+
+  if ( ! (codec = avcodec_find_decoder(st->codecpar->codec_id))) {
+    ret = AVERROR_DECODER_NOT_FOUND;
+    goto end;
+  }
+  if ( ! (ctx = avcodec_alloc_context3(codec))) {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+  if ((ret = avcodec_parameters_to_context(ctx, st->codecpar)) < 0 ||
+      (ret = avcodec_open2(ctx, codec, NULL)) < 0) {
+    goto end;
+  }
+
+  int64_t target = av_rescale_q((int64_t) (pts * AV_TIME_BASE), AV_TIME_BASE_Q, st->time_base);
+  if ((ret = avformat_seek_file(fmt, stream_index, INT64_MIN, target, target, 0)) < 0) {
+    goto end;
+  }
+
+  for (int packets = 0; ! found && packets < SNAPSHOT_MAX_PACKETS; ) {
+    if ( ! draining) {
+      ret = av_read_frame(fmt, packet);
+      if (ret == AVERROR_EOF) {
+        draining = true;
+        ret = avcodec_send_packet(ctx, NULL);
+      } else if (ret < 0) {
+        break;
+      } else {
+        if (packet->stream_index == stream_index) {
+          packets++;
+          ret = avcodec_send_packet(ctx, packet);
+        }
+        av_packet_unref(packet);
+      }
+      if (ret < 0 && ret != AVERROR(EAGAIN)) {
+        break;
+      }
+    }
+
+    while ((ret = avcodec_receive_frame(ctx, decoded)) >= 0) {
+      double decoded_pts = decoded->best_effort_timestamp == AV_NOPTS_VALUE ? NAN :
+                           decoded->best_effort_timestamp * av_q2d(st->time_base);
+      bool past = decoded_pts > pts + SNAPSHOT_PTS_EPSILON;
+
+      if (past && frame->buf[0]) {
+        // the one kept was showing at pts
+        av_frame_unref(decoded);
+        found = true;
+        break;
+      }
+      // at or before pts: the best one so far (or the seek landed past it)
+      av_frame_unref(frame);
+      av_frame_move_ref(frame, decoded);
+      *frame_pts = decoded_pts;
+      if (past) {
+        found = true;
+        break;
+      }
+    }
+    if (ret == AVERROR_EOF) {
+      // nothing after pts: the last frame of the recording
+      found = frame->buf[0] != NULL;
+      break;
+    }
+    if (ret < 0 && ret != AVERROR(EAGAIN)) {
+      break;
+    }
+  }
+  ret = found ? 0 : (ret < 0 && ret != AVERROR(EAGAIN) ? ret : AVERROR(ERANGE));
+
+ end:
+  if (ret < 0) {
+    av_frame_unref(frame);
+  }
+  av_frame_free(&decoded);
+  av_packet_free(&packet);
+  avcodec_free_context(&ctx);
+  avformat_close_input(&fmt);
+  return ret;
+}
+
+/**
+ * Encodes a frame to JPEG or PNG, converted to the pixel format the encoder
+ * takes first.
+ *
+ * @return 0, AVERROR code on error
+ */
+static int encode(snapshot_t * snapshot)
+{
+  const AVFrame * src = snapshot->frame;
+  bool jpeg = snapshot->format == SNAPSHOT_JPEG;
+  enum AVPixelFormat pix_fmt = jpeg ? AV_PIX_FMT_YUVJ420P : AV_PIX_FMT_RGB24;
+  AVCodec * codec = avcodec_find_encoder(jpeg ? AV_CODEC_ID_MJPEG : AV_CODEC_ID_PNG);
+  AVCodecContext * ctx = NULL;
+  AVFrame * picture = NULL;
+  AVPacket * packet = av_packet_alloc();
+  scaler_h scaler = NULL;
+  int ret;
+
+  if ( ! codec) {
+    ret = AVERROR_ENCODER_NOT_FOUND;
+    goto end;
+  }
+  if ( ! packet || ! (ctx = avcodec_alloc_context3(codec)) || ! (picture = av_frame_alloc())) {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+  ctx->width = src->width;
+  ctx->height = src->height;
+  ctx->pix_fmt = pix_fmt;
+  ctx->time_base = (AVRational) { 1, 25 };
+  if (jpeg) {
+    ctx->flags |= AV_CODEC_FLAG_QSCALE;
+    ctx->global_quality = FF_QP2LAMBDA * SNAPSHOT_JPEG_QSCALE;
+  }
+  if ((ret = avcodec_open2(ctx, codec, NULL)) < 0) {
+    goto end;
+  }
+
+  if (src->format == pix_fmt) {
+    ret = av_frame_ref(picture, src);
+  } else {
+    picture->format = pix_fmt;
+    picture->width = src->width;
+    picture->height = src->height;
+    if ((ret = av_frame_get_buffer(picture, 0)) < 0) {
+      goto end;
+    }
+    if ( ! (scaler = scaler_create(1))) {
+      ret = AVERROR(ENOMEM);
+      goto end;
+    }
+    scaler_set_colorspace(scaler, src->colorspace, src->color_range);
+    ret = scaler_convert(scaler,
+                         (const uint8_t * const *) src->data, src->linesize,
+                         src->width, src->height, src->format,
+                         picture->data, picture->linesize,
+                         picture->width, picture->height, pix_fmt);
+  }
+  if (ret < 0) {
+    goto end;
+  }
+  picture->quality = ctx->global_quality;
+
+  if ((ret = avcodec_send_frame(ctx, picture)) < 0 ||
+      (ret = avcodec_receive_packet(ctx, packet)) < 0) {
+    goto end;
+  }
+  if ( ! (snapshot->data = av_memdup(packet->data, packet->size))) {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+  snapshot->size = packet->size;
+
+ end:
+  scaler_destroy(scaler);
+  av_frame_free(&picture);
+  av_packet_free(&packet);
+  avcodec_free_context(&ctx);
+  return ret;
+}
+
+static int write_file(snapshot_t * snapshot)
+{
+  FILE * f = fopen(snapshot->path, "wb");
+  int ret = 0;
+
+  if ( ! f) {
+    return AVERROR(errno);
+  }
+  if (fwrite(snapshot->data, 1, snapshot->size, f) != (size_t) snapshot->size) {
+    ret = AVERROR(EIO);
+  }
+  if (fclose(f) != 0 && ret == 0) {
+    ret = AVERROR(EIO);
+  }
+  return ret;
+}
+
+int snapshot_decode(const char * url, double pts, AVFrame * frame, double * frame_pts)
+{
+  double decoded_pts = NAN;
+  int ret = decode_at(url, pts, frame, &decoded_pts);
+
+  if (frame_pts) {
+    *frame_pts = decoded_pts;
+  }
+  return ret;
+}
+
+static void process(job_t * job)
+{
+  snapshot_t * snapshot = job->snapshot;
+  int64_t start = av_gettime_relative();
+
+  if (job->url) {
+    double frame_pts = NAN;
+
+    snapshot->error = decode_at(job->url, snapshot->pts, snapshot->frame, &frame_pts);
+    snapshot->decode_ms = ms_since(start);
+    if (snapshot->error == 0 && ! isnan(frame_pts)) {
+      snapshot->pts = frame_pts;
+    }
+  }
+
+  start = av_gettime_relative();
+  if (snapshot->error == 0 && snapshot->format != SNAPSHOT_RAW) {
+    snapshot->error = encode(snapshot);
+    if (snapshot->error == 0 && snapshot->path[0]) {
+      snapshot->error = write_file(snapshot);
+    }
+    snapshot->encode_ms = ms_since(start);
+  }
+  snapshot->total_ms = ms_since(job->request_time);
+
+  if (snapshot->error < 0) {
+    LOG_W("snapshot %s at %.3f failed (%d)", job->url ? job->url : "on screen", snapshot->pts, snapshot->error);
+    av_frame_free(&snapshot->frame);
+  }
+}
+
+static void * snapshot_thread(void * arg)
+{
+  job_t * job;
+
+  for (;;) {
+    pthread_mutex_lock(&queue_mutex);
+    while ( ! queue_first) {
+      pthread_cond_wait(&queue_cond, &queue_mutex);
+    }
+    job = queue_first;
+    queue_first = job->next;
+    if ( ! queue_first) {
+      queue_last = NULL;
+    }
+    pthread_mutex_unlock(&queue_mutex);
+
+    process(job);
+
+    pthread_mutex_lock(&queue_mutex);
+    stats.pending--;
+    if (job->snapshot->error < 0) {
+      stats.failed++;
+    } else {
+      uint64_t done = stats.requests - stats.rejected - stats.failed - stats.pending;
+      if (job->url) {
+        stats.decoded++;
+        average(&stats.avg_decode_ms, stats.decoded, job->snapshot->decode_ms);
+      }
+      average(&stats.avg_encode_ms, done, job->snapshot->encode_ms);
+      average(&stats.avg_total_ms, done, job->snapshot->total_ms);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+
+    job->done(job->snapshot, job->arg);
+    av_free(job->url);
+    av_free(job);
+  }
+  return NULL;
+}
+
+bool snapshot_request(const char * url, const AVFrame * frame, double pts,
+                      snapshot_format_t format, const char * path, void * user_data,
+                      snapshot_done_t done, void * arg)
+{
+  job_t * job = av_mallocz(sizeof(job_t));
+  snapshot_t * snapshot = av_mallocz(sizeof(snapshot_t));
+
+  if ( ! job || ! snapshot || ! (snapshot->frame = av_frame_alloc()) ||
+       (frame && av_frame_ref(snapshot->frame, frame) < 0) ||
+       ( ! frame && ! (job->url = av_strdup(url)))) {
+    goto fail;
+  }
+  snapshot->pts = pts;
+  snapshot->format = format;
+  snapshot->user_data = user_data;
+  if (path) {
+    snprintf(snapshot->path, sizeof(snapshot->path), "%s", path);
+  }
+  job->snapshot = snapshot;
+  job->done = done;
+  job->arg = arg;
+  job->request_time = av_gettime_relative();
+
+  pthread_mutex_lock(&queue_mutex);
+  stats.requests++;
+  if (stats.pending >= SNAPSHOT_MAX_PENDING) {
+    stats.rejected++;
+    pthread_mutex_unlock(&queue_mutex);
+    goto fail;
+  }
+  if ( ! worker_started) {
+    if (ffw_create_thread("snapshot_thread", 0, SNAPSHOT_THREAD_PRIORITY, snapshot_thread, NULL, true) == -1) {
+      LOG_E("Could not start the snapshot thread.");
+      stats.rejected++;
+      pthread_mutex_unlock(&queue_mutex);
+      goto fail;
+    }
+    worker_started = true;
+  }
+  if (queue_last) {
+    queue_last->next = job;
+  } else {
+    queue_first = job;
+  }
+  queue_last = job;
+  stats.pending++;
+  pthread_cond_signal(&queue_cond);
+  pthread_mutex_unlock(&queue_mutex);
+  return true;
+
+ fail:
+  if (job) {
+    av_free(job->url);
+    av_free(job);
+  }
+  snapshot_free(snapshot);
+  return false;
+}
+
+void snapshot_free(snapshot_t * snapshot)
+{
+  if ( ! snapshot) {
+    return;
+  }
+  av_frame_free(&snapshot->frame);
+  av_free(snapshot->data);
+  av_free(snapshot);
+}
+
+void snapshot_get_stats(snapshot_stats_t * _stats)
+{
+  pthread_mutex_lock(&queue_mutex);
+  *_stats = stats;
+  pthread_mutex_unlock(&queue_mutex);
+}
+
+#ifdef TEST_FFWPLAYER_LIBRARY
+
+#define BENCH_WIDTH   1920
+#define BENCH_HEIGHT  1080
+#define BENCH_ROUNDS  10
+
+void snapshot_benchmark(void)
+{
+  AVFrame * frame = av_frame_alloc();
+  snapshot_t snapshot;
+
+  if ( ! frame) {
+    return;
+  }
+  frame->format = AV_PIX_FMT_YUV420P;
+  frame->width = BENCH_WIDTH;
+  frame->height = BENCH_HEIGHT;
+  if (av_frame_get_buffer(frame, 0) < 0) {
+    av_frame_free(&frame);
+    return;
+  }
+  // gradients: about as hard to compress as a camera picture
+  for (int y = 0; y < BENCH_HEIGHT; y++) {
+    for (int x = 0; x < BENCH_WIDTH; x++) {
+      frame->data[0][y * frame->linesize[0] + x] = (uint8_t) ((x * 7 + y * 3 + (x * y >> 7)) & 0xff);
+    }
+  }
+  for (int y = 0; y < BENCH_HEIGHT / 2; y++) {
+    memset(frame->data[1] + y * frame->linesize[1], (y >> 2) & 0xff, BENCH_WIDTH / 2);
+    memset(frame->data[2] + y * frame->linesize[2], 255 - ((y >> 2) & 0xff), BENCH_WIDTH / 2);
+  }
+
+  printf("snapshot encoding, %dx%d\n", BENCH_WIDTH, BENCH_HEIGHT);
+  for (snapshot_format_t format = SNAPSHOT_JPEG; format <= SNAPSHOT_PNG; format++) {
+    double total_ms = 0;
+    int size = 0;
+
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+      int64_t start = av_gettime_relative();
+
+      memset(&snapshot, 0, sizeof(snapshot));
+      snapshot.frame = frame;
+      snapshot.format = format;
+      if (encode(&snapshot) < 0) {
+        printf("%s: could not encode\n", format == SNAPSHOT_JPEG ? "jpeg" : "png");
+        break;
+      }
+      total_ms += ms_since(start);
+      size = snapshot.size;
+      av_free(snapshot.data);
+    }
+    printf("%s: %.1f ms, %d KB\n", format == SNAPSHOT_JPEG ? "jpeg" : "png", total_ms / BENCH_ROUNDS, size / 1024);
+  }
+  av_frame_free(&frame);
+}
+#endif // TEST_FFWPLAYER_LIBRARY
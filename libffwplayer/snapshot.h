@@ -0,0 +1,124 @@
+/******************************************
+ *
+ * Snapshots
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @file
+ * @brief snapshot
+ *
+ * Still pictures taken off the players, done by one background worker shared
+ * by all of them so that the playback threads never wait on it:
+ *
+ *  - the frame on the screen is referenced by the player and only encoded
+ *    here;
+ *  - the frame at a given time of a recording is decoded here with its own
+ *    demuxer and decoder (seek to the key frame before it, then decode
+ *    silently up to the frame showing at that time): the playback is not
+ *    disturbed.
+ *
+ * The picture is kept as decoded (refcounted frame) and, if asked, encoded to
+ * JPEG or PNG and written to a file. Requests are served in order.
+ *
+ */
+
+#define SNAPSHOT_MAX_PATH   1024
+
+struct AVFrame;
+
+typedef enum {
+  SNAPSHOT_RAW = 0,         /**< decoded frame only */
+  SNAPSHOT_JPEG,
+  SNAPSHOT_PNG,
+} snapshot_format_t;
+
+/**
+ * A snapshot taken, handed to the requester, see snapshot_request().
+ */
+typedef struct snapshot_st {
+  struct AVFrame *  frame;      /**< as decoded (size and pixel format of the source), NULL on error */
+  double            pts;        /**< seconds */
+  snapshot_format_t format;
+  uint8_t *         data;       /**< encoded image, NULL for SNAPSHOT_RAW */
+  int               size;
+  char              path[SNAPSHOT_MAX_PATH]; /**< file written, empty if none was asked for */
+  int               error;      /**< AVERROR code, 0 if taken */
+  double            decode_ms;  /**< seek and decoding (frame at a given time) */
+  double            encode_ms;  /**< encoding and writing */
+  double            total_ms;   /**< request to done, waiting for the worker included */
+  void *            user_data;  /**< as given to snapshot_request() */
+} snapshot_t;
+
+typedef struct snapshot_stats_st {
+  uint64_t  requests;
+  uint64_t  rejected;     /**< not queued: too many pending */
+  uint64_t  failed;
+  uint64_t  decoded;      /**< frames at a given time decoded from the source */
+  double    avg_decode_ms;
+  double    avg_encode_ms;
+  double    avg_total_ms;
+  int       pending;      /**< queued, not done yet */
+} snapshot_stats_t;
+
+/**
+ * Called by the worker with a snapshot done (or failed), owned by the callee
+ * from there: snapshot_free() it.
+ */
+typedef void (* snapshot_done_t)(snapshot_t * snapshot, void * arg);
+
+#ifdef __cplusplus
+  extern "C" {
+#endif
+
+/**
+ * @brief queues a snapshot for the worker.
+ *
+ * @param url       source the frame at pts is decoded from, when frame is NULL
+ * @param frame     frame already at hand (on the screen), referenced, or NULL
+ * @param pts       seconds: of frame, or the time to take the frame at
+ * @param format    encoding
+ * @param path      file the encoded picture is written to, NULL for none
+ * @param user_data copied to the snapshot
+ * @param done      receives the snapshot, from the worker thread
+ *
+ * @return false if not queued (too many pending, no memory): done is not
+ *         called
+ */
+bool snapshot_request(const char * url, const struct AVFrame * frame, double pts,
+                      snapshot_format_t format, const char * path, void * user_data,
+                      snapshot_done_t done, void * arg);
+
+void snapshot_free(snapshot_t * snapshot);
+
+/**
+ * @brief the frame showing at pts in a recording, decoded on the caller's
+ *        thread with its own demuxer and decoder, as the worker does for the
+ *        requests without a frame.
+ *
+ * @param frame     blank frame receiving it
+ * @param frame_pts receives its pts (seconds, NAN if it has none), may be NULL
+ *
+ * @return 0, AVERROR code on error
+ */
+int snapshot_decode(const char * url, double pts, struct AVFrame * frame, double * frame_pts);
+
+void snapshot_get_stats(snapshot_stats_t * stats);
+
+#ifdef TEST_FFWPLAYER_LIBRARY
+/**
+ * @brief prints the time taken to encode a 1080p frame to JPEG and PNG.
+ */
+void snapshot_benchmark(void);
+#endif
+
+#ifdef __cplusplus
+  }
+#endif
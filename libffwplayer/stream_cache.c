@@ -0,0 +1,482 @@
+/******************************************
+ *
+ * Stream parameters cache
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <libavformat/avformat.h>
+#include <libavutil/mem.h>
+
+#include "stream_cache.h"
+#include "log.h"
+
+#define CACHE_MAX_ENTRIES     32
+#define CACHE_MAX_STREAMS     8
+#define CACHE_URL_LEN         1024
+#define CACHE_MAX_EXTRADATA   (1024 * 1024)
+#define CACHE_FILE_MAGIC      0x43535746      /**< "FWSC" */
+#define CACHE_FILE_VERSION    1
+
+typedef struct cached_stream_st {
+  enum AVMediaType      codec_type;
+  enum AVCodecID        codec_id;
+  uint32_t              codec_tag;
+  int                   format;
+  int64_t               bit_rate;
+  int                   profile;
+  int                   level;
+  int                   width;
+  int                   height;
+  AVRational            sample_aspect_ratio;
+  enum AVFieldOrder     field_order;
+  enum AVColorRange     color_range;
+  enum AVColorPrimaries color_primaries;
+  enum AVColorTransferCharacteristic color_trc;
+  enum AVColorSpace     color_space;
+  enum AVChromaLocation chroma_location;
+  uint64_t              channel_layout;
+  int                   channels;
+  int                   sample_rate;
+  int                   frame_size;
+  AVRational            avg_frame_rate;
+  AVRational            r_frame_rate;
+  int                   extradata_size;
+  uint8_t *             extradata;      /**< written after the struct on disk */
+} cached_stream_t;
+
+typedef struct cache_entry_st {
+  bool                  used;
+  uint64_t              last_use;
+  char                  url[CACHE_URL_LEN];
+  int64_t               size;           /**< local files only, 0 otherwise */
+  int64_t               mtime;          /**< ns, local files only */
+  int64_t               duration;
+  int                   nb_streams;
+  cached_stream_t       streams[CACHE_MAX_STREAMS];
+} cache_entry_t;
+
+typedef struct cache_file_header_st {
+  uint32_t              magic;
+  uint32_t              version;
+  uint32_t              stream_size;    /**< sizeof(cached_stream_t): layout check */
+  int32_t               nb_streams;
+  int64_t               size;
+  int64_t               mtime;
+  int64_t               duration;
+  uint32_t              url_len;
+} cache_file_header_t;
+
+static pthread_mutex_t  cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cache_entry_t    cache[CACHE_MAX_ENTRIES];
+static uint64_t         use_counter;
+static char             cache_dir[CACHE_URL_LEN];
+
+/**
+ * Size and modification time of a local file source, 0 for anything else.
+ */
+static void source_stamp(const char * url, int64_t * size, int64_t * mtime)
+{
+  struct stat st;
+
+  if (strncmp(url, "file:", 5) == 0) {
+    url += 5;
+  }
+  *size = 0;
+  *mtime = 0;
+  if (stat(url, &st) == 0 && S_ISREG(st.st_mode)) {
+    *size = st.st_size;
+    *mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  }
+}
+
+static bool cache_path(const char * url, char * path, size_t len)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;  // FNV-1a
+
+  if ( ! cache_dir[0]) {
+    return false;
+  }
+  for (const char * c = url; *c; c++) {
+    hash = (hash ^ (uint8_t) *c) * 0x100000001b3ULL;
+  }
+  snprintf(path, len, "%s/%016" PRIx64 ".ffsc", cache_dir, hash);
+  return true;
+}
+
+static void free_entry(cache_entry_t * e)
+{
+  for (int i = 0; i < e->nb_streams; i++) {
+    av_freep(&e->streams[i].extradata);
+  }
+  memset(e, 0, sizeof(cache_entry_t));
+}
+
+static cache_entry_t * find_entry(const char * url)
+{
+  for (int i = 0; i < CACHE_MAX_ENTRIES; i++) {
+    if (cache[i].used && strcmp(cache[i].url, url) == 0) {
+      return &cache[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * A free entry, the least recently used one if they are all taken.
+ */
+static cache_entry_t * alloc_entry(void)
+{
+  cache_entry_t * lru = &cache[0];
+
+  for (int i = 0; i < CACHE_MAX_ENTRIES; i++) {
+    if ( ! cache[i].used) {
+      return &cache[i];
+    }
+    if (cache[i].last_use < lru->last_use) {
+      lru = &cache[i];
+    }
+  }
+  free_entry(lru);
+  return lru;
+}
+
+static void save_entry(cache_entry_t * e)
+{
+  char path[CACHE_URL_LEN + 32], tmp[CACHE_URL_LEN + 40];
+  cache_file_header_t hdr;
+  bool ok = true;
+  FILE * f;
+  int fd;
+
+  if ( ! cache_path(e->url, path, sizeof(path))) {
+    return;
+  }
+  // a temporary file of our own: other instances may save the same entry
+  snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+  if ((fd = mkstemp(tmp)) < 0) {
+    LOG_W("stream cache: could not write %s", path);
+    return;
+  }
+  fchmod(fd, 0644);
+  if ( ! (f = fdopen(fd, "wb"))) {
+    LOG_W("stream cache: could not write %s", tmp);
+    close(fd);
+    remove(tmp);
+    return;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = CACHE_FILE_MAGIC;
+  hdr.version = CACHE_FILE_VERSION;
+  hdr.stream_size = sizeof(cached_stream_t);
+  hdr.nb_streams = e->nb_streams;
+  hdr.size = e->size;
+  hdr.mtime = e->mtime;
+  hdr.duration = e->duration;
+  hdr.url_len = strlen(e->url);
+  ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 && fwrite(e->url, hdr.url_len, 1, f) == 1;
+  for (int i = 0; ok && i < e->nb_streams; i++) {
+    cached_stream_t s = e->streams[i];
+    s.extradata = NULL;
+    ok = fwrite(&s, sizeof(s), 1, f) == 1;
+    if (ok && s.extradata_size > 0) {
+      ok = fwrite(e->streams[i].extradata, s.extradata_size, 1, f) == 1;
+    }
+  }
+
+  // the rename swaps the whole file in: readers get the old or the new one,
+  // the last writer wins
+  if (fclose(f) != 0 || ! ok || rename(tmp, path) != 0) {
+    LOG_W("stream cache: could not write %s", path);
+    remove(tmp);
+  }
+}
+
+/**
+ * Loads the on disk entry of a source into the memory cache.
+ *
+ * @return the entry, NULL if there is none or it is not usable.
+ */
+static cache_entry_t * load_entry(const char * url)
+{
+  char path[CACHE_URL_LEN + 32];
+  cache_file_header_t hdr;
+  cache_entry_t loaded, * e = &loaded;
+  FILE * f;
+
+  if ( ! cache_path(url, path, sizeof(path)) || ! (f = fopen(path, "rb"))) {
+    return NULL;
+  }
+
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+      hdr.magic != CACHE_FILE_MAGIC || hdr.version != CACHE_FILE_VERSION ||
+      hdr.stream_size != sizeof(cached_stream_t) ||
+      hdr.nb_streams <= 0 || hdr.nb_streams > CACHE_MAX_STREAMS ||
+      hdr.url_len >= CACHE_URL_LEN || hdr.url_len != strlen(url)) {
+    fclose(f);
+    return NULL;
+  }
+
+  // read and checked aside: a bad file must not evict a good entry
+  memset(&loaded, 0, sizeof(loaded));
+  if (fread(e->url, hdr.url_len, 1, f) != 1) {
+    goto fail; // truncated
+  }
+  e->url[hdr.url_len] = '\0';
+  if (strcmp(e->url, url) != 0) {
+    goto fail; // hash collision
+  }
+  for (int i = 0; i < hdr.nb_streams; i++) {
+    cached_stream_t * s = &e->streams[i];
+    if (fread(s, sizeof(cached_stream_t), 1, f) != 1) {
+      goto fail;
+    }
+    s->extradata = NULL;
+    e->nb_streams = i + 1; // from here on free_entry() owns the extradata
+    if (s->extradata_size < 0 || s->extradata_size > CACHE_MAX_EXTRADATA) {
+      goto fail;
+    }
+    if (s->extradata_size > 0) {
+      if ( ! (s->extradata = av_mallocz(s->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE)) ||
+           fread(s->extradata, s->extradata_size, 1, f) != 1) {
+        goto fail;
+      }
+    }
+  }
+  fclose(f);
+
+  e->size = hdr.size;
+  e->mtime = hdr.mtime;
+  e->duration = hdr.duration;
+  e->used = true;
+  e->last_use = ++use_counter;
+
+  // takes over the extradata
+  e = alloc_entry();
+  *e = loaded;
+  return e;
+
+fail:
+  fclose(f);
+  free_entry(e);
+  return NULL;
+}
+
+/**
+ * Drops an entry from memory and from disk.
+ */
+static void drop_entry(const char * url)
+{
+  char path[CACHE_URL_LEN + 32];
+  cache_entry_t * e;
+
+  if ((e = find_entry(url))) {
+    free_entry(e);
+  }
+  if (cache_path(url, path, sizeof(path))) {
+    remove(path);
+  }
+}
+
+/**
+ * Checks the entry against what the demuxer found when opening the input.
+ * Anything it does not know yet is not checked.
+ */
+static bool entry_matches(cache_entry_t * e, AVFormatContext * fmt)
+{
+  if (e->nb_streams != fmt->nb_streams) {
+    return false;
+  }
+  for (int i = 0; i < e->nb_streams; i++) {
+    cached_stream_t * s = &e->streams[i];
+    AVCodecParameters * par = fmt->streams[i]->codecpar;
+
+    if ((par->codec_type != AVMEDIA_TYPE_UNKNOWN && par->codec_type != s->codec_type) ||
+        (par->codec_id != AV_CODEC_ID_NONE && par->codec_id != s->codec_id) ||
+        (par->width && par->width != s->width) ||
+        (par->height && par->height != s->height)) {
+      return false;
+    }
+    if (par->extradata_size > 0 && s->extradata_size > 0 &&
+        (par->extradata_size != s->extradata_size ||
+         memcmp(par->extradata, s->extradata, s->extradata_size) != 0)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void apply_entry(cache_entry_t * e, AVFormatContext * fmt)
+{
+  for (int i = 0; i < e->nb_streams; i++) {
+    cached_stream_t * s = &e->streams[i];
+    AVStream * st = fmt->streams[i];
+    AVCodecParameters * par = st->codecpar;
+
+    par->codec_type = s->codec_type;
+    par->codec_id = s->codec_id;
+    par->codec_tag = s->codec_tag;
+    par->format = s->format;
+    par->bit_rate = s->bit_rate;
+    par->profile = s->profile;
+    par->level = s->level;
+    par->width = s->width;
+    par->height = s->height;
+    par->sample_aspect_ratio = s->sample_aspect_ratio;
+    par->field_order = s->field_order;
+    par->color_range = s->color_range;
+    par->color_primaries = s->color_primaries;
+    par->color_trc = s->color_trc;
+    par->color_space = s->color_space;
+    par->chroma_location = s->chroma_location;
+    par->channel_layout = s->channel_layout;
+    par->channels = s->channels;
+    par->sample_rate = s->sample_rate;
+    par->frame_size = s->frame_size;
+
+    // the demuxer extradata is the same (entry_matches), keep it if present
+    if (par->extradata_size == 0 && s->extradata_size > 0) {
+      if ((par->extradata = av_mallocz(s->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE))) {
+        memcpy(par->extradata, s->extradata, s->extradata_size);
+        par->extradata_size = s->extradata_size;
+      }
+    }
+
+    if (st->avg_frame_rate.num == 0) {
+      st->avg_frame_rate = s->avg_frame_rate;
+    }
+    if (st->r_frame_rate.num == 0) {
+      st->r_frame_rate = s->r_frame_rate;
+    }
+  }
+  if (fmt->duration == AV_NOPTS_VALUE) {
+    fmt->duration = e->duration;
+  }
+}
+
+void stream_cache_set_dir(const char * dir)
+{
+  pthread_mutex_lock(&cache_mutex);
+  snprintf(cache_dir, sizeof(cache_dir), "%s", dir ? dir : "");
+  pthread_mutex_unlock(&cache_mutex);
+}
+
+bool stream_cache_apply(AVFormatContext * fmt, const char * url)
+{
+  cache_entry_t * e;
+  int64_t size, mtime;
+  bool applied = false;
+
+  if (fmt->ctx_flags & AVFMTCTX_NOHEADER) {
+    return false; // streams show up while probing: nothing to check the entry against
+  }
+  if (strlen(url) >= CACHE_URL_LEN) {
+    return false; // never stored, see stream_cache_store()
+  }
+  source_stamp(url, &size, &mtime);
+
+  pthread_mutex_lock(&cache_mutex);
+  if ( ! (e = find_entry(url))) {
+    e = load_entry(url);
+  }
+  if (e) {
+    if (e->size != size || e->mtime != mtime || ! entry_matches(e, fmt)) {
+      LOG_I("stream cache: %s changed, dropping its entry", url);
+      drop_entry(url);
+    } else {
+      apply_entry(e, fmt);
+      e->last_use = ++use_counter;
+      applied = true;
+    }
+  }
+  pthread_mutex_unlock(&cache_mutex);
+  return applied;
+}
+
+void stream_cache_store(AVFormatContext * fmt, const char * url)
+{
+  cache_entry_t * e;
+
+  if ((fmt->ctx_flags & AVFMTCTX_NOHEADER) || fmt->nb_streams == 0 ||
+      fmt->nb_streams > CACHE_MAX_STREAMS || strlen(url) >= CACHE_URL_LEN) {
+    return; // could not be used anyway
+  }
+
+  pthread_mutex_lock(&cache_mutex);
+  if ((e = find_entry(url))) {
+    free_entry(e);
+  } else {
+    e = alloc_entry();
+  }
+
+  strcpy(e->url, url);
+  source_stamp(url, &e->size, &e->mtime);
+  e->duration = fmt->duration;
+  for (int i = 0; i < fmt->nb_streams; i++) {
+    cached_stream_t * s = &e->streams[i];
+    AVStream * st = fmt->streams[i];
+    AVCodecParameters * par = st->codecpar;
+
+    s->codec_type = par->codec_type;
+    s->codec_id = par->codec_id;
+    s->codec_tag = par->codec_tag;
+    s->format = par->format;
+    s->bit_rate = par->bit_rate;
+    s->profile = par->profile;
+    s->level = par->level;
+    s->width = par->width;
+    s->height = par->height;
+    s->sample_aspect_ratio = par->sample_aspect_ratio;
+    s->field_order = par->field_order;
+    s->color_range = par->color_range;
+    s->color_primaries = par->color_primaries;
+    s->color_trc = par->color_trc;
+    s->color_space = par->color_space;
+    s->chroma_location = par->chroma_location;
+    s->channel_layout = par->channel_layout;
+    s->channels = par->channels;
+    s->sample_rate = par->sample_rate;
+    s->frame_size = par->frame_size;
+    s->avg_frame_rate = st->avg_frame_rate;
+    s->r_frame_rate = st->r_frame_rate;
+    e->nb_streams = i + 1;
+    if (par->extradata_size > 0 && par->extradata_size <= CACHE_MAX_EXTRADATA &&
+        (s->extradata = av_mallocz(par->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE))) {
+      memcpy(s->extradata, par->extradata, par->extradata_size);
+      s->extradata_size = par->extradata_size;
+    }
+  }
+  e->used = true;
+  e->last_use = ++use_counter;
+  save_entry(e);
+  pthread_mutex_unlock(&cache_mutex);
+}
+
+void stream_cache_invalidate(const char * url)
+{
+  pthread_mutex_lock(&cache_mutex);
+  drop_entry(url);
+  pthread_mutex_unlock(&cache_mutex);
+}
+
+void stream_cache_clear(void)
+{
+  pthread_mutex_lock(&cache_mutex);
+  for (int i = 0; i < CACHE_MAX_ENTRIES; i++) {
+    if (cache[i].used) {
+      free_entry(&cache[i]);
+    }
+  }
+  pthread_mutex_unlock(&cache_mutex);
+}
@@ -0,0 +1,69 @@
+/******************************************
+ *
+ * Stream parameters cache
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * @file
+ * @brief stream_cache
+ *
+ * Remembers the stream parameters found by avformat_find_stream_info() for a
+ * source, so the next open of the same source can fill them in right after
+ * avformat_open_input() and skip the deep probing.
+ *
+ * Sources are keyed by URL, plus size and modification time for local files.
+ * Before being used, an entry is checked against what the demuxer already
+ * knows after opening the input (stream layout, codecs and, when present,
+ * extradata such as the SDP parameter sets of a camera). A mismatch drops the
+ * entry and the caller probes as usual.
+ *
+ * Entries live in memory and, once a directory is set, also on disk so they
+ * survive the application.
+ *
+ */
+
+struct AVFormatContext;
+
+#ifdef __cplusplus
+  extern "C" {
+#endif
+
+/**
+ * @brief sets the directory of the on disk cache (it must exist). NULL keeps
+ *        the cache in memory only, the default.
+ */
+void stream_cache_set_dir(const char * dir);
+
+/**
+ * @brief fills the stream parameters of a just opened input from the cache.
+ *
+ * @return true if applied: avformat_find_stream_info() can be skipped
+ */
+bool stream_cache_apply(struct AVFormatContext * fmt, const char * url);
+
+/**
+ * @brief stores the stream parameters of a fully probed input.
+ */
+void stream_cache_store(struct AVFormatContext * fmt, const char * url);
+
+/**
+ * @brief drops the entry of a source, if any: its parameters turned out to
+ *        be wrong.
+ */
+void stream_cache_invalidate(const char * url);
+
+/**
+ * @brief drops all the entries kept in memory.
+ */
+void stream_cache_clear(void);
+
+#ifdef __cplusplus
+  }
+#endif
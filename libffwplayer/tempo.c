@@ -0,0 +1,434 @@
+/******************************************
+ *
+ * Audio time stretching
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+
+#include <math.h>
+#include <string.h>
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+#include "tempo.h"
+
+#define TEMPO_SEQUENCE_MS   40    /**< length of the sequences cut from the input */
+#define TEMPO_OVERLAP_MS    8     /**< cross-fade between two sequences */
+#define TEMPO_SEEK_MS       15    /**< how far a sequence may be shifted to match the previous one */
+#define TEMPO_HISTORY_MS    1000  /**< output taken still mapped to the input, see tempo_delay() */
+
+/**
+ * Where the output came from: from the out frame on, the input frame on.
+ */
+typedef struct tempo_mark_st {
+  int64_t       out;
+  int64_t       in;
+} tempo_mark_t;
+
+struct tempo_st {
+  int           sample_rate;
+  int           channels;
+  double        rate;
+  int           sequence;       /**< frames */
+  int           overlap;        /**< frames */
+  int           seek;           /**< frames */
+
+  int16_t *     in;             /**< input not consumed yet */
+  int           in_frames;
+  int           in_size;
+  int16_t *     out;            /**< stretched, not taken yet */
+  int           out_frames;
+  int           out_size;
+  int16_t *     mid;            /**< end of the last sequence, cross-faded into the next one */
+  bool          mid_valid;
+  int32_t *     mid_mono;       /**< mid mixed down */
+  int32_t *     in_mono;        /**< search range of the input mixed down */
+  double        skip_fract;     /**< input position not consumed yet, fraction of a frame */
+
+  int64_t       in_base;        /**< input frames consumed, before in[0] */
+  int64_t       out_base;       /**< output frames taken, before out[0] */
+  tempo_mark_t * marks;         /**< one per sequence output in the last TEMPO_HISTORY_MS */
+  int           nb_marks;
+  int           marks_size;
+
+  tempo_stats_t stats;
+};
+
+/**
+ * Makes room for more frames in a sample buffer.
+ */
+static bool reserve(tempo_h t, int16_t ** buf, int * size, int frames)
+{
+  int16_t * grown;
+
+  if (frames <= *size) {
+    return true;
+  }
+  frames = FFMAX(frames, *size * 2);
+  grown = av_realloc_array(*buf, (size_t) frames * t->channels, sizeof(int16_t));
+  if ( ! grown) {
+    return false;
+  }
+  *buf = grown;
+  *size = frames;
+  return true;
+}
+
+/**
+ * The output from the end of out on is a copy of the input from in on.
+ */
+static bool add_mark(tempo_h t, int64_t in)
+{
+  if (t->nb_marks == t->marks_size) {
+    int size = FFMAX(16, t->marks_size * 2);
+    tempo_mark_t * grown = av_realloc_array(t->marks, size, sizeof(tempo_mark_t));
+    if ( ! grown) {
+      return false;
+    }
+    t->marks = grown;
+    t->marks_size = size;
+  }
+  t->marks[t->nb_marks].out = t->out_base + t->out_frames;
+  t->marks[t->nb_marks].in = in;
+  t->nb_marks++;
+  return true;
+}
+
+/**
+ * Shift of the next sequence (from the start of the input) whose beginning is
+ * the most similar to mid: normalized cross-correlation of the mixed down
+ * channels.
+ */
+static int best_offset(tempo_h t)
+{
+  const int channels = t->channels;
+  int64_t norm = 0;
+  double best_score = -INFINITY;
+  int best = 0;
+
+  for (int i = 0; i < t->overlap; i++) {
+    int32_t m = 0;
+    for (int c = 0; c < channels; c++) {
+      m += t->mid[i * channels + c];
+    }
+    t->mid_mono[i] = m;
+  }
+  for (int i = 0; i < t->seek + t->overlap; i++) {
+    int32_t m = 0;
+    for (int c = 0; c < channels; c++) {
+      m += t->in[i * channels + c];
+    }
+    t->in_mono[i] = m;
+  }
+
+  for (int i = 0; i < t->overlap; i++) {
+    norm += (int64_t) t->in_mono[i] * t->in_mono[i];
+  }
+  for (int offset = 0; offset < t->seek; offset++) {
+    const int32_t * in = t->in_mono + offset;
+    int64_t corr = 0;
+
+    // every other sample: as good a match, half the work
+    for (int i = 0; i < t->overlap; i += 2) {
+      corr += (int64_t) t->mid_mono[i] * in[i];
+    }
+    double score = corr / sqrt((double) norm + 1.0);
+    if (score > best_score) {
+      best_score = score;
+      best = offset;
+    }
+    norm += (int64_t) in[t->overlap] * in[t->overlap] - (int64_t) in[0] * in[0];
+  }
+  return best;
+}
+
+/**
+ * Stretches as much of the input as there is.
+ */
+static bool process(tempo_h t)
+{
+  const int channels = t->channels;
+  const int step = t->sequence - t->overlap;   // frames output per sequence
+
+  for (;;) {
+    double skip = t->rate * step + t->skip_fract;
+    int skip_frames = (int) skip;
+
+    if (t->in_frames < FFMAX(t->seek + t->sequence, skip_frames)) {
+      return true;
+    }
+    if ( ! reserve(t, &t->out, &t->out_size, t->out_frames + step)) {
+      return false;
+    }
+
+    int offset = t->mid_valid ? best_offset(t) : 0;
+    if ( ! add_mark(t, t->in_base + offset)) {
+      return false;
+    }
+    const int16_t * src = t->in + offset * channels;
+    int16_t * dst = t->out + t->out_frames * channels;
+    int copied = 0;
+
+    if (t->mid_valid) {
+      for (int i = 0; i < t->overlap; i++) {
+        for (int c = 0; c < channels; c++) {
+          int k = i * channels + c;
+          dst[k] = (int16_t) ((t->mid[k] * (t->overlap - i) + src[k] * i) / t->overlap);
+        }
+      }
+      copied = t->overlap;
+    }
+    memcpy(dst + copied * channels, src + copied * channels, (step - copied) * channels * sizeof(int16_t));
+    memcpy(t->mid, src + step * channels, t->overlap * channels * sizeof(int16_t));
+    t->mid_valid = true;
+    t->out_frames += step;
+
+    t->skip_fract = skip - skip_frames;
+    t->in_base += skip_frames;
+    t->in_frames -= skip_frames;
+    memmove(t->in, t->in + skip_frames * channels, t->in_frames * channels * sizeof(int16_t));
+  }
+}
+
+tempo_h tempo_create(int sample_rate, int channels)
+{
+  tempo_h t = av_mallocz(sizeof(struct tempo_st));
+
+  if ( ! t) {
+    return NULL;
+  }
+  t->sample_rate = sample_rate;
+  t->channels = channels;
+  t->rate = 1.0;
+  t->sequence = sample_rate * TEMPO_SEQUENCE_MS / 1000;
+  t->overlap = sample_rate * TEMPO_OVERLAP_MS / 1000;
+  t->seek = sample_rate * TEMPO_SEEK_MS / 1000;
+  t->mid = av_malloc_array((size_t) t->overlap * channels, sizeof(int16_t));
+  t->mid_mono = av_malloc_array(t->overlap, sizeof(int32_t));
+  t->in_mono = av_malloc_array(t->seek + t->overlap, sizeof(int32_t));
+  if (channels <= 0 || t->overlap <= 0 || ! t->mid || ! t->mid_mono || ! t->in_mono) {
+    tempo_destroy(t);
+    return NULL;
+  }
+  return t;
+}
+
+void tempo_destroy(tempo_h t)
+{
+  if ( ! t) {
+    return;
+  }
+  av_free(t->in);
+  av_free(t->out);
+  av_free(t->mid);
+  av_free(t->mid_mono);
+  av_free(t->in_mono);
+  av_free(t->marks);
+  av_free(t);
+}
+
+void tempo_set_rate(tempo_h t, double rate)
+{
+  rate = av_clipd(rate, TEMPO_MIN_RATE, TEMPO_MAX_RATE);
+  if (rate == t->rate) {
+    return;
+  }
+  t->rate = rate;
+  if (rate == 1.0) {
+    tempo_reset(t);
+  }
+}
+
+double tempo_get_rate(tempo_h t)
+{
+  return t->rate;
+}
+
+bool tempo_put(tempo_h t, const int16_t * samples, int frames)
+{
+  int64_t start = av_gettime_relative();
+  bool ok;
+
+  t->stats.frames_in += frames;
+
+  if (t->rate == 1.0) {
+    // nothing to stretch
+    if ( ! reserve(t, &t->out, &t->out_size, t->out_frames + frames) || ! add_mark(t, t->in_base)) {
+      return false;
+    }
+    memcpy(t->out + t->out_frames * t->channels, samples, (size_t) frames * t->channels * sizeof(int16_t));
+    t->out_frames += frames;
+    t->in_base += frames;
+    return true;
+  }
+
+  if ( ! reserve(t, &t->in, &t->in_size, t->in_frames + frames)) {
+    return false;
+  }
+  memcpy(t->in + t->in_frames * t->channels, samples, (size_t) frames * t->channels * sizeof(int16_t));
+  t->in_frames += frames;
+
+  ok = process(t);
+
+  t->stats.total_ms += (av_gettime_relative() - start) / 1000.0;
+  t->stats.load = t->stats.total_ms / (t->stats.frames_in * 1000.0 / t->sample_rate);
+  return ok;
+}
+
+int tempo_get(tempo_h t, int16_t * samples, int max_frames)
+{
+  int frames = FFMIN(max_frames, t->out_frames);
+
+  memcpy(samples, t->out, (size_t) frames * t->channels * sizeof(int16_t));
+  t->out_frames -= frames;
+  memmove(t->out, t->out + frames * t->channels, (size_t) t->out_frames * t->channels * sizeof(int16_t));
+  t->out_base += frames;
+  t->stats.frames_out += frames;
+
+  // the sequences taken long ago are not played any more
+  int64_t history = (int64_t) t->sample_rate * TEMPO_HISTORY_MS / 1000;
+  int old = 0;
+  while (old + 1 < t->nb_marks && t->marks[old + 1].out <= t->out_base - history) {
+    old++;
+  }
+  if (old) {
+    t->nb_marks -= old;
+    memmove(t->marks, t->marks + old, t->nb_marks * sizeof(tempo_mark_t));
+  }
+  return frames;
+}
+
+double tempo_delay(tempo_h t, int pending)
+{
+  // the output frame played next is a copy of an input frame: each sequence
+  // comes from where it matched best, not from where the input was consumed to
+  int64_t next = t->out_base - pending;
+
+  for (int i = t->nb_marks - 1; i >= 0; i--) {
+    if (t->marks[i].out <= next) {
+      return (double) (t->in_base + t->in_frames - (t->marks[i].in + next - t->marks[i].out)) / t->sample_rate;
+    }
+  }
+  // nothing output yet (or taken too long ago)
+  return (t->in_frames + (t->out_frames + pending) * t->rate) / t->sample_rate;
+}
+
+void tempo_reset(tempo_h t)
+{
+  t->in_frames = 0;
+  t->out_frames = 0;
+  t->mid_valid = false;
+  t->skip_fract = 0;
+  t->in_base = 0;
+  t->out_base = 0;
+  t->nb_marks = 0;
+}
+
+void tempo_get_stats(tempo_h t, tempo_stats_t * stats)
+{
+  *stats = t->stats;
+}
+
+#ifdef TEST_FFWPLAYER_LIBRARY
+#include <stdio.h>
+
+#define BENCH_SECONDS       10
+#define BENCH_SAMPLE_RATE   48000
+#define BENCH_CHANNELS      2
+#define BENCH_CHUNK         1024    /**< frames per put, about what a decoder gives */
+
+/**
+ * Largest error of tempo_delay(), in ms, stretching a signal whose samples
+ * tell where they come from (left: frame index low bits, right: high bits).
+ * What the player sets its audio clock from: the input frame the next frame
+ * played is a copy of, here the last one of each chunk taken.
+ */
+static double clock_error_ms(double rate, int frames)
+{
+  tempo_h t = tempo_create(BENCH_SAMPLE_RATE, BENCH_CHANNELS);
+  int16_t in[BENCH_CHUNK * BENCH_CHANNELS];
+  int16_t out[BENCH_CHUNK * BENCH_CHANNELS];
+  double max_error = 0;
+  int64_t put = 0;
+
+  if ( ! t) {
+    return NAN;
+  }
+  tempo_set_rate(t, rate);
+  while (put + BENCH_CHUNK <= frames) {
+    for (int i = 0; i < BENCH_CHUNK; i++) {
+      in[i * 2] = (int16_t) ((put + i) & 0x7fff);
+      in[i * 2 + 1] = (int16_t) ((put + i) >> 15);
+    }
+    tempo_put(t, in, BENCH_CHUNK);
+    put += BENCH_CHUNK;
+
+    int got = tempo_get(t, out, BENCH_CHUNK);
+    if (got < 2) {
+      continue;
+    }
+    // only a frame copied as it was (not cross-faded) tells where it comes from
+    int64_t a = (int64_t) (uint16_t) out[(got - 2) * 2 + 1] << 15 | out[(got - 2) * 2];
+    int64_t b = (int64_t) (uint16_t) out[(got - 1) * 2 + 1] << 15 | out[(got - 1) * 2];
+    if (b != a + 1) {
+      continue;
+    }
+    double clock = put - tempo_delay(t, 1) * BENCH_SAMPLE_RATE;
+    max_error = FFMAX(max_error, fabs(clock - b) * 1000.0 / BENCH_SAMPLE_RATE);
+  }
+  tempo_destroy(t);
+  return max_error;
+}
+
+void tempo_benchmark(void)
+{
+  static const double rates[] = { 0.5, 0.75, 1.25, 1.5, 2.0 };
+  const int frames = BENCH_SECONDS * BENCH_SAMPLE_RATE;
+  int16_t * in = av_malloc_array((size_t) frames * BENCH_CHANNELS, sizeof(int16_t));
+  int16_t * out = av_malloc_array((size_t) BENCH_CHUNK * 4 * BENCH_CHANNELS, sizeof(int16_t));
+
+  if ( ! in || ! out) {
+    printf("no memo for the tempo benchmark\n");
+    av_free(in);
+    av_free(out);
+    return;
+  }
+
+  // a tone gliding up on the left, a chord on the right
+  for (int i = 0; i < frames; i++) {
+    double s = (double) i / BENCH_SAMPLE_RATE;
+    in[i * 2] = (int16_t) (12000 * sin(2 * M_PI * (220 + 40 * s) * s));
+    in[i * 2 + 1] = (int16_t) (6000 * (sin(2 * M_PI * 261.6 * s) + sin(2 * M_PI * 329.6 * s)));
+  }
+
+  printf("time stretch, %d s of stereo %d Hz\n", BENCH_SECONDS, BENCH_SAMPLE_RATE);
+  for (int r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+    tempo_h t = tempo_create(BENCH_SAMPLE_RATE, BENCH_CHANNELS);
+    tempo_stats_t stats;
+    int64_t out_frames = 0;
+
+    if ( ! t) {
+      break;
+    }
+    tempo_set_rate(t, rates[r]);
+    for (int i = 0; i + BENCH_CHUNK <= frames; i += BENCH_CHUNK) {
+      int got;
+      tempo_put(t, in + i * BENCH_CHANNELS, BENCH_CHUNK);
+      while ((got = tempo_get(t, out, BENCH_CHUNK * 4)) > 0) {
+        out_frames += got;
+      }
+    }
+    tempo_get_stats(t, &stats);
+    printf("%.2fx: %6.2f ms per second of audio (load %.4f), %.2f s out, clock error %.1f ms max\n",
+           rates[r], stats.total_ms / BENCH_SECONDS, stats.load, (double) out_frames / BENCH_SAMPLE_RATE,
+           clock_error_ms(rates[r], frames));
+    tempo_destroy(t);
+  }
+
+  av_free(in);
+  av_free(out);
+}
+#endif // TEST_FFWPLAYER_LIBRARY
@@ -0,0 +1,102 @@
+/******************************************
+ *
+ * Audio time stretching
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @file
+ * @brief tempo
+ *
+ * Plays audio faster or slower without changing its pitch (WSOLA, waveform
+ * similarity overlap-add): the input is cut into overlapping sequences taken
+ * further apart (faster) or closer together (slower) than they are output,
+ * each one shifted a little to where it best matches the end of the previous
+ * one, and cross-faded into it.
+ *
+ * Interleaved signed 16 bits samples. The similarity search is done on the
+ * channels mixed down, a stereo 48 kHz stream takes a few ms of CPU per
+ * second of audio.
+ *
+ * Not thread safe: used by the audio thread only.
+ *
+ */
+
+#define TEMPO_MIN_RATE  0.5
+#define TEMPO_MAX_RATE  2.0
+
+typedef struct tempo_st * tempo_h;  /**< opaque definition for the time stretcher handle */
+
+typedef struct tempo_stats_st {
+  uint64_t  frames_in;    /**< sample frames put */
+  uint64_t  frames_out;   /**< sample frames taken */
+  double    total_ms;     /**< time spent stretching */
+  double    load;         /**< total_ms over the duration of the input: < 1 faster than real time */
+} tempo_stats_t;
+
+#ifdef __cplusplus
+  extern "C" {
+#endif
+
+tempo_h tempo_create(int sample_rate, int channels);
+void tempo_destroy(tempo_h t);
+
+/**
+ * @brief changes the rate, clamped to TEMPO_MIN_RATE..TEMPO_MAX_RATE. Back to
+ *        1 what was still buffered is dropped, the audio then goes through
+ *        untouched.
+ */
+void tempo_set_rate(tempo_h t, double rate);
+double tempo_get_rate(tempo_h t);
+
+/**
+ * @brief queues input samples.
+ *
+ * @param frames    sample frames (one sample per channel)
+ *
+ * @return false if out of memory
+ */
+bool tempo_put(tempo_h t, const int16_t * samples, int frames);
+
+/**
+ * @brief takes the stretched samples ready.
+ *
+ * @param max_frames    room in samples, in sample frames
+ *
+ * @return sample frames written, 0 until enough input was put
+ */
+int tempo_get(tempo_h t, int16_t * samples, int max_frames);
+
+/**
+ * @brief input time put but not played yet (stretched or not), seconds: from
+ *        the input frame the next frame played is a copy of, to the end of
+ *        the input.
+ *
+ * @param pending   frames taken but not played yet
+ */
+double tempo_delay(tempo_h t, int pending);
+
+/**
+ * @brief drops what is buffered (seek).
+ */
+void tempo_reset(tempo_h t);
+
+void tempo_get_stats(tempo_h t, tempo_stats_t * stats);
+
+#ifdef TEST_FFWPLAYER_LIBRARY
+/**
+ * @brief prints the CPU load of stretching stereo 48 kHz audio at a few rates.
+ */
+void tempo_benchmark(void);
+#endif
+
+#ifdef __cplusplus
+  }
+#endif
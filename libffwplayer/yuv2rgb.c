@@ -0,0 +1,468 @@
+/******************************************
+ *
+ * YUV420P to RGB32 converter
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <libavutil/time.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+
+#include "yuv2rgb.h"
+#include "log.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2  __attribute__((target("avx2")))
+#endif
+
+#define COEF_BITS   14
+#define COEF(x)     ((int) ((x) * (1 << COEF_BITS) + 0.5))
+#define COEF_ROUND  (1 << (COEF_BITS - 1))
+#define ALPHA       0xff000000u
+
+typedef struct coefs_st {
+  int y_off;
+  int cy;
+  int crv;  /**< R from V */
+  int cgu;  /**< G from U (subtracted) */
+  int cgv;  /**< G from V (subtracted) */
+  int cbu;  /**< B from U */
+} coefs_t;
+
+// [matrix][full range]
+static const coefs_t coefs_table[2][2] = {
+  { // BT.601
+    { 16, COEF(1.164383), COEF(1.596027), COEF(0.391762), COEF(0.812968), COEF(2.017232) },
+    {  0, COEF(1.0),      COEF(1.402),    COEF(0.344136), COEF(0.714136), COEF(1.772)    },
+  },
+  { // BT.709
+    { 16, COEF(1.164383), COEF(1.792741), COEF(0.213249), COEF(0.532909), COEF(2.112402) },
+    {  0, COEF(1.0),      COEF(1.5748),   COEF(0.187324), COEF(0.468124), COEF(1.8556)   },
+  },
+};
+
+static inline uint32_t clip_u8(int v)
+{
+  return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/**
+ * Reference (and tail) implementation. The SIMD kernels must produce exactly
+ * the same output.
+ */
+static void row_c(const uint8_t * y, const uint8_t * u, const uint8_t * v,
+                  uint32_t * dst, int x, int width, const coefs_t * c)
+{
+  for ( ; x < width; x++) {
+    int yy = (y[x] - c->y_off) * c->cy + COEF_ROUND;
+    int cu = u[x >> 1] - 128;
+    int cv = v[x >> 1] - 128;
+    int r = (yy + c->crv * cv) >> COEF_BITS;
+    int g = (yy - c->cgu * cu - c->cgv * cv) >> COEF_BITS;
+    int b = (yy + c->cbu * cu) >> COEF_BITS;
+
+    dst[x] = ALPHA | (clip_u8(r) << 16) | (clip_u8(g) << 8) | clip_u8(b);
+  }
+}
+
+#ifdef HAVE_X86_SIMD
+
+// 4 pixels: y, u, v as 32 bit lanes (u, v already centred)
+TARGET_SSE41
+static inline __m128i pixels_sse41(__m128i y, __m128i u, __m128i v, const coefs_t * c)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i max = _mm_set1_epi32(255);
+  __m128i yy, r, g, b;
+
+  yy = _mm_sub_epi32(y, _mm_set1_epi32(c->y_off));
+  yy = _mm_add_epi32(_mm_mullo_epi32(yy, _mm_set1_epi32(c->cy)), _mm_set1_epi32(COEF_ROUND));
+
+  r = _mm_add_epi32(yy, _mm_mullo_epi32(v, _mm_set1_epi32(c->crv)));
+  g = _mm_sub_epi32(yy, _mm_mullo_epi32(u, _mm_set1_epi32(c->cgu)));
+  g = _mm_sub_epi32(g, _mm_mullo_epi32(v, _mm_set1_epi32(c->cgv)));
+  b = _mm_add_epi32(yy, _mm_mullo_epi32(u, _mm_set1_epi32(c->cbu)));
+
+  r = _mm_min_epi32(_mm_max_epi32(_mm_srai_epi32(r, COEF_BITS), zero), max);
+  g = _mm_min_epi32(_mm_max_epi32(_mm_srai_epi32(g, COEF_BITS), zero), max);
+  b = _mm_min_epi32(_mm_max_epi32(_mm_srai_epi32(b, COEF_BITS), zero), max);
+
+  return _mm_or_si128(_mm_or_si128(b, _mm_slli_epi32(g, 8)),
+                      _mm_or_si128(_mm_slli_epi32(r, 16), _mm_set1_epi32((int) ALPHA)));
+}
+
+// 8 pixels per iteration
+TARGET_SSE41
+static void row_sse41(const uint8_t * y, const uint8_t * u, const uint8_t * v,
+                      uint32_t * dst, int width, const coefs_t * c)
+{
+  const __m128i bias = _mm_set1_epi32(128);
+  int x = 0;
+
+  for ( ; x + 8 <= width; x += 8) {
+    int32_t u4, v4;
+    memcpy(&u4, u + x / 2, 4);
+    memcpy(&v4, v + x / 2, 4);
+
+    __m128i y8 = _mm_loadl_epi64((const __m128i *) (y + x));
+    __m128i cu = _mm_sub_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(u4)), bias);
+    __m128i cv = _mm_sub_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(v4)), bias);
+
+    _mm_storeu_si128((__m128i *) (dst + x),
+                     pixels_sse41(_mm_cvtepu8_epi32(y8),
+                                  _mm_unpacklo_epi32(cu, cu),
+                                  _mm_unpacklo_epi32(cv, cv), c));
+    _mm_storeu_si128((__m128i *) (dst + x + 4),
+                     pixels_sse41(_mm_cvtepu8_epi32(_mm_srli_si128(y8, 4)),
+                                  _mm_unpackhi_epi32(cu, cu),
+                                  _mm_unpackhi_epi32(cv, cv), c));
+  }
+  row_c(y, u, v, dst, x, width, c);
+}
+
+// 8 pixels: y, u, v as 32 bit lanes (u, v already centred)
+TARGET_AVX2
+static inline __m256i pixels_avx2(__m256i y, __m256i u, __m256i v, const coefs_t * c)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i max = _mm256_set1_epi32(255);
+  __m256i yy, r, g, b;
+
+  yy = _mm256_sub_epi32(y, _mm256_set1_epi32(c->y_off));
+  yy = _mm256_add_epi32(_mm256_mullo_epi32(yy, _mm256_set1_epi32(c->cy)), _mm256_set1_epi32(COEF_ROUND));
+
+  r = _mm256_add_epi32(yy, _mm256_mullo_epi32(v, _mm256_set1_epi32(c->crv)));
+  g = _mm256_sub_epi32(yy, _mm256_mullo_epi32(u, _mm256_set1_epi32(c->cgu)));
+  g = _mm256_sub_epi32(g, _mm256_mullo_epi32(v, _mm256_set1_epi32(c->cgv)));
+  b = _mm256_add_epi32(yy, _mm256_mullo_epi32(u, _mm256_set1_epi32(c->cbu)));
+
+  r = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(r, COEF_BITS), zero), max);
+  g = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(g, COEF_BITS), zero), max);
+  b = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(b, COEF_BITS), zero), max);
+
+  return _mm256_or_si256(_mm256_or_si256(b, _mm256_slli_epi32(g, 8)),
+                         _mm256_or_si256(_mm256_slli_epi32(r, 16), _mm256_set1_epi32((int) ALPHA)));
+}
+
+// 16 pixels per iteration
+TARGET_AVX2
+static void row_avx2(const uint8_t * y, const uint8_t * u, const uint8_t * v,
+                     uint32_t * dst, int width, const coefs_t * c)
+{
+  const __m256i bias = _mm256_set1_epi32(128);
+  // replicates each chroma sample to 2 pixels
+  const __m256i dup_lo = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+  const __m256i dup_hi = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+  int x = 0;
+
+  for ( ; x + 16 <= width; x += 16) {
+    __m128i y16 = _mm_loadu_si128((const __m128i *) (y + x));
+    __m256i cu = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (u + x / 2))), bias);
+    __m256i cv = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (v + x / 2))), bias);
+
+    _mm256_storeu_si256((__m256i *) (dst + x),
+                        pixels_avx2(_mm256_cvtepu8_epi32(y16),
+                                    _mm256_permutevar8x32_epi32(cu, dup_lo),
+                                    _mm256_permutevar8x32_epi32(cv, dup_lo), c));
+    _mm256_storeu_si256((__m256i *) (dst + x + 8),
+                        pixels_avx2(_mm256_cvtepu8_epi32(_mm_srli_si128(y16, 8)),
+                                    _mm256_permutevar8x32_epi32(cu, dup_hi),
+                                    _mm256_permutevar8x32_epi32(cv, dup_hi), c));
+  }
+  row_c(y, u, v, dst, x, width, c);
+}
+#endif // HAVE_X86_SIMD
+
+yuv2rgb_impl_t yuv2rgb_best_impl(void)
+{
+  static yuv2rgb_impl_t best = YUV2RGB_IMPL_AUTO;
+
+  if (best == YUV2RGB_IMPL_AUTO) {
+    yuv2rgb_impl_t impl = YUV2RGB_IMPL_C;
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      impl = YUV2RGB_IMPL_AVX2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+      impl = YUV2RGB_IMPL_SSE41;
+    }
+#endif
+    LOG_I("yuv2rgb: using %s", yuv2rgb_impl_name(impl));
+    best = impl;
+  }
+  return best;
+}
+
+const char * yuv2rgb_impl_name(yuv2rgb_impl_t impl)
+{
+  switch (impl) {
+    case YUV2RGB_IMPL_C:      return "C";
+    case YUV2RGB_IMPL_SSE41:  return "SSE4.1";
+    case YUV2RGB_IMPL_AVX2:   return "AVX2";
+    default:                  return "auto";
+  }
+}
+
+bool yuv2rgb_supported(int src_w, int src_h, enum AVPixelFormat src_fmt,
+                       int dst_w, int dst_h, enum AVPixelFormat dst_fmt)
+{
+  return (src_fmt == AV_PIX_FMT_YUV420P || src_fmt == AV_PIX_FMT_YUVJ420P) &&
+         dst_fmt == AV_PIX_FMT_RGB32 &&
+         src_w == dst_w && src_h == dst_h;
+}
+
+yuv2rgb_matrix_t yuv2rgb_matrix(enum AVColorSpace colorspace)
+{
+  return colorspace == AVCOL_SPC_BT709 ? YUV2RGB_BT709 : YUV2RGB_BT601;
+}
+
+bool yuv2rgb_full_range(enum AVColorRange range, enum AVPixelFormat src_fmt)
+{
+  return range == AVCOL_RANGE_JPEG || src_fmt == AV_PIX_FMT_YUVJ420P;
+}
+
+void yuv2rgb_convert(const uint8_t * const src[], const int src_linesize[],
+                     uint8_t * dst, int dst_linesize,
+                     int width, int height,
+                     yuv2rgb_matrix_t matrix, bool full_range,
+                     yuv2rgb_impl_t impl)
+{
+  const coefs_t * c = &coefs_table[matrix][full_range];
+  yuv2rgb_impl_t best = yuv2rgb_best_impl();
+
+  // asking for something the CPU does not have ends up in C
+  if (impl == YUV2RGB_IMPL_AUTO || impl > best) {
+    impl = impl == YUV2RGB_IMPL_AUTO ? best : YUV2RGB_IMPL_C;
+  }
+
+  for (int j = 0; j < height; j++) {
+    const uint8_t * y = src[0] + j * src_linesize[0];
+    const uint8_t * u = src[1] + (j >> 1) * src_linesize[1];
+    const uint8_t * v = src[2] + (j >> 1) * src_linesize[2];
+    uint32_t * out = (uint32_t *) (dst + j * dst_linesize);
+
+    switch (impl) {
+#ifdef HAVE_X86_SIMD
+      case YUV2RGB_IMPL_AVX2:
+        row_avx2(y, u, v, out, width, c);
+        break;
+      case YUV2RGB_IMPL_SSE41:
+        row_sse41(y, u, v, out, width, c);
+        break;
+#endif
+      default:
+        row_c(y, u, v, out, 0, width, c);
+        break;
+    }
+  }
+}
+
+#ifdef TEST_FFWPLAYER_LIBRARY
+
+#define MIN_PSNR      40.0
+#define BENCH_FRAMES  200
+
+typedef struct {
+  int w;
+  int h;
+  uint8_t * src[4];
+  int src_linesize[4];
+  uint8_t * ref[4];
+  int ref_linesize[4];
+  uint8_t * out[4];
+  int out_linesize[4];
+} test_pic_t;
+
+static bool pic_alloc(test_pic_t * p, int w, int h)
+{
+  uint32_t seed = 1;
+
+  memset(p, 0, sizeof(test_pic_t));
+  p->w = w;
+  p->h = h;
+  if (av_image_alloc(p->src, p->src_linesize, w, h, AV_PIX_FMT_YUV420P, 32) < 0 ||
+      av_image_alloc(p->ref, p->ref_linesize, w, h, AV_PIX_FMT_RGB32, 32) < 0 ||
+      av_image_alloc(p->out, p->out_linesize, w, h, AV_PIX_FMT_RGB32, 32) < 0) {
+    return false;
+  }
+
+  // luma: gradient plus noise, full 0..255 excursion to exercise clipping
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      seed = seed * 1103515245 + 12345;
+      int v = (x * 255) / w + (int) ((seed >> 16) & 0x3f) - 32;
+      p->src[0][y * p->src_linesize[0] + x] = clip_u8(v);
+    }
+  }
+  // chroma: smooth, so chroma siting differences with swscale stay small
+  for (int y = 0; y < (h + 1) / 2; y++) {
+    for (int x = 0; x < (w + 1) / 2; x++) {
+      p->src[1][y * p->src_linesize[1] + x] = (x * 2 * 255) / w;
+      p->src[2][y * p->src_linesize[2] + x] = 255 - (y * 2 * 255) / h;
+    }
+  }
+  return true;
+}
+
+static void pic_free(test_pic_t * p)
+{
+  av_freep(&p->src[0]);
+  av_freep(&p->ref[0]);
+  av_freep(&p->out[0]);
+}
+
+static double psnr_rgb32(const test_pic_t * p)
+{
+  double sse = 0;
+
+  for (int y = 0; y < p->h; y++) {
+    const uint8_t * a = p->ref[0] + y * p->ref_linesize[0];
+    const uint8_t * b = p->out[0] + y * p->out_linesize[0];
+    for (int x = 0; x < p->w * 4; x++) {
+      if ((x & 3) == 3) continue; // alpha
+      int d = a[x] - b[x];
+      sse += d * d;
+    }
+  }
+  if (sse == 0) {
+    return INFINITY;
+  }
+  return 10.0 * log10(255.0 * 255.0 * p->w * p->h * 3 / sse);
+}
+
+static bool same_rgb32(const test_pic_t * p)
+{
+  for (int y = 0; y < p->h; y++) {
+    if (memcmp(p->ref[0] + y * p->ref_linesize[0],
+               p->out[0] + y * p->out_linesize[0], p->w * 4)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static struct SwsContext * sws_reference(int w, int h, yuv2rgb_matrix_t matrix, bool full_range, int flags)
+{
+  struct SwsContext * ctx = sws_getContext(w, h, AV_PIX_FMT_YUV420P,
+                                           w, h, AV_PIX_FMT_RGB32,
+                                           flags, NULL, NULL, NULL);
+  if (ctx) {
+    sws_setColorspaceDetails(ctx,
+                             sws_getCoefficients(matrix == YUV2RGB_BT709 ? SWS_CS_ITU709 : SWS_CS_ITU601),
+                             full_range,
+                             sws_getCoefficients(SWS_CS_DEFAULT),
+                             1,
+                             0, 1 << 16, 1 << 16);
+  }
+  return ctx;
+}
+
+int yuv2rgb_test(void)
+{
+  // one aligned size and one odd size (SIMD tails, odd chroma)
+  static const int sizes[][2] = { { 1280, 720 }, { 333, 181 } };
+  int failures = 0;
+
+  printf("yuv2rgb: best implementation %s\n", yuv2rgb_impl_name(yuv2rgb_best_impl()));
+
+  for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    test_pic_t p;
+
+    if ( ! pic_alloc(&p, sizes[s][0], sizes[s][1])) {
+      printf("no memo\n");
+      pic_free(&p);
+      return -1;
+    }
+
+    for (int m = YUV2RGB_BT601; m <= YUV2RGB_BT709; m++) {
+      for (int full = 0; full <= 1; full++) {
+        const char * name = m == YUV2RGB_BT709 ? "BT.709" : "BT.601";
+
+        yuv2rgb_convert((const uint8_t * const *) p.src, p.src_linesize, p.ref[0], p.ref_linesize[0],
+                        p.w, p.h, m, full, YUV2RGB_IMPL_C);
+
+        // SIMD kernels against the C reference: bit exact
+        for (yuv2rgb_impl_t impl = YUV2RGB_IMPL_SSE41; impl <= yuv2rgb_best_impl(); impl++) {
+          memset(p.out[0], 0, p.out_linesize[0] * p.h);
+          yuv2rgb_convert((const uint8_t * const *) p.src, p.src_linesize, p.out[0], p.out_linesize[0],
+                          p.w, p.h, m, full, impl);
+          bool ok = same_rgb32(&p);
+          printf("%4dx%-4d %s %s range  %-6s vs C:       %s\n", p.w, p.h, name, full ? "full   " : "limited",
+                 yuv2rgb_impl_name(impl), ok ? "bit exact" : "MISMATCH");
+          failures += ! ok;
+        }
+
+        // C reference against swscale: PSNR
+        struct SwsContext * ctx = sws_reference(p.w, p.h, m, full, SWS_POINT | SWS_ACCURATE_RND);
+        if ( ! ctx) {
+          printf("could not create sws context\n");
+          failures++;
+          continue;
+        }
+        sws_scale(ctx, (const uint8_t * const *) p.src, p.src_linesize, 0, p.h, p.out, p.out_linesize);
+        sws_freeContext(ctx);
+
+        double psnr = psnr_rgb32(&p);
+        bool ok = psnr >= MIN_PSNR;
+        printf("%4dx%-4d %s %s range  C      vs swscale: %.2f dB %s\n", p.w, p.h, name, full ? "full   " : "limited",
+               psnr, ok ? "ok" : "FAIL");
+        failures += ! ok;
+      }
+    }
+    pic_free(&p);
+  }
+
+  printf("yuv2rgb: %s (%d failures)\n", failures ? "FAILED" : "passed", failures);
+  return failures ? -1 : 0;
+}
+
+void yuv2rgb_benchmark(void)
+{
+  test_pic_t p;
+  int64_t t0;
+  double ms;
+
+  if ( ! pic_alloc(&p, 1920, 1080)) {
+    printf("no memo\n");
+    pic_free(&p);
+    return;
+  }
+
+  printf("YUV420P -> RGB32 1920x1080, %d frames, single thread\n", BENCH_FRAMES);
+
+  // what the player used to do
+  struct SwsContext * ctx = sws_getContext(p.w, p.h, AV_PIX_FMT_YUV420P,
+                                           p.w, p.h, AV_PIX_FMT_RGB32,
+                                           SWS_BILINEAR, NULL, NULL, NULL);
+  if (ctx) {
+    t0 = av_gettime_relative();
+    for (int i = 0; i < BENCH_FRAMES; i++) {
+      sws_scale(ctx, (const uint8_t * const *) p.src, p.src_linesize, 0, p.h, p.out, p.out_linesize);
+    }
+    ms = (av_gettime_relative() - t0) / 1000.0 / BENCH_FRAMES;
+    printf("  %-8s %7.2f ms/frame %8.1f Mpixel/s\n", "swscale", ms, p.w * p.h / ms / 1000.0);
+    sws_freeContext(ctx);
+  }
+
+  for (yuv2rgb_impl_t impl = YUV2RGB_IMPL_C; impl <= yuv2rgb_best_impl(); impl++) {
+    t0 = av_gettime_relative();
+    for (int i = 0; i < BENCH_FRAMES; i++) {
+      yuv2rgb_convert((const uint8_t * const *) p.src, p.src_linesize, p.out[0], p.out_linesize[0],
+                      p.w, p.h, YUV2RGB_BT601, false, impl);
+    }
+    ms = (av_gettime_relative() - t0) / 1000.0 / BENCH_FRAMES;
+    printf("  %-8s %7.2f ms/frame %8.1f Mpixel/s\n", yuv2rgb_impl_name(impl), ms, p.w * p.h / ms / 1000.0);
+  }
+  pic_free(&p);
+}
+#endif // TEST_FFWPLAYER_LIBRARY
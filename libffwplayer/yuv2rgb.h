@@ -0,0 +1,92 @@
+/******************************************
+ *
+ * YUV420P to RGB32 converter
+ *
+ * License: GPL-3
+ * Copyrights: Marcelo Varanda
+ *
+ ******************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libavutil/pixfmt.h>
+
+/**
+ * @file
+ * @brief yuv2rgb
+ *
+ * Unscaled YUV420P -> RGB32 (BGRA in memory) conversion with SSE4.1 and AVX2
+ * kernels picked at run time from the CPU features. Chroma is replicated to
+ * the 2x2 luma block, the same way the unscaled swscale converters do.
+ *
+ * Anything else (other formats, scaling) is left to swscale.
+ *
+ */
+
+typedef enum {
+  YUV2RGB_IMPL_AUTO = 0,  /**< best one the CPU supports */
+  YUV2RGB_IMPL_C,         /**< portable reference */
+  YUV2RGB_IMPL_SSE41,
+  YUV2RGB_IMPL_AVX2,
+} yuv2rgb_impl_t;
+
+typedef enum {
+  YUV2RGB_BT601 = 0,
+  YUV2RGB_BT709,
+} yuv2rgb_matrix_t;
+
+#ifdef __cplusplus
+  extern "C" {
+#endif
+
+/**
+ * @brief true if the conversion can be done by this module.
+ */
+bool yuv2rgb_supported(int src_w, int src_h, enum AVPixelFormat src_fmt,
+                       int dst_w, int dst_h, enum AVPixelFormat dst_fmt);
+
+/**
+ * @brief picks the matrix and the range from the stream colour properties, the
+ *        way swscale interprets them (unspecified means BT.601, limited range
+ *        unless the format is a J one).
+ */
+yuv2rgb_matrix_t yuv2rgb_matrix(enum AVColorSpace colorspace);
+bool yuv2rgb_full_range(enum AVColorRange range, enum AVPixelFormat src_fmt);
+
+/**
+ * @brief converts a YUV420P picture (or a band of it, starting on an even line).
+ *
+ * @param impl  YUV2RGB_IMPL_AUTO in normal use; the others are for testing and
+ *              fall back to C if the CPU does not support them.
+ */
+void yuv2rgb_convert(const uint8_t * const src[], const int src_linesize[],
+                     uint8_t * dst, int dst_linesize,
+                     int width, int height,
+                     yuv2rgb_matrix_t matrix, bool full_range,
+                     yuv2rgb_impl_t impl);
+
+/**
+ * @brief implementation selected by YUV2RGB_IMPL_AUTO.
+ */
+yuv2rgb_impl_t yuv2rgb_best_impl(void);
+const char * yuv2rgb_impl_name(yuv2rgb_impl_t impl);
+
+#ifdef TEST_FFWPLAYER_LIBRARY
+/**
+ * @brief checks the SIMD kernels are bit exact with the C reference and the C
+ *        reference against swscale (PSNR), for all matrix/range variants.
+ *
+ * @return 0 if all checks passed
+ */
+int yuv2rgb_test(void);
+
+/**
+ * @brief prints 1080p throughput of swscale and of each implementation.
+ */
+void yuv2rgb_benchmark(void);
+#endif
+
+#ifdef __cplusplus
+  }
+#endif